@@ -0,0 +1,166 @@
+#include "Bench.h"
+#include "Maths.h"
+#include "AllocTracker.h"
+
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include "Windows.h"
+#endif
+
+//--------------------------------------------------------------------------------
+//                               Runner
+//--------------------------------------------------------------------------------
+
+static volatile double ourSink = 0.0;
+void BenchSink(double val) {
+    ourSink = val;
+}
+
+static double NowNs() {
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void BenchRunner::Add(const std::string& name, BenchFunc fn) {
+    myBenches.push_back({ name, std::move(fn) });
+}
+
+BenchResult BenchRunner::Run(const std::string& name, const BenchFunc& fn) const {
+    //Warm up the caches, and find out roughly how long an op takes
+    double start = NowNs();
+    uint64 items = fn();
+    double firstNs = Max(NowNs() - start, 1.0);
+
+    const double sampleNs = myMinTime * 1e9 / mySamples;
+    uint64 iterations = (uint64)Max(1.0, sampleNs / firstNs);
+    //Re-calibrate with a short batch, the first call is often much slower
+    {
+        uint64 calib = Min<uint64>(iterations, 1000);
+        start = NowNs();
+        for (uint64 i = 0; i < calib; i++)
+            fn();
+        double ns = Max(NowNs() - start, 1.0) / calib;
+        iterations = (uint64)Max(1.0, sampleNs / ns);
+    }
+
+    std::vector<double> samples;
+    const AllocTracker::Counters allocs = AllocTracker::Total();
+    for (int32 s = 0; s < mySamples; s++) {
+        start = NowNs();
+        for (uint64 i = 0; i < iterations; i++)
+            items = fn();
+        samples.push_back((NowNs() - start) / iterations);
+    }
+    const double totalOps = (double)iterations * mySamples;
+
+    std::sort(samples.begin(), samples.end());
+    BenchResult res;
+    res.Name = name;
+    res.Iterations = iterations * mySamples;
+    res.NsPerOp = samples[samples.size() / 2];
+    res.ItemsPerOp = (double)items;
+    res.ItemsPerSec = (double)items * 1e9 / res.NsPerOp;
+    const AllocTracker::Counters allocsAfter = AllocTracker::Total();
+    res.AllocsPerOp = (allocsAfter.Allocs - allocs.Allocs) / totalOps;
+    res.BytesPerOp = (allocsAfter.Bytes - allocs.Bytes) / totalOps;
+    return res;
+}
+
+void BenchRunner::RunAll() {
+    myResults.clear();
+    Log("%-40s %14s %14s %12s %12s\n", "Benchmark", "ns/op", "items/s", "allocs/op", "bytes/op");
+    for (const Entry& e : myBenches) {
+        if (!myFilter.empty() && e.Name.find(myFilter) == std::string::npos)
+            continue;
+
+        BenchResult res = Run(e.Name, e.Func);
+        Log("%-40s %14.1f %14.4g %12.2f %12.1f\n", res.Name.c_str(), res.NsPerOp, res.ItemsPerSec, res.AllocsPerOp, res.BytesPerOp);
+        fflush(stdout);
+        myResults.push_back(res);
+    }
+}
+
+static void WriteJsonString(FILE* pf, const std::string& str) {
+    fputc('"', pf);
+    for (char c : str) {
+        if (c == '"' || c == '\\')
+            fputc('\\', pf);
+        if ((unsigned char)c >= 0x20)
+            fputc(c, pf);
+    }
+    fputc('"', pf);
+}
+
+bool BenchRunner::WriteJson(const char* path) const {
+    FILE* pf = fopen(path, "w");
+    if (!pf) {
+        LogError("Could not open: %s", path);
+        return false;
+    }
+
+    fprintf(pf, "{\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < myResults.size(); i++) {
+        const BenchResult& r = myResults[i];
+        fprintf(pf, "    {\"name\": ");
+        WriteJsonString(pf, r.Name);
+        fprintf(pf, ", \"iterations\": %llu, \"ns_per_op\": %.3f, \"items_per_op\": %.1f, \"items_per_sec\": %.1f, \"allocs_per_op\": %.3f, \"bytes_per_op\": %.1f}%s\n",
+            (unsigned long long)r.Iterations, r.NsPerOp, r.ItemsPerOp, r.ItemsPerSec, r.AllocsPerOp, r.BytesPerOp,
+            (i + 1 < myResults.size()) ? "," : "");
+    }
+    fprintf(pf, "  ]\n}\n");
+    fclose(pf);
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+//                               Main
+//--------------------------------------------------------------------------------
+
+//Usage: GraphItBench [--filter substring] [--json out.json] [--min-time seconds] [--samples n] [--errors]
+int main(int argc, const char* argv[]) {
+    LOG_INIT();
+
+    BenchRunner runner;
+    const char* jsonPath = nullptr;
+    bool bErrors = false;
+    for (int i = 1; i < argc; i++) {
+        bool bHasValue = (i + 1 < argc);
+        if (strcmp(argv[i], "--filter") == 0 && bHasValue)
+            runner.SetFilter(argv[++i]);
+        else if (strcmp(argv[i], "--json") == 0 && bHasValue)
+            jsonPath = argv[++i];
+        else if (strcmp(argv[i], "--min-time") == 0 && bHasValue)
+            runner.SetMinTime(atof(argv[++i]));
+        else if (strcmp(argv[i], "--samples") == 0 && bHasValue)
+            runner.SetSamples(Max(1, atoi(argv[++i])));
+        else if (strcmp(argv[i], "--errors") == 0)
+            bErrors = true;
+        else {
+            LogError("Unknown argument: %s", argv[i]);
+            Log("Usage: GraphItBench [--filter substring] [--json out.json] [--min-time seconds] [--samples n] [--errors]\n");
+            return 1;
+        }
+    }
+
+    if (bErrors) {
+        PrintKernelErrors();
+        return 0;
+    }
+
+    AddMathBenches(runner);
+    AddRenderBenches(runner);
+    AddLogBenches(runner);
+    AddKernelBenches(runner);
+    runner.RunAll();
+
+    if (jsonPath) {
+        if (!runner.WriteJson(jsonPath))
+            return 1;
+        LogInfo("Wrote results to: %s", jsonPath);
+    }
+    return 0;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include "DebugFinal.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+//Minimal benchmark runner. Each benchmark is a function that does one operation and returns how many items (tokens,
+//samples, triangles..) it processed. The runner picks an iteration count so that a sample takes about
+//MinTime / Samples, and reports the median of the samples
+struct BenchResult {
+    std::string Name;
+    uint64      Iterations;
+    double      NsPerOp;
+    double      ItemsPerOp;
+    double      ItemsPerSec;
+    double      AllocsPerOp;
+    double      BytesPerOp;
+};
+
+class BenchRunner {
+public:
+    using BenchFunc = std::function<uint64()>;
+
+public:
+    void Add(const std::string& name, BenchFunc fn);
+
+    void SetFilter(const char* filter)      { myFilter = filter ? filter : ""; }
+    void SetMinTime(double seconds)         { myMinTime = seconds; }
+    void SetSamples(int32 samples)          { mySamples = samples; }
+
+    void RunAll();
+    bool WriteJson(const char* path) const;
+
+    const std::vector<BenchResult>& Results() const { return myResults; }
+
+private:
+    BenchResult Run(const std::string& name, const BenchFunc& fn) const;
+
+private:
+    struct Entry {
+        std::string Name;
+        BenchFunc   Func;
+    };
+    std::vector<Entry>          myBenches;
+    std::vector<BenchResult>    myResults;
+    std::string                 myFilter;
+    double                      myMinTime = 0.5;
+    int32                       mySamples = 7;
+};
+
+//Keeps the compiler from optimizing away a result that is otherwise unused
+void BenchSink(double val);
+
+//Registered by each bench file
+void AddMathBenches(BenchRunner& runner);
+void AddRenderBenches(BenchRunner& runner);
+void AddLogBenches(BenchRunner& runner);
+void AddKernelBenches(BenchRunner& runner);
+
+//Error of each approximate function against the C library, instead of running benchmarks (--errors)
+void PrintKernelErrors();
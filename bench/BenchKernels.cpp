@@ -0,0 +1,75 @@
+#include "Bench.h"
+#include "MathKernels.h"
+
+#include <cstdio>
+#include <vector>
+
+using namespace MathParser;
+
+static const Accuracy ourAccuracies[] = { Accuracy_Full, Accuracy_1e7, Accuracy_1e4 };
+
+//One batch worth of inputs in the range each function is usually called with
+template <typename T>
+static void FillInputs(Kernels::Function f, std::vector<T>& a, std::vector<T>& b) {
+    constexpr int32 Count = 4096;
+    a.resize(Count);
+    b.resize(Count);
+    for (int32 i = 0; i < Count; i++) {
+        const double u = (double)i / (Count - 1);
+        switch (f) {
+            case Kernels::Func_Exp: a[i] = (T)(-20.0 + 40.0 * u);   break;
+            case Kernels::Func_Ln:  a[i] = (T)(1e-3 + 1e3 * u);     break;
+            case Kernels::Func_Pow: a[i] = (T)(0.1 + 10.0 * u);     break;
+            default:                a[i] = (T)(-50.0 + 100.0 * u);  break;
+        }
+        b[i] = (T)(-3.0 + 6.0 * (1.0 - u));
+    }
+}
+
+template <typename T>
+static void AddKernelBench(BenchRunner& runner, Kernels::Function f, Accuracy acc, const char* typeName) {
+    char name[64];
+    snprintf(name, sizeof(name), "Kernel/%s %s %s", Kernels::FunctionName(f), typeName, Kernels::AccuracyName(acc));
+
+    std::vector<T> a, b;
+    FillInputs(f, a, b);
+    runner.Add(name, [f, acc, a, b]() -> uint64 {
+        static std::vector<T> out;
+        out.resize(a.size());
+        const int32 n = (int32)a.size();
+        switch (f) {
+            case Kernels::Func_Sin: Kernels::Sin(a.data(), out.data(), n, acc);            break;
+            case Kernels::Func_Cos: Kernels::Cos(a.data(), out.data(), n, acc);            break;
+            case Kernels::Func_Tan: Kernels::Tan(a.data(), out.data(), n, acc);            break;
+            case Kernels::Func_Exp: Kernels::Exp(a.data(), out.data(), n, acc);            break;
+            case Kernels::Func_Ln:  Kernels::Ln(a.data(), out.data(), n, acc);             break;
+            case Kernels::Func_Pow: Kernels::Pow(a.data(), b.data(), out.data(), n, acc);  break;
+            default: break;
+        }
+        BenchSink((double)out[n / 3]);
+        return (uint64)n;
+    });
+}
+
+void AddKernelBenches(BenchRunner& runner) {
+    for (int32 f = 0; f < Kernels::FuncCount; f++) {
+        for (Accuracy acc : ourAccuracies) {
+            AddKernelBench<float>(runner, (Kernels::Function)f, acc, "float");
+            AddKernelBench<double>(runner, (Kernels::Function)f, acc, "double");
+        }
+    }
+}
+
+void PrintKernelErrors() {
+    printf("%-6s %-7s %-9s %14s %12s %14s\n", "func", "type", "accuracy", "max ulp", "max rel", "worst input");
+    for (int32 f = 0; f < Kernels::FuncCount; f++) {
+        for (Accuracy acc : ourAccuracies) {
+            for (int32 type = 0; type < 2; type++) {
+                const Kernels::Error e = (type == 0) ? Kernels::Measure<float>((Kernels::Function)f, acc)
+                                                     : Kernels::Measure<double>((Kernels::Function)f, acc);
+                printf("%-6s %-7s %-9s %14.1f %12.3g %14.6g\n", Kernels::FunctionName((Kernels::Function)f),
+                    type == 0 ? "float" : "double", Kernels::AccuracyName(acc), e.MaxUlp, e.MaxRel, e.WorstInput);
+            }
+        }
+    }
+}
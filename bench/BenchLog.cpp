@@ -0,0 +1,14 @@
+#include "Bench.h"
+#include "DebugFinal.h"
+
+void AddLogBenches(BenchRunner& runner) {
+    //Sustained logging, more than the log thread can keep up with, so callers end up helping to print. "%.0s" prints
+    //nothing, so this measures the queue and the formatting and not the terminal
+    runner.Add("Log/Push", []() -> uint64 {
+        constexpr int32 count = 256;
+        for (int32 i = 0; i < count; i++) {
+            AsyncLog::Push(AsyncLog::Site{ nullptr, __FILE__, __LINE__, false }, "%.0s", "tile");
+        }
+        return count;   //Log calls
+    });
+}
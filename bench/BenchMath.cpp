@@ -0,0 +1,265 @@
+#include "Bench.h"
+#include "MathContext.h"
+#include "MathProgram.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+using namespace MathParser;
+
+//Every line is added to the same context, in order, so later lines can use earlier ones
+static const char* ourCorpus[] = {
+    "0.2*x + y/2",
+    "sin(x) * exp(y/7)",
+    "cos(2*pi * y / 4)",
+    "(0.5*x^2 + 0.5*y^2) / 10",
+    "sqrt(x*x + y*y + 1) - 3",
+    "speed = 0.5 + 2",
+    "speed * x - y",
+    "f(a,b) = a*sin(x) + b*cos(y)",
+    "f(1, 0)",
+    "f(0.5, 0.25) + 1",
+    "g(a) = a*a + f(a, 1-a)",
+    "g(x/4) * exp(0 - (x*x + y*y)/50)",
+};
+static constexpr int32 ourCorpusSize = sizeof(ourCorpus) / sizeof(ourCorpus[0]);
+
+//Polynomials, which the program evaluates with Horner's rule instead of pow
+static const char* ourPolynomials[] = {
+    "(0.5*x^2 + 0.5*y^2) / 10",
+    "x^3 - 3*x*y^2",
+    "0.01*x^4 - 0.3*x^2*y + y^3/50 + 2",
+    "(x^2 + y^2 - 25)^2 / 100 + x^5 / 1000",
+};
+
+struct ParserBenchAccess {
+    static bool Parse(Context& c, std::string_view str, Equation* eq) {
+        return c.ParseLine(str, eq, nullptr);
+    }
+};
+
+//Random but repeatable equations, roughly like the ones people write. Mostly definitions of functions of a and b
+static void GenerateExpression(uint32& seed, int32 depth, std::string& out) {
+    auto Rand = [&seed](uint32 n) { seed = seed * 1664525u + 1013904223u; return (seed >> 8) % n; };
+    static const char* leaves[] = { "x", "y", "a", "b", "pi", "k" };
+    static const char* funcs[] = { "sin", "cos", "sqrt", "exp" };
+    static const char ops[] = { '+', '-', '*', '/', '^' };
+
+    const uint32 kind = depth <= 0 ? Rand(2) : Rand(6);
+    if (kind == 0) {
+        out += leaves[Rand(6)];
+    }
+    else if (kind == 1) {
+        out += std::to_string(Rand(1000) / 8.0).substr(0, 5);
+    }
+    else if (kind == 2) {
+        out += funcs[Rand(4)];
+        out += '(';
+        GenerateExpression(seed, depth - 1, out);
+        out += ')';
+    }
+    else if (kind == 3) {
+        out += '(';
+        GenerateExpression(seed, depth - 1, out);
+        out += ')';
+    }
+    else {
+        GenerateExpression(seed, depth - 1, out);
+        out += ' ';
+        out += ops[Rand(kind == 4 ? 5 : 4)];
+        out += ' ';
+        GenerateExpression(seed, depth - 1, out);
+    }
+}
+
+//About 4 MB of equations, one per line
+static const std::string& GeneratedFile() {
+    static std::string file;
+    if (file.empty()) {
+        uint32 seed = 12345;
+        int32 line = 0;
+        while (file.size() < 4 * 1024 * 1024) {
+            file += "g" + std::to_string(line++) + "(a, b) = ";
+            GenerateExpression(seed, 6, file);
+            file += '\n';
+        }
+    }
+    return file;
+}
+
+//The generated equations plus as many that call them, a few levels deep, written to a temporary file. Returns its path
+static const std::string& StartupFile() {
+    static std::string path;
+    if (path.empty()) {
+        path = (std::filesystem::temp_directory_path() / "graphit_bench_startup.txt").string();
+        std::ofstream f(path, std::ios::binary);
+        f << "k = 0.5\n" << GeneratedFile();
+        const std::string& file = GeneratedFile();
+        const int32 lines = (int32)std::count(file.begin(), file.end(), '\n');
+        f << "h0 = g0(x, y)\n";
+        for (int32 i = 1; i < lines; i++) {
+            f << "h" << i << " = g" << i << "(x, y) + h" << i / 2 << "\n";
+        }
+    }
+    return path;
+}
+
+static Context& CorpusContext() {
+    static Context* ctx = nullptr;
+    if (!ctx) {
+        ctx = new Context;
+        for (const char* str : ourCorpus) {
+            bool bAdded = ctx->AddEquation(str);
+            Assert(bAdded && "Corpus equation failed to parse");
+        }
+        ctx->Resolve();
+    }
+    return *ctx;
+}
+
+void AddMathBenches(BenchRunner& runner) {
+    static std::vector<std::string> strs(ourCorpus, ourCorpus + ourCorpusSize);
+
+    runner.Add("Parse/Line", []() -> uint64 {
+        static Context ctx;
+        uint64 count = 0;
+        for (const std::string& str : strs) {
+            Equation eq(&ctx);
+            count += ParserBenchAccess::Parse(ctx, str, &eq);
+        }
+        return count;   //Equations
+    });
+
+    //Throughput over a large file. Every line is parsed but not added to the context
+    runner.Add("Parse/File", []() -> uint64 {
+        static Context ctx;
+        const std::string& file = GeneratedFile();
+        std::string_view rest = file;
+        while (rest.size()) {
+            size_t end = rest.find('\n');
+            Equation eq(&ctx);
+            bool bParsed = ParserBenchAccess::Parse(ctx, rest.substr(0, end), &eq);
+            Assert(bParsed && "Generated equation failed to parse");
+            rest.remove_prefix(end + 1);
+        }
+        return file.size();     //Bytes
+    });
+
+    //Everything the app does with the equation file at startup: read, parse, resolve
+    runner.Add("Startup/LoadFile", []() -> uint64 {
+        const std::string& path = StartupFile();
+        Context ctx;
+        bool bLoaded = ctx.LoadFromFile(path);
+        Assert(bLoaded && "Could not load the startup file");
+        return ctx.GetCount();      //Equations
+    });
+
+    //The same, when the precompiled file from an earlier run is still up to date
+    runner.Add("Startup/LoadCached", []() -> uint64 {
+        const std::string& path = StartupFile();
+        static bool bCompiled = false;
+        if (!bCompiled) {
+            std::error_code err;
+            std::filesystem::remove(Context::CompiledPath(path), err);
+            Context ctx;
+            ctx.LoadFromFileCached(path);
+            bCompiled = true;
+        }
+        Context ctx;
+        bool bLoaded = ctx.LoadFromFileCached(path);
+        Assert(bLoaded && "Could not load the startup file");
+        return ctx.GetCount();      //Equations
+    });
+
+    //A save of the startup file where one line changed, loaded after the context of the save before it, as the file
+    //watcher does. The two versions only differ in their last line, which nothing calls
+    runner.Add("Startup/ReloadOneLine", []() -> uint64 {
+        static std::string paths[2];
+        static ContextSnapshot current;
+        static int32 next = 0;
+        if (!current) {
+            std::ifstream in(StartupFile(), std::ios::binary);
+            const std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            for (int32 i = 0; i < 2; i++) {
+                paths[i] = (std::filesystem::temp_directory_path() / ("graphit_bench_reload" + std::to_string(i) + ".txt")).string();
+                std::ofstream f(paths[i], std::ios::binary);
+                f << text << "last = x * " << i + 2 << "\n";
+            }
+            std::shared_ptr<Context> first = std::make_shared<Context>();
+            first->LoadFromFile(paths[0]);
+            current = first;
+        }
+        next ^= 1;
+        //Every save changes the text, so the precompiled file is never up to date
+        std::error_code err;
+        std::filesystem::remove(Context::CompiledPath(paths[next]), err);
+        std::shared_ptr<Context> ctx = std::make_shared<Context>();
+        ReloadStats stats;
+        bool bLoaded = ctx->LoadFromFileAfter(paths[next], *current, &stats);
+        Assert(bLoaded && stats.Parsed == 1 && stats.Resolved == 1 && "Only the last line should have been parsed");
+        current = ctx;
+        return ctx->GetCount();     //Equations
+    });
+
+    runner.Add("Parse/Resolve", []() -> uint64 {
+        Context& ctx = CorpusContext();
+        ctx.Resolve();
+        return ctx.GetCount();      //Equations
+    });
+
+    //Per sample evaluation of every plottable equation in the corpus, over a 64x64 grid
+    for (int32 i = 0; i < ourCorpusSize; i++) {
+        Context& ctx = CorpusContext();
+        Equation* eq = ctx.FindEquationIndex(ctx.GetCount() - ourCorpusSize + i);
+        if (!eq || !eq->Valid() || eq->EParamCount() != 0 || eq->IParamCount() == 0)
+            continue;
+
+        runner.Add(std::string("Evaluate/") + ourCorpus[i], [eq]() -> uint64 {
+            constexpr int32 size = 64;
+            double sum = 0.0;
+            for (int32 y = 0; y < size; y++) {
+                for (int32 x = 0; x < size; x++) {
+                    sum += eq->Evaluate(x * (20.0 / size) - 10.0, y * (20.0 / size) - 10.0);
+                }
+            }
+            BenchSink(sum);
+            return size * size;     //Samples
+        });
+    }
+
+    //The polynomials through the program, in batches over a 64x64 grid
+    for (const char* str : ourPolynomials) {
+        static Context ctx;
+        bool bAdded = ctx.AddEquation(str);
+        Assert(bAdded && "Polynomial failed to parse");
+        ctx.Resolve();
+        Program* p = new Program;
+        bool bBuilt = p->Build(*ctx.FindEquationIndex(ctx.GetCount() - 1));
+        Assert(bBuilt && "Polynomial failed to build");
+
+        for (int32 bFloat = 0; bFloat < 2; bFloat++) {
+            runner.Add(std::string("Program/") + str + (bFloat ? " float" : " double"), [p, bFloat]() -> uint64 {
+                constexpr int32 size = 64;
+                static double xs[size], ys[size], out[size];
+                static Program::Scratch s;
+                p->Reserve(s);
+                double sum = 0.0;
+                for (int32 y = 0; y < size; y++) {
+                    for (int32 x = 0; x < size; x++) {
+                        xs[x] = x * (20.0 / size) - 10.0;
+                        ys[x] = y * (20.0 / size) - 10.0;
+                    }
+                    if (bFloat)
+                        p->Evaluate<float>(xs, ys, 0.0, 0.0, out, size, s);
+                    else
+                        p->Evaluate<double>(xs, ys, 0.0, 0.0, out, size, s);
+                    sum += out[size / 2];
+                }
+                BenchSink(sum);
+                return size * size;     //Samples
+            });
+        }
+    }
+}
@@ -0,0 +1,306 @@
+#include "Bench.h"
+#include "StubGL.h"
+#include "MathContext.h"
+#include "Grapher3D.h"
+#include "MathNative.h"
+#include "Camera.h"
+#include "RE_RendererBatch.h"
+#include "RE_CommandList.h"
+
+#include <cstdio>
+#include <cmath>
+
+static MathParser::Equation* BenchEquation() {
+    static MathParser::Context* ctx = nullptr;
+    if (!ctx) {
+        ctx = new MathParser::Context;
+        ctx->AddEquation("sin(x) * exp(y/7)");
+        ctx->Resolve();
+    }
+    return ctx->FindEquationIndex(ctx->GetCount() - 1);
+}
+
+//Surfaces that use t. One has to be meshed again every frame, the other only moves
+static MathParser::Equation* BenchAnimatedEquation(bool bAdditive) {
+    static MathParser::Context* ctx = nullptr;
+    if (!ctx) {
+        ctx = new MathParser::Context;
+        ctx->AddEquation("wave = sin(x + t) * exp(y/7)");
+        ctx->AddEquation("bob = sin(x) * exp(y/7) + sin(2*t)");
+        ctx->Resolve();
+    }
+    return ctx->FindEquation(bAdditive ? "bob" : "wave");
+}
+
+//Surfaces that all call the same helper, for meshing them together
+static std::vector<MathParser::Equation*> BenchSharedEquations() {
+    static MathParser::Context* ctx = nullptr;
+    if (!ctx) {
+        ctx = new MathParser::Context;
+        ctx->AddEquation("w(a, b) = sin(a) * cos(b) + exp(-(a*a + b*b) / 50)");
+        ctx->AddEquation("s1 = w(x, y) + 1");
+        ctx->AddEquation("s2 = w(x, y) * 2 - y / 4");
+        ctx->AddEquation("s3 = w(x, y) - w(y, x)");
+        ctx->AddEquation("s4 = sqrt(x*x + y*y) / 2 + w(x, y)");
+        ctx->Resolve();
+    }
+    return { ctx->FindEquation("s1"), ctx->FindEquation("s2"), ctx->FindEquation("s3"), ctx->FindEquation("s4") };
+}
+
+static Camera& BenchCamera() {
+    static Camera cam(glm::vec3(-9.81f, -21.986f, 16.197f), glm::vec3(0.3228f, 0.738f, -0.5917f), glm::vec3(0.0f, 0.0f, 1.0f),
+        45.0f, (float)windowSize.x / windowSize.y, 0.1f, 100.0f);
+    return cam;
+}
+
+//Shaders are loaded relative to the working directory, same as GraphIt
+static RendererBatch& BenchRenderer() {
+    static RendererBatch* r = nullptr;
+    if (!r) {
+        r = new RendererBatch;
+        r->Init(&BenchCamera());
+    }
+    return *r;
+}
+
+void AddRenderBenches(BenchRunner& runner) {
+    //Samples along each axis for the [-10, 10] range
+    const double increments[] = { 0.5, 0.25, 0.1, 0.05 };
+
+    for (double inc : increments) {
+        const uint64 samples = (uint64)(20.0 / inc + 1.5) * (uint64)(20.0 / inc + 1.5);
+        char name[64];
+        snprintf(name, sizeof(name), "Mesh/Explicit inc=%.2f", inc);
+        runner.Add(name, [inc, samples]() -> uint64 {
+            Grapher3D g;
+            g.SetEquation(BenchEquation());
+            g.SetResolution(inc);
+            g.CalculateExplicit(nullptr);
+            BenchSink(g.TileCount());
+            return samples;
+        });
+    }
+
+    //The same surface in each precision, without the first mesh's allocations
+    struct PrecisionBench { const char* Name; Grapher3D::Precision Prec; };
+    const PrecisionBench precisions[] = {
+        { "Mesh/Precision double", Grapher3D::Precision_Double },
+        { "Mesh/Precision float",  Grapher3D::Precision_Float },
+        { "Mesh/Precision mixed",  Grapher3D::Precision_Mixed },
+    };
+    for (const PrecisionBench& p : precisions) {
+        Grapher3D* g = new Grapher3D;
+        g->SetEquation(BenchEquation());
+        g->SetResolution(0.05);
+        g->SetPrecision(p.Prec);
+        g->CalculateExplicit(nullptr);
+        runner.Add(p.Name, [g]() -> uint64 {
+            g->CalculateExplicit(nullptr);
+            BenchSink(g->TileCount());
+            return 401 * 401;
+        });
+    }
+
+    //The approximate functions, in float with the same equation
+    const MathParser::Accuracy accuracies[] = { MathParser::Accuracy_Full, MathParser::Accuracy_1e7, MathParser::Accuracy_1e4 };
+    for (MathParser::Accuracy acc : accuracies) {
+        char name[64];
+        snprintf(name, sizeof(name), "Mesh/Accuracy float %s", MathParser::Kernels::AccuracyName(acc));
+        Grapher3D* g = new Grapher3D;
+        g->SetEquation(BenchEquation());
+        g->SetResolution(0.05);
+        g->SetPrecision(Grapher3D::Precision_Float);
+        g->SetAccuracy(acc);
+        g->CalculateExplicit(nullptr);
+        runner.Add(name, [g]() -> uint64 {
+            g->CalculateExplicit(nullptr);
+            BenchSink(g->TileCount());
+            return 401 * 401;
+        });
+    }
+
+    //The same surface compiled to machine code (see NativeLibrary). Built on the first run, falls back to the program
+    //when there is no compiler
+    runner.Add("Mesh/Native double", []() -> uint64 {
+        static Grapher3D* g = nullptr;
+        if (!g) {
+            static MathParser::Context ctx;
+            static MathParser::NativeLibrary lib;
+            ctx.AddEquation("sin(x) * exp(y/7)");
+            ctx.Resolve();
+            MathParser::Equation* eq = ctx.FindEquationIndex(ctx.GetCount() - 1);
+            lib.Build(ctx, MathParser::NativeLibrary::DefaultCacheDir());
+            g = new Grapher3D;
+            g->SetEquation(eq);
+            g->SetResolution(0.05);
+            g->SetNative(lib.FindExplicit(eq));
+        }
+        g->CalculateExplicit(nullptr);
+        BenchSink(g->TileCount());
+        return 401 * 401;
+    });
+
+    //Four surfaces that share a helper, one at a time and in one sweep (see Grapher3D::CalculateFused)
+    for (int32 bFused = 0; bFused < 2; bFused++) {
+        std::vector<Grapher3D>* graphers = new std::vector<Grapher3D>(4);
+        Grapher3D::FuseCache* fuse = new Grapher3D::FuseCache;
+        const std::vector<MathParser::Equation*> eqs = BenchSharedEquations();
+        for (int32 i = 0; i < 4; i++) {
+            (*graphers)[i].SetEquation(eqs[i]);
+            (*graphers)[i].SetResolution(0.05);
+            (*graphers)[i].SetPrecision(Grapher3D::Precision_Double);
+        }
+        runner.Add(bFused ? "Mesh/Shared 4 fused" : "Mesh/Shared 4 separate", [graphers, fuse, bFused]() -> uint64 {
+            if (bFused) {
+                //Outdated again, so all four are taken
+                for (Grapher3D& g : *graphers)
+                    g.SetResolution(0.05);
+                Grapher3D::CalculateFused(*graphers, *fuse);
+            }
+            else {
+                for (Grapher3D& g : *graphers)
+                    g.CalculateExplicit(nullptr);
+            }
+            BenchSink((*graphers)[3].TileCount());
+            return 4 * 401 * 401;
+        });
+    }
+
+    //Animated 256x256 surfaces. At 60 fps a frame has 16.7ms for both. Both record the surface into a list as well,
+    //as an animated surface is recorded again every frame either way
+    {
+        const double inc = 20.0 / 255.0;
+        runner.Add("Animate/Remesh 256x256", [inc]() -> uint64 {
+            static Grapher3D* g = nullptr;
+            static CommandList list;
+            static double time = 0.0;
+            if (!g) {
+                g = new Grapher3D;
+                g->SetEquation(BenchAnimatedEquation(false));
+                g->SetResolution(inc);
+            }
+            time += 1.0 / 60.0;
+            g->SetTime(time);
+            g->Calculate(nullptr);
+            list.Clear();
+            g->Draw(list);
+            BenchSink(list.Tris().size());
+            return 256 * 256;
+        });
+
+        runner.Add("Animate/Offset 256x256", [inc]() -> uint64 {
+            static Grapher3D* g = nullptr;
+            static CommandList list;
+            static double time = 0.0;
+            if (!g) {
+                g = new Grapher3D;
+                g->SetEquation(BenchAnimatedEquation(true));
+                g->SetResolution(inc);
+                g->Calculate(nullptr);
+            }
+            time += 1.0 / 60.0;
+            g->Animate(time);
+            list.Clear();
+            g->Draw(list);
+            BenchSink(list.Tris().size());
+            return 256 * 256;
+        });
+    }
+
+    //Equations of only x as curves, at the resolution of the 401x401 surfaces. Items are samples
+    for (const char* str : { "sin(x)", "tan(x)" }) {
+        static MathParser::Context* ctx = nullptr;
+        if (!ctx)
+            ctx = new MathParser::Context;
+        ctx->AddEquation(str);
+        ctx->Resolve();
+        Grapher3D* g = new Grapher3D;
+        g->SetEquation(ctx->FindEquationIndex(ctx->GetCount() - 1));
+        g->SetResolution(0.05);
+
+        char name[64];
+        snprintf(name, sizeof(name), "Curve/%s", str);
+        runner.Add(name, [g]() -> uint64 {
+            g->CalculateExplicit(nullptr);
+            BenchSink(g->TileCount());
+            return (uint64)g->SampleCount();
+        });
+    }
+
+    //Contour lines from a sampled 401x401 surface, without the meshing. Items are cells, every one is tested against
+    //every level
+    for (int32 levelCount : { 1, 16 }) {
+        const int32 count = 401;
+        std::vector<double> heights((size_t)count * count);
+        for (int32 j = 0; j < count; j++)
+            for (int32 i = 0; i < count; i++)
+                heights[(size_t)j * count + i] = std::sin(-10.0 + i * 0.05) * std::exp((-10.0 + j * 0.05) / 7);
+        std::vector<double> levels(levelCount);
+        for (int32 k = 0; k < levelCount; k++)
+            levels[k] = -3.0 + 6.0 * (k + 0.5) / levelCount;
+
+        char name[64];
+        snprintf(name, sizeof(name), "Contours/401x401 %d levels", levelCount);
+        runner.Add(name, [heights, levels, count]() -> uint64 {
+            static Contours contours;
+            const Contours::Grid grid = { heights.data(), count, count, -10.0, -10.0, 0.05 };
+            contours.Extract(grid, levels.data(), (int32)levels.size());
+            BenchSink(contours.Points().size());
+            return (uint64)(count - 1) * (count - 1);
+        });
+    }
+
+    //Picking a 401x401 surface from a camera looking down at it. Items are rays, a grid of them over the whole surface
+    {
+        Grapher3D* g = new Grapher3D;
+        g->SetEquation(BenchEquation());
+        g->SetResolution(0.05);
+        g->CalculateExplicit(nullptr);
+        std::vector<Ray> rays;
+        const glm::vec3 eye = glm::vec3(0.0f, -25.0f, 15.0f);
+        for (int32 j = 0; j < 16; j++)
+            for (int32 i = 0; i < 16; i++)
+                rays.push_back({ eye, glm::normalize(glm::vec3(-9.5f + i * 1.25f, -9.5f + j * 1.25f, 0.0f) - eye) });
+
+        runner.Add("Pick/401x401", [g, rays]() -> uint64 {
+            Grapher3D::PickHit hit;
+            int32 hits = 0;
+            for (const Ray& ray : rays)
+                hits += g->Pick(ray, hit);
+            BenchSink(hits);
+            return (uint64)rays.size();
+        });
+    }
+
+    //Vertex generation and upload. Items are triangles that reached glDrawElements
+    for (double inc : { 0.25, 0.05 }) {
+        Grapher3D* g = new Grapher3D;
+        g->SetEquation(BenchEquation());
+        g->SetResolution(inc);
+        g->CalculateExplicit(nullptr);
+
+        char name[64];
+        snprintf(name, sizeof(name), "Batch/Immediate inc=%.2f", inc);
+        runner.Add(name, [g]() -> uint64 {
+            RendererBatch& r = BenchRenderer();
+            StubGL::ResetCounters();
+            r.StartFrame();
+            g->Draw(&r);
+            r.EndFrame();
+            return StubGL::IndicesDrawn / 3;
+        });
+
+        snprintf(name, sizeof(name), "Batch/CommandList inc=%.2f", inc);
+        runner.Add(name, [g]() -> uint64 {
+            static CommandList list;
+            RendererBatch& r = BenchRenderer();
+            StubGL::ResetCounters();
+            r.StartFrame();
+            list.Clear();
+            g->Draw(list);
+            r.Submit(list);
+            r.EndFrame();
+            return StubGL::IndicesDrawn / 3;
+        });
+    }
+}
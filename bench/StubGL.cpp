@@ -0,0 +1,105 @@
+#include "StubGL.h"
+#include <GL/glew.h>
+#include "Maths.h"
+
+namespace StubGL {
+    uint64 DrawCalls = 0;
+    uint64 IndicesDrawn = 0;
+    uint64 BytesUploaded = 0;
+
+    void ResetCounters() {
+        DrawCalls = 0;
+        IndicesDrawn = 0;
+        BytesUploaded = 0;
+    }
+}
+
+//Normally defined in main.cpp
+glm::ivec2 windowSize = { 1800, 1200 };
+double deltaTime = 0.0;
+
+static GLuint ourNextId = 1;
+
+static void StubGenIds(GLsizei n, GLuint* ids) {
+    for (GLsizei i = 0; i < n; i++)
+        ids[i] = ourNextId++;
+}
+
+//GLEW entry points. GpuTimer sees a context without timer queries
+GLboolean __GLEW_VERSION_3_3 = GL_FALSE;
+GLboolean __GLEW_ARB_timer_query = GL_FALSE;
+
+//Shaders
+PFNGLCREATEPROGRAMPROC          __glewCreateProgram         = []() -> GLuint { return ourNextId++; };
+PFNGLCREATESHADERPROC           __glewCreateShader          = [](GLenum) -> GLuint { return ourNextId++; };
+PFNGLDELETEPROGRAMPROC          __glewDeleteProgram         = [](GLuint) {};
+PFNGLDELETESHADERPROC           __glewDeleteShader          = [](GLuint) {};
+PFNGLSHADERSOURCEPROC           __glewShaderSource          = [](GLuint, GLsizei, const GLchar* const*, const GLint*) {};
+PFNGLCOMPILESHADERPROC          __glewCompileShader         = [](GLuint) {};
+PFNGLATTACHSHADERPROC           __glewAttachShader          = [](GLuint, GLuint) {};
+PFNGLLINKPROGRAMPROC            __glewLinkProgram           = [](GLuint) {};
+PFNGLUSEPROGRAMPROC             __glewUseProgram            = [](GLuint) {};
+PFNGLGETSHADERIVPROC            __glewGetShaderiv           = [](GLuint, GLenum, GLint* p) { *p = GL_TRUE; };
+PFNGLGETPROGRAMIVPROC           __glewGetProgramiv          = [](GLuint, GLenum, GLint* p) { *p = GL_TRUE; };
+PFNGLGETSHADERINFOLOGPROC       __glewGetShaderInfoLog      = [](GLuint, GLsizei, GLsizei* len, GLchar* log) { if (len) *len = 0; if (log) *log = '\0'; };
+PFNGLGETPROGRAMINFOLOGPROC      __glewGetProgramInfoLog     = [](GLuint, GLsizei, GLsizei* len, GLchar* log) { if (len) *len = 0; if (log) *log = '\0'; };
+PFNGLGETUNIFORMLOCATIONPROC     __glewGetUniformLocation    = [](GLuint, const GLchar*) -> GLint { return 0; };
+PFNGLUNIFORM1FPROC              __glewUniform1f             = [](GLint, GLfloat) {};
+PFNGLUNIFORM1IPROC              __glewUniform1i             = [](GLint, GLint) {};
+PFNGLUNIFORM1IVPROC             __glewUniform1iv            = [](GLint, GLsizei, const GLint*) {};
+PFNGLUNIFORM2FPROC              __glewUniform2f             = [](GLint, GLfloat, GLfloat) {};
+PFNGLUNIFORM2FVPROC             __glewUniform2fv            = [](GLint, GLsizei, const GLfloat*) {};
+PFNGLUNIFORM3FPROC              __glewUniform3f             = [](GLint, GLfloat, GLfloat, GLfloat) {};
+PFNGLUNIFORM3FVPROC             __glewUniform3fv            = [](GLint, GLsizei, const GLfloat*) {};
+PFNGLUNIFORM4FPROC              __glewUniform4f             = [](GLint, GLfloat, GLfloat, GLfloat, GLfloat) {};
+PFNGLUNIFORM4FVPROC             __glewUniform4fv            = [](GLint, GLsizei, const GLfloat*) {};
+PFNGLUNIFORMMATRIX3FVPROC       __glewUniformMatrix3fv      = [](GLint, GLsizei, GLboolean, const GLfloat*) {};
+PFNGLUNIFORMMATRIX4FVPROC       __glewUniformMatrix4fv      = [](GLint, GLsizei, GLboolean, const GLfloat*) {};
+
+//Buffers
+PFNGLGENBUFFERSPROC             __glewGenBuffers            = [](GLsizei n, GLuint* ids) { StubGenIds(n, ids); };
+PFNGLDELETEBUFFERSPROC          __glewDeleteBuffers         = [](GLsizei, const GLuint*) {};
+PFNGLBINDBUFFERPROC             __glewBindBuffer            = [](GLenum, GLuint) {};
+PFNGLBUFFERDATAPROC             __glewBufferData            = [](GLenum, GLsizeiptr size, const void* data, GLenum) { if (data) StubGL::BytesUploaded += size; };
+PFNGLBUFFERSUBDATAPROC          __glewBufferSubData         = [](GLenum, GLintptr, GLsizeiptr size, const void*) { StubGL::BytesUploaded += size; };
+PFNGLGENVERTEXARRAYSPROC        __glewGenVertexArrays       = [](GLsizei n, GLuint* ids) { StubGenIds(n, ids); };
+PFNGLDELETEVERTEXARRAYSPROC     __glewDeleteVertexArrays    = [](GLsizei, const GLuint*) {};
+PFNGLBINDVERTEXARRAYPROC        __glewBindVertexArray       = [](GLuint) {};
+PFNGLENABLEVERTEXATTRIBARRAYPROC __glewEnableVertexAttribArray = [](GLuint) {};
+PFNGLVERTEXATTRIBPOINTERPROC    __glewVertexAttribPointer   = [](GLuint, GLint, GLenum, GLboolean, GLsizei, const void*) {};
+
+//Textures
+PFNGLACTIVETEXTUREPROC          __glewActiveTexture         = [](GLenum) {};
+PFNGLGENERATEMIPMAPPROC         __glewGenerateMipmap        = [](GLenum) {};
+
+//Queries
+PFNGLGENQUERIESPROC             __glewGenQueries            = [](GLsizei n, GLuint* ids) { StubGenIds(n, ids); };
+PFNGLDELETEQUERIESPROC          __glewDeleteQueries         = [](GLsizei, const GLuint*) {};
+PFNGLBEGINQUERYPROC             __glewBeginQuery            = [](GLenum, GLuint) {};
+PFNGLENDQUERYPROC               __glewEndQuery              = [](GLenum) {};
+PFNGLGETQUERYOBJECTIVPROC       __glewGetQueryObjectiv      = [](GLuint, GLenum, GLint* p) { *p = 0; };
+PFNGLGETQUERYOBJECTUI64VPROC    __glewGetQueryObjectui64v   = [](GLuint, GLenum, GLuint64* p) { *p = 0; };
+
+//GL 1.1, which GLEW does not load
+void GLAPIENTRY glEnable(GLenum) {}
+void GLAPIENTRY glDepthFunc(GLenum) {}
+void GLAPIENTRY glDepthMask(GLboolean) {}
+void GLAPIENTRY glPolygonMode(GLenum, GLenum) {}
+GLenum GLAPIENTRY glGetError() { return GL_NO_ERROR; }
+void GLAPIENTRY glDrawArrays(GLenum, GLint, GLsizei) { StubGL::DrawCalls++; }
+void GLAPIENTRY glDrawElements(GLenum, GLsizei count, GLenum, const void*) { StubGL::DrawCalls++; StubGL::IndicesDrawn += count; }
+void GLAPIENTRY glGenTextures(GLsizei n, GLuint* ids) { StubGenIds(n, ids); }
+void GLAPIENTRY glDeleteTextures(GLsizei, const GLuint*) {}
+void GLAPIENTRY glBindTexture(GLenum, GLuint) {}
+void GLAPIENTRY glTexParameteri(GLenum, GLenum, GLint) {}
+void GLAPIENTRY glTexImage2D(GLenum, GLint, GLint, GLsizei, GLsizei, GLint, GLenum, GLenum, const void*) {}
+void GLAPIENTRY glPixelStorei(GLenum, GLint) {}
+
+//Camera reads the mouse through glfw
+extern "C" {
+    struct GLFWwindow;
+    void glfwGetCursorPos(GLFWwindow*, double* x, double* y)    { *x = 0.0; *y = 0.0; }
+    int glfwGetMouseButton(GLFWwindow*, int)                    { return 0; }
+    int glfwGetKey(GLFWwindow*, int)                            { return 0; }
+    void glfwGetWindowSize(GLFWwindow*, int* w, int* h)         { *w = windowSize.x; *h = windowSize.y; }
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include "DebugFinal.h"
+
+//The benchmarks link against this instead of GLEW and the system GL, so the renderer can run without a context.
+//Every call is a no-op, apart from the counters below and the ids and status values that the renderer checks
+namespace StubGL {
+    extern uint64 DrawCalls;
+    extern uint64 IndicesDrawn;
+    extern uint64 BytesUploaded;
+
+    void ResetCounters();
+}
@@ -1,3 +1,20 @@
+-- The default build runs on any x86-64 cpu. gcc on linux still gets the AVX2 and AVX-512 loops of the evaluator, which
+-- are picked at runtime (see KERNELS_CLONES in src/MathKernels.h). Everything else only gets them with this option, and
+-- the build then needs a cpu which has them
+newoption
+{
+	trigger = "simd",
+	value = "level",
+	description = "Widest SIMD the whole build may use",
+	default = "sse2",
+	allowed =
+	{
+		{ "sse2",   "Any x86-64 cpu" },
+		{ "avx2",   "AVX2 and FMA (x86-64-v3), 8 floats wide" },
+		{ "avx512", "AVX-512 (x86-64-v4), 16 floats wide" },
+	}
+}
+
 workspace "LearnOpenGL"
 	architecture "x64"
 
@@ -168,4 +185,103 @@ project "GraphIt"
 
 	filter "configurations:Dist"
 		defines "RM_DIST=1"
-		optimize "On"
\ No newline at end of file
+		optimize "On"
+
+    -- gcc and clang only vectorise the batch loops of the evaluator at -O3
+	filter { "configurations:Release or Dist", "system:not windows", "files:src/MathKernels.cpp or src/MathProgram.cpp" }
+		buildoptions "-O3"
+
+	filter { "options:simd=avx2", "system:windows" }
+		buildoptions "/arch:AVX2"
+	filter { "options:simd=avx2", "system:not windows" }
+		buildoptions "-march=x86-64-v3"
+	filter { "options:simd=avx512", "system:windows" }
+		buildoptions "/arch:AVX512"
+	filter { "options:simd=avx512", "system:not windows" }
+		buildoptions "-march=x86-64-v4"
+
+-- Microbenchmarks for the parser, evaluator, mesher and batcher. Runs headless: GL is replaced by bench/StubGL.cpp
+-- Usage: GraphItBench [--filter substring] [--json out.json] [--min-time seconds] [--samples n] [--errors]
+project "GraphItBench"
+	location "bench"
+	kind "ConsoleApp"
+	language "C++"
+    cppdialect "C++17"
+    debugdir "./"
+
+	targetdir ("bin/" .. outputdir .. "/")
+	objdir ("bin-int/" .. outputdir .. "/%{prj.name}/")
+
+	files
+	{
+		"src/**.h",
+		"src/**.cpp",
+		"bench/**.h",
+		"bench/**.cpp",
+
+        "vendor/stb_image/stb_image.cpp",
+	}
+
+    -- Everything that needs a window, a real GL context or freetype
+    removefiles
+    {
+        "src/main.cpp",
+        "src/EventCallback.cpp",
+        "src/RE_Font.cpp",
+    }
+
+	includedirs
+	{
+		"src",
+		"bench",
+        "vendor/GLFW/include",
+        "vendor/GLEW/include",
+        "vendor/glm",
+        "vendor/stb_image",
+	}
+
+    -- StubGL defines the GLEW entry points itself, so they must not be dllimport
+    defines
+    {
+        "GLEW_STATIC",
+    }
+
+    filter "system:windows"
+        staticruntime "On"
+		systemversion "latest"
+        defines
+        {
+            "RM_WIN=1",
+            "_CRT_SECURE_NO_WARNINGS",
+        }
+
+        links
+        {
+            "DbgHelp"
+        }
+
+    filter "system:macosx"
+        defines
+		{
+			"RM_MAC=1",
+		}
+
+	filter "configurations:Debug"
+		defines "RM_DEBUG=1"
+		symbols "On"
+
+	filter "configurations:Release"
+		defines "RM_RELEASE=1"
+		optimize "On"
+
+	filter { "configurations:Release", "system:not windows", "files:src/MathKernels.cpp or src/MathProgram.cpp" }
+		buildoptions "-O3"
+
+	filter { "options:simd=avx2", "system:windows" }
+		buildoptions "/arch:AVX2"
+	filter { "options:simd=avx2", "system:not windows" }
+		buildoptions "-march=x86-64-v3"
+	filter { "options:simd=avx512", "system:windows" }
+		buildoptions "/arch:AVX512"
+	filter { "options:simd=avx512", "system:not windows" }
+		buildoptions "-march=x86-64-v4"
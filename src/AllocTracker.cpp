@@ -0,0 +1,226 @@
+#include "AllocTracker.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+//Counters live in a fixed array instead of the heap, as they are needed from inside operator new. Slots are never
+//given back, the thread pool threads live for the whole program
+struct alignas(64) AllocThreadSlot {
+    std::atomic<uint64> Allocs{ 0 };
+    std::atomic<uint64> Frees{ 0 };
+    std::atomic<uint64> Bytes{ 0 };
+};
+
+static AllocThreadSlot          ourSlots[AllocTracker::MaxThreads];
+static std::atomic<int32>       ourSlotCount{ 0 };
+static thread_local AllocThreadSlot* tlSlot = nullptr;
+
+static AllocThreadSlot* LocalSlot() {
+    if (!tlSlot) {
+        int32 index = ourSlotCount.fetch_add(1, std::memory_order_relaxed);
+        //The last slot is shared by every thread that did not get its own
+        tlSlot = &ourSlots[index < AllocTracker::MaxThreads ? index : AllocTracker::MaxThreads - 1];
+    }
+    return tlSlot;
+}
+
+void AllocTracker::OnAlloc(size_t bytes) {
+    AllocThreadSlot* slot = LocalSlot();
+    slot->Allocs.fetch_add(1, std::memory_order_relaxed);
+    slot->Bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void AllocTracker::OnFree() {
+    LocalSlot()->Frees.fetch_add(1, std::memory_order_relaxed);
+}
+
+AllocTracker::Counters AllocTracker::Thread() {
+    const AllocThreadSlot* slot = LocalSlot();
+    Counters c;
+    c.Allocs = slot->Allocs.load(std::memory_order_relaxed);
+    c.Frees = slot->Frees.load(std::memory_order_relaxed);
+    c.Bytes = slot->Bytes.load(std::memory_order_relaxed);
+    return c;
+}
+
+AllocTracker::Counters AllocTracker::Total() {
+    int32 count = ourSlotCount.load(std::memory_order_relaxed);
+    if (count > MaxThreads)
+        count = MaxThreads;
+
+    Counters c;
+    for (int32 i = 0; i < count; i++) {
+        c.Allocs += ourSlots[i].Allocs.load(std::memory_order_relaxed);
+        c.Frees += ourSlots[i].Frees.load(std::memory_order_relaxed);
+        c.Bytes += ourSlots[i].Bytes.load(std::memory_order_relaxed);
+    }
+    return c;
+}
+
+bool AllocTracker::RunAllTests() {
+#if USE_ALLOC_TRACKER
+    bool bSuccess = true;
+
+    //Counts on this thread
+    {
+        //Called directly, as the compiler is allowed to remove a new expression which is deleted right away
+        Counters before = Thread();
+        void* p = ::operator new(100 * sizeof(int32));
+        ::operator delete(p);
+        Counters after = Thread();
+        if (after.Allocs - before.Allocs != 1 || after.Frees - before.Frees != 1 || after.Bytes - before.Bytes < 100 * sizeof(int32)) {
+            LogError("AllocTracker test failed. Expected 1 alloc and 1 free on this thread, got %llu and %llu",
+                (unsigned long long)(after.Allocs - before.Allocs), (unsigned long long)(after.Frees - before.Frees));
+            bSuccess = false;
+        }
+    }
+
+    //Another thread's allocations show up in the total, but not in this thread's counters
+    {
+        constexpr int32 allocCount = 1000;
+        Counters beforeThread = Thread();
+        Counters beforeTotal = Total();
+        std::thread t([]() {
+            for (int32 i = 0; i < allocCount; i++)
+                ::operator delete(::operator new(sizeof(uint64)));
+        });
+        t.join();
+        //std::thread allocates its own state, so only a lower bound can be checked for the total
+        Counters afterThread = Thread();
+        Counters afterTotal = Total();
+        if (afterTotal.Allocs - beforeTotal.Allocs < allocCount) {
+            LogError("AllocTracker test failed. Allocations on other threads are missing from the total");
+            bSuccess = false;
+        }
+        if (afterThread.Allocs - beforeThread.Allocs > 2) {
+            LogError("AllocTracker test failed. Allocations on other threads were counted on this thread");
+            bSuccess = false;
+        }
+    }
+
+    //Over-aligned allocations go through their own operator new, and are counted the same
+    {
+        //Through pointers, so that the compiler can't look through the pair and warn about what it sees inside them
+        void* (*volatile alignedNew)(std::size_t, std::align_val_t) = &::operator new;
+        void (*volatile alignedDelete)(void*, std::align_val_t) noexcept = &::operator delete;
+        Counters before = Thread();
+        void* p = alignedNew(100, std::align_val_t(64));
+        const bool bAligned = ((uintptr_t)p & 63) == 0;
+        alignedDelete(p, std::align_val_t(64));
+        Counters after = Thread();
+        if (!bAligned || after.Allocs - before.Allocs != 1 || after.Frees - before.Frees != 1) {
+            LogError("AllocTracker test failed. Expected 1 aligned alloc and 1 free on this thread, got %llu and %llu",
+                (unsigned long long)(after.Allocs - before.Allocs), (unsigned long long)(after.Frees - before.Frees));
+            bSuccess = false;
+        }
+    }
+
+    //A scope without allocations passes. A scope with one is only checked by hand, as it would assert
+    {
+        std::vector<int32> v;
+        v.reserve(16);
+        uint64 start = Thread().Allocs;
+        {
+            NO_ALLOC_SCOPE("AllocTracker test");
+            for (int32 i = 0; i < 16; i++)
+                v.push_back(i);
+        }
+        v.push_back(16);
+        if (Thread().Allocs - start != 1) {
+            LogError("AllocTracker test failed. Growing a vector was not counted");
+            bSuccess = false;
+        }
+    }
+
+    return bSuccess;
+#else
+    return true;
+#endif
+}
+
+//--------------------------------------------------------------------------------
+//                               operator new / delete
+//--------------------------------------------------------------------------------
+
+#if USE_ALLOC_TRACKER
+
+void* operator new(std::size_t size) {
+    AllocTracker::OnAlloc(size);
+    if (void* p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    AllocTracker::OnAlloc(size);
+    return malloc(size ? size : 1);
+}
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept {
+    return operator new(size, tag);
+}
+
+void operator delete(void* p) noexcept {
+    if (p) {
+        AllocTracker::OnFree();
+        free(p);
+    }
+}
+void operator delete[](void* p) noexcept                        { operator delete(p); }
+void operator delete(void* p, std::size_t) noexcept             { operator delete(p); }
+void operator delete[](void* p, std::size_t) noexcept           { operator delete(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept   { operator delete(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { operator delete(p); }
+
+//Aligned by hand on top of malloc, the same on every platform. The pointer malloc returned is kept right in front of
+//the aligned one, for AlignedFree
+static void* AlignedMalloc(std::size_t size, std::align_val_t align) {
+    const std::size_t alignment = (std::size_t)align > sizeof(void*) ? (std::size_t)align : sizeof(void*);
+    if (size > SIZE_MAX - alignment - sizeof(void*))
+        return nullptr;
+    void* base = malloc(size + alignment + sizeof(void*));
+    if (!base)
+        return nullptr;
+    const uintptr_t aligned = ((uintptr_t)base + sizeof(void*) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    ((void**)aligned)[-1] = base;
+    return (void*)aligned;
+}
+static void AlignedFree(void* p) {
+    free(((void**)p)[-1]);
+}
+
+void* operator new(std::size_t size, std::align_val_t align) {
+    AllocTracker::OnAlloc(size);
+    if (void* p = AlignedMalloc(size, align))
+        return p;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t size, std::align_val_t align) {
+    return operator new(size, align);
+}
+void* operator new(std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    AllocTracker::OnAlloc(size);
+    return AlignedMalloc(size, align);
+}
+void* operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t& tag) noexcept {
+    return operator new(size, align, tag);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    if (p) {
+        AllocTracker::OnFree();
+        AlignedFree(p);
+    }
+}
+void operator delete[](void* p, std::align_val_t align) noexcept                            { operator delete(p, align); }
+void operator delete(void* p, std::size_t, std::align_val_t align) noexcept                 { operator delete(p, align); }
+void operator delete[](void* p, std::size_t, std::align_val_t align) noexcept               { operator delete(p, align); }
+void operator delete(void* p, std::align_val_t align, const std::nothrow_t&) noexcept       { operator delete(p, align); }
+void operator delete[](void* p, std::align_val_t align, const std::nothrow_t&) noexcept     { operator delete(p, align); }
+
+#endif
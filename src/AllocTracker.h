@@ -0,0 +1,60 @@
+#pragma once
+#include "DebugFinal.h"
+
+#ifndef USE_ALLOC_TRACKER
+    #define USE_ALLOC_TRACKER 1
+#endif
+
+//Counts heap allocations through a global operator new/delete override (AllocTracker.cpp). Every thread gets its own
+//counters so that counting never contends, and Total() sums them up.
+//Mark hot loops with NO_ALLOC_SCOPE() to assert (debug builds only) that nothing in them allocates on this thread
+class AllocTracker {
+public:
+    struct Counters {
+        uint64 Allocs = 0;
+        uint64 Frees = 0;
+        uint64 Bytes = 0;       //Bytes requested by the allocations. Frees are not subtracted
+    };
+
+    //Threads beyond this share one set of counters
+    static constexpr int32 MaxThreads = 256;
+
+public:
+    static Counters Thread();       //Calling thread only
+    static Counters Total();        //All threads
+
+    //Used by the operator new/delete overrides
+    static void OnAlloc(size_t bytes);
+    static void OnFree();
+
+    static bool RunAllTests();    //Returns true when all tests pass
+};
+
+class ScopedNoAlloc {
+public:
+    explicit ScopedNoAlloc(const char* name) :
+        myName(name), myStart(AllocTracker::Thread().Allocs)
+    {
+    }
+    ~ScopedNoAlloc() {
+        uint64 count = AllocTracker::Thread().Allocs - myStart;
+        if (count != 0) {
+            LogError("%llu allocation(s) inside no-alloc scope: %s", (unsigned long long)count, myName);
+            Assert(false && "Allocated inside a no-alloc scope");
+        }
+    }
+    ScopedNoAlloc(const ScopedNoAlloc&) = delete;
+    ScopedNoAlloc& operator= (const ScopedNoAlloc&) = delete;
+
+private:
+    const char* myName;
+    uint64      myStart;
+};
+
+#if USE_ALLOC_TRACKER && RM_DEBUG
+    #define NO_ALLOC_CONCAT_(a, b) a##b
+    #define NO_ALLOC_CONCAT(a, b) NO_ALLOC_CONCAT_(a, b)
+    #define NO_ALLOC_SCOPE(name) ScopedNoAlloc NO_ALLOC_CONCAT(noAllocScope_, __LINE__)(name)
+#else
+    #define NO_ALLOC_SCOPE(name)
+#endif
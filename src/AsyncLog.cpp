@@ -0,0 +1,254 @@
+#include "DebugFinal.h"
+#include "AsyncLog.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace AsyncLog {
+
+//Must be a power of 2
+static constexpr uint64 Capacity = 2048;
+
+//Slot i is used for the positions i, i + Capacity, i + 2*Capacity.. The n'th time round (its lap) a slot is free
+//while Seq == 2*lap, and holds a record that is ready to print while Seq == 2*lap + 1. Everything starts at zero so
+//that logging works even before the static initializers of this file ran
+struct alignas(64) Slot {
+    std::atomic<uint64> Seq;
+    uint64              Pos;
+    Record              R;
+};
+
+static Slot                     ourSlots[Capacity];
+alignas(64) static std::atomic<uint64> ourTail;         //Next position to claim
+alignas(64) static std::atomic<uint64> ourHead;         //Next position to print
+static std::atomic<uint64>      ourWaits;
+static std::atomic_flag         ourDraining = ATOMIC_FLAG_INIT;
+
+enum State { STATE_IDLE, STATE_STARTING, STATE_RUNNING, STATE_STOPPED };
+static std::atomic<int32>       ourState;
+static std::thread*             ourThread;
+
+static void Print(const Record& r) {
+    char buf[1024];
+    const char* msg = buf;
+    std::string big;
+    int n = r.Format(r, buf, sizeof(buf));
+    if (n >= (int)sizeof(buf)) {
+        big.resize(n + 1);
+        r.Format(r, &big[0], big.size());
+        msg = big.c_str();
+    }
+    else if (n < 0) {
+        msg = "(log format error)";
+    }
+
+    if (r.Where.Col)
+        fprintf(stdout, "%s%s(%d) ~ %s%s" LOG_ENDL, r.Where.Col, r.Where.File, r.Where.Line, msg, LOG_COL_RESET);
+    else
+        fputs(msg, stdout);
+}
+
+//Prints every record that is ready. Only one thread drains at a time, returns false if another one already is
+static bool Drain() {
+    if (ourDraining.test_and_set(std::memory_order_acquire))
+        return false;
+
+    bool bPrinted = false;
+    uint64 pos = ourHead.load(std::memory_order_relaxed);
+    while (true) {
+        Slot& s = ourSlots[pos & (Capacity - 1)];
+        const uint64 lap = pos / Capacity;
+        if (s.Seq.load(std::memory_order_acquire) != 2*lap + 1)
+            break;
+
+        Print(s.R);
+        s.Seq.store(2*(lap + 1), std::memory_order_release);
+        ourHead.store(++pos, std::memory_order_release);
+        bPrinted = true;
+    }
+    if (bPrinted)
+        fflush(stdout);
+
+    ourDraining.clear(std::memory_order_release);
+    return true;
+}
+
+static void ThreadLoop() {
+    while (ourState.load(std::memory_order_acquire) == STATE_RUNNING) {
+        //Sleeping instead of waiting on a condition variable keeps the producers free of syscalls
+        if (ourHead.load(std::memory_order_relaxed) == ourTail.load(std::memory_order_relaxed))
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        else
+            Drain();
+    }
+}
+
+static void Shutdown() {
+    ourState.store(STATE_STOPPED, std::memory_order_release);
+    if (ourThread) {
+        ourThread->join();
+        delete ourThread;
+        ourThread = nullptr;
+    }
+    Flush();
+}
+
+static void StartThread() {
+    int32 expected = STATE_IDLE;
+    if (!ourState.compare_exchange_strong(expected, STATE_STARTING))
+        return;
+
+    ourState.store(STATE_RUNNING, std::memory_order_release);
+    ourThread = new std::thread(ThreadLoop);
+    std::atexit(Shutdown);
+}
+
+//The caller has to print records itself when there is no log thread (before it starts, or after exit)
+static bool HasThread() {
+    return ourState.load(std::memory_order_acquire) == STATE_RUNNING;
+}
+
+Record* Begin() {
+    if (ourState.load(std::memory_order_relaxed) == STATE_IDLE)
+        StartThread();
+
+    uint64 pos = ourTail.load(std::memory_order_relaxed);
+    while (true) {
+        Slot& s = ourSlots[pos & (Capacity - 1)];
+        const uint64 lap = pos / Capacity;
+        const uint64 seq = s.Seq.load(std::memory_order_acquire);
+
+        if (seq == 2*lap) {
+            if (ourTail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                s.Pos = pos;
+                return &s.R;
+            }
+        }
+        else if (seq < 2*lap) {
+            //Full. The slot still holds a record from the previous lap. Help print instead of waiting for the log
+            //thread to wake up
+            ourWaits.fetch_add(1, std::memory_order_relaxed);
+            if (!Drain())
+                std::this_thread::yield();
+            pos = ourTail.load(std::memory_order_relaxed);
+        }
+        else {
+            //Another producer got this position first
+            pos = ourTail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void Commit(Record* r) {
+    Slot* s = reinterpret_cast<Slot*>(reinterpret_cast<char*>(r) - offsetof(Slot, R));
+    s->Seq.store(2*(s->Pos / Capacity) + 1, std::memory_order_release);
+
+    if (!HasThread())
+        Flush();
+}
+
+void Flush() {
+    const uint64 target = ourTail.load(std::memory_order_acquire);
+    while (ourHead.load(std::memory_order_acquire) < target) {
+        //Drain on this thread as well, it is faster than waiting for the log thread to wake up
+        if (!Drain())
+            std::this_thread::yield();
+    }
+}
+
+StoredString StoreString(Record& r, const char* str) {
+    if (!str)
+        str = "(null)";
+
+    StoredString res = { r.StringsUsed };
+    const uint32 space = StringBytes - r.StringsUsed;
+    if (space == 0) {
+        //Completely full. Point at the terminator of the previous string
+        res.Offset = StringBytes - 1;
+        return res;
+    }
+
+    size_t len = strlen(str);
+    if (len >= space)
+        len = space - 1;
+    memcpy(r.Strings + r.StringsUsed, str, len);
+    r.Strings[r.StringsUsed + len] = '\0';
+    r.StringsUsed += (uint32)len + 1;
+    return res;
+}
+
+uint64_t Pending() {
+    return ourTail.load(std::memory_order_acquire) - ourHead.load(std::memory_order_acquire);
+}
+
+uint64_t WaitCount() {
+    return ourWaits.load(std::memory_order_relaxed);
+}
+
+//Formats a record straight into a buffer instead of printing it
+template<typename... Args>
+static std::string FormatForTest(const char* fmt, Args&&... args) {
+    static Record r;
+    r.Fmt = fmt;
+    r.Format = &FormatRecord<Stored<Args>...>;
+    r.StringsUsed = 0;
+    if constexpr (sizeof...(Args) > 0)
+        new (r.ArgData) std::tuple<Stored<Args>...>{ Store(r, std::forward<Args>(args))... };
+
+    char buf[512];
+    r.Format(r, buf, sizeof(buf));
+    return buf;
+}
+
+bool RunAllTests() {
+    bool bSuccess = true;
+
+    //Arguments are copied when logging, strings included
+    {
+        char str[32] = "before";
+        std::string res = FormatForTest("%s %d %.2f %c %llu", str, -3, 1.5f, 'x', (unsigned long long)1 << 40);
+        strcpy(str, "after");
+        if (res != "before -3 1.50 x 1099511627776") {
+            LogError("AsyncLog test failed. Formatting gave: '%s'", res.c_str());
+            bSuccess = false;
+        }
+
+        std::string longStr(1000, 'a');
+        res = FormatForTest("%s|%s", longStr.c_str(), "b");
+        if (res.size() != StringBytes || res.back() != '|') {
+            LogError("AsyncLog test failed. Long strings should be truncated to the record");
+            bSuccess = false;
+        }
+    }
+
+    //Many threads logging at once, more than the queue holds. Everything has to be printed after a flush
+    {
+        constexpr int32 threadCount = 4;
+        constexpr int32 perThread = (int32)Capacity;
+        std::vector<std::thread> threads;
+        for (int32 t = 0; t < threadCount; t++) {
+            threads.emplace_back([t]() {
+                for (int32 i = 0; i < perThread; i++) {
+                    Push(Site{ nullptr, __FILE__, __LINE__, false }, "%s", "");
+                }
+            });
+        }
+        for (std::thread& t : threads)
+            t.join();
+
+        Flush();
+        if (Pending() != 0) {
+            LogError("AsyncLog test failed. %llu records were not printed after a flush", (unsigned long long)Pending());
+            bSuccess = false;
+        }
+    }
+
+    return bSuccess;
+}
+
+} //End of namespace AsyncLog
@@ -0,0 +1,113 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+//Backend of the Log macros in DebugFinal.h. A log call only copies the format string pointer and its arguments into
+//a slot of a lock free ring buffer (many producers, one consumer). A background thread does the formatting and the
+//printing, and flushes stdout once per batch instead of once per line.
+//Format strings have to be string literals. String arguments are copied, every other argument has to be trivially
+//copyable (same as printf). Errors flush the queue before returning, so nothing is lost if an Assert follows
+namespace AsyncLog {
+
+    struct Site {
+        const char* Col;        //Colour prefix. nullptr for raw output (LogL), which gets no prefix and no newline
+        const char* File;
+        int         Line;
+        bool        bFlush;     //Wait till everything up to and including this record is printed
+    };
+
+    static constexpr size_t ArgBytes = 192;
+    static constexpr size_t StringBytes = 256;
+
+    struct Record;
+    using FormatFunc = int(*)(const Record& r, char* out, size_t size);
+
+    struct Record {
+        Site        Where;
+        const char* Fmt;
+        FormatFunc  Format;
+        uint32_t    StringsUsed;
+        alignas(16) unsigned char ArgData[ArgBytes];
+        char        Strings[StringBytes];
+    };
+
+    //A string argument, stored in Record::Strings
+    struct StoredString {
+        uint32_t Offset;
+    };
+
+    template<typename T>
+    constexpr bool IsString = std::is_same_v<std::decay_t<T>, char*> || std::is_same_v<std::decay_t<T>, const char*>;
+
+    template<typename T>
+    using Stored = std::conditional_t<IsString<T>, StoredString, std::decay_t<T>>;
+
+    //Copies str into the record, truncating it if the record is full
+    StoredString StoreString(Record& r, const char* str);
+
+    template<typename T>
+    inline Stored<T> Store(Record& r, T&& val) {
+        if constexpr (IsString<T>)
+            return StoreString(r, val);
+        else
+            return val;
+    }
+
+    template<typename T>
+    inline auto Load(const Record& r, const T& val) {
+        if constexpr (std::is_same_v<T, StoredString>)
+            return (const char*)(r.Strings + val.Offset);
+        else
+            return val;
+    }
+
+    //Runs on the log thread
+    template<typename... S>
+    int FormatRecord(const Record& r, char* out, size_t size) {
+        if constexpr (sizeof...(S) == 0) {
+            return snprintf(out, size, "%s", r.Fmt);
+        }
+        else {
+            const std::tuple<S...>& args = *reinterpret_cast<const std::tuple<S...>*>(r.ArgData);
+            return std::apply([&](const S&... a) { return snprintf(out, size, r.Fmt, Load(r, a)...); }, args);
+        }
+    }
+
+    //Claims a slot, waiting for one if the queue is full. Never returns nullptr
+    Record* Begin();
+    //Publishes a slot returned by Begin
+    void Commit(Record* r);
+
+    //Waits till everything that was logged so far is printed
+    void Flush();
+
+    template<typename... Args>
+    void Push(const Site& site, const char* fmt, Args&&... args) {
+        using Tuple = std::tuple<Stored<Args>...>;
+        static_assert(sizeof(Tuple) <= ArgBytes, "Too many log arguments");
+        static_assert((std::is_trivially_copyable_v<Stored<Args>> && ...), "Log arguments have to be trivially copyable");
+
+        Record* r = Begin();
+        r->Where = site;
+        r->Fmt = fmt;
+        r->Format = &FormatRecord<Stored<Args>...>;
+        r->StringsUsed = 0;
+        if constexpr (sizeof...(Args) > 0)
+            new (r->ArgData) Tuple{ Store(*r, std::forward<Args>(args))... };
+        Commit(r);
+
+        if (site.bFlush)
+            Flush();
+    }
+
+    //Records logged but not printed yet, and records that had to wait for a free slot. Used by the tests
+    uint64_t Pending();
+    uint64_t WaitCount();
+
+    bool RunAllTests();    //Returns true when all tests pass
+}
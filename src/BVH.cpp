@@ -0,0 +1,174 @@
+#include "BVH.h"
+#include <algorithm>
+
+void TileBVH::Clear() {
+    myItems.clear();
+    myNodes.clear();
+}
+
+void TileBVH::Build(std::vector<Item>&& items) {
+    myItems = std::move(items);
+    myNodes.clear();
+    if (myItems.empty())
+        return;
+
+    //A binary tree with leaves of at least 1 item never has more than 2n-1 nodes
+    myNodes.reserve(2 * myItems.size());
+    myNodes.emplace_back();
+    Subdivide(0, 0, (uint32)myItems.size());
+}
+
+void TileBVH::Subdivide(uint32 node, uint32 start, uint32 count) {
+    AABB bounds;
+    AABB centroids;
+    for (uint32 i = start; i < start + count; i++) {
+        bounds.Expand(myItems[i].Bounds);
+        centroids.Expand(myItems[i].Bounds.Center());
+    }
+
+    myNodes[node].Bounds = bounds;
+    myNodes[node].Start = start;
+    myNodes[node].Count = count;
+    myNodes[node].Left = 0;
+
+    if (count <= MaxLeafItems)
+        return;
+
+    //Median split along the longest axis of the centroids. Tiles are roughly uniform in size so this is good enough
+    glm::vec3 size = centroids.Max - centroids.Min;
+    int32 axis = 0;
+    if (size.y > size[axis]) axis = 1;
+    if (size.z > size[axis]) axis = 2;
+
+    const uint32 half = count / 2;
+    std::nth_element(myItems.begin() + start, myItems.begin() + start + half, myItems.begin() + start + count,
+        [axis](const Item& a, const Item& b) { return a.Bounds.Center()[axis] < b.Bounds.Center()[axis]; });
+
+    const uint32 left = (uint32)myNodes.size();
+    myNodes.emplace_back();
+    myNodes.emplace_back();
+    myNodes[node].Left = left;
+
+    Subdivide(left, start, half);
+    Subdivide(left + 1, start + half, count - half);
+}
+
+void TileBVH::Query(const Frustum& f, std::vector<const Item*>& outVisible, QueryStats* outStats) const {
+    QueryStats stats;
+    if (myNodes.empty()) {
+        if (outStats)
+            *outStats = stats;
+        return;
+    }
+
+    struct Entry { uint32 Node; uint32 Mask; };
+    constexpr int32 maxDepth = 64;
+    Entry stack[maxDepth];
+    int32 top = 0;
+    stack[top++] = { 0, Frustum::AllPlanes };
+
+    while (top > 0) {
+        const Entry e = stack[--top];
+        const Node& n = myNodes[e.Node];
+        stats.NodesVisited++;
+
+        uint32 mask = e.Mask;
+        FrustumResult res = f.Test(n.Bounds, mask);
+        if (res == FRUSTUM_OUTSIDE) {
+            stats.Culled += n.Count;
+            continue;
+        }
+
+        if (res == FRUSTUM_INSIDE) {
+            for (uint32 i = n.Start; i < n.Start + n.Count; i++)
+                outVisible.push_back(&myItems[i]);
+            stats.Visible += n.Count;
+            continue;
+        }
+
+        if (n.Left == 0) {
+            //Leaf which straddles a plane. Test the items themselves
+            for (uint32 i = n.Start; i < n.Start + n.Count; i++) {
+                uint32 itemMask = mask;
+                if (f.Test(myItems[i].Bounds, itemMask) != FRUSTUM_OUTSIDE) {
+                    outVisible.push_back(&myItems[i]);
+                    stats.Visible++;
+                }
+                else
+                    stats.Culled++;
+            }
+            continue;
+        }
+
+        Assert(top + 2 <= maxDepth && "BVH is deeper than expected");
+        stack[top++] = { n.Left + 1, mask };
+        stack[top++] = { n.Left, mask };
+    }
+
+    if (outStats)
+        *outStats = stats;
+}
+
+bool TileBVH::RunAllTests() {
+    bool bSuccess = true;
+
+    //A 64 x 64 grid of unit tiles on the ground plane
+    constexpr int32 size = 64;
+    std::vector<Item> items;
+    for (int32 y = 0; y < size; y++) {
+        for (int32 x = 0; x < size; x++) {
+            Item item;
+            item.Bounds.Expand(glm::vec3(x - size/2, y - size/2, -0.5f));
+            item.Bounds.Expand(glm::vec3(x - size/2 + 1, y - size/2 + 1, +0.5f));
+            item.Grapher = x;
+            item.Tile = y;
+            items.push_back(item);
+        }
+    }
+    std::vector<Item> reference = items;
+
+    TileBVH bvh;
+    bvh.Build(std::move(items));
+    if (bvh.ItemCount() != size*size) {
+        LogError("BVH test failed. Expected %d items, got %u", size*size, bvh.ItemCount());
+        return false;
+    }
+
+    //Compare against brute force for a few cameras
+    glm::vec3 cams[][2] = {
+        { glm::vec3(0, 0, 40),      glm::vec3(0, 0, 0) },       //Looking straight down at everything
+        { glm::vec3(-10, -20, 15),  glm::vec3(-5, -10, 0) },    //Default like view
+        { glm::vec3(0, 0, 2),       glm::vec3(30, 0, 2) },      //Looking along the ground
+        { glm::vec3(0, 0, 10),      glm::vec3(0, 0, 20) },      //Looking away from everything
+    };
+
+    for (auto& cam : cams) {
+        glm::mat4 proj = glm::perspective(glm::radians(45.0f), 1.5f, 0.1f, 100.0f);
+        glm::mat4 view = glm::lookAt(cam[0], cam[1], glm::vec3(0, 0, 1));
+        Frustum f(proj * view);
+
+        std::vector<const Item*> visible;
+        QueryStats stats;
+        bvh.Query(f, visible, &stats);
+
+        uint32 expected = 0;
+        for (const Item& it : reference)
+            expected += f.Intersects(it.Bounds) ? 1 : 0;
+
+        bool bCountsMatch = (stats.Visible == visible.size()) && (stats.Visible + stats.Culled == size*size);
+        if (visible.size() != expected || !bCountsMatch) {
+            LogError("BVH test failed. Expected %u visible tiles, got %u (stats: %u visible, %u culled)",
+                expected, (uint32)visible.size(), stats.Visible, stats.Culled);
+            bSuccess = false;
+        }
+        for (const Item* it : visible) {
+            if (!f.Intersects(it->Bounds)) {
+                LogError("BVH test failed. Tile (%u, %u) should have been culled", it->Grapher, it->Tile);
+                bSuccess = false;
+                break;
+            }
+        }
+    }
+
+    return bSuccess;
+}
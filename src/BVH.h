@@ -0,0 +1,53 @@
+#pragma once
+#include "DebugFinal.h"
+#include "Bounds.h"
+#include <vector>
+
+//Bounding volume hierarchy over the surface tiles of every grapher. It is rebuilt whenever the graphers are re-meshed,
+//and queried once per frame to find the tiles inside the camera frustum
+class TileBVH {
+public:
+    struct Item {
+        AABB    Bounds;
+        uint32  Grapher;
+        uint32  Tile;
+    };
+
+    struct QueryStats {
+        uint32 NodesVisited = 0;
+        uint32 Visible = 0;
+        uint32 Culled = 0;
+    };
+
+    static constexpr uint32 MaxLeafItems = 4;
+
+public:
+    TileBVH() = default;
+
+    void Build(std::vector<Item>&& items);
+    void Clear();
+
+    //Appends every item whose bounds are not completely outside the frustum
+    void Query(const Frustum& f, std::vector<const Item*>& outVisible, QueryStats* outStats = nullptr) const;
+
+    uint32 ItemCount() const { return (uint32)myItems.size(); }
+    uint32 NodeCount() const { return (uint32)myNodes.size(); }
+
+    static bool RunAllTests();    //Returns true when all tests pass
+
+private:
+    //Items of a node are always the contiguous range [Start, Start+Count), which lets a node that is completely
+    //inside the frustum add all of its items without visiting its children
+    struct Node {
+        AABB    Bounds;
+        uint32  Start;
+        uint32  Count;
+        uint32  Left;       //Right child is always Left+1. 0 for leaves (the root is never a child)
+    };
+
+    void Subdivide(uint32 node, uint32 start, uint32 count);
+
+private:
+    std::vector<Item>   myItems;
+    std::vector<Node>   myNodes;
+};
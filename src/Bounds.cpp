@@ -0,0 +1,112 @@
+#include "Bounds.h"
+
+void Frustum::Extract(const glm::mat4& vp) {
+    //glm is column major, so row i of the matrix is (m[0][i], m[1][i], m[2][i], m[3][i])
+    auto row = [&vp](int32 i) { return glm::vec4(vp[0][i], vp[1][i], vp[2][i], vp[3][i]); };
+    const glm::vec4 r0 = row(0);
+    const glm::vec4 r1 = row(1);
+    const glm::vec4 r2 = row(2);
+    const glm::vec4 r3 = row(3);
+
+    myPlanes[PLANE_LEFT]    = r3 + r0;
+    myPlanes[PLANE_RIGHT]   = r3 - r0;
+    myPlanes[PLANE_BOTTOM]  = r3 + r1;
+    myPlanes[PLANE_TOP]     = r3 - r1;
+    myPlanes[PLANE_NEAR]    = r3 + r2;
+    myPlanes[PLANE_FAR]     = r3 - r2;
+
+    for (glm::vec4& p : myPlanes) {
+        float len = glm::length(glm::vec3(p));
+        if (len > 0.0f)
+            p /= len;
+    }
+}
+
+FrustumResult Frustum::Test(const AABB& box, uint32& inOutMask) const {
+    if (!box.Valid())
+        return FRUSTUM_OUTSIDE;
+
+    const glm::vec3 c = box.Center();
+    const glm::vec3 e = box.Extents();
+
+    for (int32 i = 0; i < PLANE_COUNT; i++) {
+        const uint32 bit = 1u << i;
+        if (!(inOutMask & bit))
+            continue;
+
+        const glm::vec3 n = glm::vec3(myPlanes[i]);
+        const float dist = glm::dot(n, c) + myPlanes[i].w;
+        const float radius = glm::dot(glm::abs(n), e);
+
+        if (dist + radius < 0.0f)
+            return FRUSTUM_OUTSIDE;
+        if (dist - radius >= 0.0f)
+            inOutMask &= ~bit;
+    }
+    return inOutMask ? FRUSTUM_INTERSECT : FRUSTUM_INSIDE;
+}
+
+static AABB MakeBox(glm::vec3 min, glm::vec3 max) {
+    AABB b;
+    b.Expand(min);
+    b.Expand(max);
+    return b;
+}
+
+bool Frustum::RunAllTests() {
+    bool bSuccess = true;
+
+    //Camera at (0, 0, 10) looking down -z
+    glm::mat4 proj = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 100.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0, 0, 10), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+    Frustum f(proj * view);
+
+    struct TestCase { AABB Box; FrustumResult Expected; };
+    TestCase tests[] = {
+        { MakeBox({-1, -1, -1},     {1, 1, 1}),         FRUSTUM_INSIDE },
+        { MakeBox({-1, -1, 11},     {1, 1, 12}),        FRUSTUM_OUTSIDE },      //Behind the camera
+        { MakeBox({-1, -1, -200},   {1, 1, -150}),      FRUSTUM_OUTSIDE },      //Beyond the far plane
+        { MakeBox({50, -1, -1},     {51, 1, 1}),        FRUSTUM_OUTSIDE },      //Off to the right
+        { MakeBox({-51, -1, -1},    {-50, 1, 1}),       FRUSTUM_OUTSIDE },
+        { MakeBox({-1, 50, -1},     {1, 51, 1}),        FRUSTUM_OUTSIDE },
+        { MakeBox({-100, -1, -1},   {100, 1, 1}),       FRUSTUM_INTERSECT },    //Straddles the left and right planes
+        { MakeBox({-1, -1, 0},      {1, 1, 20}),        FRUSTUM_INTERSECT },    //Contains the camera
+    };
+
+    for (const TestCase& t : tests) {
+        FrustumResult res = f.Test(t.Box);
+        if (res != t.Expected) {
+            LogError("Frustum test failed. Box (%.1f, %.1f, %.1f) ~ (%.1f, %.1f, %.1f). Expected: %d, got %d",
+                t.Box.Min.x, t.Box.Min.y, t.Box.Min.z, t.Box.Max.x, t.Box.Max.y, t.Box.Max.z, (int)t.Expected, (int)res);
+            bSuccess = false;
+        }
+    }
+
+    //A box that is inside some planes should have those planes removed from the mask
+    {
+        uint32 mask = AllPlanes;
+        f.Test(MakeBox({-100, -1, -1}, {100, 1, 1}), mask);
+        uint32 expected = (1u << PLANE_LEFT) | (1u << PLANE_RIGHT);
+        if (mask != expected) {
+            LogError("Frustum test failed. Expected plane mask %02x, got %02x", expected, mask);
+            bSuccess = false;
+        }
+    }
+
+    //Every point in NDC should be inside
+    for (int32 i = 0; i < 100; i++) {
+        glm::vec4 ndc = glm::vec4(Random(-0.99, 0.99), Random(-0.99, 0.99), Random(-0.99, 0.99), 1.0f);
+        glm::vec4 world = glm::inverse(proj * view) * ndc;
+        world /= world.w;
+
+        AABB b;
+        b.Expand(glm::vec3(world));
+        if (f.Test(b) != FRUSTUM_INSIDE) {
+            LogError("Frustum test failed. NDC point (%.2f, %.2f, %.2f) was not inside", ndc.x, ndc.y, ndc.z);
+            bSuccess = false;
+            break;
+        }
+    }
+
+    return bSuccess;
+}
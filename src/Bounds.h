@@ -0,0 +1,69 @@
+#pragma once
+#include "DebugFinal.h"
+#include "Maths.h"
+#include <cfloat>
+
+//Axis aligned bounding box. A default constructed box is empty, and grows with every Expand
+struct AABB {
+    glm::vec3 Min = glm::vec3( FLT_MAX);
+    glm::vec3 Max = glm::vec3(-FLT_MAX);
+
+    bool Valid() const                  { return Min.x <= Max.x && Min.y <= Max.y && Min.z <= Max.z; }
+    glm::vec3 Center() const            { return (Min + Max) * 0.5f; }
+    glm::vec3 Extents() const           { return (Max - Min) * 0.5f; }
+
+    void Expand(glm::vec3 p)            { Min = glm::min(Min, p); Max = glm::max(Max, p); }
+    void Expand(const AABB& b)          { Min = glm::min(Min, b.Min); Max = glm::max(Max, b.Max); }
+    void Expand(const glm::vec3* pos, int32 count) {
+        for (int32 i = 0; i < count; i++)
+            Expand(pos[i]);
+    }
+};
+
+//A half line that starts at Origin and goes along Dir, which has a length of 1
+struct Ray {
+    glm::vec3 Origin;
+    glm::vec3 Dir;
+};
+
+enum FrustumResult {
+    FRUSTUM_OUTSIDE,
+    FRUSTUM_INTERSECT,
+    FRUSTUM_INSIDE,
+};
+
+//The 6 planes of a view projection matrix. Normals point into the frustum
+class Frustum {
+public:
+    enum Plane {
+        PLANE_LEFT,
+        PLANE_RIGHT,
+        PLANE_BOTTOM,
+        PLANE_TOP,
+        PLANE_NEAR,
+        PLANE_FAR,
+
+        PLANE_COUNT
+    };
+    static constexpr uint32 AllPlanes = (1u << PLANE_COUNT) - 1;
+
+public:
+    Frustum() = default;
+    explicit Frustum(const glm::mat4& vp) { Extract(vp); }
+
+    //Gribb/Hartmann extraction. Expects OpenGL clip space (-w <= z <= w)
+    void Extract(const glm::mat4& vp);
+
+    const glm::vec4& GetPlane(int32 i) const { Assert(i >= 0 && i < PLANE_COUNT); return myPlanes[i]; }
+
+    //Only the planes whose bit is set in inOutMask are tested. Planes which the box is completely inside of are
+    //cleared from the mask, so children of a box never have to test them again
+    FrustumResult Test(const AABB& box, uint32& inOutMask) const;
+    FrustumResult Test(const AABB& box) const { uint32 mask = AllPlanes; return Test(box, mask); }
+    bool Intersects(const AABB& box) const  { return Test(box) != FRUSTUM_OUTSIDE; }
+
+    static bool RunAllTests();    //Returns true when all tests pass
+
+private:
+    glm::vec4 myPlanes[PLANE_COUNT];
+};
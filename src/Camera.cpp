@@ -79,6 +79,7 @@ void Camera::CalculateMatrix() {
     myMatProjInv = glm::inverse(myMatProj);
     myMatVP = myMatProj * myMatView;
     myMatVPInv = myMatViewInv * myMatProjInv;
+    myFrustum.Extract(myMatVP);
 }
 
 glm::vec3 Camera::NDCToWorldPoint(glm::vec3 position) const {
@@ -115,30 +116,15 @@ glm::vec3 Camera::ScreenToWorldPoint(glm::vec2 position) const {
     // glCheckError();
 }
 
-glm::vec3 Camera::ScreenPointToRay(glm::vec2 position) const {
+Ray Camera::ScreenPointToRay(glm::vec2 position) const {
     glm::vec3 pos;
     pos.x = Remap(position.x, 0, windowSize.x, -1.0f, 1.0f);
     pos.y = Remap(position.y, 0, windowSize.y, 1.0f, -1.0f);
     pos.z = -1.0f;  //Near plane
-    glm::vec3 posNear = NDCToWorldPoint(pos);
+    const glm::vec3 posNear = NDCToWorldPoint(pos);
     pos.z = +1.0f;  //far plane
-    glm::vec3 posFar = NDCToWorldPoint(pos);
-
-    glm::vec3 dir = posFar - posNear;
-    glm::vec3 dirCam = posNear - myPos;
-    glm::vec3 dirCam2 = posFar - myPos;
-
-    LogWarn("Pos N: %+.02f, %+.02f, %+.02f", posNear.x, posNear.y, posNear.z);
-    LogWarn("Pos F: %+.02f, %+.02f, %+.02f", posFar.x, posFar.y, posFar.z);
-    LogWarn("Pos  : %+.02f, %+.02f, %+.02f", myPos.x, myPos.y, myPos.z);
-
-    LogWarn("Dir 0: %+.02f, %+.02f, %+.02f", dir.x, dir.y, dir.z);
-    LogWarn("Dir 1: %+.02f, %+.02f, %+.02f", dirCam.x, dirCam.y, dirCam.z);
-    LogWarn("Dir 2: %+.02f, %+.02f, %+.02f", dirCam2.x, dirCam2.y, dirCam2.z);
-
-    Assert(false && "Todo: implement this");
-
-    return glm::normalize(posFar - posNear);
+    const glm::vec3 posFar = NDCToWorldPoint(pos);
+    return { posNear, glm::normalize(posFar - posNear) };
 }
 
 void Camera::ProcessZoom(double yoff)
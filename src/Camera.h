@@ -1,5 +1,6 @@
 #pragma once
 #include "Maths.h"
+#include "Bounds.h"
 #include "RE_Buffers.h"
 #include <GLFW/glfw3.h>
 
@@ -17,11 +18,13 @@ public:
     const glm::mat4& ViewInv() const                { Assert(myValid); return myMatViewInv; }
     const glm::mat4& VP() const                     { Assert(myValid); return myMatVP; }
     const glm::mat4& VPInv() const                  { Assert(myValid); return myMatVPInv; }
+    const Frustum& GetFrustum() const               { Assert(myValid); return myFrustum; }
 
     glm::vec3 NDCToWorldPoint(glm::vec3 pos) const;
     glm::vec3 WorldToNDCPoint(glm::vec3 pos) const;
     glm::vec3 ScreenToWorldPoint(glm::vec2 pos) const;
-    glm::vec3 ScreenPointToRay(glm::vec2 pos) const;
+    //The ray through a pixel (in window coordinates, as the cursor is), starting on the near plane
+    Ray ScreenPointToRay(glm::vec2 pos) const;
 
     void ProcessInput(GLFWwindow* win);
     void ProcessZoom(double yoff);
@@ -57,6 +60,7 @@ private:
     glm::mat4           myMatProjInv;
     glm::mat4           myMatVP;
     glm::mat4           myMatVPInv;
+    Frustum             myFrustum;
 
     //Variables to turn the camera
     double myOldMouseX;
@@ -0,0 +1,393 @@
+#include "Contours.h"
+#include "RE_CommandList.h"
+#include "ThreadPool.h"
+#include "Profiler.h"
+#include "AllocTracker.h"
+
+#include <algorithm>
+#include <cmath>
+
+//A band has at least this many rows of cells, fewer are not worth a job
+static constexpr int32 MinBandRows = 32;
+
+//Corners of a cell go counter clockwise from the bottom left: (i, j), (i+1, j), (i+1, j+1), (i, j+1). Bit c of a case
+//is set when corner c is at or above the level. Edges are 0 bottom, 1 right, 2 top, 3 left, and every pair of them is
+//a segment. Cases 5 and 10 are saddles: the table splits off the corners that are above the level, which is right
+//when the centre of the cell is below it. Otherwise the other saddle is right, which is the case with every bit flipped
+static const int8 ourCases[16][4] = {
+    { -1, -1, -1, -1 },
+    {  3,  0, -1, -1 },
+    {  0,  1, -1, -1 },
+    {  3,  1, -1, -1 },
+    {  1,  2, -1, -1 },
+    {  3,  0,  1,  2 },
+    {  0,  2, -1, -1 },
+    {  3,  2, -1, -1 },
+    {  2,  3, -1, -1 },
+    {  0,  2, -1, -1 },
+    {  0,  1,  2,  3 },
+    {  1,  2, -1, -1 },
+    {  1,  3, -1, -1 },
+    {  0,  1, -1, -1 },
+    {  3,  0, -1, -1 },
+    { -1, -1, -1, -1 },
+};
+
+//The edge from (i, j) to (i+1, j) is 2 * (j * CountX + i), and the one from (i, j) to (i, j+1) is one more than that.
+//The level is in the top half, so the same edge crossed at two levels gives two keys
+static uint64 EdgeKey(int32 level, int32 countX, int32 i, int32 j, bool bVertical) {
+    return ((uint64)level << 32) | (2 * ((uint64)j * countX + i) + (bVertical ? 1 : 0));
+}
+
+void Contours::Clear() {
+    myLevels.clear();
+    mySegments.clear();
+    myLines.clear();
+    myPoints.clear();
+}
+
+void Contours::Extract(const Grid& grid, const double* levels, int32 levelCount) {
+    myLevels.assign(levels, levels + levelCount);
+    Assert(std::is_sorted(myLevels.begin(), myLevels.end()));
+    ExtractLevels(grid);
+}
+
+void Contours::ExtractSpaced(const Grid& grid, double spacing, int32 maxLevels) {
+    myLevels.clear();
+    double lo = INFINITY, hi = -INFINITY;
+    const int64 count = (int64)grid.CountX * grid.CountY;
+    for (int64 k = 0; k < count; k++) {
+        const double h = grid.Heights[k];
+        if (std::isfinite(h)) {
+            lo = Min(lo, h);
+            hi = Max(hi, h);
+        }
+    }
+
+    if (spacing > 0.0 && maxLevels > 0 && lo <= hi) {
+        //Every few multiples when there would be too many
+        const double levels = std::floor(hi / spacing) - std::ceil(lo / spacing) + 1.0;
+        const double step = spacing * Max(1.0, std::ceil(levels / maxLevels));
+        const double first = std::ceil(lo / step);
+        const double last = std::floor(hi / step);
+        for (double k = first; k <= last && (int32)myLevels.size() < maxLevels; k++)
+            myLevels.push_back(k * step);
+    }
+    ExtractLevels(grid);
+}
+
+void Contours::ExtractLevels(const Grid& grid) {
+    PROFILE_ZONE("Contours");
+    mySegments.clear();
+    myLines.clear();
+    myPoints.clear();
+    if (myLevels.empty() || grid.CountX < 2 || grid.CountY < 2)
+        return;
+
+    //Bands of rows of cells. Segments that cross from one band into the next are joined by Stitch like any other
+    const int32 cellRows = grid.CountY - 1;
+    const int32 bandCount = Max(1, Min(cellRows / MinBandRows, 4 * (ThreadPool::Global().ThreadCount() + 1)));
+    if ((int32)myBands.size() < bandCount)
+        myBands.resize(bandCount);
+    auto Band = [this, &grid, cellRows, bandCount](int32 b) {
+        myBands[b].clear();
+        ExtractBand(grid, (int32)((int64)cellRows * b / bandCount), (int32)((int64)cellRows * (b + 1) / bandCount), myBands[b]);
+    };
+    if (bandCount == 1)
+        Band(0);
+    else
+        ThreadPool::Global().ParallelFor(bandCount, Band);
+
+    for (int32 b = 0; b < bandCount; b++)
+        mySegments.insert(mySegments.end(), myBands[b].begin(), myBands[b].end());
+    Stitch();
+}
+
+void Contours::ExtractBand(const Grid& grid, int32 rowStart, int32 rowEnd, std::vector<Segment>& out) const {
+    const int32 countX = grid.CountX;
+    const double* levels = myLevels.data();
+    const int32 levelCount = (int32)myLevels.size();
+
+    for (int32 j = rowStart; j < rowEnd; j++) {
+        const double* row0 = grid.Heights + (int64)j * countX;
+        const double* row1 = row0 + countX;
+        for (int32 i = 0; i + 1 < countX; i++) {
+            const double v[4] = { row0[i], row0[i+1], row1[i+1], row1[i] };
+            if (!std::isfinite(v[0]) || !std::isfinite(v[1]) || !std::isfinite(v[2]) || !std::isfinite(v[3]))
+                continue;
+            const double lo = Min(Min(v[0], v[1]), Min(v[2], v[3]));
+            const double hi = Max(Max(v[0], v[1]), Max(v[2], v[3]));
+
+            //Only the levels in (lo, hi] have corners on both sides
+            int32 level = (int32)(std::upper_bound(levels, levels + levelCount, lo) - levels);
+            for (; level < levelCount && levels[level] <= hi; level++) {
+                const double value = levels[level];
+                int32 code = (v[0] >= value ? 1 : 0) | (v[1] >= value ? 2 : 0) | (v[2] >= value ? 4 : 0) | (v[3] >= value ? 8 : 0);
+                if ((code == 5 || code == 10) && 0.25 * (v[0] + v[1] + v[2] + v[3]) >= value)
+                    code ^= 15;
+
+                const int8* edges = ourCases[code];
+                for (int32 k = 0; k < 4 && edges[k] >= 0; k += 2) {
+                    Segment seg;
+                    for (int32 end = 0; end < 2; end++) {
+                        //Always from the bottom or left corner, so the cells on both sides of an edge get the same point
+                        double a, b;
+                        double px = grid.MinX + i * grid.Increment;
+                        double py = grid.MinY + j * grid.Increment;
+                        switch (edges[k + end]) {
+                            case 0:
+                                a = v[0]; b = v[1];
+                                px += grid.Increment * (value - a) / (b - a);
+                                seg.Keys[end] = EdgeKey(level, countX, i, j, false);
+                                break;
+                            case 1:
+                                a = v[1]; b = v[2];
+                                px += grid.Increment;
+                                py += grid.Increment * (value - a) / (b - a);
+                                seg.Keys[end] = EdgeKey(level, countX, i + 1, j, true);
+                                break;
+                            case 2:
+                                a = v[3]; b = v[2];
+                                px += grid.Increment * (value - a) / (b - a);
+                                py += grid.Increment;
+                                seg.Keys[end] = EdgeKey(level, countX, i, j + 1, false);
+                                break;
+                            default:
+                                a = v[0]; b = v[3];
+                                py += grid.Increment * (value - a) / (b - a);
+                                seg.Keys[end] = EdgeKey(level, countX, i, j, true);
+                                break;
+                        }
+                        seg.Ends[end] = glm::vec3(px, py, value);
+                    }
+                    out.push_back(seg);
+                }
+            }
+        }
+    }
+}
+
+Contours::Slot& Contours::Find(uint64 key) {
+    uint64 index = (key * 0x9E3779B97F4A7C15ull) >> 32;
+    while (true) {
+        Slot& slot = myTable[index & myTableMask];
+        if (slot.Key == key)
+            return slot;
+        if (slot.Key == EmptyKey) {
+            slot.Key = key;
+            return slot;
+        }
+        index++;
+    }
+}
+
+int32 Contours::Neighbour(int32 e) {
+    const Slot& slot = Find(mySegments[e >> 1].Keys[e & 1]);
+    return slot.Ends[0] == e ? slot.Ends[1] : slot.Ends[0];
+}
+
+void Contours::Stitch() {
+    const int32 segCount = (int32)mySegments.size();
+
+    //At most two keys per segment, and the table is kept at most half full
+    uint64 size = 16;
+    while (size < 4 * (uint64)segCount)
+        size *= 2;
+    if (myTable.size() < size)
+        myTable.resize(size);
+    myTableMask = size - 1;
+    std::fill(myTable.begin(), myTable.begin() + size, Slot{ EmptyKey, { -1, -1 } });
+
+    for (int32 e = 0; e < 2 * segCount; e++) {
+        Slot& slot = Find(mySegments[e >> 1].Keys[e & 1]);
+        Assert(slot.Ends[1] < 0 && "An edge is the end of more than two segments");
+        slot.Ends[slot.Ends[0] < 0 ? 0 : 1] = e;
+    }
+
+    //Walks from every segment that is not part of a line yet, first backwards to where the line starts, then forwards
+    myVisited.assign(segCount, false);
+    for (int32 s = 0; s < segCount; s++) {
+        if (myVisited[s])
+            continue;
+        myVisited[s] = true;
+
+        bool bClosed = false;
+        myBackwards.clear();
+        for (int32 e = 2 * s; ; ) {
+            const int32 next = Neighbour(e);
+            if (next < 0)
+                break;
+            if ((next >> 1) == s) {
+                bClosed = true;
+                break;
+            }
+            Assert(!myVisited[next >> 1]);
+            myVisited[next >> 1] = true;
+            e = next ^ 1;
+            myBackwards.push_back(mySegments[e >> 1].Ends[e & 1]);
+        }
+
+        Polyline line;
+        line.Start = (uint32)myPoints.size();
+        line.Level = (int32)(mySegments[s].Keys[0] >> 32);
+        myPoints.insert(myPoints.end(), myBackwards.rbegin(), myBackwards.rend());
+        myPoints.push_back(mySegments[s].Ends[0]);
+        myPoints.push_back(mySegments[s].Ends[1]);
+        //A closed line already came back around to the other end
+        for (int32 e = 2 * s + 1; !bClosed; ) {
+            const int32 next = Neighbour(e);
+            if (next < 0)
+                break;
+            Assert(!myVisited[next >> 1]);
+            myVisited[next >> 1] = true;
+            e = next ^ 1;
+            myPoints.push_back(mySegments[e >> 1].Ends[e & 1]);
+        }
+        line.Count = (uint32)myPoints.size() - line.Start;
+        myLines.push_back(line);
+    }
+}
+
+void Contours::Draw(CommandList& list, glm::vec3 offset, glm::vec4 col, float width, std::vector<glm::vec3>& scratch) const {
+    for (const Polyline& line : myLines) {
+        scratch.resize(line.Count);
+        for (uint32 k = 0; k < line.Count; k++)
+            scratch[k] = myPoints[line.Start + k] + offset;
+        list.DrawLineStrip(scratch.data(), (int32)line.Count, col, width);
+    }
+}
+
+bool Contours::RunAllTests() {
+    bool bVal = RunTest_Shapes();
+    bVal &= RunTest_Bands();
+    return bVal;
+}
+
+bool Contours::RunTest_Shapes() {
+    bool bSuccess = true;
+    #define TEST(x) \
+        if (!(x)) { \
+            LogError("Contours test failed: %s", #x); \
+            bSuccess = false; \
+        }
+
+    //Samples in [-5, 5] x [-5, 5]
+    const int32 count = 41;
+    std::vector<double> heights(count * count);
+    const Contours::Grid grid = { heights.data(), count, count, -5.0, -5.0, 0.25 };
+    auto Fill = [&](double (*func)(double x, double y)) {
+        for (int32 j = 0; j < count; j++)
+            for (int32 i = 0; i < count; i++)
+                heights[j * count + i] = func(grid.MinX + i * grid.Increment, grid.MinY + j * grid.Increment);
+    };
+    Contours c;
+
+    //Circles around the cone. Every one is closed, and all of its points are on the circle
+    Fill([](double x, double y) { return std::sqrt(x*x + y*y); });
+    const double circles[] = { 1.1, 2.1, 3.1 };
+    c.Extract(grid, circles, 3);
+    TEST(c.Lines().size() == 3);
+    for (const Polyline& line : c.Lines()) {
+        const glm::vec3* p = &c.Points()[line.Start];
+        TEST(line.Count > 8 && p[0] == p[line.Count - 1]);
+        bool bOnCircle = true;
+        for (uint32 k = 0; k < line.Count; k++)
+            bOnCircle &= p[k].z == (float)circles[line.Level] && std::abs(glm::length(glm::vec2(p[k])) - circles[line.Level]) < 0.05;
+        TEST(bOnCircle);
+    }
+
+    //A plane gives one line across the whole grid, a point on every row
+    Fill([](double x, double) { return x; });
+    const double half = 0.6;
+    c.Extract(grid, &half, 1);
+    TEST(c.Lines().size() == 1 && c.Lines()[0].Count == count);
+    bool bStraight = true;
+    for (const glm::vec3& p : c.Points())
+        bStraight &= std::abs(p.x - 0.6f) < 1e-5f;
+    TEST(bStraight);
+
+    //A hole through the middle cuts it in two
+    Fill([](double x, double y) { return std::abs(y) < 0.1 ? NAN : x; });
+    c.Extract(grid, &half, 1);
+    TEST(c.Lines().size() == 2 && c.Points().size() == count - 1);
+
+    //Two lines that cross, which meet in a saddle cell. The centre of the cell splits the cross into two lines that
+    //both go from one side of the grid to another
+    Fill([](double x, double y) { return (x - 0.1) * (y - 0.1); });
+    const double zero = 0.0;
+    c.Extract(grid, &zero, 1);
+    TEST(c.Lines().size() == 2);
+    for (const Polyline& line : c.Lines())
+        TEST(line.Count > 2 && c.Points()[line.Start] != c.Points()[line.Start + line.Count - 1]);
+
+    //The cone goes from 0 to about 7.07, so the spaced levels are 0 to 7. Cut down to 3 they are every third one
+    Fill([](double x, double y) { return std::sqrt(x*x + y*y); });
+    c.ExtractSpaced(grid, 1.0);
+    TEST(c.Levels().size() == 8 && c.Levels()[0] == 0.0 && c.Levels()[7] == 7.0);
+    c.ExtractSpaced(grid, 1.0, 3);
+    TEST(c.Levels().size() == 3 && c.Levels()[1] == 3.0 && c.Levels()[2] == 6.0);
+
+    //The buffers are big enough already
+    const AllocTracker::Counters before = AllocTracker::Thread();
+    c.ExtractSpaced(grid, 1.0);
+    TEST(AllocTracker::Thread().Allocs == before.Allocs);
+
+    #undef TEST
+    return bSuccess;
+}
+
+bool Contours::RunTest_Bands() {
+    bool bSuccess = true;
+    #define TEST(x) \
+        if (!(x)) { \
+            LogError("Contours band test failed: %s", #x); \
+            bSuccess = false; \
+        }
+
+    //Big enough for several bands. Lines cross from one band into the next all the time
+    const int32 count = 401;
+    std::vector<double> heights(count * count);
+    const Contours::Grid grid = { heights.data(), count, count, -10.0, -10.0, 0.05 };
+    for (int32 j = 0; j < count; j++)
+        for (int32 i = 0; i < count; i++)
+            heights[j * count + i] = std::sin(grid.MinX + i * grid.Increment) * std::cos(0.7 * (grid.MinY + j * grid.Increment));
+
+    Contours c;
+    const double levels[] = { -0.75, -0.25, 0.3, 0.8 };
+    c.Extract(grid, levels, 4);
+
+    //Every segment is in exactly one line
+    size_t segments = 0;
+    bool bEnds = true;
+    const double maxX = grid.MinX + (count - 1) * grid.Increment;
+    const double maxY = grid.MinY + (count - 1) * grid.Increment;
+    auto OnBorder = [&](const glm::vec3& p) {
+        return std::abs(p.x - grid.MinX) < 1e-4 || std::abs(p.x - maxX) < 1e-4 || std::abs(p.y - grid.MinY) < 1e-4 || std::abs(p.y - maxY) < 1e-4;
+    };
+    for (const Polyline& line : c.Lines()) {
+        segments += line.Count - 1;
+        //There are no holes, so a line that is not closed goes from one side of the grid to another
+        const glm::vec3& first = c.Points()[line.Start];
+        const glm::vec3& last = c.Points()[line.Start + line.Count - 1];
+        if (first != last)
+            bEnds &= OnBorder(first) && OnBorder(last);
+    }
+    TEST(segments == c.mySegments.size() && bEnds);
+
+    //Segments counted one cell at a time. A saddle cell has two
+    size_t crossings = 0;
+    for (int32 j = 0; j + 1 < count; j++) {
+        for (int32 i = 0; i + 1 < count; i++) {
+            const double v[4] = { heights[j*count + i], heights[j*count + i+1], heights[(j+1)*count + i+1], heights[(j+1)*count + i] };
+            for (double level : levels) {
+                const int32 above = (v[0] >= level) + (v[1] >= level) + (v[2] >= level) + (v[3] >= level);
+                const bool bSaddle = above == 2 && (v[0] >= level) == (v[2] >= level);
+                crossings += bSaddle ? 2 : ((above > 0 && above < 4) ? 1 : 0);
+            }
+        }
+    }
+    TEST(crossings == segments);
+
+    #undef TEST
+    return bSuccess;
+}
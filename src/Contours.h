@@ -0,0 +1,85 @@
+#pragma once
+#include "DebugFinal.h"
+#include "Maths.h"
+#include <vector>
+
+class CommandList;
+
+//Level sets (isolines) of a grid of heights, found with marching squares. Every level is extracted in the same pass
+//over the grid, bands of rows in parallel on the thread pool. The pieces every cell gives are joined into polylines
+//through a hash table of the grid edges they end on. Re-extracting into the same object does not allocate once its
+//buffers are big enough
+class Contours {
+public:
+    //Heights[j * CountX + i] is the height at (MinX + i * Increment, MinY + j * Increment). Heights that are not a
+    //finite number are holes, no line goes through the cells around them
+    struct Grid {
+        const double* Heights;
+        int32 CountX;
+        int32 CountY;
+        double MinX;
+        double MinY;
+        double Increment;
+    };
+
+    //Points[Start, Start + Count), all at z = the height of the level. A closed line ends on its first point
+    struct Polyline {
+        uint32 Start;
+        uint32 Count;
+        int32 Level;        //Index into the levels that were extracted
+    };
+
+public:
+    Contours() = default;
+
+    //levels have to be sorted, lowest first
+    void Extract(const Grid& grid, const double* levels, int32 levelCount);
+    //The multiples of spacing between the lowest and the highest height, but never more than maxLevels of them
+    void ExtractSpaced(const Grid& grid, double spacing, int32 maxLevels = 64);
+    void Clear();
+
+    const std::vector<Polyline>& Lines() const      { return myLines; }
+    const std::vector<glm::vec3>& Points() const    { return myPoints; }
+    const std::vector<double>& Levels() const       { return myLevels; }
+
+    //offset is added to every point. Can be called from any thread
+    void Draw(CommandList& list, glm::vec3 offset, glm::vec4 col, float width, std::vector<glm::vec3>& scratch) const;
+
+    static bool RunAllTests();    //Returns true when all tests pass
+
+private:
+    //A piece of a line inside one cell. Each end is on a grid edge, Keys tell which edge and level (see EdgeKey)
+    struct Segment {
+        uint64 Keys[2];
+        glm::vec3 Ends[2];
+    };
+
+    //Up to two segments end on an edge, one from the cell on each side. Ends are segment * 2 + which end, -1 for none
+    struct Slot {
+        uint64 Key;
+        int32 Ends[2];
+    };
+    static constexpr uint64 EmptyKey = ~0ull;
+
+    void ExtractLevels(const Grid& grid);
+    void ExtractBand(const Grid& grid, int32 rowStart, int32 rowEnd, std::vector<Segment>& out) const;
+    void Stitch();
+    Slot& Find(uint64 key);
+    //The end of another segment that touches segment end e, or -1
+    int32 Neighbour(int32 e);
+
+    static bool RunTest_Shapes();
+    static bool RunTest_Bands();
+
+private:
+    std::vector<double> myLevels;
+    std::vector<std::vector<Segment>> myBands;
+    std::vector<Segment> mySegments;
+    std::vector<Slot> myTable;          //Open addressing, only the first myTableMask + 1 slots are used
+    uint64 myTableMask = 0;
+    std::vector<bool> myVisited;
+    std::vector<glm::vec3> myBackwards;
+
+    std::vector<Polyline> myLines;
+    std::vector<glm::vec3> myPoints;
+};
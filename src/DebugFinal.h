@@ -57,14 +57,14 @@ extern void stack_trace();
     #include <stdio.h>
     #include <assert.h>
 
+    #include "AsyncLog.h"
+
+    //Levels below LOG_LEVEL are compiled out. Everything else is queued and printed by the log thread (AsyncLog.h),
+    //errors and above wait till they are printed
     #define LogGeneric(strCol, level, ...) \
         do { \
-            if (level >= LOG_LEVEL) { \
-                /* printf("%s%s:%d ~ ", strCol, __FILE__, __LINE__); */ \
-                printf("%s%s(%d) ~ ", strCol, __FILE__, __LINE__); \
-                printf(__VA_ARGS__); \
-                printf("%s" LOG_ENDL, LOG_COL_RESET); \
-                fflush(stdout); \
+            if constexpr ((level) >= LOG_LEVEL) { \
+                AsyncLog::Push(AsyncLog::Site{ strCol, __FILE__, __LINE__, (level) >= LOG_LEVEL_ERROR }, __VA_ARGS__); \
             } \
         } while(0)
 
@@ -77,9 +77,8 @@ extern void stack_trace();
     
     #define LogL(level, ...) \
         do { \
-            if (level >= LOG_LEVEL) { \
-                printf(__VA_ARGS__); \
-                fflush(stdout); \
+            if constexpr ((level) >= LOG_LEVEL) { \
+                AsyncLog::Push(AsyncLog::Site{ nullptr, __FILE__, __LINE__, (level) >= LOG_LEVEL_ERROR }, __VA_ARGS__); \
             } \
         } while(0)
 
@@ -109,6 +108,7 @@ extern void stack_trace();
             if (!(x)) { \
                 LogError("*** Assert failed ***"); \
                 LogError("%s", #x); \
+                AsyncLog::Flush(); \
                 stack_trace(); \
                 ASSERT_IDE(); \
             } \
@@ -3,15 +3,18 @@
 #include "Camera.h"
 #include "RE_Renderer.h"
 #include "MathContext.h"
+#include "Profiler.h"
 
 extern void ResetViewport();
 extern void viewport(int x, int y, int w, int h);
 
 extern Camera* g_cam;
 extern Renderer* g_renderer;
-extern const char* g_strEqFile;
-extern MathParser::Context* g_ctx;
-extern bool g_updateGrapher;
+extern MathParser::ContextPublisher* g_equations;
+extern bool g_reloadEquations;
+extern double g_contourSpacing;
+extern glm::vec2 g_cursor;
+extern bool g_logPick;
 
 void SetCallbacks(GLFWwindow* window) {
     // glfwSetWindowUserPointer(window, this);
@@ -62,7 +65,9 @@ void MouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 	{
 		case GLFW_PRESS:
 		{
-			//Mouse down
+			//Mouse down. The main loop logs the point of the surface under the cursor
+            if (button == GLFW_MOUSE_BUTTON_LEFT)
+                g_logPick = true;
 			break;
 		}
 		case GLFW_RELEASE:
@@ -76,6 +81,7 @@ void MouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 void MousePositionCallback(GLFWwindow* window, double xpos, double ypos)
 {
 	// LogTrace("Mouse Move Event: %f, %f", xpos, ypos);
+    g_cursor = glm::vec2((float)xpos, (float)ypos);
 }
 
 void MouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset) {
@@ -101,21 +107,35 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
                     break;
                 }
 
+                case GLFW_KEY_L: {
+                    //Contour lines over the surfaces, picked up by the main loop
+                    g_contourSpacing = (g_contourSpacing > 0.0) ? 0.0 : 1.0;
+                    break;
+                }
+
                 case GLFW_KEY_M: {
                     g_renderer->PrintMetrics();
                     break;
                 }
 
                 case GLFW_KEY_R: {
-                    g_ctx->Clear();
-                    g_ctx->LoadFromFile(g_strEqFile);
-                    g_ctx->PrintProperties();
-                    g_updateGrapher = true;
+                    //Done by the main loop, which reads the file again on a worker
+                    g_reloadEquations = true;
                     break;
                 }
                 
                 case GLFW_KEY_P: {
-                    g_ctx->PrintProperties(true);
+                    g_equations->Pin()->PrintProperties(true);
+                    break;
+                }
+
+                case GLFW_KEY_F: {
+                    Profiler::PrintFrameBreakdown();
+                    break;
+                }
+
+                case GLFW_KEY_T: {
+                    Profiler::ExportChromeTrace("profile.json");
                     break;
                 }
 			}
@@ -0,0 +1,157 @@
+#include "FileWatcher.h"
+
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+
+#ifdef __linux__
+    #include <sys/inotify.h>
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <errno.h>
+#endif
+
+FileWatcher::~FileWatcher() {
+    Stop();
+}
+
+bool FileWatcher::Watch(const std::string& path, Mode mode) {
+    Stop();
+    myPath = path;
+
+    std::filesystem::path p(path);
+    myFileName = p.filename().string();
+    std::string dir = p.parent_path().string();
+    if (dir.empty())
+        dir = ".";
+
+    CheckStat();
+    myNextPoll = 0.0;
+    myPending = false;
+
+#ifdef __linux__
+    if (mode == Mode_Auto) {
+        //The directory is watched instead of the file, as saving by renaming a new file over it would end the watch
+        myInotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (myInotifyFd >= 0) {
+            myInotifyWatch = inotify_add_watch(myInotifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE);
+            if (myInotifyWatch < 0) {
+                LogWarn("inotify could not watch %s (%s), polling instead", dir.c_str(), strerror(errno));
+                close(myInotifyFd);
+                myInotifyFd = -1;
+            }
+        }
+    }
+#endif
+
+    return true;
+}
+
+void FileWatcher::Stop() {
+#ifdef __linux__
+    if (myInotifyFd >= 0) {
+        close(myInotifyFd);
+    }
+#endif
+    myInotifyFd = -1;
+    myInotifyWatch = -1;
+    myPending = false;
+}
+
+bool FileWatcher::Poll(double time) {
+    bool bChanged = false;
+    if (myInotifyFd >= 0) {
+        bChanged = ReadInotify();
+    }
+    else if (time >= myNextPoll) {
+        myNextPoll = time + PollSeconds;
+        bChanged = CheckStat();
+    }
+
+    if (bChanged) {
+        myPending = true;
+        myLastChange = time;
+    }
+
+    if (myPending && time - myLastChange >= DebounceSeconds) {
+        myPending = false;
+        return true;
+    }
+    return false;
+}
+
+bool FileWatcher::ReadInotify() {
+    bool bChanged = false;
+#ifdef __linux__
+    alignas(inotify_event) char buf[4096];
+    while (true) {
+        ssize_t len = read(myInotifyFd, buf, sizeof(buf));
+        if (len <= 0)
+            break;  //EAGAIN, nothing left
+
+        for (char* ptr = buf; ptr < buf + len; ) {
+            const inotify_event* ev = reinterpret_cast<const inotify_event*>(ptr);
+            //When the queue overflowed events were dropped, which could have been a save
+            if ((ev->mask & IN_Q_OVERFLOW) || (ev->len && myFileName == ev->name))
+                bChanged = true;
+            ptr += sizeof(inotify_event) + ev->len;
+        }
+    }
+#endif
+    return bChanged;
+}
+
+bool FileWatcher::CheckStat() {
+    std::error_code err;
+    int64 writeTime = 0;
+    int64 size = -1;
+
+    //Missing while an editor replaces it, which also counts as a change
+    std::filesystem::file_time_type t = std::filesystem::last_write_time(myPath, err);
+    if (!err) {
+        writeTime = (int64)t.time_since_epoch().count();
+        size = (int64)std::filesystem::file_size(myPath, err);
+        if (err)
+            size = -1;
+    }
+
+    bool bChanged = (writeTime != myWriteTime || size != mySize);
+    myWriteTime = writeTime;
+    mySize = size;
+    return bChanged;
+}
+
+bool FileWatcher::RunAllTests() {
+    bool bSuccess = true;
+    const std::string path = (std::filesystem::temp_directory_path() / "graphit_watch_test.txt").string();
+
+    for (Mode mode : { Mode_Auto, Mode_Poll }) {
+        { std::ofstream f(path); f << "a = 1\n"; }
+
+        FileWatcher w;
+        w.Watch(path, mode);
+        double t = 10.0;
+        bool bEarly = w.Poll(t);
+
+        //A burst of writes is reported once, after it has settled
+        { std::ofstream f(path); f << "a = 2\n"; }
+        t += PollSeconds;
+        bEarly |= w.Poll(t);
+        { std::ofstream f(path); f << "a = 23\n"; }
+        t += PollSeconds;
+        bEarly |= w.Poll(t);
+        t += DebounceSeconds;
+        bool bReported = w.Poll(t);
+        t += PollSeconds;
+        bool bAgain = w.Poll(t);
+
+        if (bEarly || !bReported || bAgain) {
+            LogError("FileWatcher test failed (%s). Early: %d, Reported: %d, Again: %d", mode == Mode_Auto ? "auto" : "poll", bEarly, bReported, bAgain);
+            bSuccess = false;
+        }
+    }
+
+    std::error_code err;
+    std::filesystem::remove(path, err);
+    return bSuccess;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "DebugFinal.h"
+#include <string>
+
+//Tells when a file changed on disk. Uses inotify on linux and compares the modification time and size everywhere
+//else. Editors tend to save with several writes, or write a temporary file and rename it over the original, so a
+//change is only reported once the file has been quiet for DebounceSeconds
+class FileWatcher {
+public:
+    enum Mode {
+        Mode_Auto,      //inotify where available, polling otherwise
+        Mode_Poll,
+    };
+
+    static constexpr double DebounceSeconds = 0.15;
+    //How often the file is checked when polling
+    static constexpr double PollSeconds = 0.25;
+
+public:
+    FileWatcher() = default;
+    ~FileWatcher();
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator= (const FileWatcher&) = delete;
+
+    bool Watch(const std::string& path, Mode mode = Mode_Auto);
+    void Stop();
+
+    //Call once per frame with the current time in seconds. Returns true once for every burst of changes
+    bool Poll(double time);
+
+    const std::string& Path() const { return myPath; }
+    bool UsesInotify() const        { return myInotifyFd >= 0; }
+
+    static bool RunAllTests();    //Returns true when all tests pass
+
+private:
+    bool ReadInotify();
+    bool CheckStat();
+
+private:
+    std::string myPath;
+    std::string myFileName;     //Events are for the whole directory, this picks ours
+
+    int32 myInotifyFd = -1;
+    int32 myInotifyWatch = -1;
+
+    //Polling
+    int64 myWriteTime = 0;
+    int64 mySize = -1;
+    double myNextPoll = 0.0;
+
+    bool myPending = false;     //Changed, but not reported yet
+    double myLastChange = 0.0;
+};
@@ -1,284 +1,503 @@
 #include "Grapher3D.h"
+#include "RE_CommandList.h"
+#include "Profiler.h"
+#include "AllocTracker.h"
+#include "ThreadPool.h"
 
-#if 0
-struct Cell {
-    uint8 Edges[4];
-    uint8 AltEdges[4];   //Usually always 0
-    bool Flag;          //When this flag is set, we need to calculate the midpoint of the box and choose whether to use edges or alt edges based on the center
-
-};
-
-static Cell mapCells[16] = {
-/* 00 */    { {}, {}, false },
-/* 01 */    { {2, 3}, {}, false },
-/* 02 */    { {3, 4}, {}, false },
-/* 03 */    { {2, 4}, {}, false },
-
-/* 04 */    { {1, 2}, {}, false },
-/* 05 */    { {1, 3}, {}, false },
-/* 06 */    { {1, 2, 3, 4}, {1, 4, 2, 3}, true },
-/* 07 */    { {1, 4}, {}, false },
-
-/* 08 */    { {1, 4}, {}, false },
-/* 09 */    { {1, 4, 2, 3}, {1, 2, 3, 4}, true },
-/* 10 */    { {1, 3}, {}, false },
-/* 11 */    { {1, 2}, {}, false },
-
-/* 12 */    { {2, 4}, {}, false },
-/* 13 */    { {3, 4}, {}, false },
-/* 14 */    { {2, 3}, {}, false },
-/* 15 */    { {}, {}, false },
-
-};
-
-void Grapher3D::Calculate(FuncType func) {
-    Assert(func);
-
-    int res = 4;    //resolution.. Divides the minor square into more tinier squares to sample from.. 
-    double l = g_gridMinorL - g_gridMinorInc;
-    double r = g_gridMinorR + g_gridMinorInc;
-    double t = g_gridMinorT + g_gridMinorInc;
-    double b = g_gridMinorB - g_gridMinorInc;
-
-    double inc = g_gridMinorInc / res;
-    int size = int( (r - l)/inc ) + 1;
-
-//Visualise points
-#if 0
-    for (double y = b; y <= t; y += inc) {
-        for (double x = l; x <= r; x += inc) {
-            float off = +0.05;
-            LineRenderer::DrawLine({x,y,0.0}, {x+off, y+off, 0.0}, 1, {1.0, 0.0, 0.0, 1.0});
-        }
-    }
-    // LogWarn("%f ~ %f", g_gridL, g_gridR);
-    LogWarn("size: %d", size);
-    return;
-#endif
+#include <thread>
+#include <algorithm>
 
-    myLines.clear();
-    myLines.reserve(1000);
+Grapher3D::~Grapher3D() {
+    //The worker might still be reading the equation
+    WaitRemesh();
+}
 
-    double* buff1 = new double[size];
-    double* buff2 = new double[size];
+void Grapher3D::Calculate(Renderer* r) {
+    if (!myEquation)
+        return;
 
-    double* pBufOld = buff1;
-    double* pBufCur = buff2;
-    
-    //Calculate the first row
-    {
-        int index = 0;
-        for (double x = l; x <= r; x += inc) {
-            pBufOld[index++] = func(x, b);
-        }
+    if (myEquation->IParamCount() < 3 ) {
+        CalculateExplicit(r);
+    }
+    else {
+        Assert("Unimplemented");
     }
 
-    //Iterate over row 2 onwards
-    for (double y = b+inc; y <= t; y += inc) {
-        pBufCur[0] = func(l, y);
-        int index = 1;
-        // LogWarn("00 (%.1f, %.1f): %.1f", l, y, pBufCur[0]);
-
-        for (double x = l+inc; x <= r; x += inc) {
-            Assert(index < size);
-            pBufCur[index] = func(x, y);
+    myMeshedRevision = myEquation->Revision();
+}
 
-            double cellVals[4] = { pBufOld[index-1], pBufOld[index], pBufCur[index], pBufCur[index-1] };
+void Grapher3D::CalculateExplicit(Renderer* r) {
+    Assert(myEquation);
+    //Whatever is running in the background was started for the old equation
+    WaitRemesh();
+    if (myJob)
+        myJob->Finished = false;
+
+    BuildProgram();
+    CalculateMesh(Settings(myTime), myMesh);
+    myOffset = glm::vec3(0.0f);
+}
 
-            uint8 iBL = (pBufOld[index-1] >= 0.0) ? 1 : 0; 
-            uint8 iBR = (pBufOld[index]   >= 0.0) ? 1 : 0; 
-            uint8 iTL = (pBufCur[index-1] >= 0.0) ? 1 : 0; 
-            uint8 iTR = (pBufCur[index]   >= 0.0) ? 1 : 0;
+void Grapher3D::BuildProgram() {
+    if (!myProgram)
+        myProgram = std::make_shared<MathParser::Program>();
+    if (myProgramRevision != myEquation->Revision()) {
+        myProgram->Build(*myEquation);
+        myProgramRevision = myEquation->Revision();
+    }
+    //Nothing else is running with the program, as the background re-mesh was waited for
+    myProgram->SetAccuracy(myAccuracy);
+}
 
-            //visualise the graph.. Point is coloured red/green whether it is < 0 or > 0. The region in between the two is the plot of the graph
-            #if 0
-            {
-                float off = 0.05;
-                glm::vec4 col1 = {1.0, 0.0, 0.0, 1.0};
-                glm::vec4 col2 = {0.0, 1.0, 0.0, 1.0};
-                LineRenderer::DrawLine({x,y,0.0}, {x+off, y+off, 0.0}, 2.5, 
-                    (iTR) ? col1 : col2);
-                continue;
-            }   
-            // LogWarn("%02d (%.1f, %.1f): %.1f", index, x, y, pBufCur[index]);
-            #endif
-
-            int code = ( iBL << 3 | iBR << 2 | iTL << 1 | iTR );
-            // LogWarn("%d", code);
-
-            //Process code
-            {
-                Assert(code < 16);
-                Cell* pc = &mapCells[code];
-                uint8* pEdges;
-                if (!pc->Flag)
-                    pEdges = pc->Edges;
-                else {
-                    bool b = func(x - inc/2, y - inc/2) >= 0.0;
-                    pEdges = b ? pc->AltEdges : pc->Edges; 
-                }
+void Grapher3D::EvaluateRow(const MeshSettings& settings, Mesh& mesh, int32 count, double* out) {
+    const double* x = mesh.SampleX.data();
+    const double* y = mesh.SampleY.data();
+    if (settings.Native) {
+        for (int32 i = 0; i < count; i++)
+            out[i] = settings.Native(x[i], y[i]);
+        return;
+    }
+    if (!settings.Prog->Valid()) {
+        for (int32 i = 0; i < count; i++)
+            out[i] = settings.Eq->Evaluate(x[i], y[i], 0.0, settings.Time);
+        return;
+    }
 
-                glm::vec2 positions[2];
-                for (int line = 0; line < 4; line += 2) {
-                    if (pEdges[line] == 0)
-                        break;
-                    for (int k = 0; k < 2; k++) {
-                        uint8 edge = pEdges[line+k];
-                        
-                        // {
-                        //     double targetX = 0.5;
-                        //     double targetY = 0.0;
-                        //     double givenX = x;
-                        //     double givenY = y;
-
-                        //     if (givenX < targetX+0.01 && givenX > targetX-0.01 && givenY < targetY+0.01 && givenY > targetY-0.01 || 0) {
-                        //         LogWarn("EDge: %d", edge);
-                        //     }
-
-                        // }
-
-                        switch(edge) {
-                            //Note x and y are positions of the top right coordinate of a cell
-                            case 1:
-                            {
-                                double p = Percent(cellVals[0], cellVals[1], 0.0);
-                                positions[k] = { x-inc + inc*p, y-inc };
-                                break;
-                            }
-                            case 3:
-                            {
-                                double p = Percent(cellVals[3], cellVals[2], 0.0);
-                                positions[k] = { x-inc + inc*p, y };
-                                break;
-                            }
-
-                            case 2:
-                            {
-                                double p = Percent(cellVals[1], cellVals[2], 0.0);
-                                positions[k] = { x, y-inc + inc*p };
-                                break;
-                            }
-                            
-                            case 4:
-                            {
-                                double p = Percent(cellVals[0], cellVals[3], 0.0);
-                                positions[k] = { x-inc, y-inc + inc*p };
-                                break;
-                            }
-                        }
-                        
-
-                    }
-
-                    // double targetX = 0.5;
-                    // double targetY = 0.0;
-                    // double givenX = positions[0].x;
-                    // double givenY = positions[0].y;
-
-                    // if (givenX < targetX+0.01 && givenX > targetX-0.01 && givenY < targetY+0.01 && givenY > targetY-0.01 || 1) {
-                    //     // LogWarn("Code: %d", code);
-                    //     // LogWarn("x: %f y: %f", x, y);
-                        
-                    // }
-
-                    myLines.push_back({ positions[0], positions[1] });
-                
-                }
-            }
+    switch (settings.Prec) {
+        case Precision_Double:  settings.Prog->Evaluate<double>(x, y, 0.0, settings.Time, out, count, mesh.Scratch);   break;
+        case Precision_Float:   settings.Prog->Evaluate<float>(x, y, 0.0, settings.Time, out, count, mesh.Scratch);    break;
+        case Precision_Mixed:   settings.Prog->EvaluateMixed(x, y, 0.0, settings.Time, out, count, mesh.Scratch);      break;
+    }
+}
 
-            index++;
-            
-        } //End of second for loop iterating over x
-        // LogWarn("");
+Grapher3D::SampleGrid Grapher3D::MakeGrid(double increment) {
+    //Todo: make the bounds more dynamic.. Maybe based on the 
+    const glm::vec2 boundX = { -10, 10 };
+    const glm::vec2 boundY = { -10, 10 };
 
-        //Swap the buffers
-        double* temp = pBufCur;
-        pBufCur = pBufOld;
-        pBufOld = temp;
+    double eps = 0.001;
+    SampleGrid grid;
+    grid.MinX = boundX[0];
+    grid.MinY = boundY[0];
+    grid.Increment = increment;
+    grid.CountX = (int32)((boundX[1] - boundX[0] + eps) / increment) + 1;
+    grid.CountY = (int32)((boundY[1] - boundY[0] + eps) / increment) + 1;
+    return grid;
+}
 
-        // break;  //Run only once for now
+void Grapher3D::BeginMesh(const SampleGrid& grid, Mesh& out) {
+    const int32 countX = grid.CountX;
+    const int32 countY = grid.CountY;
+
+    //Everything is sized up front, so that re-meshing at the same resolution does not allocate at all
+    const int32 rowCount = 2 * countX;
+    int32 rowTiles = 0;
+    int32 rowVertices = 0;
+    for (int32 start = 0; start + 2 < rowCount; start += 2 * TileQuads) {
+        rowTiles++;
+        rowVertices += Min(2 * (TileQuads + 1), rowCount - start);
     }
 
-    delete[] buff1;
-    delete[] buff2;
+    out.Strips.clear();
+    out.Positions.clear();
+    //Holes (see AddRow) split a row into more tiles, at most one for every three samples. Each tile has at least one
+    //pair fewer than the samples it skips, so the vertices never go beyond a row without holes plus a pair per tile
+    const int32 maxRowTiles = rowTiles + (countX + 1) / 3;
+    out.Strips.reserve((size_t)maxRowTiles * (countY - 1));
+    out.Positions.reserve((size_t)(rowVertices + 2 * maxRowTiles) * (countY - 1));
+    out.Row.resize(rowCount);
+    out.SampleX.resize(countX);
+    out.SampleY.resize(countX);
+    out.Grid = grid;
+    out.Heights.resize((size_t)countX * countY);
+    out.IsCurve = false;
+    out.Samples = countX * countY;
+}
 
+void Grapher3D::MeshRow(const SampleGrid& grid, int32 j, Mesh& out) {
+    const double* prev = out.Heights.data() + (size_t)(j - 1) * grid.CountX;
+    const double* cur = prev + grid.CountX;
+    const double prevY = grid.MinY + (j - 1) * grid.Increment;
+    const double y = grid.MinY + j * grid.Increment;
+    for (int32 i = 0; i < grid.CountX; i++) {
+        const double x = grid.MinX + i * grid.Increment;
+        out.Row[2*i + 0] = glm::vec3(x, prevY, prev[i]);
+        out.Row[2*i + 1] = glm::vec3(x, y, cur[i]);
+    }
+    AddRow(out, out.Row.data(), 2 * grid.CountX);
 }
-#endif
 
+void Grapher3D::ExtractContours(double spacing, Mesh& mesh) {
+    if (spacing <= 0.0) {
+        mesh.Lines.Clear();
+        return;
+    }
+    const SampleGrid& grid = mesh.Grid;
+    const Contours::Grid heights = { mesh.Heights.data(), grid.CountX, grid.CountY, grid.MinX, grid.MinY, grid.Increment };
+    mesh.Lines.ExtractSpaced(heights, spacing);
+}
 
-void Grapher3D::Calculate(Renderer* r) {
-    if (!myEquation)
+void Grapher3D::BuildMipmap(Mesh& mesh) {
+    const SampleGrid& grid = mesh.Grid;
+    mesh.Mipmap.Build({ mesh.Heights.data(), grid.CountX, grid.CountY, grid.MinX, grid.MinY, grid.Increment });
+}
+
+void Grapher3D::SetContourSpacing(double spacing) {
+    if (spacing == myContourSpacing)
         return;
+    myContourSpacing = spacing;
+    if (!myMesh.Heights.empty())
+        ExtractContours(spacing, myMesh);
+}
 
-    if (myEquation->IParamCount() < 3 ) {
-        CalculateExplicit(r);
-    }
-    else {
-        Assert("Unimplemented");
+void Grapher3D::CalculateMesh(const MeshSettings& settings, Mesh& out) {
+    if (settings.Eq->IParamCount() == 1)
+        CalculateCurve(settings, out);
+    else
+        CalculateExplicit(settings, out);
+}
+
+void Grapher3D::CalculateExplicit(const MeshSettings& settings, Mesh& out) {
+    PROFILE_ZONE("Meshing");
+    Assert(settings.Eq && settings.Prog);
+    const SampleGrid grid = MakeGrid(settings.Increment);
+    const int32 countX = grid.CountX;
+
+    BeginMesh(grid, out);
+    settings.Prog->Reserve(out.Scratch);
+    {
+        NO_ALLOC_SCOPE("Grapher3D::CalculateExplicit");
+
+        //Whole rows are evaluated at once
+        for (int32 i = 0; i < countX; i++) {
+            out.SampleX[i] = grid.MinX + i * grid.Increment;
+            out.SampleY[i] = grid.MinY;
+        }
+        EvaluateRow(settings, out, countX, out.Heights.data());
+        out.Time = settings.Time;
+        out.RefX = grid.MinX;
+        out.RefY = grid.MinY;
+        out.RefValue = out.Heights[0];
+
+        //Skip the first row as we already processed it above
+        for (int32 j = 1; j < grid.CountY; j++) {
+            const double y = grid.MinY + j * grid.Increment;
+            for (int32 i = 0; i < countX; i++)
+                out.SampleY[i] = y;
+            EvaluateRow(settings, out, countX, out.Heights.data() + (size_t)j * countX);
+            MeshRow(grid, j, out);
+        }
     }
+    //Outside of the scope, as bands of the contours can be handed to other threads
+    ExtractContours(settings.ContourSpacing, out);
+    BuildMipmap(out);
+}
 
+double Grapher3D::EvaluateCurve(const MeshSettings& settings, Mesh& mesh, double x) {
+    mesh.Samples++;
+    if (settings.Native)
+        return settings.Native(x, 0.0);
+    return settings.Eq->Evaluate(x, 0.0, 0.0, settings.Time);
 }
 
-void Grapher3D::CalculateExplicit(Renderer* r) {
+void Grapher3D::CalculateCurve(const MeshSettings& settings, Mesh& out) {
+    PROFILE_ZONE("Curve");
+    Assert(settings.Eq);
+    //The samples of a surface along x are where the curve starts from, every piece between them is split further
+    const SampleGrid grid = MakeGrid(settings.Increment);
+    out.IsCurve = true;
+    out.Samples = 0;
+    out.Strips.clear();
+    out.Positions.clear();
+    out.Heights.clear();
+    out.Lines.Clear();
+    out.Mipmap.Clear();
+
+    double a = grid.MinX;
+    double fa = EvaluateCurve(settings, out, a);
+    out.Positions.push_back(glm::vec3(a, 0.0, fa));
+    out.Time = settings.Time;
+    out.RefX = a;
+    out.RefY = 0.0;
+    out.RefValue = fa;
+    for (int32 i = 1; i < grid.CountX; i++) {
+        const double b = grid.MinX + i * grid.Increment;
+        const double fb = EvaluateCurve(settings, out, b);
+        SubdivideCurve(settings, out, a, fa, b, fb, 0);
+        a = b;
+        fa = fb;
+    }
 
-    myStrips.clear();
+    //Tiles are the runs of numbers between the breaks, cut into pieces
+    const uint32 count = (uint32)out.Positions.size();
+    for (uint32 start = 0; start < count; ) {
+        if (!std::isfinite(out.Positions[start].z)) {
+            start++;
+            continue;
+        }
+        uint32 end = start + 1;
+        while (end < count && std::isfinite(out.Positions[end].z) && end - start < TilePoints)
+            end++;
+        if (end - start >= 2) {
+            TriangleStrip piece;
+            piece.Start = start;
+            piece.Count = end - start;
+            piece.Bounds.Expand(&out.Positions[start], piece.Count);
+            out.Strips.push_back(piece);
+        }
+        //The next piece starts on the last point of this one, unless the curve broke there
+        start = (end < count && std::isfinite(out.Positions[end].z)) ? end - 1 : end;
+    }
+}
 
-    //Todo: make the bounds more dynamic.. Maybe based on the 
-    const glm::vec2 boundX = { -10, 10 };
-    const glm::vec2 boundY = { -10, 10 };
-    const double incY = 0.25;
-    const double incX = 0.25;
+void Grapher3D::SubdivideCurve(const MeshSettings& settings, Mesh& mesh, double a, double fa, double b, double fb, int32 depth) {
+    const double m = 0.5 * (a + b);
+    const double fm = EvaluateCurve(settings, mesh, m);
+    const bool bFinite = std::isfinite(fa) && std::isfinite(fm) && std::isfinite(fb);
+
+    if (bFinite) {
+        //Close enough to a straight line, and not bending much at the middle. The distance is at a right angle to the
+        //line, so steep parts are not split more than flat ones
+        const double dx = m - a;
+        const double distance = std::abs(fm - 0.5 * (fa + fb)) * 2.0 * dx / std::sqrt(4.0 * dx * dx + (fb - fa) * (fb - fa));
+        const double cosBend = (dx * dx + (fm - fa) * (fb - fm)) / std::sqrt((dx * dx + (fm - fa) * (fm - fa)) * (dx * dx + (fb - fm) * (fb - fm)));
+        const bool bOutside = (Min(Min(fa, fm), fb) > CurveClip) || (Max(Max(fa, fm), fb) < -CurveClip);
+        if (bOutside || (distance <= CurveTolerance && cosBend >= std::cos(glm::radians(CurveMaxBend)))) {
+            mesh.Positions.push_back(glm::vec3(b, 0.0, fb));
+            return;
+        }
+    }
+    else if (!std::isfinite(fa) && !std::isfinite(fb)) {
+        //Nothing to draw on either side. Whatever is in between is narrower than the samples of a surface
+        mesh.Positions.push_back(glm::vec3(b, 0.0, fb));
+        return;
+    }
 
-    std::vector<double> buffer1, buffer2;
-    std::vector<double> *pbPrev = &buffer1, *pbCur = &buffer2;
+    if (depth == CurveMaxDepth) {
+        //Still not straight this close up. A curve that is only steep splits the change between the two halves, while
+        //across a jump, like an asymptote of tan, one half has all of it. The curve breaks there
+        const double change = std::abs(fb - fa);
+        if (bFinite && Max(std::abs(fm - fa), std::abs(fb - fm)) > 0.9 * change && change > 100.0 * CurveTolerance)
+            mesh.Positions.push_back(glm::vec3(m, 0.0, NAN));
+        else if (std::isfinite(fa) != std::isfinite(fb))
+            mesh.Positions.push_back(glm::vec3(m, 0.0, fm));
+        mesh.Positions.push_back(glm::vec3(b, 0.0, fb));
+        return;
+    }
+    SubdivideCurve(settings, mesh, a, fa, m, fm, depth + 1);
+    SubdivideCurve(settings, mesh, m, fm, b, fb, depth + 1);
+}
 
-    double eps = 0.001;
-#if 0
-    for (double y = boundY[0]; y < boundY[1] + eps; y += incY) {
-        for (double x = boundX[0]; x < boundX[1] + eps; x += incX) {
-            r->DrawPoint( glm::vec3(x, y, 0.01f), glm::vec4(1.0, 0.0, 0.0, 1.0), 1);
+int32 Grapher3D::CalculateFused(std::vector<Grapher3D>& graphers, FuseCache& cache) {
+    //The first grapher that can be fused decides the grid and the precision
+    std::vector<Grapher3D*>& group = cache.Group;
+    std::vector<const MathParser::Equation*>& equations = cache.Equations;
+    group.clear();
+    equations.clear();
+    for (Grapher3D& g : graphers) {
+        if (!g.Outdated() || g.myNative || g.myEquation->IParamCount() != 2)
+            continue;
+        if (!group.empty()) {
+            const Grapher3D& first = *group[0];
+            if (g.myIncrement != first.myIncrement || g.myPrecision != first.myPrecision ||
+                g.myAccuracy != first.myAccuracy || g.myTime != first.myTime)
+                continue;
         }
+        group.push_back(&g);
+        equations.push_back(g.myEquation);
+    }
+    //A single surface has nothing to share
+    if (group.size() < 2)
+        return 0;
+
+    for (Grapher3D* g : group) {
+        g->WaitRemesh();
+        //Animate re-meshes with the grapher's own program, and it is what the fused one is compared with
+        g->BuildProgram();
     }
-    return;
-#endif
 
-    for (double x = boundX[0]; x < boundX[1] + eps; x += incX) {
-        const double y = boundY[0];
-        
-        // double z = func(x, y);
-        Assert(myEquation);
-        double z = myEquation->Evaluate(x, y);
+    //The program only changes with the equations. It is only worth a sweep that is not split up by surface when the
+    //surfaces really have something in common, which value numbering shows as fewer instructions
+    bool bSameEquations = cache.Revisions.size() == group.size();
+    for (size_t k = 0; k < group.size() && bSameEquations; k++)
+        bSameEquations = cache.Revisions[k] == group[k]->myEquation->Revision();
+    if (!bSameEquations) {
+        cache.Revisions.clear();
+        int32 separate = 0;
+        for (Grapher3D* g : group) {
+            cache.Revisions.push_back(g->myEquation->Revision());
+            separate += g->myProgram->Valid() ? g->myProgram->InstructionCount() : MathParser::Program::MaxInstructions;
+        }
+        cache.bShares = cache.Fused.Build(equations) && cache.Fused.InstructionCount() < separate;
+    }
+    if (!cache.bShares)
+        return 0;
+
+    PROFILE_ZONE("Meshing fused");
+    const Grapher3D& first = *group[0];
+    MathParser::Program& fused = cache.Fused;
+    fused.SetAccuracy(first.myAccuracy);
+    const SampleGrid grid = MakeGrid(first.myIncrement);
+    const int32 countX = grid.CountX;
+    const int32 surfaces = (int32)group.size();
+
+    for (Grapher3D* g : group) {
+        if (g->myJob)
+            g->myJob->Finished = false;
+        BeginMesh(grid, g->myMesh);
+    }
 
-        pbPrev->push_back(z);
+    //Bands of rows are evaluated in parallel, every band with its own buffers. Each writes a plane of countX samples
+    //for every surface, which goes straight into the rows of the heights
+    const int32 bandCount = Max(1, Min(grid.CountY / FusedBandRows, 4 * (ThreadPool::Global().ThreadCount() + 1)));
+    if ((int32)cache.Bands.size() < bandCount)
+        cache.Bands.resize(bandCount);
+    for (int32 b = 0; b < bandCount; b++) {
+        FuseBand& band = cache.Bands[b];
+        band.SampleX.resize(countX);
+        band.SampleY.resize(countX);
+        band.Planes.resize((size_t)surfaces * countX);
+        fused.Reserve(band.Scratch);
     }
 
-    //Skip the first row as we already processed it above
-    double prevY = boundY[0];
-    for (double y = boundY[0] + incY; y < boundY[1] + eps; y += incY) {
-        int i = 0;
-        TriangleStrip strip;
+    ThreadPool::Global().ParallelFor(bandCount, [&](int32 b) {
+        NO_ALLOC_SCOPE("Grapher3D::CalculateFused");
+        FuseBand& band = cache.Bands[b];
+        for (int32 i = 0; i < countX; i++)
+            band.SampleX[i] = grid.MinX + i * grid.Increment;
+        const int32 rowStart = (int32)((int64)grid.CountY * b / bandCount);
+        const int32 rowEnd = (int32)((int64)grid.CountY * (b + 1) / bandCount);
+        for (int32 j = rowStart; j < rowEnd; j++) {
+            std::fill(band.SampleY.begin(), band.SampleY.end(), grid.MinY + j * grid.Increment);
+            const double* x = band.SampleX.data();
+            const double* y = band.SampleY.data();
+            double* planes = band.Planes.data();
+            switch (first.myPrecision) {
+                case Precision_Double:  fused.Evaluate<double>(x, y, 0.0, first.myTime, planes, countX, band.Scratch);   break;
+                case Precision_Float:   fused.Evaluate<float>(x, y, 0.0, first.myTime, planes, countX, band.Scratch);    break;
+                case Precision_Mixed:   fused.EvaluateMixed(x, y, 0.0, first.myTime, planes, countX, band.Scratch);      break;
+            }
+            for (int32 k = 0; k < surfaces; k++)
+                std::copy(planes + (size_t)k * countX, planes + (size_t)(k + 1) * countX, group[k]->myMesh.Heights.begin() + (size_t)j * countX);
+        }
+    });
+
+    //Then every surface is meshed from its heights, in parallel as well
+    ThreadPool::Global().ParallelFor(surfaces, [&](int32 k) {
+        Grapher3D& g = *group[k];
+        Mesh& mesh = g.myMesh;
+        {
+            NO_ALLOC_SCOPE("Grapher3D::CalculateFused");
+            for (int32 j = 1; j < grid.CountY; j++)
+                MeshRow(grid, j, mesh);
+            mesh.Time = first.myTime;
+            mesh.RefX = grid.MinX;
+            mesh.RefY = grid.MinY;
+            mesh.RefValue = mesh.Heights[0];
+        }
+        //Outside of the scope, as bands of the contours can be handed to other threads
+        ExtractContours(g.myContourSpacing, mesh);
+        BuildMipmap(mesh);
+        g.myOffset = glm::vec3(0.0f);
+        g.myMeshedRevision = g.myEquation->Revision();
+    });
+    return surfaces;
+}
 
-        for (double x = boundX[0]; x < boundX[1] + eps; x += incX) {
-            // double z = func(x, y);
-            Assert(myEquation);
-            double z = myEquation->Evaluate(x, y);
+void Grapher3D::AddRow(Mesh& mesh, const glm::vec3* row, int32 count) {
+    //A row is a strip of (bottom, top) pairs. Neighbouring tiles share one pair, and every tile starts on a pair so
+    //the winding order never flips. A pair with a sample that is not a finite number (a domain error like sqrt(-1),
+    //or a result too large for a float) is a hole: the tile ends before it, and no triangle uses it
+    const int32 pairs = count / 2;
+    auto Finite = [row](int32 pair) { return std::isfinite(row[2*pair].z) && std::isfinite(row[2*pair + 1].z); };
+
+    int32 start = 0;
+    while (start < pairs) {
+        if (!Finite(start)) {
+            start++;
+            continue;
+        }
+        int32 end = start + 1;
+        while (end < pairs && end - start < TileQuads + 1 && Finite(end))
+            end++;
+
+        if (end - start >= 2) {
+            const int32 n = 2 * (end - start);
+            TriangleStrip strip;
+            strip.Start = (uint32)mesh.Positions.size();
+            strip.Count = (uint32)n;
+            strip.Bounds.Expand(row + 2*start, n);
+            mesh.Positions.insert(mesh.Positions.end(), row + 2*start, row + 2*start + n);
+            mesh.Strips.push_back(strip);
+        }
+        //A full tile shares its last pair with the next one
+        start = (end - start == TileQuads + 1) ? end - 1 : end;
+    }
+}
 
-            pbCur->push_back(z);
+AABB Grapher3D::TileBounds(int32 tile) const {
+    Assert(tile >= 0 && tile < TileCount());
+    AABB bounds = myMesh.Strips[tile].Bounds;
+    bounds.Min += myOffset;
+    bounds.Max += myOffset;
+    return bounds;
+}
 
-            Assert (i < pbPrev->size() && "Expected buffer size to match");
-            if (i < pbPrev->size()) {
-                double prevZ = pbPrev->at(i);
-                strip.Positions.emplace_back( x, prevY, prevZ );
-                strip.Positions.emplace_back( x, y, z );
-                i++;
-            }
+bool Grapher3D::Animate(double time) {
+    PROFILE_ZONE("Animate");
+    if (!Animated() || Outdated())
+        return false;
+
+    if (myEquation->TimeAdditive()) {
+        //z = f(x, y) + g(t), so the whole surface moves by g(t) - g(mesh time). The first sample tells how much
+        const double value = myEquation->Evaluate(myMesh.RefX, myMesh.RefY, 0.0, time);
+        const float offset = (float)(value - myMesh.RefValue);
+        if (std::isfinite(offset)) {
+            bool bMoved = offset != myOffset.z;
+            myOffset.z = offset;
+            return bMoved;
         }
-        myStrips.push_back(std::move(strip));
+        //The first sample is not a number, so g(t) cannot be told apart. Fall back to meshing
+    }
 
-        prevY = y;
-        std::swap(pbPrev, pbCur);
-        pbCur->clear();
+    bool bChanged = false;
+    if (myJob && !myJob->Running.load(std::memory_order_acquire) && myJob->Finished) {
+        //The old mesh goes back to the job, so its buffers get reused for the next one
+        std::swap(myMesh, myJob->Result);
+        myJob->Finished = false;
+        myOffset = glm::vec3(0.0f);
+        bChanged = true;
     }
+
+    //Only one re-mesh per grapher is in flight. If meshing is slower than the frame rate, frames keep showing the
+    //newest mesh instead of queueing up work
+    if (!myJob || !myJob->Running.load(std::memory_order_acquire))
+        StartRemesh(time);
+    return bChanged;
+}
+
+void Grapher3D::StartRemesh(double time) {
+    if (!myJob)
+        myJob = std::make_shared<RemeshJob>();
+    myJob->Running.store(true, std::memory_order_relaxed);
+
+    //The job keeps its own references, as the grapher can be moved while it runs
+    std::shared_ptr<RemeshJob> job = myJob;
+    std::shared_ptr<const MathParser::Program> program = myProgram;
+    MathParser::ContextSnapshot snapshot = mySnapshot;
+    const MeshSettings settings = Settings(time);
+    ThreadPool::Global().Enqueue([job, program, snapshot, settings]() {
+        CalculateMesh(settings, job->Result);
+        job->Finished = true;
+        job->Running.store(false, std::memory_order_release);
+    });
+}
+
+void Grapher3D::WaitRemesh() {
+    if (!myJob)
+        return;
+    while (myJob->Running.load(std::memory_order_acquire))
+        std::this_thread::yield();
 }
 
 void Grapher3D::CalculateImplicit(FuncImplicitType func) {
@@ -293,12 +512,319 @@ void Grapher3D::Draw(Renderer* r) {
         r->PushPolygonState(RE_POLYGON_LINE);
 
     r->PushDepthState(RE_DEPTH_LESS);
-    for (const TriangleStrip& strip : myStrips) {
-        r->DrawTriangleStrip(strip.Positions.data(), strip.Positions.size(), col);
+    for (const TriangleStrip& strip : myMesh.Strips) {
+        const glm::vec3* pos = &myMesh.Positions[strip.Start];
+        if (myOffset != glm::vec3(0.0f)) {
+            myDrawScratch.resize(strip.Count);
+            for (uint32 i = 0; i < strip.Count; i++)
+                myDrawScratch[i] = pos[i] + myOffset;
+            pos = myDrawScratch.data();
+        }
+        if (myMesh.IsCurve)
+            r->DrawLineStrip(pos, strip.Count, col, CurveWidth);
+        else
+            r->DrawTriangleStrip(pos, strip.Count, col);
     }
     r->PopDepthState();
 
     if (bWireframe)
         r->PopPolygonState();
 
-}
\ No newline at end of file
+}
+void Grapher3D::Draw(CommandList& list) {
+    glm::vec4 col = {0.75, 0.75, 0.75, 1.0};
+
+    bool bWireframe = 0;
+    if (bWireframe)
+        list.PushPolygonState(RE_POLYGON_LINE);
+
+    list.PushDepthState(RE_DEPTH_LESS);
+    list.SetTriOffset(myOffset);
+    for (uint32 tile = 0; tile < myMesh.Strips.size(); tile++) {
+        const TriangleStrip& strip = myMesh.Strips[tile];
+        if (myMesh.IsCurve)
+            DrawCurve(list, tile, col);
+        else
+            list.DrawTriangleStrip(&myMesh.Positions[strip.Start], strip.Count, col);
+    }
+    list.SetTriOffset(glm::vec3(0.0f));
+    DrawContours(list);
+    list.PopDepthState();
+
+    if (bWireframe)
+        list.PopPolygonState();
+}
+
+void Grapher3D::DrawCurve(CommandList& list, uint32 tile, glm::vec4 col) {
+    //Lines are not moved by the list like triangles are
+    const TriangleStrip& strip = myMesh.Strips[tile];
+    myDrawScratch.resize(strip.Count);
+    for (uint32 i = 0; i < strip.Count; i++)
+        myDrawScratch[i] = myMesh.Positions[strip.Start + i] + myOffset;
+    list.DrawLineStrip(myDrawScratch.data(), (int32)strip.Count, col, CurveWidth);
+}
+
+void Grapher3D::DrawContours(CommandList& list) {
+    //Lifted a little, as the triangles of a cell are not exactly where the lines through it are
+    const glm::vec3 lift = glm::vec3(0.0f, 0.0f, 0.02f);
+    const glm::vec4 col = {0.2, 0.2, 0.2, 1.0};
+    myMesh.Lines.Draw(list, myOffset + lift, col, 1.5f, myDrawScratch);
+}
+
+double Grapher3D::SurfaceAt(double x, double y) const {
+    return myNative ? myNative(x, y) : myEquation->Evaluate(x, y, 0.0, myMesh.Time);
+}
+
+bool Grapher3D::Pick(const Ray& ray, PickHit& out) const {
+    PROFILE_ZONE("Pick");
+    if (!myEquation || myMesh.Mipmap.Empty())
+        return false;
+
+    //The mesh is drawn moved by the offset, so the ray is moved back instead
+    const glm::dvec3 origin = glm::dvec3(ray.Origin - myOffset);
+    const glm::dvec3 dir = glm::dvec3(ray.Dir);
+    auto Above = [&](double t) {
+        const glm::dvec3 p = origin + t * dir;
+        return p.z - SurfaceAt(p.x, p.y);
+    };
+
+    //Steps through the cell till the ray goes from one side of the surface to the other, then Newton's method on the
+    //distance above it. Steps that leave what is known to be around the crossing are bisections instead
+    auto Cell = [&](int32, int32, double t0, double t1) -> double {
+        double lo = t0, fLo = Above(t0);
+        for (int32 s = 1; s <= PickSteps; s++) {
+            double hi = t0 + (t1 - t0) * s / PickSteps;
+            const double fHi = Above(hi);
+            if (!std::isfinite(fLo) || !std::isfinite(fHi) || (fLo > 0.0) == (fHi > 0.0)) {
+                lo = hi;
+                fLo = fHi;
+                continue;
+            }
+
+            double t = lo - fLo * (hi - lo) / (fHi - fLo);
+            for (int32 k = 0; k < PickIterations; k++) {
+                const double f = Above(t);
+                if (f == 0.0)
+                    break;
+                if (std::isfinite(f) && (f > 0.0) == (fLo > 0.0)) {
+                    lo = t;
+                    fLo = f;
+                }
+                else {
+                    hi = t;
+                }
+                const double h = 1e-7 * Max(1.0, std::abs(t));
+                double next = t - f * h / (Above(t + h) - f);
+                if (!(next > lo && next < hi))
+                    next = 0.5 * (lo + hi);
+                const bool bDone = std::abs(next - t) <= 1e-12 * Max(1.0, std::abs(t));
+                t = next;
+                if (bDone)
+                    break;
+            }
+            return t;
+        }
+        return -1.0;
+    };
+
+    const double t = myMesh.Mipmap.Trace(origin, dir, Cell);
+    if (t < 0.0)
+        return false;
+
+    const glm::dvec3 p = origin + t * dir;
+    const double hx = 1e-6 * Max(1.0, std::abs(p.x));
+    const double hy = 1e-6 * Max(1.0, std::abs(p.y));
+    out.T = t;
+    out.Position = glm::dvec3(p.x, p.y, SurfaceAt(p.x, p.y)) + glm::dvec3(myOffset);
+    out.Gradient.x = (SurfaceAt(p.x + hx, p.y) - SurfaceAt(p.x - hx, p.y)) / (2.0 * hx);
+    out.Gradient.y = (SurfaceAt(p.x, p.y + hy) - SurfaceAt(p.x, p.y - hy)) / (2.0 * hy);
+    return true;
+}
+
+void Grapher3D::Draw(CommandList& list, const std::vector<uint32>& tiles) {
+    PROFILE_ZONE("Record");
+    glm::vec4 col = {0.75, 0.75, 0.75, 1.0};
+
+    list.PushDepthState(RE_DEPTH_LESS);
+    list.SetTriOffset(myOffset);
+    for (uint32 tile : tiles) {
+        Assert(tile < myMesh.Strips.size());
+        const TriangleStrip& strip = myMesh.Strips[tile];
+        if (myMesh.IsCurve)
+            DrawCurve(list, tile, col);
+        else
+            list.DrawTriangleStrip(&myMesh.Positions[strip.Start], strip.Count, col);
+    }
+    list.SetTriOffset(glm::vec3(0.0f));
+    //The lines are not split into tiles, they are drawn whenever any of the surface is
+    if (!tiles.empty())
+        DrawContours(list);
+    list.PopDepthState();
+}
+
+bool Grapher3D::RunAllTests() {
+    bool bSuccess = true;
+    #define TEST(x) \
+        if (!(x)) { \
+            LogError("Grapher3D test failed: %s", #x); \
+            bSuccess = false; \
+        }
+
+    MathParser::Context ctx;
+    ctx.Reload({ "full = x + y", "half = sqrt(x) + y / 4", "pole = 1 / x + y / 4", "wave = sin(x)", "steep = tan(x)", "root = sqrt(x)", "bumps = sin(x) * cos(y)", "ridge = cos(y)" });
+
+    Grapher3D g;
+    g.SetPrecision(Precision_Double);
+    g.SetEquation(ctx.FindEquation("full"));
+    g.CalculateExplicit(nullptr);
+    const int32 fullTiles = g.TileCount();
+    TEST(fullTiles > 0);
+
+    //sqrt of a negative x is a hole, so only the half with x >= 0 gets triangles
+    g.SetEquation(ctx.FindEquation("half"));
+    g.CalculateExplicit(nullptr);
+    bool bInside = true;
+    for (const glm::vec3& v : g.myMesh.Positions)
+        bInside &= std::isfinite(v.z) && v.x >= 0.0f;
+    TEST(g.TileCount() > 0 && g.TileCount() < fullTiles && bInside);
+
+    //x = 0 is a sample, which splits every row in two around it
+    g.SetEquation(ctx.FindEquation("pole"));
+    g.CalculateExplicit(nullptr);
+    bool bLeft = false, bRight = false;
+    bInside = true;
+    for (const glm::vec3& v : g.myMesh.Positions) {
+        bInside &= std::isfinite(v.z) && v.x != 0.0f;
+        bLeft |= v.x < 0.0f;
+        bRight |= v.x > 0.0f;
+    }
+    TEST(bInside && bLeft && bRight);
+    bool bSplit = true;
+    for (int32 tile = 0; tile < g.TileCount(); tile++) {
+        const AABB bounds = g.TileBounds(tile);
+        bSplit &= bounds.Min.x > 0.0f || bounds.Max.x < 0.0f;
+    }
+    TEST(bSplit);
+
+    //Contours come from the heights that were meshed. x + y is at -20 to 20, every level is a straight line
+    g.SetEquation(ctx.FindEquation("full"));
+    g.CalculateExplicit(nullptr);
+    g.SetContourSpacing(1.0);
+    const Contours& contours = g.GetContours();
+    bool bStraight = true;
+    for (const glm::vec3& p : contours.Points())
+        bStraight &= std::abs(p.x + p.y - p.z) < 1e-4f;
+    TEST(contours.Levels().size() == 41 && contours.Lines().size() == 40 && bStraight);
+    g.SetContourSpacing(0.0);
+    TEST(contours.Lines().empty());
+
+    //Equations of only x are curves. Between any two points the curve is within the tolerance of the line joining them,
+    //with far fewer samples than a surface
+    auto Curve = [&g, &ctx](const char* name) {
+        g.SetEquation(ctx.FindEquation(name));
+        g.Calculate(nullptr);
+        return g.IsCurve() && g.TileCount() > 0;
+    };
+    TEST(Curve("wave"));
+    const int32 surfaceSamples = 81 * 81;
+    bool bClose = true;
+    for (int32 tile = 0; tile < g.TileCount(); tile++) {
+        const TriangleStrip& piece = g.myMesh.Strips[tile];
+        for (uint32 k = piece.Start; k + 1 < piece.Start + piece.Count; k++) {
+            const glm::vec3 p0 = g.myMesh.Positions[k], p1 = g.myMesh.Positions[k + 1];
+            bClose &= std::abs(std::sin(0.5 * (p0.x + p1.x)) - 0.5 * (p0.z + p1.z)) < 4.0 * CurveTolerance;
+        }
+    }
+    TEST(bClose && g.SampleCount() < surfaceSamples / 8);
+
+    //tan breaks at each of the 6 asymptotes between -10 and 10, instead of joining +inf to -inf
+    TEST(Curve("steep"));
+    int32 runs = 0;
+    bool bJoined = false;
+    for (int32 tile = 0; tile < g.TileCount(); tile++) {
+        const TriangleStrip& piece = g.myMesh.Strips[tile];
+        runs += (tile == 0 || g.myMesh.Strips[tile - 1].Start + g.myMesh.Strips[tile - 1].Count - 1 != piece.Start) ? 1 : 0;
+        for (uint32 k = piece.Start; k + 1 < piece.Start + piece.Count; k++) {
+            const double asymptote = glm::pi<double>() * (std::floor(g.myMesh.Positions[k].x / glm::pi<double>() - 0.5) + 1.5);
+            bJoined |= g.myMesh.Positions[k + 1].x > asymptote;
+        }
+    }
+    TEST(runs == 7 && !bJoined);
+
+    //sqrt starts right at 0, not at the next sample of a surface
+    TEST(Curve("root"));
+    const glm::vec3 first = g.myMesh.Positions[g.myMesh.Strips[0].Start];
+    TEST(first.x >= 0.0f && first.x < 0.01f && g.SampleCount() < surfaceSamples / 8);
+
+    //Curves have no surface to pick
+    PickHit hit;
+    TEST(!g.Pick({ glm::vec3(1.0f, 0.0f, 5.0f), glm::vec3(0.0f, 0.0f, -1.0f) }, hit));
+
+    //The hit is on the ray and on the surface, and x + y slopes by 1 both ways
+    g.SetEquation(ctx.FindEquation("full"));
+    g.Calculate(nullptr);
+    const Ray slanted = { glm::vec3(3.0f, -2.0f, 12.0f), glm::normalize(glm::vec3(-0.4f, 0.3f, -1.0f)) };
+    TEST(g.Pick(slanted, hit));
+    const glm::dvec3 along = glm::dvec3(slanted.Origin) + hit.T * glm::dvec3(slanted.Dir);
+    TEST(glm::length(along - hit.Position) < 1e-6 && std::abs(hit.Position.x + hit.Position.y - hit.Position.z) < 1e-9);
+    TEST(std::abs(hit.Gradient.x - 1.0) < 1e-6 && std::abs(hit.Gradient.y - 1.0) < 1e-6);
+    TEST(!g.Pick({ glm::vec3(0.0f, 0.0f, 30.0f), glm::vec3(0.0f, 0.0f, 1.0f) }, hit));
+
+    //A grazing ray over bumps finds the first crossing, the same one as marching along it in small steps
+    g.SetEquation(ctx.FindEquation("bumps"));
+    g.Calculate(nullptr);
+    bool bFirst = true;
+    int32 picked = 0;
+    for (int32 r = 0; r < 20; r++) {
+        const Ray grazing = { glm::vec3(-12.0f, -9.0f + r, 2.0f), glm::normalize(glm::vec3(1.0f, 0.05f * r, -0.15f)) };
+        double marched = -1.0;
+        for (double t = 0.0; t < 40.0 && marched < 0.0; t += 1e-3) {
+            const glm::dvec3 p = glm::dvec3(grazing.Origin) + t * glm::dvec3(grazing.Dir);
+            if (std::abs(p.x) <= 10.0 && std::abs(p.y) <= 10.0 && p.z <= std::sin(p.x) * std::cos(p.y))
+                marched = t;
+        }
+        const bool bHit = g.Pick(grazing, hit);
+        bFirst &= bHit == (marched >= 0.0) && (!bHit || std::abs(hit.T - marched) < 2e-3);
+        picked += bHit;
+    }
+    TEST(bFirst && picked > 10);
+
+    //Meshed together, in one program, the meshes are the same as one at a time
+    std::vector<Grapher3D> graphers(3);
+    const char* names[] = { "full", "half", "pole" };
+    for (int32 i = 0; i < 3; i++) {
+        graphers[i].SetEquation(ctx.FindEquation(names[i]));
+        graphers[i].SetPrecision(Precision_Double);
+        graphers[i].SetContourSpacing(0.5);
+    }
+    g.SetContourSpacing(0.5);
+    FuseCache cache;
+    TEST(CalculateFused(graphers, cache) == 3);
+    for (int32 i = 0; i < 3; i++) {
+        g.SetEquation(ctx.FindEquation(names[i]));
+        g.CalculateExplicit(nullptr);
+        const Mesh& fused = graphers[i].myMesh;
+        TEST(!graphers[i].Outdated() && fused.Strips.size() == g.myMesh.Strips.size() && fused.Positions == g.myMesh.Positions);
+        TEST(fused.Lines.Points() == g.myMesh.Lines.Points() && !fused.Lines.Points().empty());
+    }
+    //Again with the same equations reuses the program and the buffers, so it allocates no more than meshing them one
+    //at a time, where only the jobs of the thread pool do
+    for (Grapher3D& fg : graphers)
+        fg.SetResolution(fg.myIncrement);
+    const uint64 fusedStart = AllocTracker::Total().Allocs;
+    TEST(CalculateFused(graphers, cache) == 3);
+    const uint64 fusedAllocs = AllocTracker::Total().Allocs - fusedStart;
+    const uint64 separateStart = AllocTracker::Total().Allocs;
+    for (Grapher3D& fg : graphers)
+        fg.CalculateExplicit(nullptr);
+    TEST(fusedAllocs <= AllocTracker::Total().Allocs - separateStart);
+
+    //Nothing in common, which is not worth a sweep for both
+    graphers.resize(2);
+    graphers[0].SetEquation(ctx.FindEquation("steep"));
+    graphers[1].SetEquation(ctx.FindEquation("ridge"));
+    TEST(CalculateFused(graphers, cache) == 0 && graphers[0].Outdated() && graphers[1].Outdated());
+
+    #undef TEST
+    return bSuccess;
+}
@@ -2,14 +2,35 @@
 #include "DebugFinal.h"
 #include "Maths.h"
 #include <vector>
+#include <memory>
+#include <atomic>
 #include "RE_Renderer.h"
 #include "MathContext.h"
+#include "MathProgram.h"
+#include "Bounds.h"
+#include "Contours.h"
+#include "HeightMipmap.h"
+
+class CommandList;
 
 //Marching squares
 class Grapher3D {
 public:
     Grapher3D() = default;
-    Grapher3D(const Grapher3D&) = default;
+    ~Grapher3D();
+    //A re-mesh running in the background owns a copy of the buffers, so graphers can only be moved
+    Grapher3D(const Grapher3D&) = delete;
+    Grapher3D(Grapher3D&&) = default;
+    Grapher3D& operator= (const Grapher3D&) = delete;
+    Grapher3D& operator= (Grapher3D&&) = default;
+
+    //What the surface is calculated in. Float is twice as wide per instruction, and plenty for what ends up in a
+    //glm::vec3. Mixed redoes the samples that lose too much in float in double (see Program::EvaluateMixed)
+    enum Precision {
+        Precision_Double,
+        Precision_Float,
+        Precision_Mixed,
+    };
 
     using FuncExplicitType = double(*)(double x, double y);
     using FuncImplicitType = double(*)(double x, double y, double z);
@@ -22,16 +43,211 @@ public:
     void CalculateImplicit(FuncImplicitType func);
 
     void Draw(Renderer* r);
+    void Draw(CommandList& list);   //Can be called from any thread
+    //Only draws the given tiles (see TileBVH). Can be called from any thread
+    void Draw(CommandList& list, const std::vector<uint32>& tiles);
+
+    int32 TileCount() const                         { return (int32)myMesh.Strips.size(); }
+    //Equations of only x are drawn as the curve z = f(x) along y = 0, sampled more finely where it bends (see
+    //CalculateCurve). Its tiles are pieces of the curve
+    bool IsCurve() const                            { return myMesh.IsCurve; }
+    //How often the equation was evaluated for the current mesh
+    int32 SampleCount() const                       { return myMesh.Samples; }
+    AABB TileBounds(int32 tile) const;
 
-    void SetEquation(MathParser::Equation* eq) { myEquation = eq; }
+    //snapshot keeps the context of eq alive for as long as the grapher, or a re-mesh in the background, uses it
+    void SetEquation(const MathParser::Equation* eq, MathParser::ContextSnapshot snapshot = nullptr) { myEquation = eq; mySnapshot = std::move(snapshot); }
+    const MathParser::Equation* GetEquation() const { return myEquation; }
+    //Distance between two samples along x and y
+    void SetResolution(double increment)       { Assert(increment > 0.0); myIncrement = increment; myMeshedRevision = 0; }
+    void SetPrecision(Precision precision)     { myPrecision = precision; myMeshedRevision = 0; }
+    Precision GetPrecision() const             { return myPrecision; }
+    //Approximate sin, cos, tan, exp and ^ (see MathKernels.h). Equations the program can't hold always use the C library
+    void SetAccuracy(MathParser::Accuracy acc) { myAccuracy = acc; myMeshedRevision = 0; }
+    MathParser::Accuracy GetAccuracy() const   { return myAccuracy; }
+    //A compiled function of the equation (see NativeLibrary), used instead of the program. Always double.
+    //nullptr goes back to the program
+    void SetNative(FuncExplicitType func)      { if (func != myNative) { myNative = func; myMeshedRevision = 0; } }
+
+    //True when the mesh was not calculated for the current equation (see Equation::Revision). Revisions are unique
+    //across contexts, so an equation that was kept by a reload keeps its mesh
+    bool Outdated() const { return myEquation && myEquation->Revision() != myMeshedRevision; }
+
+    //Lines where the surface is at a multiple of spacing, drawn over it. 0 turns them off. They come from the heights
+    //of the mesh, so changing the spacing does not mesh again
+    void SetContourSpacing(double spacing);
+    double GetContourSpacing() const          { return myContourSpacing; }
+    const Contours& GetContours() const       { return myMesh.Lines; }
+
+    //Where a ray first hits the surface. T is the distance along the ray, Gradient is (df/dx, df/dy) there
+    struct PickHit {
+        double T;
+        glm::dvec3 Position;
+        glm::dvec2 Gradient;
+    };
+    //The mipmap of the meshed heights finds the cell that is hit, the equation is solved in it for where exactly.
+    //False for misses and curves. Call on the render thread, as Animate replaces the mesh
+    bool Pick(const Ray& ray, PickHit& out) const;
+
+    //The value of t that Calculate uses
+    void SetTime(double time)                  { myTime = time; }
+    //True when the surface changes with t (see Equation::UsesTime)
+    bool Animated() const                      { return myEquation && myEquation->UsesTime(); }
+    //Called once a frame on the render thread, never blocks. Surfaces where t is only added on are moved as a whole.
+    //Everything else is meshed again on a worker thread, one mesh at a time, and the newest finished mesh is shown.
+    //Returns true when the tile bounds changed
+    bool Animate(double time);
+    //Blocks till the background re-mesh has finished. The equations must not change while one is running
+    void WaitRemesh();
+
+    //Buffers of one band of rows of CalculateFused
+    struct FuseBand {
+        std::vector<double> SampleX;
+        std::vector<double> SampleY;
+        std::vector<double> Planes;     //A row of every surface
+        MathParser::Program::Scratch Scratch;
+    };
+    //Kept by the caller of CalculateFused from one call to the next, so that meshing the same equations again, at any
+    //resolution or time, does not allocate. Only used by one call at a time
+    struct FuseCache {
+        MathParser::Program Fused;
+        std::vector<uint32> Revisions;  //Of the equations Fused was built for
+        bool bShares = false;           //Fused has fewer instructions than the programs of the equations together
+        std::vector<Grapher3D*> Group;
+        std::vector<const MathParser::Equation*> Equations;
+        std::vector<FuseBand> Bands;
+    };
+
+    //Meshes the outdated graphers with one program for all their equations (see Program::Build), when that program
+    //is shorter than theirs together: helpers they share are calculated once per sample. Bands of rows of every
+    //surface are evaluated in parallel, then the surfaces are meshed in parallel. Graphers with a native function, or
+    //another resolution, precision, accuracy or time than the first one are left outdated. Returns how many were
+    //meshed, 0 when there was nothing to share
+    static int32 CalculateFused(std::vector<Grapher3D>& graphers, FuseCache& cache);
+
+    static bool RunAllTests();    //Returns true when all tests pass
 
 private:
+    //Each row of the surface is split into tiles of this many quads so that they can be culled individually
+    static constexpr int32 TileQuads = 8;
+    //Pieces of a curve have at most this many points. Neighbouring pieces share one
+    static constexpr int32 TilePoints = 64;
+    //A curve piece is split in two till its middle is within this of the line between its ends, and it bends less
+    //than the angle. Pieces are never split more than this many times, or when they are far above or below the grid
+    static constexpr double CurveTolerance = 5e-3;
+    static constexpr double CurveMaxBend = 5.0;     //Degrees
+    static constexpr int32 CurveMaxDepth = 10;
+    static constexpr double CurveClip = 100.0;
+    static constexpr float CurveWidth = 2.0f;
+    //A band of CalculateFused has at least this many rows, fewer are not worth a job
+    static constexpr int32 FusedBandRows = 32;
+    //A cell is stepped through in this many pieces to find where the ray crosses the surface, which is then refined
+    static constexpr int32 PickSteps = 4;
+    static constexpr int32 PickIterations = 32;
+
+    //A tile of the surface. The vertices are Positions[Start, Start + Count)
     struct TriangleStrip {
+        uint32 Start;
+        uint32 Count;
+        AABB Bounds;
+    };
+
+    //Where the samples of a mesh are
+    struct SampleGrid {
+        double MinX;
+        double MinY;
+        double Increment;
+        int32 CountX;
+        int32 CountY;
+    };
+
+    struct Mesh {
+        std::vector<TriangleStrip> Strips;
         std::vector<glm::vec3> Positions;
+        SampleGrid Grid;
+        std::vector<double> Heights;    //Every sample, a row at a time
+        Contours Lines;
+        HeightMipmap Mipmap;            //Of the heights, for Pick
+        bool IsCurve = false;           //Positions is a line, with NaN points where it breaks
+        int32 Samples = 0;
+
+        //Scratch buffers for meshing. They are kept so that re-meshing does not allocate
+        std::vector<glm::vec3> Row;
+        std::vector<double> SampleX;
+        std::vector<double> SampleY;
+        MathParser::Program::Scratch Scratch;
+
+        double Time = 0.0;          //Value of t the mesh was calculated for
+        double RefX = 0.0;          //The first sample, see Animate
+        double RefY = 0.0;
+        double RefValue = 0.0;
     };
 
-    std::vector<TriangleStrip> myStrips;
+    //Owned together by the grapher and the worker that fills it in
+    struct RemeshJob {
+        std::atomic<bool> Running{ false };
+        bool Finished = false;      //Mesh holds a result that was not shown yet
+        Mesh Result;
+    };
+
+    //How a mesh gets calculated. Only read while meshing, so several meshes can be calculated at once
+    struct MeshSettings {
+        const MathParser::Equation* Eq;
+        const MathParser::Program* Prog;    //Evaluates one sample at a time when this is not valid
+        FuncExplicitType Native;            //Used instead of Prog when set
+        Precision Prec;
+        double Increment;
+        double Time;
+        double ContourSpacing;
+    };
+
+    static SampleGrid MakeGrid(double increment);
+    //Clears out and sizes its buffers for the grid
+    static void BeginMesh(const SampleGrid& grid, Mesh& out);
+    //Adds the quads between sample rows j - 1 and j, which have to be in out.Heights already
+    static void MeshRow(const SampleGrid& grid, int32 j, Mesh& out);
+
+    void BuildProgram();
+    //Meshes a surface, or samples a curve for equations of only x
+    static void CalculateMesh(const MeshSettings& settings, Mesh& out);
+    static void CalculateExplicit(const MeshSettings& settings, Mesh& out);
+    static void CalculateCurve(const MeshSettings& settings, Mesh& out);
+    static double EvaluateCurve(const MeshSettings& settings, Mesh& mesh, double x);
+    //Adds the points after a, up to b
+    static void SubdivideCurve(const MeshSettings& settings, Mesh& mesh, double a, double fa, double b, double fb, int32 depth);
+    static void EvaluateRow(const MeshSettings& settings, Mesh& mesh, int32 count, double* out);
+    MeshSettings Settings(double time) const { return { myEquation, myProgram.get(), myNative, myPrecision, myIncrement, time, myContourSpacing }; }
+    static void ExtractContours(double spacing, Mesh& mesh);
+    static void BuildMipmap(Mesh& mesh);
+    //The height of the equation at the time of the mesh, without the offset
+    double SurfaceAt(double x, double y) const;
+    void DrawContours(CommandList& list);
+    void DrawCurve(CommandList& list, uint32 tile, glm::vec4 col);
+    static void AddRow(Mesh& mesh, const glm::vec3* row, int32 count);
+    void StartRemesh(double time);
+
+    Mesh myMesh;
+    std::shared_ptr<RemeshJob> myJob;
+    Precision myPrecision = Precision_Mixed;
+    MathParser::Accuracy myAccuracy = MathParser::Accuracy_Full;
+    FuncExplicitType myNative = nullptr;
+
+    //Built when the equation changes. Shared with the background re-mesh
+    std::shared_ptr<MathParser::Program> myProgram;
+    uint32 myProgramRevision = 0;
+
+    //Added to every vertex, for surfaces where t is only added on (see Equation::TimeAdditive)
+    glm::vec3 myOffset = glm::vec3(0.0f);
+    double myTime = 0.0;
+    //Positions copied with the offset, for Draw(Renderer*)
+    std::vector<glm::vec3> myDrawScratch;
 
     //Todo: Store a delegate instead of a Equation*
-    MathParser::Equation* myEquation;
+    const MathParser::Equation* myEquation = nullptr;
+    MathParser::ContextSnapshot mySnapshot;
+    double myIncrement = 0.25;
+    double myContourSpacing = 0.0;
+
+    //What the current mesh was calculated for
+    uint32 myMeshedRevision = 0;
 };
\ No newline at end of file
@@ -0,0 +1,291 @@
+#include "HeightMipmap.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+
+//A block that nothing can hit, lowest above highest so that it never grows another range
+static const glm::dvec2 EmptyRange = { std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity() };
+
+void HeightMipmap::Build(const Grid& grid) {
+    PROFILE_ZONE("HeightMipmap::Build");
+    myLevelCount = 0;
+    myMinX = grid.MinX;
+    myMinY = grid.MinY;
+    myIncrement = grid.Increment;
+    if (grid.CountX < 2 || grid.CountY < 2)
+        return;
+
+    //Level 0 is the cells, every level above halves both sides (rounding up) until a single block is left
+    int32 width = grid.CountX - 1;
+    int32 height = grid.CountY - 1;
+    while (true) {
+        if (myLevelCount == (int32)myLevels.size())
+            myLevels.emplace_back();
+        Level& level = myLevels[myLevelCount++];
+        level.Width = width;
+        level.Height = height;
+        level.Range.resize((size_t)width * height);
+        if (width == 1 && height == 1)
+            break;
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+    }
+
+    Level& cells = myLevels[0];
+    for (int32 j = 0; j < cells.Height; j++) {
+        const double* row = grid.Heights + (size_t)j * grid.CountX;
+        const double* above = row + grid.CountX;
+        for (int32 i = 0; i < cells.Width; i++) {
+            const double corners[4] = { row[i], row[i + 1], above[i], above[i + 1] };
+            glm::dvec2 range = { corners[0], corners[0] };
+            bool bFinite = true;
+            for (double h : corners) {
+                bFinite &= std::isfinite(h);
+                range.x = std::min(range.x, h);
+                range.y = std::max(range.y, h);
+            }
+            cells.Range[(size_t)j * cells.Width + i] = bFinite ? range : EmptyRange;
+        }
+    }
+
+    for (int32 l = 1; l < myLevelCount; l++) {
+        const Level& below = myLevels[l - 1];
+        Level& level = myLevels[l];
+        for (int32 j = 0; j < level.Height; j++) {
+            for (int32 i = 0; i < level.Width; i++) {
+                glm::dvec2 range = EmptyRange;
+                for (int32 cj = 2 * j; cj < std::min(2 * j + 2, below.Height); cj++) {
+                    for (int32 ci = 2 * i; ci < std::min(2 * i + 2, below.Width); ci++) {
+                        const glm::dvec2& child = below.Range[(size_t)cj * below.Width + ci];
+                        range.x = std::min(range.x, child.x);
+                        range.y = std::max(range.y, child.y);
+                    }
+                }
+                level.Range[(size_t)j * level.Width + i] = range;
+            }
+        }
+    }
+}
+
+void HeightMipmap::Clear() {
+    myLevelCount = 0;
+}
+
+bool HeightMipmap::Enter(const glm::dvec3& origin, const glm::dvec3& dir, int32 level, int32 i, int32 j, double& t0, double& t1) const {
+    const Level& l = myLevels[level];
+    const glm::dvec2& range = l.Range[(size_t)j * l.Width + i];
+    if (range.x > range.y)
+        return false;
+
+    //The block covers cells [i << level, (i+1) << level), which the last block of a row only partly has
+    const Level& cells = myLevels[0];
+    const double lo[3] = {
+        myMinX + (double)(i << level) * myIncrement,
+        myMinY + (double)(j << level) * myIncrement,
+        range.x
+    };
+    const double hi[3] = {
+        myMinX + (double)std::min((i + 1) << level, cells.Width) * myIncrement,
+        myMinY + (double)std::min((j + 1) << level, cells.Height) * myIncrement,
+        range.y
+    };
+
+    t0 = 0.0;
+    t1 = std::numeric_limits<double>::infinity();
+    for (int32 axis = 0; axis < 3; axis++) {
+        if (dir[axis] == 0.0) {
+            if (origin[axis] < lo[axis] || origin[axis] > hi[axis])
+                return false;
+            continue;
+        }
+        double tLo = (lo[axis] - origin[axis]) / dir[axis];
+        double tHi = (hi[axis] - origin[axis]) / dir[axis];
+        if (tLo > tHi)
+            std::swap(tLo, tHi);
+        t0 = std::max(t0, tLo);
+        t1 = std::min(t1, tHi);
+        if (t0 > t1)
+            return false;
+    }
+    return true;
+}
+
+double HeightMipmap::Trace(glm::dvec3 origin, glm::dvec3 dir, const CellFunc& cell) const {
+    if (Empty())
+        return -1.0;
+
+    struct Node {
+        int32 Level;
+        int32 I;
+        int32 J;
+        double T;       //Where the ray enters the box
+    };
+    //Every level pushes at most four blocks, and there are never more than 32 levels of int32 sized grids
+    Node stack[4 * 33];
+    int32 top = 0;
+
+    double tTop0, tTop1;
+    if (!Enter(origin, dir, myLevelCount - 1, 0, 0, tTop0, tTop1))
+        return -1.0;
+    stack[top++] = { myLevelCount - 1, 0, 0, tTop0 };
+
+    double best = std::numeric_limits<double>::infinity();
+    while (top > 0) {
+        const Node node = stack[--top];
+        if (node.T >= best)
+            continue;
+
+        if (node.Level == 0) {
+            double t0, t1;
+            if (!Enter(origin, dir, 0, node.I, node.J, t0, t1))
+                continue;
+            const double t = cell(node.I, node.J, t0, t1);
+            if (t >= 0.0 && t < best)
+                best = t;
+            continue;
+        }
+
+        const Level& below = myLevels[node.Level - 1];
+        Node children[4];
+        int32 count = 0;
+        for (int32 cj = 2 * node.J; cj < std::min(2 * node.J + 2, below.Height); cj++) {
+            for (int32 ci = 2 * node.I; ci < std::min(2 * node.I + 2, below.Width); ci++) {
+                double t0, t1;
+                if (Enter(origin, dir, node.Level - 1, ci, cj, t0, t1) && t0 < best)
+                    children[count++] = { node.Level - 1, ci, cj, t0 };
+            }
+        }
+        //Furthest pushed first, so that the nearest is looked at next. Sorted by insertion, there are at most four
+        for (int32 k = 1; k < count; k++) {
+            const Node child = children[k];
+            int32 m = k;
+            for (; m > 0 && children[m - 1].T < child.T; m--)
+                children[m] = children[m - 1];
+            children[m] = child;
+        }
+        for (int32 k = 0; k < count; k++)
+            stack[top++] = children[k];
+    }
+    return best == std::numeric_limits<double>::infinity() ? -1.0 : best;
+}
+
+//
+//Tests
+//
+bool HeightMipmap::RunAllTests() {
+    bool bSuccess = true;
+    #define TEST(x) \
+        if (!(x)) { \
+            LogError("HeightMipmap test failed: %s", #x); \
+            bSuccess = false; \
+        }
+
+    //Samples in [-4, 4] x [-3, 3.5], an odd number of cells on both sides so that the last blocks are cut off
+    const int32 countX = 34;
+    const int32 countY = 27;
+    const double inc = 0.25;
+    std::vector<double> heights(countX * countY);
+    const Grid grid = { heights.data(), countX, countY, -4.0, -3.0, inc };
+    for (int32 j = 0; j < countY; j++) {
+        for (int32 i = 0; i < countX; i++) {
+            const double x = grid.MinX + i * inc, y = grid.MinY + j * inc;
+            heights[j * countX + i] = std::sin(x) * std::cos(y) + 0.1 * x;
+        }
+    }
+    //A hole in the middle
+    for (int32 j = 12; j < 15; j++)
+        for (int32 i = 15; i < 19; i++)
+            heights[j * countX + i] = std::nan("");
+
+    HeightMipmap mipmap;
+    mipmap.Build(grid);
+    TEST(mipmap.LevelCount() == 7);     //33x26 cells, 17x13, 9x7, 5x4, 3x2, 2x1, 1x1
+
+    glm::dvec3 origin, dir;
+    //Where the ray crosses the bilinear surface of the cell: stepped through, then bisected
+    auto Cell = [&](int32 i, int32 j, double t0, double t1) -> double {
+        const double* h = &heights[j * countX + i];
+        auto Above = [&](double t) {
+            const glm::dvec3 p = origin + t * dir;
+            const double u = (p.x - grid.MinX) / inc - i, v = (p.y - grid.MinY) / inc - j;
+            const double surface = (h[0] * (1 - u) + h[1] * u) * (1 - v) + (h[countX] * (1 - u) + h[countX + 1] * u) * v;
+            return p.z - surface;
+        };
+        const int32 steps = 8;
+        double a = t0, fa = Above(t0);
+        for (int32 s = 1; s <= steps; s++) {
+            double b = t0 + (t1 - t0) * s / steps, fb = Above(b);
+            if ((fa > 0.0) != (fb > 0.0)) {
+                for (int32 k = 0; k < 50; k++) {
+                    const double m = 0.5 * (a + b), fm = Above(m);
+                    if ((fa > 0.0) != (fm > 0.0)) { b = m; }
+                    else { a = m; fa = fm; }
+                }
+                return a;
+            }
+            a = b;
+            fa = fb;
+        }
+        return -1.0;
+    };
+    auto BruteForce = [&]() {
+        double best = -1.0;
+        for (int32 j = 0; j < countY - 1; j++) {
+            for (int32 i = 0; i < countX - 1; i++) {
+                if (!std::isfinite(heights[j * countX + i]) || !std::isfinite(heights[j * countX + i + 1]) ||
+                    !std::isfinite(heights[(j + 1) * countX + i]) || !std::isfinite(heights[(j + 1) * countX + i + 1]))
+                    continue;
+                double t0, t1;
+                if (!mipmap.Enter(origin, dir, 0, i, j, t0, t1))
+                    continue;
+                const double t = Cell(i, j, t0, t1);
+                if (t >= 0.0 && (best < 0.0 || t < best))
+                    best = t;
+            }
+        }
+        return best;
+    };
+
+    //Rays from all around, pointing somewhere over the grid. Trace finds the same hit as looking at every cell
+    std::mt19937 random(7);
+    std::uniform_real_distribution<double> angle(0.0, 6.2831853), spread(-3.0, 3.0);
+    int32 same = 0, hits = 0;
+    const int32 rays = 300;
+    for (int32 r = 0; r < rays; r++) {
+        const double a = angle(random);
+        origin = { 8.0 * std::cos(a), 8.0 * std::sin(a), 2.0 + spread(random) };
+        dir = glm::normalize(glm::dvec3(spread(random), spread(random) * 0.8, spread(random) * 0.5) - origin);
+        const double traced = mipmap.Trace(origin, dir, Cell);
+        const double brute = BruteForce();
+        same += (traced < 0.0 && brute < 0.0) || std::abs(traced - brute) < 1e-9;
+        hits += brute >= 0.0;
+    }
+    TEST(same == rays);
+    TEST(hits > rays / 4 && hits < rays);
+
+    //Straight down, which has dir.x and dir.y zero: a hit over the surface, none over the hole or off the grid
+    dir = { 0.0, 0.0, -1.0 };
+    origin = { 1.1, 0.6, 5.0 };
+    const double down = mipmap.Trace(origin, dir, Cell);
+    TEST(down > 0.0 && std::abs((5.0 - down) - (std::sin(1.1) * std::cos(0.6) + 0.11)) < 0.05);
+    origin = { 0.3, 0.2, 5.0 };
+    TEST(mipmap.Trace(origin, dir, Cell) < 0.0);
+    origin = { 4.5, 0.0, 5.0 };
+    TEST(mipmap.Trace(origin, dir, Cell) < 0.0);
+
+    //Pointing up from above everything
+    origin = { 0.0, 0.0, 3.0 };
+    dir = { 0.1, 0.0, 1.0 };
+    TEST(mipmap.Trace(origin, dir, Cell) < 0.0);
+
+    //Too small to have a cell
+    const Grid line = { heights.data(), countX, 1, -4.0, -3.0, inc };
+    mipmap.Build(line);
+    TEST(mipmap.Empty());
+
+    #undef TEST
+    return bSuccess;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include "DebugFinal.h"
+#include "Maths.h"
+#include <vector>
+#include <functional>
+
+//The lowest and highest height of every cell of a grid of heights, and of every 2x2, 4x4, ... block of cells above
+//that. A ray only goes down into the blocks whose box it passes through, so finding the cell where it first hits the
+//surface takes about log(cells) steps instead of one per cell. Used for picking (see Grapher3D::Pick)
+class HeightMipmap {
+public:
+    //Heights[j * CountX + i] is the height at (MinX + i * Increment, MinY + j * Increment). Cells with a height that is
+    //not a finite number can not be hit
+    struct Grid {
+        const double* Heights;
+        int32 CountX;
+        int32 CountY;
+        double MinX;
+        double MinY;
+        double Increment;
+    };
+
+    //Called for the cells that the ray goes through the box of, nearest first. t0 and t1 are where the ray enters and
+    //leaves the box, which the surface of the cell is inside when it goes straight between the corners. Returns where
+    //the ray hits in the cell, or a negative number for none
+    using CellFunc = std::function<double(int32 i, int32 j, double t0, double t1)>;
+
+public:
+    HeightMipmap() = default;
+
+    //Does not keep the heights. Building again at the same size does not allocate
+    void Build(const Grid& grid);
+    void Clear();
+    bool Empty() const { return myLevelCount == 0; }
+
+    //Distance along dir (which does not have to be normalised) to the nearest hit, negative when there is none. Cells
+    //behind a hit that was found already are skipped
+    double Trace(glm::dvec3 origin, glm::dvec3 dir, const CellFunc& cell) const;
+
+    int32 LevelCount() const { return myLevelCount; }
+
+    static bool RunAllTests();    //Returns true when all tests pass
+
+private:
+    struct Level {
+        int32 Width;
+        int32 Height;
+        std::vector<glm::dvec2> Range;      //Lowest and highest height. Lowest is above highest for blocks of holes
+    };
+
+    //Where the ray is inside the box of the block of cells, false when it never is
+    bool Enter(const glm::dvec3& origin, const glm::dvec3& dir, int32 level, int32 i, int32 j, double& t0, double& t1) const;
+
+private:
+    std::vector<Level> myLevels;    //Kept when cleared, so that building again reuses them
+    int32 myLevelCount = 0;
+    double myMinX = 0.0;
+    double myMinY = 0.0;
+    double myIncrement = 0.0;
+};
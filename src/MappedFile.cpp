@@ -0,0 +1,98 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const std::string& path) {
+    Close();
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return false;
+    }
+    myFile = file;
+    mySize = (size_t)size.QuadPart;
+    if (mySize == 0)
+        return true;    //Empty files cannot be mapped
+
+    myMapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (myMapping)
+        myData = (const char*)MapViewOfFile(myMapping, FILE_MAP_READ, 0, 0, 0);
+    if (!myData) {
+        LogWarn("Could not map %s", path.c_str());
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::Close() {
+    if (myData)
+        UnmapViewOfFile(myData);
+    if (myMapping)
+        CloseHandle((HANDLE)myMapping);
+    if (myFile)
+        CloseHandle((HANDLE)myFile);
+    myData = nullptr;
+    myMapping = nullptr;
+    myFile = nullptr;
+    mySize = 0;
+}
+
+#else
+
+bool MappedFile::Open(const std::string& path) {
+    Close();
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    mySize = (size_t)st.st_size;
+    if (mySize == 0) {
+        close(fd);
+        return true;    //Empty files cannot be mapped
+    }
+
+    //The mapping stays valid after the descriptor is closed
+    void* data = mmap(nullptr, mySize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        LogWarn("Could not map %s", path.c_str());
+        mySize = 0;
+        return false;
+    }
+    //Read front to back, so the kernel can read ahead
+    madvise(data, mySize, MADV_SEQUENTIAL);
+    myData = (const char*)data;
+    return true;
+}
+
+void MappedFile::Close() {
+    if (myData)
+        munmap((void*)myData, mySize);
+    myData = nullptr;
+    mySize = 0;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+#include "DebugFinal.h"
+#include <string>
+
+//A whole file mapped read only into memory. The pages are read in by the OS as they are touched, so nothing is copied
+//up front and several threads can read different parts of the file at once
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator= (const MappedFile&) = delete;
+
+    //Returns false if the file could not be opened. An empty file opens fine, with Data() == nullptr
+    bool Open(const std::string& path);
+    void Close();
+
+    const char* Data() const { return myData; }
+    size_t Size() const      { return mySize; }
+
+private:
+    const char* myData = nullptr;
+    size_t mySize = 0;
+
+#ifdef _WIN32
+    void* myFile = nullptr;
+    void* myMapping = nullptr;
+#endif
+};
@@ -0,0 +1,728 @@
+#include "MathContext.h"
+#include "MathNode.h"
+#include "MappedFile.h"
+
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <functional>
+#include <unordered_map>
+
+#include "Maths.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+
+using std::vector;
+using std::string_view;
+
+namespace MathParser {
+
+//Layout of a .gic file. A header followed by four tables, each 8 byte aligned. Everything is written the way it is in
+//memory, so a file only loads on the kind of machine that wrote it (see ByteOrder)
+namespace Compiled {
+
+static constexpr char Magic[4] = { 'G', 'I', 'C', '\0' };
+static constexpr uint32 Version = 2;
+static constexpr uint32 ByteOrder = 0x01020304;
+//Arguments nested deeper than the parser allows mean the file is broken
+static constexpr int MaxDepth = 256;
+
+struct Header {
+    char   Magic[4];
+    uint32 Version;
+    uint32 ByteOrder;
+    uint32 InbuiltCount;    //Inbuilt equations are not stored, but callee indices count them
+    uint64 SourceHash;
+    uint64 FileSize;
+    uint32 EquationCount;
+    uint32 NodeCount;
+    uint32 CalleeCount;
+    uint32 StringBytes;
+    uint64 EquationsOffset;
+    uint64 NodesOffset;
+    uint64 CalleesOffset;
+    uint64 StringsOffset;
+};
+
+//Part of the string table. Lines are followed by a '\0', names point into their line
+struct String {
+    uint32 Offset;
+    uint32 Length;
+};
+
+//Properties of an equation or argument, see Flags below
+enum Flag : uint32 {
+    Flag_Valid        = 1 << 0,
+    Flag_UsesTime     = 1 << 1,
+    Flag_TimeAdditive = 1 << 2,
+};
+
+static uint32 GetFlags(const MathParser::Equation& eq) {
+    return (eq.Valid() ? (uint32)Flag_Valid : 0u) | (eq.UsesTime() ? (uint32)Flag_UsesTime : 0u) | (eq.TimeAdditive() ? (uint32)Flag_TimeAdditive : 0u);
+}
+
+static void SetFlags(MathParser::Equation& eq, int32 iParamCount, int32 eParamCount, uint32 flags) {
+    eq.SetProperties(iParamCount, eParamCount, (flags & Flag_Valid) != 0);
+    eq.SetTimeProperties((flags & Flag_UsesTime) != 0, (flags & Flag_TimeAdditive) != 0);
+}
+
+struct Equation {
+    String Line;
+    String Name;
+    uint32 FirstNode;
+    uint32 NodeCount;       //Arguments included
+    uint32 FirstCallee;
+    uint32 CalleeCount;
+    int32  IParamCount;
+    int32  EParamCount;
+    uint32 Flags;
+    uint32 Unused;
+};
+
+enum NodeKind : uint8 {
+    Kind_Value,
+    Kind_Param,
+    Kind_Operator,
+    Kind_Call,
+    Kind_Argument,
+};
+
+//Calls are followed by their arguments. Every argument starts with a Kind_Argument node, that holds its properties
+//and how many of the nodes after it belong to it
+struct Node {
+    uint8  Kind;
+    uint8  Implicit;        //Param
+    uint16 Op;              //Operator
+    uint32 Count;           //Param: index. Call: arguments. Argument: nodes, nested arguments included
+    String Name;            //Call
+    int32  Callee;          //Call: equation index, -1 if there was none
+    int32  IParamCount;     //Argument
+    int32  EParamCount;     //Argument
+    uint32 Flags;           //Argument
+    double Value;           //Value
+};
+
+} //End of namespace Compiled
+
+//Rounds of xxHash64. Only has to notice that the text changed, nobody is trying to fool it
+static constexpr uint64 HashPrime1 = 0x9e3779b185ebca87ull;
+static constexpr uint64 HashPrime2 = 0xc2b2ae3d27d4eb4full;
+
+static uint64 RotateLeft(uint64 v, int bits) {
+    return (v << bits) | (v >> (64 - bits));
+}
+
+static uint64 HashRound(uint64 acc, uint64 word) {
+    return RotateLeft(acc + word * HashPrime2, 31) * HashPrime1;
+}
+
+static uint64 ReadWord(const char* data) {
+    uint64 word;
+    memcpy(&word, data, sizeof(word));
+    return word;
+}
+
+uint64 Context::HashSource(const char* data, size_t size) {
+    //Eight bytes at a time, in four lanes that do not wait on each other
+    uint64 lanes[4] = { HashPrime1 + HashPrime2, HashPrime2, 0, 0 - HashPrime1 };
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        for (int l = 0; l < 4; l++)
+            lanes[l] = HashRound(lanes[l], ReadWord(data + i + 8 * l));
+    }
+
+    uint64 hash = RotateLeft(lanes[0], 1) + RotateLeft(lanes[1], 7) + RotateLeft(lanes[2], 12) + RotateLeft(lanes[3], 18);
+    hash ^= (uint64)size;
+    for (; i + 8 <= size; i += 8)
+        hash = HashRound(hash, ReadWord(data + i));
+    if (i < size) {
+        uint64 word = 0;
+        memcpy(&word, data + i, size - i);
+        hash = HashRound(hash, word);
+    }
+
+    //Every bit of the result depends on every bit of the input
+    hash ^= hash >> 33;
+    hash *= HashPrime2;
+    hash ^= hash >> 29;
+    hash *= HashPrime1;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+std::string Context::CompiledPath(const std::string& path) {
+    return std::filesystem::path(path).replace_extension(".gic").string();
+}
+
+//--------------------------------------------------------------------------------
+//                               Writing
+//--------------------------------------------------------------------------------
+
+namespace {
+
+struct Writer {
+    std::vector<Compiled::Equation> Equations;
+    std::vector<Compiled::Node> Nodes;
+    std::vector<int32> Callees;
+    std::string Strings;
+    std::unordered_map<const Equation*, int32> Indices;
+
+    Compiled::String AddLine(string_view str) {
+        Compiled::String res = { (uint32)Strings.size(), (uint32)str.size() };
+        Strings.append(str.data(), str.size());
+        Strings += '\0';
+        return res;
+    }
+
+    //Names are almost always part of their line, so they take no space of their own
+    Compiled::String AddName(string_view str, Compiled::String line, string_view lineStr) {
+        std::less_equal<const char*> lessEq;
+        if (lessEq(lineStr.data(), str.data()) && lessEq(str.data() + str.size(), lineStr.data() + lineStr.size()))
+            return { line.Offset + (uint32)(str.data() - lineStr.data()), (uint32)str.size() };
+        return AddLine(str);
+    }
+
+    void AddNodes(const Equation& eq, Compiled::String line, string_view lineStr) {
+        for (int i = 0; i < eq.NodeCount(); i++) {
+            const NodeGeneric& n = eq.Node(i);
+            Compiled::Node rec = {};
+            switch (n.type) {
+                case NodeType::NodeValue:
+                    rec.Kind = Compiled::Kind_Value;
+                    rec.Value = n.GetValue()->GetValue();
+                    Nodes.push_back(rec);
+                    break;
+
+                case NodeType::NodeParam:
+                    rec.Kind = Compiled::Kind_Param;
+                    rec.Count = (uint32)n.GetParam()->Index();
+                    rec.Implicit = n.GetParam()->Implicit();
+                    Nodes.push_back(rec);
+                    break;
+
+                case NodeType::NodeOperator:
+                    rec.Kind = Compiled::Kind_Operator;
+                    rec.Op = (uint16)n.GetOp()->Op();
+                    Nodes.push_back(rec);
+                    break;
+
+                case NodeType::NodeExpression:
+                {
+                    const NodeExpression* ne = n.GetExpr();
+                    auto it = Indices.find(ne->GetEquation());
+                    rec.Kind = Compiled::Kind_Call;
+                    rec.Count = (uint32)ne->GetParams().size();
+                    rec.Name = AddName(ne->Name(), line, lineStr);
+                    rec.Callee = it != Indices.end() ? it->second : -1;
+                    Nodes.push_back(rec);
+
+                    for (const Equation& arg : ne->GetParams()) {
+                        const size_t at = Nodes.size();
+                        Compiled::Node argRec = {};
+                        argRec.Kind = Compiled::Kind_Argument;
+                        argRec.IParamCount = arg.IParamCount();
+                        argRec.EParamCount = arg.EParamCount();
+                        argRec.Flags = Compiled::GetFlags(arg);
+                        Nodes.push_back(argRec);
+                        AddNodes(arg, line, lineStr);
+                        Nodes[at].Count = (uint32)(Nodes.size() - at - 1);
+                    }
+                    break;
+                }
+
+                default:
+                    Assert(false && "Unknown type");
+                    break;
+            }
+        }
+    }
+};
+
+} //End of anonymous namespace
+
+bool Context::SaveCompiled(const std::string& path, uint64 sourceHash) const {
+    PROFILE_ZONE("SaveCompiled");
+    //The graph is only up to date after resolving
+    Assert((int)myCallees.size() == myCount);
+
+    Writer w;
+    for (int i = 0; i < myCount; i++)
+        w.Indices.emplace(myEquations[i], i);
+
+    for (int i = myCustomEqStart; i < myCount; i++) {
+        const Equation* eq = myEquations[i];
+        Compiled::Equation rec = {};
+        rec.Line = w.AddLine(myStrEquations[i]);
+        rec.Name = w.AddName(eq->Name(), rec.Line, myStrEquations[i]);
+        rec.FirstNode = (uint32)w.Nodes.size();
+        w.AddNodes(*eq, rec.Line, myStrEquations[i]);
+        rec.NodeCount = (uint32)w.Nodes.size() - rec.FirstNode;
+        rec.FirstCallee = (uint32)w.Callees.size();
+        w.Callees.insert(w.Callees.end(), myCallees[i].begin(), myCallees[i].end());
+        rec.CalleeCount = (uint32)myCallees[i].size();
+        rec.IParamCount = eq->IParamCount();
+        rec.EParamCount = eq->EParamCount();
+        rec.Flags = Compiled::GetFlags(*eq);
+        w.Equations.push_back(rec);
+    }
+
+    auto Align = [](uint64 offset) { return (offset + 7) & ~(uint64)7; };
+    Compiled::Header h = {};
+    memcpy(h.Magic, Compiled::Magic, sizeof(h.Magic));
+    h.Version = Compiled::Version;
+    h.ByteOrder = Compiled::ByteOrder;
+    h.InbuiltCount = (uint32)myCustomEqStart;
+    h.SourceHash = sourceHash;
+    h.EquationCount = (uint32)w.Equations.size();
+    h.NodeCount = (uint32)w.Nodes.size();
+    h.CalleeCount = (uint32)w.Callees.size();
+    h.StringBytes = (uint32)w.Strings.size();
+    h.EquationsOffset = Align(sizeof(h));
+    h.NodesOffset = Align(h.EquationsOffset + w.Equations.size() * sizeof(Compiled::Equation));
+    h.CalleesOffset = Align(h.NodesOffset + w.Nodes.size() * sizeof(Compiled::Node));
+    h.StringsOffset = Align(h.CalleesOffset + w.Callees.size() * sizeof(int32));
+    h.FileSize = h.StringsOffset + w.Strings.size();
+
+    //Written next to it and renamed over it, so that a crash never leaves half a file behind
+    const std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            LogWarn("Could not write %s", tmpPath.c_str());
+            return false;
+        }
+
+        uint64 pos = 0;
+        auto Write = [&file, &pos](uint64 offset, const void* data, size_t size) {
+            static const char zeros[8] = {};
+            file.write(zeros, (std::streamsize)(offset - pos));
+            file.write((const char*)data, (std::streamsize)size);
+            pos = offset + size;
+        };
+        Write(0, &h, sizeof(h));
+        Write(h.EquationsOffset, w.Equations.data(), w.Equations.size() * sizeof(Compiled::Equation));
+        Write(h.NodesOffset, w.Nodes.data(), w.Nodes.size() * sizeof(Compiled::Node));
+        Write(h.CalleesOffset, w.Callees.data(), w.Callees.size() * sizeof(int32));
+        Write(h.StringsOffset, w.Strings.data(), w.Strings.size());
+        if (!file.good()) {
+            LogWarn("Could not write %s", tmpPath.c_str());
+            return false;
+        }
+    }
+
+    std::error_code err;
+    std::filesystem::rename(tmpPath, path, err);
+    if (err) {
+        LogWarn("Could not write %s (%s)", path.c_str(), err.message().c_str());
+        std::filesystem::remove(tmpPath, err);
+        return false;
+    }
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+//                               Reading
+//--------------------------------------------------------------------------------
+
+namespace {
+
+struct Reader {
+    Context* Ctx;
+    std::pmr::memory_resource* Memory;     //Of the nodes and arguments
+    const std::vector<Equation*>* Equations;
+    const char* Strings;
+    uint32 StringBytes;
+
+    bool GetString(Compiled::String str, string_view& out) const {
+        if (str.Offset > StringBytes || str.Length > StringBytes - str.Offset)
+            return false;
+        out = string_view(Strings + str.Offset, str.Length);
+        return true;
+    }
+
+    //What evaluating with these counts can hold (see Equation::Evaluate)
+    static bool ValidCounts(int32 iParamCount, int32 eParamCount) {
+        return iParamCount >= 0 && iParamCount <= NodeParam::TimeParam && eParamCount >= 0 && eParamCount <= NodeExpression::MaxParams;
+    }
+
+    //Every count and index is checked, a broken file has to fail instead of crashing
+    bool ReadNodes(const Compiled::Node* nodes, uint32 count, int depth, Equation& eq) const {
+        if (depth > Compiled::MaxDepth)
+            return false;
+
+        //Reserved exactly, as memory of the arena is not given back when a vector grows. Arguments belong to a call
+        uint32 top = 0;
+        for (uint32 i = 0; i < count; ) {
+            const bool bArgument = nodes[i].Kind == Compiled::Kind_Argument;
+            i += bArgument ? Min(nodes[i].Count, count - i - 1) + 1 : 1;
+            top += !bArgument;
+        }
+        eq.ReserveNodes((int)top);
+
+        for (uint32 i = 0; i < count; ) {
+            const Compiled::Node& n = nodes[i++];
+            switch (n.Kind) {
+                case Compiled::Kind_Value:
+                    eq.PushNode( NodeValue(n.Value) );
+                    break;
+
+                case Compiled::Kind_Param:
+                    if (n.Count >= (uint32)(n.Implicit ? NodeParam::ImplicitSlots : NodeExpression::MaxParams))
+                        return false;
+                    eq.PushNode( NodeParam((int)n.Count, n.Implicit != 0) );
+                    break;
+
+                case Compiled::Kind_Operator:
+                    if (n.Op == NodeOperator::OP_INVALID || n.Op > NodeOperator::OP_NEG)
+                        return false;
+                    eq.PushNode( NodeOperator((NodeOperator::Operator)n.Op) );
+                    break;
+
+                case Compiled::Kind_Call:
+                {
+                    string_view name;
+                    if (!GetString(n.Name, name) || n.Callee < -1 || n.Callee >= (int32)Equations->size() || n.Count > (uint32)NodeExpression::MaxParams)
+                        return false;
+
+                    std::pmr::vector<Equation> args(Memory);
+                    args.reserve(n.Count);
+                    for (uint32 k = 0; k < n.Count; k++) {
+                        if (i >= count || nodes[i].Kind != Compiled::Kind_Argument)
+                            return false;
+                        const Compiled::Node& a = nodes[i++];
+                        if (a.Count > count - i)
+                            return false;
+
+                        Equation& arg = args.emplace_back(Ctx, Memory);
+                        if (!ReadNodes(nodes + i, a.Count, depth + 1, arg) || !ValidCounts(a.IParamCount, a.EParamCount))
+                            return false;
+                        Compiled::SetFlags(arg, a.IParamCount, a.EParamCount, a.Flags);
+                        i += a.Count;
+                    }
+
+                    NodeExpression expr(name, std::move(args));
+                    expr.SetEquation(n.Callee >= 0 ? (*Equations)[n.Callee] : nullptr);
+                    eq.PushNode( std::move(expr) );
+                    break;
+                }
+
+                default:
+                    return false;
+            }
+        }
+        return true;
+    }
+};
+
+//Fewer equations are not worth a job of their own
+static constexpr uint32 MinChunkEquations = 1024;
+
+template<typename T>
+static bool GetTable(const MappedFile& file, uint64 offset, uint32 count, const T*& out) {
+    if (offset % alignof(T) != 0 || offset > file.Size() || (file.Size() - offset) / sizeof(T) < count)
+        return false;
+    out = reinterpret_cast<const T*>(file.Data() + offset);
+    return true;
+}
+
+} //End of anonymous namespace
+
+bool Context::LoadCompiled(const std::string& path, uint64 sourceHash) {
+    PROFILE_ZONE("LoadCompiled");
+    MappedFile file;
+    if (!file.Open(path) || file.Size() < sizeof(Compiled::Header))
+        return false;
+
+    Compiled::Header h;
+    memcpy(&h, file.Data(), sizeof(h));
+    if (memcmp(h.Magic, Compiled::Magic, sizeof(h.Magic)) != 0 || h.Version != Compiled::Version || h.ByteOrder != Compiled::ByteOrder)
+        return false;
+    if (h.SourceHash != sourceHash)
+        return false;   //Made from another version of the text
+    if (h.FileSize != file.Size() || h.InbuiltCount != (uint32)myCustomEqStart)
+        return false;
+
+    const Compiled::Equation* equations;
+    const Compiled::Node* nodes;
+    const int32* callees;
+    const char* strings;
+    if (!GetTable(file, h.EquationsOffset, h.EquationCount, equations) || !GetTable(file, h.NodesOffset, h.NodeCount, nodes) ||
+        !GetTable(file, h.CalleesOffset, h.CalleeCount, callees) || !GetTable(file, h.StringsOffset, h.StringBytes, strings))
+        return false;
+    if (h.StringBytes == 0 || strings[h.StringBytes - 1] != '\0')
+        return false;
+
+    //The text only has to be copied once. The equations point into it, like they do into a parsed file
+    Clear();
+    Arena text;
+    text.Size = h.StringBytes;
+    text.Data.reset(new char[text.Size]);
+    memcpy(text.Data.get(), strings, text.Size);
+
+    //The nodes are read in chunks on the thread pool, like a text file is parsed (see LoadFromFile). The equations go
+    //into one block, and the nodes and arguments of every chunk into memory of its own
+    const uint32 chunkCount = Max(1u, Min(h.EquationCount / MinChunkEquations, (uint32)(ThreadPool::Global().ThreadCount() + 1) * 4));
+    const uint32 chunkSize = Max(1u, (h.EquationCount + chunkCount - 1) / chunkCount);
+    std::unique_ptr<EquationArena> arena = std::make_unique<EquationArena>(Max((size_t)h.EquationCount * sizeof(Equation), (size_t)64));
+    arena->Equations = static_cast<Equation*>(arena->Memory.allocate(h.EquationCount * sizeof(Equation), alignof(Equation)));
+    for (uint32 c = 0; c < chunkCount; c++) {
+        //Every compiled node becomes a node or an argument. Broken counts only make the first block too large or small
+        uint64 chunkNodes = 0;
+        for (uint32 k = c * chunkSize; k < Min(h.EquationCount, (c + 1) * chunkSize); k++)
+            chunkNodes += Min(equations[k].NodeCount, h.NodeCount);
+        const size_t bytes = (size_t)Min(chunkNodes, (uint64)h.NodeCount) * Max(sizeof(NodeGeneric), sizeof(Equation));
+        arena->Nodes.push_back(std::make_unique<std::pmr::monotonic_buffer_resource>(Max(bytes, (size_t)64)));
+    }
+    EquationArena& loaded = *arena;
+
+    const int total = myCustomEqStart + (int)h.EquationCount;
+    Reader reader = { this, nullptr, &myEquations, text.Data.get(), h.StringBytes };
+    myArenas.push_back(std::move(text));
+    myEquations.reserve(total);
+    myStrEquations.reserve(total);
+    myNameIndex.Reserve(total);
+
+    //All equations exist before any node is read, calls can go to later ones
+    bool bValid = true;
+    for (uint32 k = 0; k < h.EquationCount && bValid; k++) {
+        const Compiled::Equation& rec = equations[k];
+        string_view line, name;
+        bValid = reader.GetString(rec.Line, line) && reader.GetString(rec.Name, name) &&
+                 rec.Line.Offset + line.size() < h.StringBytes && line.data()[line.size()] == '\0';
+        if (!bValid)
+            break;
+
+        Equation* eq = new (&arena->Equations[k]) Equation(this, arena->Nodes[k / chunkSize].get());
+        arena->Count++;
+        eq->SetName(name);
+        PushEquation(eq, line);
+    }
+    myEquationArenas.push_back(std::move(arena));
+
+    //Runs fn on every chunk of equations, false if it was false for any of them. Equations only touch their own nodes
+    //and lists, and read the others
+    auto ForEachChunk = [&](const std::function<bool(Reader& chunkReader, uint32 k)>& fn) {
+        std::vector<uint8> chunkValid(chunkCount, 1);
+        ThreadPool::Global().ParallelFor((int32)chunkCount, [&](int32 c) {
+            PROFILE_ZONE("LoadCompiledChunk");
+            Reader chunkReader = reader;
+            chunkReader.Memory = loaded.Nodes[c].get();
+            const uint32 end = Min(h.EquationCount, (uint32)(c + 1) * chunkSize);
+            for (uint32 k = (uint32)c * chunkSize; k < end && chunkValid[c]; k++)
+                chunkValid[c] = fn(chunkReader, k);
+        });
+        return std::all_of(chunkValid.begin(), chunkValid.end(), [](uint8 b) { return b != 0; });
+    };
+
+    const uint32 revision = ourRevision.fetch_add(h.EquationCount) + 1;
+    bValid = bValid && ForEachChunk([&](Reader& chunkReader, uint32 k) {
+        const Compiled::Equation& rec = equations[k];
+        const int i = myCustomEqStart + (int)k;
+        bool bRead = rec.FirstNode <= h.NodeCount && rec.NodeCount <= h.NodeCount - rec.FirstNode &&
+                     rec.FirstCallee <= h.CalleeCount && rec.CalleeCount <= h.CalleeCount - rec.FirstCallee;
+        if (bRead)
+            bRead = chunkReader.ReadNodes(nodes + rec.FirstNode, rec.NodeCount, 0, *myEquations[i]);
+        if (bRead)
+            myCallees[i].reserve(rec.CalleeCount);
+        for (uint32 c = 0; c < rec.CalleeCount && bRead; c++) {
+            const int32 callee = callees[rec.FirstCallee + c];
+            bRead = callee >= 0 && callee < total;
+            if (bRead)
+                myCallees[i].push_back(callee);
+        }
+        Compiled::SetFlags(*myEquations[i], rec.IParamCount, rec.EParamCount, rec.Flags);
+        myEquations[i]->SetRevision(revision + k);
+        return bRead && Reader::ValidCounts(rec.IParamCount, rec.EParamCount);
+    });
+
+    //Callers are counted first, so that every list is allocated once
+    if (bValid) {
+        std::vector<int> callerCounts(total, 0);
+        for (int i = myCustomEqStart; i < total; i++) {
+            for (int callee : myCallees[i])
+                callerCounts[callee]++;
+        }
+        for (int i = 0; i < total; i++)
+            myCallers[i].reserve(callerCounts[i]);
+        for (int i = myCustomEqStart; i < total; i++) {
+            for (int callee : myCallees[i])
+                myCallers[callee].push_back(i);
+        }
+    }
+
+    //The flags are only trusted once every equation is loaded, as calls can go to later ones. An equation that claims
+    //to be valid has to be: params in range of its counts, calls that get enough arguments and a stack that balances.
+    //Callees are only checked for their flag, but they are checked themselves, and one lie fails the whole file
+    bValid = bValid && ForEachChunk([&](Reader&, uint32 k) {
+        const Equation& eq = *myEquations[myCustomEqStart + (int)k];
+        return !eq.Valid() || eq.Validate(eq.IParamCount(), eq.EParamCount());
+    });
+
+    if (!bValid) {
+        LogWarn("%s is broken, ignoring it", path.c_str());
+        Clear();
+        return false;
+    }
+    return true;
+}
+
+bool Context::LoadFromFileCached(const std::string& path) {
+    PROFILE_ZONE("LoadFromFileCached");
+    uint64 hash;
+    {
+        MappedFile file;
+        if (!file.Open(path))
+            return false;
+        hash = HashSource(file.Data(), file.Size());
+    }
+
+    const std::string compiledPath = CompiledPath(path);
+    if (LoadCompiled(compiledPath, hash)) {
+        LogTrace("Loaded %d precompiled equations from %s", myCount - myCustomEqStart, compiledPath.c_str());
+        return true;
+    }
+
+    Clear();
+    if (!LoadFromFile(path))
+        return false;
+    SaveCompiled(compiledPath, hash);
+    return true;
+}
+
+bool Context::RunTest_Compiled() {
+    bool bSuccess = true;
+    #define TEST(x) \
+        do { \
+            if (!(x)) { \
+                LogError("Context compiled test failed: %s", #x); \
+                bSuccess = false; \
+            } \
+        } while (0)
+
+    const std::string path = (std::filesystem::temp_directory_path() / "graphit_compiled_test.txt").string();
+    const std::string compiledPath = CompiledPath(path);
+    std::error_code err;
+    std::filesystem::remove(compiledPath, err);
+
+    //Calls before the definition, nested arguments, a cycle and a call to nothing. Everything has to come back as it was
+    const std::vector<std::string> lines = {
+        "f(a, b) = a * sin(b) + g(a)",
+        "g(p) = p^2 - -3",
+        "h = f(g(2), f(1, pi / 2)) + e",
+        "x * f(y, sqrt(x*x + 1)) / 4",
+        "c1 = c2 + 1",
+        "c2 = c1",
+        "m = missing(1) + 2",
+        "w(p) = x + sin(t) * p + cos(x * t)",
+    };
+    {
+        std::ofstream f(path, std::ios::binary);
+        for (const std::string& line : lines)
+            f << line << '\n';
+    }
+
+    Context text;
+    TEST(text.LoadFromFileCached(path));
+    TEST(std::filesystem::exists(compiledPath));
+
+    std::ifstream f(path, std::ios::binary);
+    std::string source((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    const uint64 hash = HashSource(source.data(), source.size());
+
+    //Any byte changed, or any bytes cut off the end, give another hash
+    {
+        bool bDiffers = true;
+        std::string edited = source;
+        for (size_t b = 0; b < edited.size(); b++) {
+            edited[b] ^= 1;
+            bDiffers &= HashSource(edited.data(), edited.size()) != hash;
+            edited[b] ^= 1;
+        }
+        for (size_t len = 0; len < source.size(); len++)
+            bDiffers &= HashSource(source.data(), len) != hash;
+        TEST(bDiffers);
+    }
+
+    Clear();
+    TEST(LoadCompiled(compiledPath, hash));
+    TEST(myCount == text.myCount);
+    for (int i = 0; i < myCount && i < text.myCount; i++) {
+        const Equation* a = text.myEquations[i];
+        const Equation* b = myEquations[i];
+        bool bSame = a->Name() == b->Name() && a->Valid() == b->Valid() && a->IParamCount() == b->IParamCount() &&
+                     a->UsesTime() == b->UsesTime() && a->TimeAdditive() == b->TimeAdditive() &&
+                     a->EParamCount() == b->EParamCount() && a->NodeCount() == b->NodeCount() &&
+                     text.myStrEquations[i] == myStrEquations[i] && text.myCallees[i] == myCallees[i];
+        if (bSame && b->Valid() && b->EParamCount() == 0)
+            bSame = myEquations[i]->Evaluate(0.5, 1.5) == text.myEquations[i]->Evaluate(0.5, 1.5);
+        if (!bSame) {
+            LogError("Context compiled test failed. Equation %s differs", myStrEquations[i].data());
+            bSuccess = false;
+        }
+    }
+    TEST(Dependents(FindIndex("g")).size() == 2);
+
+    //Reloading compares lines, so it works on a precompiled context as well
+    {
+        std::vector<std::string> newLines = lines;
+        newLines[1] = "g(p) = p";
+        ReloadStats stats;
+        Reload(newLines, &stats);
+        TEST(stats.Parsed == 1 && stats.Kept == (int)lines.size() - 1 && stats.Resolved == 4);
+        TEST(FindEquation("h")->Valid() && text.FindEquation("h")->Evaluate(0, 0) != FindEquation("h")->Evaluate(0, 0));
+        TEST(myEquationArenas.size() == 1);     //The kept equations are still in it
+    }
+
+    //A file that passes the hash but has a node out of range for the counts it claims, like a stale or edited file,
+    //fails instead of reading past the params when evaluated
+    auto LoadPatched = [&](auto patch) {
+        std::ifstream in(compiledPath, std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        in.close();
+        Compiled::Header h;
+        memcpy(&h, data.data(), sizeof(h));
+        Compiled::Node* patched = reinterpret_cast<Compiled::Node*>(&data[h.NodesOffset]);
+        bool bPatched = false;
+        for (uint32 n = 0; n < h.NodeCount && !bPatched; n++)
+            bPatched = patch(patched[n]);
+        const std::string brokenPath = compiledPath + ".broken";
+        {
+            std::ofstream out(brokenPath, std::ios::binary | std::ios::trunc);
+            out.write(data.data(), data.size());
+        }
+        Context broken;
+        const bool bLoaded = broken.LoadCompiled(brokenPath, hash);
+        std::filesystem::remove(brokenPath, err);
+        return bPatched && !bLoaded;
+    };
+    TEST(LoadPatched([](Compiled::Node& n) { return n.Kind == Compiled::Kind_Param && n.Implicit && (n.Count = 7, true); }));
+    TEST(LoadPatched([](Compiled::Node& n) { return n.Kind == Compiled::Kind_Param && n.Implicit && (n.Count = 2, true); }));
+    TEST(LoadPatched([](Compiled::Node& n) { return n.Kind == Compiled::Kind_Param && !n.Implicit && (n.Count = 5, true); }));
+    //A binary operator that became unary leaves a value too many on the stack
+    TEST(LoadPatched([](Compiled::Node& n) { return n.Kind == Compiled::Kind_Operator && n.Op < NodeOperator::OP_SIN && (n.Op = NodeOperator::OP_NEG, true); }));
+
+    //Other text, or a broken file, leave the context alone
+    TEST(!LoadCompiled(compiledPath, hash + 1));
+    TEST(FindEquation("h") != nullptr);
+    {
+        std::ifstream in(compiledPath, std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        in.close();
+        std::ofstream out(compiledPath, std::ios::binary | std::ios::trunc);
+        out.write(data.data(), data.size() / 2);
+    }
+    TEST(!LoadCompiled(compiledPath, hash));
+
+    //The equations of the arena are freed with it, once none of them is left
+    Reload(std::vector<std::string>());
+    TEST(myEquationArenas.empty() && myCount == myCustomEqStart);
+
+    std::filesystem::remove(compiledPath, err);
+    std::filesystem::remove(path, err);
+
+    #undef TEST
+    Clear();
+    return bSuccess;
+}
+
+} //End of namespace MathParser
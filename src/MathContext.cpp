@@ -3,10 +3,18 @@
 #include "MathNode.h"
 
 #include <unordered_map>
+#include <unordered_set>
+#include <cstring>
 #include <stack>
 #include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <thread>
 
 #include "Maths.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+#include "MappedFile.h"
 
 using std::vector;
 using std::string_view;
@@ -30,7 +38,7 @@ void Equation::Print() const {
         Log(LOG_COL_WARN "----- (Unnamed) -----\n" LOG_COL_RESET);
     }
 
-    for (int i = 0; i < myNodeCount; i++) {
+    for (int i = 0; i < (int)myNodes.size(); i++) {
         const NodeGeneric& node = myNodes[i];
         node.Print();
     }
@@ -51,76 +59,20 @@ void PrintParams(MapParams map) {
     Log("%s----------------------------------%s\n", LOG_COL_WARN, LOG_COL_RESET);
 }
 
-void Context::PrintTokens(const std::vector<TokenData>& tokens) {
-    LogInfo("");
-    Log("%s----------    Tokens    ----------%s\n", LOG_COL_WARN, LOG_COL_RESET);
-    for (const TokenData& t : tokens) {
-        char message[100] = "(Invalid)";
-        switch(t.Type) {
-        case Token_Invalid:
-            break;
-        case Token_Number:
-            sprintf(message, "%-15s: %+.04f", "Number", t.NumberValue);
-            break; 
-        case Token_EqualSign:
-            sprintf(message, "%-15s: =", "EqualSign");
-            break;
-
-        case Token_Expression:
-        {
-            std::string str = std::string(t.Str);
-            sprintf(message, "%-15s: %s", "Expr", str.c_str());
-            break;
-        }
-        
-        case Token_Operator:
-            sprintf(message, "%-15s: %c", "Operator", t.charValue);
-            break;
-        
-        case Token_Comma:
-            sprintf(message, "%-15s: ,", "Comma");
-            break;
-
-        case Token_Param_Start: 
-            sprintf(message, "%-15s: %c", "Param_Start", t.charValue);
-            break;
-        
-        case Token_Param_End:
-            sprintf(message, "%-15s: %c", "Param_End", t.charValue);
-            break;
-
-        case Token_Brack_Start:
-            sprintf(message, "%-15s: %c", "Brack_Start", t.charValue);
-            break;
-
-        case Token_Brack_End:
-            sprintf(message, "%-15s: %c", "Brack_End", t.charValue);
-            break;
-        
-        }
-
-        Log("%s\n", message);
-    
-    }
-    Log("%s----------------------------------%s\n", LOG_COL_WARN, LOG_COL_RESET);
-}
-
-void Context::PrintProperties(bool bPrintBuiltIn) {
+void Context::PrintProperties(bool bPrintBuiltIn) const {
     Log("\n%s----------    Props    ----------%s\n", LOG_COL_WARN, LOG_COL_RESET);
     
 
     int i = (bPrintBuiltIn ? 0 : myCustomEqStart);
-    for (; i < myMaxEquations; i++)
+    for (; i < myCount; i++)
     {
-        Equation* eq = myEquations[i];
-        if (!eq)
-            continue;
+        const Equation* eq = myEquations[i];
         
         if (bPrintBuiltIn && i == myCustomEqStart) {
             Log("%s----------------------------------%s\n", LOG_COL_WARN, LOG_COL_RESET);
         }
 
-        Log("%s\n", myStrEquations[i].c_str() );
+        Log("%s\n", myStrEquations[i].data() );
         Log("%s" LOG_COL_RESET ", implicit: " LOG_COL_INFO "%d" LOG_COL_RESET ", explicit: " LOG_COL_INFO "%d" LOG_COL_RESET "\n", 
             (eq->Valid() ? LOG_COL_INFO "Valid" : LOG_COL_ERROR "Invalid"), 
             eq->IParamCount(), 
@@ -143,7 +95,8 @@ void Context::PrintProperties(bool bPrintBuiltIn) {
 
 void Equation::ResolveEquations(Context* ctx) {
     Assert(ctx);
-    for (int i = 0; i < myNodeCount; i++) {
+    myContext = ctx;
+    for (int i = 0; i < (int)myNodes.size(); i++) {
         if (myNodes[i].type == NodeType::NodeExpression) {
             NodeExpression* node = myNodes[i].GetExpr();
             Assert(node);
@@ -152,6 +105,19 @@ void Equation::ResolveEquations(Context* ctx) {
     }
 }
 
+void Equation::CollectReferences(std::vector<std::string_view>& outNames) const {
+    for (int i = 0; i < (int)myNodes.size(); i++) {
+        if (myNodes[i].type == NodeType::NodeExpression) {
+            const NodeExpression* node = myNodes[i].GetExpr();
+            Assert(node);
+            outNames.push_back(node->Name());
+            for (const Equation& eq : node->GetParams()) {
+                eq.CollectReferences(outNames);
+            }
+        }
+    }
+}
+
 void Equation::FetchProperties() {
     // myIsValid = false;
     // myIParamCount = -1;
@@ -160,13 +126,16 @@ void Equation::FetchProperties() {
     int iParamCount = 0;
     int eParamCount = 0;
 
-    for (int i = 0; i < myNodeCount; i++) {
+    for (int i = 0; i < (int)myNodes.size(); i++) {
         NodeGeneric& n = myNodes[i]; 
 
         if (n.type == NodeType::NodeParam) {
             NodeParam* np = n.GetParam();
             Assert(np);
-            if ( np->Implicit() ) {
+            if ( np->Implicit() && np->Index() == NodeParam::TimeParam ) {
+                //Always passed in, see Evaluate
+            }
+            else if ( np->Implicit() ) {
                 iParamCount = Max(iParamCount, np->Index() + 1);
             }
             else {
@@ -176,6 +145,12 @@ void Equation::FetchProperties() {
         else if (n.type == NodeType::NodeExpression) {
             NodeExpression* ne = n.GetExpr();
             Assert(ne);
+            if (!ne->GetEquation()) {
+                //Calls a function that does not exist (or no longer does, after a reload)
+                SetInvalid();
+                return;
+            }
+            //Only fetches the arguments. The called equation was fetched before this one (see Context::ResolveMarked)
             ne->FetchProperties();
             
             iParamCount = Max(iParamCount, ne->GetEquation()->myIParamCount);
@@ -197,43 +172,201 @@ void Equation::FetchProperties() {
     myIParamCount = iParamCount;
     Assert (myIParamCount <= 3 && myIParamCount >= 0);
 
-    //Calculate IsValid now. The only way to do it is to simulate a Evaluate()
-    std::vector<NodeValue> eParams;
-    eParams.reserve(myEParamCount);
-    for (int i = 0; i < myEParamCount; i++) {
-        eParams.emplace_back(0.0);
+    myUsesTime = myTimeAdditive = false;
+    if (myEParamCount > NodeExpression::MaxParams) {
+        myIsValid = false;
+        return;
     }
-    NodeValue iParams[3];
-    myIsValid = EvaluatePrivate(iParams, myIParamCount, eParams.data() , myEParamCount).Success;
+    myIsValid = Validate(myIParamCount, myEParamCount);
+    if (myIsValid)
+        FetchTimeProperties();
 }
 
-double Equation::Evaluate(double x, double y)
+void Equation::FetchTimeProperties() {
+    //What every value on the stack depends on. Explicit params count as space, as the caller might pass x or y in them
+    struct Term {
+        bool Space;     //x, y, z or an explicit param
+        bool Time;
+        bool Additive;  //Can be split into f(space) + g(time)
+    };
+    Term stack[ValueStack::Capacity];
+    int count = 0;
+
+    for (int i = 0; i < (int)myNodes.size(); i++) {
+        const NodeGeneric& node = myNodes[i];
+        Term term = { false, false, true };
+        switch (node.type) {
+            case NodeType::NodeValue:
+                break;
+
+            case NodeType::NodeParam:
+            {
+                const NodeParam* np = node.GetParam();
+                term.Time = np->Implicit() && np->Index() == NodeParam::TimeParam;
+                term.Space = !term.Time;
+                break;
+            }
+            case NodeType::NodeOperator:
+            {
+                const NodeOperator* op = node.GetOp();
+                const Term b = stack[--count];
+                const Term a = op->Arity() == 2 ? stack[--count] : Term{ false, false, true };
+                term.Space = a.Space || b.Space;
+                term.Time = a.Time || b.Time;
+                if (op->Op() == NodeOperator::OP_ADD || op->Op() == NodeOperator::OP_SUB || op->Op() == NodeOperator::OP_NEG)
+                    term.Additive = a.Additive && b.Additive;
+                else
+                    term.Additive = !(term.Space && term.Time);
+                break;
+            }
+            case NodeType::NodeExpression:
+            {
+                const NodeExpression* ne = node.GetExpr();
+                const Equation* callee = ne->GetEquation();
+                bool bArgsTime = false;
+                for (const Equation& eq : ne->GetParams()) {
+                    term.Space |= eq.IParamCount() > 0 || eq.EParamCount() > 0;
+                    bArgsTime |= eq.UsesTime();
+                }
+                term.Space |= callee->IParamCount() > 0;
+                term.Time = bArgsTime || callee->UsesTime();
+                //The part of an additive callee that uses the time does not use its params
+                term.Additive = !(term.Space && term.Time) || (callee->TimeAdditive() && !bArgsTime);
+                break;
+            }
+            default:
+                break;
+        }
+        stack[count++] = term;
+    }
+
+    Assert(count == 1);
+    myUsesTime = stack[0].Time;
+    myTimeAdditive = stack[0].Time && stack[0].Additive;
+}
+
+bool Equation::Validate(int iSize, int eSize) const {
+    int depth = 0;
+    int maxDepth = 0;
+    for (int i = 0; i < (int)myNodes.size(); i++) {
+        const NodeGeneric& node = myNodes[i];
+        switch (node.type) {
+            case NodeType::NodeValue:
+                depth++;
+                break;
+
+            case NodeType::NodeParam:
+            {
+                const NodeParam* np = node.GetParam();
+                const bool bTime = np->Implicit() && np->Index() == NodeParam::TimeParam;
+                if (!bTime && np->Index() >= (np->Implicit() ? iSize : eSize))
+                    return false;
+                depth++;
+                break;
+            }
+            case NodeType::NodeOperator:
+            {
+                const int arity = node.GetOp()->Arity();
+                if (depth < arity)
+                    return false;
+                depth += 1 - arity;
+                break;
+            }
+            case NodeType::NodeExpression:
+            {
+                //The called equation was already validated, it is only checked that it gets what it needs
+                const NodeExpression* ne = node.GetExpr();
+                const Equation* callee = ne->GetEquation();
+                const int argCount = (int)ne->GetParams().size();
+                if (!callee || !callee->Valid() || argCount > NodeExpression::MaxParams)
+                    return false;
+                if (callee->EParamCount() > argCount || callee->IParamCount() > iSize)
+                    return false;
+
+                for (const Equation& eq : ne->GetParams()) {
+                    if (!eq.Validate(iSize, eSize))
+                        return false;
+                }
+                depth++;
+                break;
+            }
+
+            default:
+                return false;
+        }
+        maxDepth = Max(maxDepth, depth);
+    }
+    return depth == 1 && maxDepth <= ValueStack::Capacity;
+}
+
+Equation::Equation(const Equation& other, Context* ctx, std::pmr::memory_resource* memory):
+    myContext(ctx), myEquationName(other.myEquationName), myNodes(memory),
+    myEParamCount(other.myEParamCount), myIParamCount(other.myIParamCount), myIsValid(other.myIsValid),
+    myUsesTime(other.myUsesTime), myTimeAdditive(other.myTimeAdditive), myRevision(other.myRevision)
 {
-    NodeValue val[2];
-    val[0].SetValue(x);
-    val[1].SetValue(y);
-    NodeValueType ret = EvaluatePrivate(val, 2, nullptr, 0);
-    Assert(ret.Success);
-    return ret.Value.GetValue();
+    myNodes.reserve(other.myNodes.size());
+    for (const NodeGeneric& node : other.myNodes) {
+        const NodeExpression* expr = node.GetExpr();
+        if (!expr) {
+            myNodes.push_back(node);
+            continue;
+        }
+        std::pmr::vector<Equation> params(memory);
+        params.reserve(expr->GetParams().size());
+        for (const Equation& param : expr->GetParams())
+            params.emplace_back(param, ctx, memory);
+        myNodes.push_back( NodeExpression(expr->Name(), std::move(params)) );
+    }
+}
+
+void Equation::SetInvalid() {
+    myEParamCount = myIParamCount = 0;
+    myIsValid = false;
+    myUsesTime = myTimeAdditive = false;
+}
+
+void Equation::SetProperties(int iParamCount, int eParamCount, bool bValid) {
+    myIParamCount = iParamCount;
+    myEParamCount = eParamCount;
+    myIsValid = bValid;
+}
+
+void Equation::SetTimeProperties(bool bUsesTime, bool bTimeAdditive) {
+    myUsesTime = bUsesTime;
+    myTimeAdditive = bTimeAdditive;
 }
 
-double Equation::Evaluate(double x, double y, double z)
+double Equation::Evaluate(double x, double y) const
 {
-    NodeValue val[3];
+    return Evaluate(x, y, 0.0, 0.0);
+}
+
+double Equation::Evaluate(double x, double y, double z) const
+{
+    return Evaluate(x, y, z, 0.0);
+}
+
+double Equation::Evaluate(double x, double y, double z, double t) const
+{
+    //Checked once here instead of at every node
+    Assert(myIsValid && "Only valid equations can be evaluated");
+    if (!myIsValid)
+        return std::numeric_limits<double>::quiet_NaN();
+
+    //Every slot is always passed, Validate made sure that only the ones the equation has are used
+    NodeValue val[NodeParam::ImplicitSlots];
     val[0].SetValue(x);
     val[1].SetValue(y);
     val[2].SetValue(z);
-    NodeValueType ret = EvaluatePrivate(val, 3, nullptr, 0);
-    Assert(ret.Success);
-    return ret.Value.GetValue();
+    val[NodeParam::TimeParam].SetValue(t);
+    return EvaluatePrivate(val, NodeParam::ImplicitSlots, nullptr, 0);
 }
 
-NodeValueType Equation::EvaluatePrivate(NodeValue* iParams, int iSize, NodeValue* eParams, int eSize)
+double Equation::EvaluatePrivate(NodeValue* iParams, int iSize, NodeValue* eParams, int eSize) const
 {
-    //Todo: store this on the stack instead
-    std::stack<NodeValue> stackValues;
-    for (int i = 0; i < myNodeCount; i++) {
-        NodeGeneric& node = myNodes[i];
+    ValueStack stackValues;
+    for (int i = 0; i < (int)myNodes.size(); i++) {
+        const NodeGeneric& node = myNodes[i];
         switch (node.type) {
             case NodeType::NodeValue:
             {
@@ -242,65 +375,100 @@ NodeValueType Equation::EvaluatePrivate(NodeValue* iParams, int iSize, NodeValue
             }
             case NodeType::NodeParam:
             {
-                NodeParam* np = node.GetParam();
-                Assert(np);
-                if (np->Implicit()) {
-                    if (np->Index() >= iSize)
-                        return NodeValueType(false);
-                    
-                    stackValues.push( iParams[np->Index()] );
-                }
-                else {
-                    if (np->Index() >= eSize)
-                        return NodeValueType(false);
-                    stackValues.push( eParams[np->Index()] );
-                }
+                const NodeParam* np = node.GetParam();
+                Assert(np && np->Index() < (np->Implicit() ? iSize : eSize));
+                stackValues.push( np->Implicit() ? iParams[np->Index()] : eParams[np->Index()] );
                 break;
             }
             case NodeType::NodeOperator:
             {
                 //Todo: calculate automatically pops the stack because operators might not always be binary and take two operands
-                NodeValueType res = node.GetOp()->Calculate(stackValues);
-                if (!res.Success)
-                    return res;
-                stackValues.push(res.Value);
+                stackValues.push( node.GetOp()->Calculate(stackValues) );
                 break;
             }
             case NodeType::NodeExpression:
             {
-                NodeValueType res = node.GetExpr()->Calculate(iParams, iSize, eParams, eSize);
-                if (!res.Success)
-                    return res;
-                stackValues.push(res.Value);
+                stackValues.push( node.GetExpr()->Calculate(iParams, iSize, eParams, eSize) );
                 break;
             }
 
             default:
                 Assert(false && "Unknown type");
-                return NodeValueType(false);
                 break;
         } //End of switch
     } //End of for loop
 
-    if (stackValues.size() != 1)
-        return NodeValueType(false);
-    
-    double val = stackValues.top().GetValue();
-    return NodeValueType( true, val );
+    Assert(stackValues.size() == 1);
+    return stackValues.top().GetValue();
 }
 
 //--------------------------------------------------------------------------------
-//                               Context
+//                               NameIndex
 //--------------------------------------------------------------------------------
 
-Context::Context()
-{
+void NameIndex::Clear() {
+    std::fill(mySlots.begin(), mySlots.end(), Slot());
     myCount = 0;
+}
 
-    for (int i = 0; i < myMaxEquations; i++) {
-        myEquations[i] = nullptr;
+void NameIndex::Reserve(size_t count) {
+    size_t capacity = 16;
+    while (capacity < 2 * count)
+        capacity *= 2;
+    if (capacity > mySlots.size())
+        Grow(capacity);
+}
+
+size_t NameIndex::Probe(std::string_view name, uint32 hash) const {
+    const size_t mask = mySlots.size() - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        const Slot& slot = mySlots[i];
+        if (slot.Index < 0)
+            return i;
+        if (slot.Hash == hash && slot.Length == name.size() && (name.empty() || memcmp(slot.Name, name.data(), name.size()) == 0))
+            return i;
     }
+}
+
+void NameIndex::Grow(size_t capacity) {
+    std::vector<Slot> old(capacity);
+    std::swap(old, mySlots);
+    const size_t mask = capacity - 1;
+    for (const Slot& slot : old) {
+        if (slot.Index < 0)
+            continue;
+        size_t i = slot.Hash & mask;
+        while (mySlots[i].Index >= 0)
+            i = (i + 1) & mask;
+        mySlots[i] = slot;
+    }
+}
+
+void NameIndex::Emplace(std::string_view name, int index) {
+    if (2 * (myCount + 1) > mySlots.size())
+        Grow(Max((size_t)16, 2 * mySlots.size()));
+    const uint32 hash = (uint32)std::hash<std::string_view>()(name);
+    Slot& slot = mySlots[Probe(name, hash)];
+    if (slot.Index >= 0)
+        return;
+    slot = { name.data(), (uint32)name.size(), hash, index };
+    myCount++;
+}
 
+int NameIndex::Find(std::string_view name) const {
+    if (myCount == 0)
+        return -1;
+    return mySlots[Probe(name, (uint32)std::hash<std::string_view>()(name))].Index;
+}
+
+//--------------------------------------------------------------------------------
+//                               Context
+//--------------------------------------------------------------------------------
+
+std::atomic<uint32> Context::ourRevision{ 0 };
+
+Context::Context()
+{
     AddInbuiltEqs();
 }
 
@@ -308,6 +476,17 @@ Context::~Context() {
     ClearPrivate();
 }
 
+void Context::PushEquation(Equation* eq, std::string_view str) {
+    Assert(eq);
+    if (eq->Name().size())
+        myNameIndex.Emplace(eq->Name(), myCount);   //Keeps the first one
+    myEquations.push_back(eq);
+    myStrEquations.push_back(str);
+    myCallees.emplace_back();
+    myCallers.emplace_back();
+    myCount++;
+}
+
 void Context::AddInbuiltEqs() {
     
     //sin
@@ -316,11 +495,7 @@ void Context::AddInbuiltEqs() {
         eq->SetName("sin");
         eq->PushNode( NodeParam(0, false) );
         eq->PushNode( NodeOperator(NodeOperator::OP_SIN) );
-        
-        Assert(myCount < myMaxEquations);
-        myEquations[myCount] = eq;
-        myStrEquations[myCount] = "Inbuilt: sin(x)";
-        myCount++;
+        PushEquation(eq, "Inbuilt: sin(x)");
     }
 
     //cos
@@ -329,11 +504,7 @@ void Context::AddInbuiltEqs() {
         eq->SetName("cos");
         eq->PushNode( NodeParam(0, false) );
         eq->PushNode( NodeOperator(NodeOperator::OP_COS) );
-        
-        Assert(myCount < myMaxEquations);
-        myEquations[myCount] = eq;
-        myStrEquations[myCount] = "Inbuilt: cos(x)";
-        myCount++;
+        PushEquation(eq, "Inbuilt: cos(x)");
     }
     //tan
     {
@@ -341,11 +512,7 @@ void Context::AddInbuiltEqs() {
         eq->SetName("tan");
         eq->PushNode( NodeParam(0, false) );
         eq->PushNode( NodeOperator(NodeOperator::OP_TAN) );
-        
-        Assert(myCount < myMaxEquations);
-        myEquations[myCount] = eq;
-        myStrEquations[myCount] = "Inbuilt: tan(x)";
-        myCount++;
+        PushEquation(eq, "Inbuilt: tan(x)");
     }
     
     //sqrt
@@ -354,11 +521,7 @@ void Context::AddInbuiltEqs() {
         eq->SetName("sqrt");
         eq->PushNode( NodeParam(0, false) );
         eq->PushNode( NodeOperator(NodeOperator::OP_SQRT) );
-        
-        Assert(myCount < myMaxEquations);
-        myEquations[myCount] = eq;
-        myStrEquations[myCount] = "Inbuilt: sqrt(x)";
-        myCount++;
+        PushEquation(eq, "Inbuilt: sqrt(x)");
     }
     //exp
     {
@@ -366,11 +529,7 @@ void Context::AddInbuiltEqs() {
         eq->SetName("exp");
         eq->PushNode( NodeParam(0, false) );
         eq->PushNode( NodeOperator(NodeOperator::OP_EXP) );
-        
-        Assert(myCount < myMaxEquations);
-        myEquations[myCount] = eq;
-        myStrEquations[myCount] = "Inbuilt: exp(x)";
-        myCount++;
+        PushEquation(eq, "Inbuilt: exp(x)");
     }
 
     //Constants
@@ -378,24 +537,20 @@ void Context::AddInbuiltEqs() {
         Equation* eq = new Equation;
         eq->SetName("pi");
         eq->PushNode( NodeValue( glm::pi<double>() ) );
-        
-        Assert(myCount < myMaxEquations);
-        myEquations[myCount] = eq;
-        myStrEquations[myCount] = "Inbuilt: pi";
-        myCount++;
+        PushEquation(eq, "Inbuilt: pi");
     }
 
     {
         Equation* eq = new Equation;
         eq->SetName("e");
         eq->PushNode( NodeValue( glm::exp(1) ) );
-        
-        Assert(myCount < myMaxEquations);
-        myEquations[myCount] = eq;
-        myStrEquations[myCount] = "Inbuilt: e";
-        myCount++;
+        PushEquation(eq, "Inbuilt: e");
     }
 
+    //They call nothing, so they can be fetched right away. Reload counts on them being ready
+    for (int i = 0; i < myCount; i++) {
+        myEquations[i]->FetchProperties();
+    }
     myCustomEqStart = myCount;
 }
 
@@ -404,83 +559,401 @@ void Context::Clear() {
     AddInbuiltEqs();
 }
 void Context::ClearPrivate() {
-    for (int i = 0; i < myMaxEquations; i++) {
-        Equation* eq = myEquations[i];
-        if (eq) {
-            delete eq;
-        }
-        myEquations[i] = nullptr;
-        myStrEquations[i] = "";
+    for (Equation* eq : myEquations) {
+        DeleteEquation(eq);
     }
+    myEquations.clear();
+    myStrEquations.clear();
+    myCallees.clear();
+    myCallers.clear();
+    myNameIndex.Clear();
+    myArenas.clear();
+    myEquationArenas.clear();
     myCount = 0;
 }
 
-Context& Context::operator= (Context&& other) {
-    int maxCount = Max(myCount, other.myCount);
-    for (int i = 0; i < maxCount; i++) {
-        std::swap(myStrEquations[i], other.myStrEquations[i]);
-        std::swap(myEquations[i], other.myEquations[i]);
+Context::EquationArena::~EquationArena() {
+    for (int i = 0; i < Count; i++)
+        Equations[i].~Equation();
+}
+
+bool Context::EquationArena::Owns(const Equation* eq) const {
+    std::less<const Equation*> less;
+    return !less(eq, Equations) && less(eq, Equations + Count);
+}
+
+void Context::DeleteEquation(Equation* eq) {
+    for (const std::unique_ptr<EquationArena>& arena : myEquationArenas) {
+        if (arena->Owns(eq))
+            return;
     }
+    delete eq;
+}
+
+Context& Context::operator= (Context&& other) {
+    std::swap(myStrEquations, other.myStrEquations);
+    std::swap(myEquations, other.myEquations);
+    std::swap(myCallees, other.myCallees);
+    std::swap(myCallers, other.myCallers);
+    std::swap(myNameIndex, other.myNameIndex);
+    std::swap(myArenas, other.myArenas);
+    std::swap(myEquationArenas, other.myEquationArenas);
     std::swap(myCount, other.myCount);
 
     return *this;
 }
 
+//Below this many items the thread pool costs more than it saves
+static constexpr int ParallelBlock = 256;
+
+//Calls fn(i) for every i in [0, count), in blocks of ParallelBlock on the thread pool
+template<typename Fn>
+static void ParallelBlocks(int count, const Fn& fn) {
+    if (count <= ParallelBlock) {
+        for (int i = 0; i < count; i++)
+            fn(i);
+        return;
+    }
+
+    ThreadPool::Global().ParallelFor((count + ParallelBlock - 1) / ParallelBlock, [&](int32 block) {
+        const int end = Min(count, (block + 1) * ParallelBlock);
+        for (int i = block * ParallelBlock; i < end; i++)
+            fn(i);
+    });
+}
+
 bool Context::Resolve() {
+    PROFILE_ZONE("Resolve");
+    BuildGraph();
+    ResolveMarked(std::vector<bool>(myCount, true));
+    return true;
+}
+
+int Context::FindIndex(const std::string_view& name) const {
+    return myNameIndex.Find(name);
+}
+
+void Context::BuildGraph() {
+    PROFILE_ZONE("BuildGraph");
+    myNameIndex.Clear();
+    myNameIndex.Reserve(myCount);
     for (int i = 0; i < myCount; i++) {
-        Assert(myEquations[i]);
-        if (myEquations[i]) {
+        if (myEquations[i]->Name().size())
+            myNameIndex.Emplace(myEquations[i]->Name(), i);
+    }
+
+    myCallees.resize(myCount);
+    myCallers.resize(myCount);
+    for (int i = 0; i < myCount; i++) {
+        myCallees[i].clear();
+        myCallers[i].clear();
+    }
+
+    //Looking up the names is most of the work and only reads the index, so it is done in parallel
+    ParallelBlocks(myCount, [&](int i) {
+        thread_local std::vector<string_view> refs;
+        refs.clear();
+        myEquations[i]->CollectReferences(refs);
+        for (string_view ref : refs) {
+            int callee = FindIndex(ref);
+            if (callee < 0 || std::find(myCallees[i].begin(), myCallees[i].end(), callee) != myCallees[i].end())
+                continue;
+            myCallees[i].push_back(callee);
+        }
+    });
+    for (int i = 0; i < myCount; i++) {
+        for (int callee : myCallees[i])
+            myCallers[callee].push_back(i);
+    }
+}
+
+void Context::ResolveMarked(const std::vector<bool>& marked) {
+    PROFILE_ZONE("ResolveMarked");
+    Assert((int)marked.size() >= myCount);
+
+    //Only reads the name index, so every equation can look up its callees at once
+    ParallelBlocks(myCount, [&](int i) {
+        if (marked[i])
             myEquations[i]->ResolveEquations(this);
+    });
+
+    //Kahn's algorithm, a level at a time. Whatever is left with callees that were never ordered is on a cycle, or
+    //calls one
+    std::vector<int> remaining(myCount);
+    std::vector<int> order;
+    std::vector<int> levelEnds;     //Level k is order[levelEnds[k-1], levelEnds[k])
+    order.reserve(myCount);
+    for (int i = 0; i < myCount; i++) {
+        remaining[i] = (int)myCallees[i].size();
+        if (remaining[i] == 0)
+            order.push_back(i);
+    }
+    for (int start = 0; start < (int)order.size(); ) {
+        const int end = (int)order.size();
+        for (int k = start; k < end; k++) {
+            for (int caller : myCallers[order[k]]) {
+                if (--remaining[caller] == 0)
+                    order.push_back(caller);
+            }
         }
+        levelEnds.push_back(end);
+        start = end;
     }
-    
+
+    //A block of revisions, one for every equation
+    const uint32 revision = ourRevision.fetch_add((uint32)myCount) + 1;
+    int levelStart = 0;
+    for (int levelEnd : levelEnds) {
+        ParallelBlocks(levelEnd - levelStart, [&](int k) {
+            const int i = order[levelStart + k];
+            if (marked[i]) {
+                myEquations[i]->FetchProperties();
+                myEquations[i]->SetRevision(revision + i);
+            }
+        });
+        levelStart = levelEnd;
+    }
+
+    if ((int)order.size() == myCount)
+        return;
+
+    std::vector<bool> reported(myCount, false);
+    std::vector<int> visitedAt(myCount, -1);
+    std::vector<int> path;
     for (int i = 0; i < myCount; i++) {
-        Assert(myEquations[i]);
-        if (myEquations[i]) {
-            myEquations[i]->FetchProperties();
+        if (remaining[i] == 0 || !marked[i])
+            continue;
+
+        myEquations[i]->SetInvalid();
+        myEquations[i]->SetRevision(revision + i);
+        if (reported[i])
+            continue;
+
+        //Every equation that is left calls at least one other that is left, so following them has to come back around.
+        //Either onto this path (a cycle that was not reported yet) or onto the path of an earlier equation
+        path.clear();
+        int cur = i;
+        while (visitedAt[cur] < 0 && !reported[cur]) {
+            visitedAt[cur] = (int)path.size();
+            path.push_back(cur);
+            for (int callee : myCallees[cur]) {
+                if (remaining[callee] > 0) {
+                    cur = callee;
+                    break;
+                }
+            }
+        }
+        for (int k : path)
+            reported[k] = true;
+        const int cycleStart = visitedAt[cur];
+        for (int k : path)
+            visitedAt[k] = -1;
+        if (cycleStart < 0)
+            continue;
+
+        std::string strCycle;
+        for (int k = cycleStart; k < (int)path.size(); k++) {
+            strCycle += std::string(myEquations[path[k]]->Name()) + " -> ";
         }
+        strCycle += std::string(myEquations[cur]->Name());
+        LogError("Circular dependency: %s", strCycle.c_str());
     }
+}
 
-    return true;
+const std::vector<int>& Context::Dependents(int index) const {
+    Assert(index >= 0 && index < myCount);
+    return myCallers[index];
 }
 
-Equation* Context::FindEquation(const std::string_view& str) {
-    for (int i = 0; i < myCount; i++) {
-        Assert(myEquations[i]);
+void Context::CollectDependents(std::vector<int>& inOutIndices) const {
+    std::vector<bool> added(myCount, false);
+    for (int i : inOutIndices)
+        added[i] = true;
 
-        if (myEquations[i] && myEquations[i]->Name() == str) {
-            return myEquations[i];
+    for (size_t k = 0; k < inOutIndices.size(); k++) {
+        for (int caller : myCallers[inOutIndices[k]]) {
+            if (!added[caller]) {
+                added[caller] = true;
+                inOutIndices.push_back(caller);
+            }
         }
     }
-    return nullptr;
+}
+
+Equation* Context::FindEquation(const std::string_view& str) {
+    int index = FindIndex(str);
+    return index >= 0 ? myEquations[index] : nullptr;
 }
 
 Equation* Context::FindEquationIndex(int index) {
-    Assert(index < myMaxEquations);
-    if (index < myMaxEquations)
+    Assert(index >= 0 && index < myCount);
+    if (index >= 0 && index < myCount)
         return myEquations[index];
     return nullptr;
 }
 
-bool Context::LoadFromFile(const std::string& str) {
+const Equation* Context::FindEquation(const std::string_view& str) const {
+    int index = FindIndex(str);
+    return index >= 0 ? myEquations[index] : nullptr;
+}
+
+const Equation* Context::FindEquationIndex(int index) const {
+    Assert(index >= 0 && index < myCount);
+    if (index >= 0 && index < myCount)
+        return myEquations[index];
+    return nullptr;
+}
+
+std::string_view Context::StoreLine(std::string_view str) {
+    Arena arena;
+    arena.Size = str.size() + 1;
+    arena.Data.reset(new char[arena.Size]);
+    memcpy(arena.Data.get(), str.data(), str.size());
+    arena.Data[str.size()] = '\0';
+
+    string_view res(arena.Data.get(), str.size());
+    myArenas.push_back(std::move(arena));
+    return res;
+}
+
+void Context::ReleaseUnusedArenas() {
+    size_t keptEquations = 0;
+    for (size_t a = 0; a < myEquationArenas.size(); a++) {
+        const EquationArena& arena = *myEquationArenas[a];
+        if (std::any_of(myEquations.begin(), myEquations.end(), [&arena](const Equation* eq) { return arena.Owns(eq); }))
+            myEquationArenas[keptEquations++] = std::move(myEquationArenas[a]);
+    }
+    myEquationArenas.resize(keptEquations);
+
+    if (myArenas.empty())
+        return;
+
+    std::less<const char*> less;
+    std::sort(myArenas.begin(), myArenas.end(), [&less](const Arena& a, const Arena& b) { return less(a.Data.get(), b.Data.get()); });
+
+    std::vector<bool> used(myArenas.size(), false);
+    for (string_view str : myStrEquations) {
+        //The last arena that starts at or before the line. The inbuilt lines are in none of them
+        auto it = std::upper_bound(myArenas.begin(), myArenas.end(), str.data(), [&less](const char* ptr, const Arena& a) { return less(ptr, a.Data.get()); });
+        if (it == myArenas.begin())
+            continue;
+        --it;
+        if (less(str.data(), it->Data.get() + it->Size))
+            used[it - myArenas.begin()] = true;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < myArenas.size(); i++) {
+        if (used[i])
+            myArenas[kept++] = std::move(myArenas[i]);
+    }
+    myArenas.resize(kept);
+}
+
+bool Context::ReadLines(const std::string& path, std::vector<std::string>& outLines) {
     std::ifstream file;
-    file.open(str.c_str());
+    file.open(path.c_str());
     if (!file.is_open())
     {
         return false;
     }
 
-    char buff[300];
-    while (!file.eof())
+    //Lines can be of any length
+    std::string line;
+    while (std::getline(file, line))
     {
-        file.getline(buff, 300);
-         if ( buff[0] == '\0' || buff[0] == '#' )
-             continue;
+        //Files saved on windows
+        if (line.size() && line.back() == '\r')
+            line.pop_back();
+        outLines.push_back(std::move(line));
+    }
+    return true;
+}
+
+//Files are split into chunks of at least this size, so small files are parsed on the calling thread
+static constexpr size_t MinChunkBytes = 16 * 1024;
 
-        // LogTrace("Line: %s", buff);
-        AddEquation(buff);
+bool Context::LoadFromFile(const std::string& str) {
+    PROFILE_ZONE("LoadFromFile");
+    MappedFile file;
+    if (!file.Open(str))
+        return false;
+
+    //A few chunks per thread, so that a chunk with long lines does not hold up the rest. Chunks end after a '\n' (or at
+    //the end of the file), so no line is split
+    const char* data = file.Data();
+    const size_t size = file.Size();
+    //Data() is null for an empty file, which memcpy must not be given even for no bytes
+    if (size == 0)
+        return Resolve();
+    const size_t maxChunks = (size_t)(ThreadPool::Global().ThreadCount() + 1) * 4;
+    const size_t chunkCount = Max((size_t)1, Min(size / MinChunkBytes, maxChunks));
+
+    std::vector<size_t> bounds = { 0 };
+    for (size_t c = 1; c < chunkCount; c++) {
+        size_t pos = Max(size * c / chunkCount, bounds.back());
+        const char* nl = (const char*)memchr(data + pos, '\n', size - pos);
+        bounds.push_back(nl ? (size_t)(nl - data) + 1 : size);
     }
-    
+    bounds.push_back(size);
+
+    //Every chunk copies its text into its own arena, which the context takes over afterwards
+    struct Chunk {
+        Arena Text;
+        std::vector<Equation*> Equations;
+        std::vector<string_view> Lines;
+    };
+    std::vector<Chunk> chunks(bounds.size() - 1);
+
+    ThreadPool::Global().ParallelFor((int32)chunks.size(), [&](int32 c) {
+        PROFILE_ZONE("ParseChunk");
+        Chunk& chunk = chunks[c];
+        const size_t len = bounds[c + 1] - bounds[c];
+        chunk.Text.Size = len + 1;
+        chunk.Text.Data.reset(new char[len + 1]);
+        char* text = chunk.Text.Data.get();
+        memcpy(text, data + bounds[c], len);
+        text[len] = '\0';
+
+        //Lines are terminated in place, as ParseEquation wants
+        char* const end = text + len;
+        for (char* line = text; line < end; ) {
+            char* nl = (char*)memchr(line, '\n', end - line);
+            char* lineEnd = nl ? nl : end;
+            *lineEnd = '\0';
+            //Files saved on windows
+            if (lineEnd > line && lineEnd[-1] == '\r')
+                *--lineEnd = '\0';
+
+            string_view strLine(line, lineEnd - line);
+            line = (nl ? nl : end) + 1;
+            if (strLine.empty() || strLine[0] == '#')
+                continue;
+
+            Equation* eq = ParseEquation(strLine);
+            if (!eq)
+                continue;
+            chunk.Equations.push_back(eq);
+            chunk.Lines.push_back(strLine);
+        }
+    });
+
+    //Merged in file order, so the first equation with a name is the same as when parsing line by line
+    size_t total = myEquations.size();
+    for (const Chunk& chunk : chunks)
+        total += chunk.Equations.size();
+    myEquations.reserve(total);
+    myStrEquations.reserve(total);
+    myNameIndex.Reserve(total);
+
+    for (Chunk& chunk : chunks) {
+        for (size_t k = 0; k < chunk.Equations.size(); k++) {
+            PushEquation(chunk.Equations[k], chunk.Lines[k]);
+        }
+        if (chunk.Equations.size())
+            myArenas.push_back(std::move(chunk.Text));
+    }
+
     if ( !Resolve()) {
         return false;
     }
@@ -488,14 +961,727 @@ bool Context::LoadFromFile(const std::string& str) {
     return true;
 }
 
+bool Context::ReloadFromFile(const std::string& str, ReloadStats* outStats) {
+    PROFILE_ZONE("LoadFromFile");
+    std::vector<std::string> lines;
+    if (!ReadLines(str, lines))
+        return false;
+
+    Reload(lines, outStats);
+    return true;
+}
+
+void Context::Reload(const std::vector<std::string>& lines, ReloadStats* outStats) {
+    PROFILE_ZONE("Reload");
+    ReloadStats stats;
+
+    //The previous load, by line. A line can be in the file more than once
+    std::unordered_multimap<string_view, int> oldLines;
+    for (int i = myCustomEqStart; i < myCount; i++) {
+        oldLines.emplace(myStrEquations[i], i);
+    }
+
+    std::vector<Equation*> newEquations(myEquations.begin(), myEquations.begin() + myCustomEqStart);
+    std::vector<string_view> newStrEquations(myStrEquations.begin(), myStrEquations.begin() + myCustomEqStart);
+    std::vector<bool> dirty(myCustomEqStart, false);
+    for (int i = 0; i < myCustomEqStart; i++) {
+        myEquations[i] = nullptr;
+    }
+
+    for (const std::string& line : lines) {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        auto it = oldLines.find(line);
+        if (it != oldLines.end()) {
+            newEquations.push_back(myEquations[it->second]);
+            newStrEquations.push_back(myStrEquations[it->second]);
+            dirty.push_back(false);
+            myEquations[it->second] = nullptr;
+            oldLines.erase(it);
+            stats.Kept++;
+            continue;
+        }
+
+        string_view str = StoreLine(line);
+        Equation* eq = ParseEquation(str);
+        if (!eq)
+            continue;
+
+        newEquations.push_back(eq);
+        newStrEquations.push_back(str);
+        dirty.push_back(true);
+        stats.Parsed++;
+    }
+
+    //Anything that called a removed equation is broken now, or calls another equation with the same name. The names
+    //point into arenas, which are only released at the end
+    std::unordered_set<string_view> removedNames;
+    for (int i = myCustomEqStart; i < myCount; i++) {
+        if (myEquations[i]) {
+            if (myEquations[i]->Name().size())
+                removedNames.insert(myEquations[i]->Name());
+            stats.Removed++;
+        }
+    }
+
+    for (int i = myCustomEqStart; i < myCount; i++) {
+        DeleteEquation(myEquations[i]);
+    }
+    myEquations = std::move(newEquations);
+    myStrEquations = std::move(newStrEquations);
+    myCount = (int)myEquations.size();
+    BuildGraph();
+
+    //Parsed equations and the ones that called a removed equation have to be resolved again, and so does everything
+    //that depends on them
+    std::vector<int> changed;
+    std::vector<string_view> refs;
+    for (int i = myCustomEqStart; i < myCount; i++) {
+        if (dirty[i]) {
+            changed.push_back(i);
+            continue;
+        }
+
+        refs.clear();
+        myEquations[i]->CollectReferences(refs);
+        for (string_view ref : refs) {
+            if (removedNames.count(ref)) {
+                changed.push_back(i);
+                break;
+            }
+        }
+    }
+    CollectDependents(changed);
+
+    for (int i : changed)
+        dirty[i] = true;
+    stats.Resolved = (int)changed.size();
+    ResolveMarked(dirty);
+    ReleaseUnusedArenas();
+
+    if (outStats)
+        *outStats = stats;
+}
+
+//Equations kept by LoadFromFileAfter are copied in chunks of at least this many
+static constexpr int MinChunkCopies = 1024;
+
+bool Context::LoadFromFileAfter(const std::string& path, const Context& previous, ReloadStats* outStats) {
+    PROFILE_ZONE("LoadFromFileAfter");
+    MappedFile file;
+    if (!file.Open(path))
+        return false;
+    Clear();
+    ReloadStats stats;
+
+    //The same as Reload, but previous is still read by other threads, so the equations of the lines that did not change
+    //are copied out of it. Their text stays where it is, this context shares the arenas with previous
+    myArenas = previous.myArenas;
+
+    //Previous, by line. A line can be in the file more than once, the index has the first and nextSame chains the rest
+    //in order. unused[first] is the first of the chain that was not matched yet
+    NameIndex oldLines;
+    std::vector<int> nextSame(previous.myCount, -1);
+    std::vector<int> unused(previous.myCount, -1);
+    std::vector<int> lastSame(previous.myCount, -1);
+    std::vector<bool> matched(previous.myCount, false);
+    oldLines.Reserve(previous.myCount - previous.myCustomEqStart);
+    for (int i = previous.myCustomEqStart; i < previous.myCount; i++) {
+        const int first = oldLines.Find(previous.myStrEquations[i]);
+        if (first < 0) {
+            oldLines.Emplace(previous.myStrEquations[i], i);
+            unused[i] = lastSame[i] = i;
+        }
+        else {
+            nextSame[lastSame[first]] = i;
+            lastSame[first] = i;
+        }
+    }
+
+    //Kept lines point at the text of previous, new ones at the file until they are stored
+    struct Line {
+        string_view Str;
+        int Previous;   //Index in previous, -1 for a new line
+    };
+    std::vector<Line> lines;
+    size_t newBytes = 0;
+    const char* const data = file.Data();
+    const char* const end = data + file.Size();
+    for (const char* line = data; line < end; ) {
+        const char* nl = (const char*)memchr(line, '\n', end - line);
+        string_view str(line, (nl ? nl : end) - line);
+        line = (nl ? nl : end) + 1;
+        //Files saved on windows
+        if (str.size() && str.back() == '\r')
+            str.remove_suffix(1);
+        if (str.empty() || str[0] == '#')
+            continue;
+
+        const int first = oldLines.Find(str);
+        if (first >= 0 && unused[first] >= 0) {
+            const int old = unused[first];
+            unused[first] = nextSame[old];
+            matched[old] = true;
+            lines.push_back({ previous.myStrEquations[old], old });
+            continue;
+        }
+        lines.push_back({ str, -1 });
+        newBytes += str.size() + 1;
+    }
+
+    //The new lines go into one arena, null terminated as ParseEquation wants
+    if (newBytes) {
+        Arena text;
+        text.Size = newBytes;
+        text.Data.reset(new char[newBytes]);
+        char* dst = text.Data.get();
+        for (Line& l : lines) {
+            if (l.Previous >= 0)
+                continue;
+            memcpy(dst, l.Str.data(), l.Str.size());
+            dst[l.Str.size()] = '\0';
+            l.Str = string_view(dst, l.Str.size());
+            dst += l.Str.size() + 1;
+        }
+        myArenas.push_back(std::move(text));
+    }
+
+    //The kept equations are copied into one block, with their nodes in memory per chunk, like LoadCompiled does. Copies
+    //only read previous, so the chunks are copied in parallel
+    std::vector<Equation*> equations(lines.size(), nullptr);
+    std::vector<int> kept;      //Index in lines
+    for (int k = 0; k < (int)lines.size(); k++) {
+        if (lines[k].Previous >= 0)
+            kept.push_back(k);
+    }
+    if (kept.size()) {
+        const int keptCount = (int)kept.size();
+        const int chunkCount = Max(1, Min(keptCount / MinChunkCopies, (ThreadPool::Global().ThreadCount() + 1) * 4));
+        const int chunkSize = (keptCount + chunkCount - 1) / chunkCount;
+        std::unique_ptr<EquationArena> arena = std::make_unique<EquationArena>(keptCount * sizeof(Equation));
+        arena->Equations = static_cast<Equation*>(arena->Memory.allocate(keptCount * sizeof(Equation), alignof(Equation)));
+        for (int c = 0; c < chunkCount; c++) {
+            size_t nodes = 0;
+            for (int j = c * chunkSize; j < Min(keptCount, (c + 1) * chunkSize); j++)
+                nodes += previous.myEquations[lines[kept[j]].Previous]->NodeCount();
+            arena->Nodes.push_back(std::make_unique<std::pmr::monotonic_buffer_resource>(Max(nodes * sizeof(NodeGeneric), (size_t)64)));
+        }
+
+        EquationArena& copies = *arena;
+        ThreadPool::Global().ParallelFor(chunkCount, [&](int32 c) {
+            PROFILE_ZONE("CopyChunk");
+            for (int j = c * chunkSize; j < Min(keptCount, (c + 1) * chunkSize); j++) {
+                const Equation& old = *previous.myEquations[lines[kept[j]].Previous];
+                equations[kept[j]] = new (&copies.Equations[j]) Equation(old, this, copies.Nodes[c].get());
+            }
+        });
+        arena->Count = keptCount;
+        myEquationArenas.push_back(std::move(arena));
+    }
+
+    //Parsing only reads the line, so the new ones are parsed in parallel too
+    ParallelBlocks((int)lines.size(), [&](int k) {
+        if (lines[k].Previous < 0)
+            equations[k] = ParseEquation(lines[k].Str);
+    });
+
+    myEquations.reserve(myCustomEqStart + lines.size());
+    myStrEquations.reserve(myCustomEqStart + lines.size());
+    std::vector<bool> dirty(myCustomEqStart, false);
+    for (size_t k = 0; k < lines.size(); k++) {
+        if (!equations[k])
+            continue;
+        PushEquation(equations[k], lines[k].Str);
+        dirty.push_back(lines[k].Previous < 0);
+        if (lines[k].Previous >= 0)
+            stats.Kept++;
+        else
+            stats.Parsed++;
+    }
+
+    std::unordered_set<string_view> removedNames;
+    for (int i = previous.myCustomEqStart; i < previous.myCount; i++) {
+        if (matched[i])
+            continue;
+        const Equation* eq = previous.myEquations[i];
+        if (eq->Name().size())
+            removedNames.insert(eq->Name());
+        stats.Removed++;
+    }
+    BuildGraph();
+
+    //The calls of the copies go nowhere yet. Pointing them at the equations of this context only looks up names, nothing
+    //is fetched again. Copies that called a removed equation are broken now, or call another one with the same name
+    std::vector<uint8> callsRemoved(myCount, 0);
+    ParallelBlocks(myCount - myCustomEqStart, [&](int k) {
+        const int i = myCustomEqStart + k;
+        if (dirty[i])
+            return;
+        myEquations[i]->ResolveEquations(this);
+        if (removedNames.empty())
+            return;
+
+        thread_local std::vector<string_view> refs;
+        refs.clear();
+        myEquations[i]->CollectReferences(refs);
+        for (string_view ref : refs) {
+            if (removedNames.count(ref)) {
+                callsRemoved[i] = 1;
+                break;
+            }
+        }
+    });
+
+    //Parsed equations and the broken copies have to be resolved, and so does everything that depends on them
+    std::vector<int> changed;
+    for (int i = myCustomEqStart; i < myCount; i++) {
+        if (dirty[i] || callsRemoved[i])
+            changed.push_back(i);
+    }
+    CollectDependents(changed);
+
+    for (int i : changed)
+        dirty[i] = true;
+    stats.Resolved = (int)changed.size();
+    ResolveMarked(dirty);
+    ReleaseUnusedArenas();
+
+    if (outStats)
+        *outStats = stats;
+    return true;
+}
+
 bool Context::RunAllTests() {
     Context c;
-    bool bVal = c.RunTest_InfixToToken();
+    bool bVal = c.RunTest_Parser();
+    bVal &= c.RunTest_Reload();
+    bVal &= c.RunTest_Graph();
+    bVal &= c.RunTest_LoadFile();
+    bVal &= c.RunTest_Compiled();
+    bVal &= c.RunTest_Snapshots();
     return bVal;
 }
 
-bool Context::RunTest_InfixToToken() {
-    return true;
+
+bool Context::RunTest_Parser() {
+    bool bSuccess = true;
+
+    //Values of constant expressions
+    struct ValueTest { const char* Str; double Value; };
+    const ValueTest values[] = {
+        { "2 + 3 * 4 ^ 2",      50.0 },
+        { "2^3^2",              64.0 },
+        { "10 - 4 - 3",         3.0 },
+        { "-2^2",               -4.0 },
+        { "-(1 + 2) * 3",       -9.0 },
+        { "2 * -3 + +1",        -5.0 },
+        { "[1 + 2] * {3}",      9.0 },
+        { "1e2 / .5",           200.0 },
+        { "k = sqrt(16) - -1",  5.0 },
+    };
+    for (const ValueTest& t : values) {
+        Reload({ t.Str });
+        Equation* eq = FindEquationIndex(myCustomEqStart);
+        if (myCount != myCustomEqStart + 1 || !eq->Valid() || eq->Evaluate(0, 0) != t.Value) {
+            LogError("Parser test failed: %s should be %f", t.Str, t.Value);
+            bSuccess = false;
+        }
+    }
+
+    //Errors point at the offending column
+    struct ErrorTest { const char* Str; int Column; };
+    const ErrorTest errors[] = {
+        { "1 + * 2",            4 },
+        { "f(1, 2",             6 },
+        { "sin(x))",            6 },
+        { "(1 + 2]",            6 },
+        { "a = b = 2",          6 },
+        { "2 $ 3",              2 },
+        { "2 x",                2 },
+        { "f(x) = x",           2 },
+        { "f(a, a) = a",        5 },
+        { "t = 2",              0 },
+        { "f(t) = 1",           2 },
+        { "= 2",                0 },
+    };
+    for (const ErrorTest& t : errors) {
+        Equation eq(this);
+        ParseError err;
+        if (ParseLine(t.Str, &eq, &err) || err.Column != t.Column) {
+            LogError("Parser test failed: %s should fail at column %d, got %d (%s)", t.Str, t.Column, err.Column, err.Message.c_str());
+            bSuccess = false;
+        }
+    }
+
+    //Lines are not limited in length
+    {
+        std::string str = "1";
+        for (int i = 0; i < 5000; i++)
+            str += " + 1";
+        std::string nested = std::string(200, '(') + "2" + std::string(200, ')');
+        Reload({ str, nested });
+        if (!myEquations[myCustomEqStart]->Valid() || myEquations[myCustomEqStart]->Evaluate(0, 0) != 5001.0 ||
+            !myEquations[myCustomEqStart + 1]->Valid() || myEquations[myCustomEqStart + 1]->Evaluate(0, 0) != 2.0) {
+            LogError("Parser test failed: long lines");
+            bSuccess = false;
+        }
+    }
+
+    //The time is not a param of the surface. Additive equations can be moved instead of evaluated again
+    {
+        struct TimeTest { const char* Name; bool UsesTime; bool Additive; int IParams; };
+        const TimeTest times[] = {
+            { "g",  true,  false, 0 },
+            { "a",  true,  true,  1 },
+            { "b",  true,  false, 1 },
+            { "c",  true,  false, 1 },
+            { "d",  true,  true,  2 },
+            { "f2", true,  true,  1 },
+            { "s",  false, false, 2 },
+        };
+        Reload({ "g(p) = p * t", "a = x + sin(t)", "b = x * t", "c = g(x) + t", "d = -y + g(t)", "f2 = x^2 + g(2)", "s = x + y" });
+        for (const TimeTest& t : times) {
+            const Equation* eq = FindEquation(t.Name);
+            if (!eq || !eq->Valid() || eq->UsesTime() != t.UsesTime || eq->TimeAdditive() != t.Additive || eq->IParamCount() != t.IParams) {
+                LogError("Parser test failed: time properties of %s", t.Name);
+                bSuccess = false;
+            }
+        }
+        if (FindEquation("a")->Evaluate(1, 0, 0, 3.14159265358979 / 2) != 2.0 || FindEquation("c")->Evaluate(2, 0, 0, 3) != 9.0 ||
+            FindEquation("a")->Evaluate(1, 0) != 1.0) {
+            LogError("Parser test failed: evaluating with a time");
+            bSuccess = false;
+        }
+    }
+
+    //Domain errors give NaN, which carries through operators and calls
+    {
+        Reload({ "r(p) = sqrt(p)", "n1 = sqrt(-1)", "n2 = 1 / 0", "n3 = r(x) + 1", "n4 = 0 * (1 / x)" });
+        const ValueTest tests[] = { { "n1", 0 }, { "n2", 0 }, { "n3", -4 }, { "n4", 0 } };     //Value is x here
+        for (const ValueTest& test : tests) {
+            Equation* eq = FindEquation(test.Str);
+            if (!eq || !eq->Valid() || !std::isnan(eq->Evaluate(test.Value, 0))) {
+                LogError("Parser test failed: %s should be NaN", test.Str);
+                bSuccess = false;
+            }
+        }
+        if (FindEquation("n3")->Evaluate(4, 0) != 3.0 || FindEquation("n4")->Evaluate(4, 0) != 0.0) {
+            LogError("Parser test failed: evaluating around NaN");
+            bSuccess = false;
+        }
+    }
+
+    Clear();
+    return bSuccess;
+}
+
+bool Context::RunTest_Reload() {
+    bool bSuccess = true;
+    #define TEST(x) \
+        do { \
+            if (!(x)) { \
+                LogError("Context reload test failed: %s", #x); \
+                bSuccess = false; \
+            } \
+        } while (0)
+
+    ReloadStats stats;
+    Reload({ "k = 2", "f(p) = k*p", "h = f(3)", "", "# comment", "g = 5", "x + y" }, &stats);
+    TEST(stats.Parsed == 5 && stats.Kept == 0 && stats.Resolved == 5);
+    TEST(GetCount() == myCustomEqStart + 5);
+
+    Equation* g = FindEquation("g");
+    Equation* h = FindEquation("h");
+    TEST(h && h->Valid() && h->Evaluate(0, 0) == 6.0);
+
+    //Changing k has to re-resolve f and h (through f), but not g
+    const uint32 gRevision = g ? g->Revision() : 0;
+    Reload({ "k = 4", "f(p) = k*p", "h = f(3)", "g = 5", "x + y" }, &stats);
+    TEST(stats.Parsed == 1 && stats.Kept == 4 && stats.Removed == 1 && stats.Resolved == 3);
+    TEST(FindEquation("g") == g && g->Revision() == gRevision);
+    TEST(FindEquation("h") == h && h->Evaluate(0, 0) == 12.0);
+
+    //Removing k leaves f and h invalid
+    Reload({ "f(p) = k*p", "h = f(3)", "g = 5", "x + y" }, &stats);
+    TEST(stats.Parsed == 0 && stats.Removed == 1 && stats.Resolved == 2);
+    TEST(!FindEquation("h")->Valid());
+
+    //Long lines are read in full
+    const std::string path = (std::filesystem::temp_directory_path() / "graphit_reload_test.txt").string();
+    {
+        std::ofstream f(path);
+        f << "k = 1" << std::string(1000, ' ') << "+ 7\n" << "f(p) = k*p\r\n";
+    }
+    TEST(ReloadFromFile(path, &stats));
+    TEST(stats.Parsed == 1 && stats.Kept == 1 && stats.Removed == 3);
+    TEST(FindEquation("k") && FindEquation("k")->Evaluate(0, 0) == 8.0);
+    std::error_code err;
+    std::filesystem::remove(path, err);
+
+    #undef TEST
+    return bSuccess;
+}
+
+bool Context::RunTest_Graph() {
+    bool bSuccess = true;
+    #define TEST(x) \
+        do { \
+            if (!(x)) { \
+                LogError("Context graph test failed: %s", #x); \
+                bSuccess = false; \
+            } \
+        } while (0)
+
+    //Every level calls the previous one twice. Fetching the callees again for every call would take 2^30 steps
+    {
+        std::vector<std::string> lines = { "c0(p) = p" };
+        for (int i = 1; i <= 30; i++) {
+            lines.push_back("c" + std::to_string(i) + "(p) = c" + std::to_string(i-1) + "(p) + c" + std::to_string(i-1) + "(p)");
+        }
+        Clear();
+        for (const std::string& line : lines)
+            AddEquation(line);
+        Resolve();
+
+        Equation* top = FindEquation("c30");
+        TEST(top && top->Valid() && top->EParamCount() == 1);
+        int c0 = FindIndex("c0");
+        TEST(c0 >= 0 && Dependents(c0).size() == 1 && myEquations[Dependents(c0)[0]]->Name() == "c1");
+
+        std::vector<int> deps = { c0 };
+        CollectDependents(deps);
+        TEST(deps.size() == 31);
+    }
+
+    //Cycles make everything on them, and everything that calls them, invalid instead of recursing forever
+    {
+        ReloadStats stats;
+        Reload({ "a = b + 1", "b = 2 * a", "d = a + 1", "s = s + 1", "u = 3" }, &stats);
+        TEST(!FindEquation("a")->Valid() && !FindEquation("b")->Valid() && !FindEquation("d")->Valid());
+        TEST(!FindEquation("s")->Valid());
+        TEST(FindEquation("u")->Valid() && FindEquation("u")->Evaluate(0, 0) == 3.0);
+
+        const std::vector<int>& deps = Dependents(FindIndex("a"));
+        TEST(deps.size() == 2);
+
+        //Breaking the cycle fixes its callers
+        Reload({ "a = 5", "b = 2 * a", "d = a + 1", "s = s + 1", "u = 3" }, &stats);
+        TEST(stats.Parsed == 1 && stats.Resolved == 3);
+        TEST(FindEquation("b")->Valid() && FindEquation("b")->Evaluate(0, 0) == 10.0);
+        TEST(FindEquation("d")->Valid() && FindEquation("d")->Evaluate(0, 0) == 6.0);
+    }
+
+    #undef TEST
+    Clear();
+    return bSuccess;
+}
+
+bool Context::RunTest_LoadFile() {
+    bool bSuccess = true;
+    #define TEST(x) \
+        do { \
+            if (!(x)) { \
+                LogError("Context load test failed: %s", #x); \
+                bSuccess = false; \
+            } \
+        } while (0)
+
+    //Large enough to be split into several chunks, with callers before their callees. v(n) calls v(n/2), so the
+    //levels of the graph double in size and the larger ones get fetched in parallel
+    constexpr int count = 5000;
+    std::vector<std::string> lines = { "# Generated", "dup = 1" };
+    for (int i = count - 1; i > 0; i--) {
+        lines.push_back("v" + std::to_string(i) + " = v" + std::to_string(i / 2) + " + 1\r");
+    }
+    lines.push_back("");
+    lines.push_back("v0 = 0");
+    lines.push_back("dup = 2");
+
+    const std::string path = (std::filesystem::temp_directory_path() / "graphit_load_test.txt").string();
+    {
+        std::ofstream f(path, std::ios::binary);
+        for (const std::string& line : lines)
+            f << line << '\n';
+    }
+
+    Clear();
+    TEST(LoadFromFile(path));
+    TEST(myCount == myCustomEqStart + count + 2);
+    TEST(FindEquation("dup") && FindEquation("dup")->Evaluate(0, 0) == 1.0);
+
+    bool bAllValid = true;
+    for (int i = myCustomEqStart; i < myCount; i++) {
+        bAllValid &= myEquations[i]->Valid();
+    }
+    TEST(bAllValid);
+    Equation* eq = FindEquation("v4095");
+    TEST(eq && eq->Evaluate(0, 0) == 12.0);
+    eq = FindEquation("v4096");
+    TEST(eq && eq->Evaluate(0, 0) == 13.0);
+
+    //Precompiled, the equations are read in chunks that call each other
+    {
+        const std::string compiledPath = CompiledPath(path);
+        TEST(SaveCompiled(compiledPath, 1));
+        Context compiled;
+        TEST(compiled.LoadCompiled(compiledPath, 1));
+        TEST(compiled.myCount == myCount && compiled.myEquationArenas.size() == 1 && compiled.myEquationArenas[0]->Nodes.size() > 1);
+        const Equation* loaded = compiled.FindEquation("v4096");
+        TEST(loaded && loaded->Valid() && loaded->Evaluate(0, 0) == 13.0);
+        std::error_code removeErr;
+        std::filesystem::remove(compiledPath, removeErr);
+    }
+
+    //Reloading keeps the equations and their text. Dropping the second half frees what only it used
+    {
+        for (std::string& line : lines) {
+            if (line.size() && line.back() == '\r')
+                line.pop_back();
+        }
+        ReloadStats stats;
+        Reload(lines, &stats);
+        TEST(stats.Kept == count + 2 && stats.Parsed == 0 && stats.Removed == 0);
+
+        lines.resize(2);
+        lines.push_back("v0 = 3");
+        Reload(lines, &stats);
+        TEST(stats.Kept == 1 && stats.Parsed == 1 && stats.Removed == count + 1);
+        TEST(myArenas.size() == 2);
+        TEST(FindEquation("v0")->Evaluate(0, 0) == 3.0 && FindEquation("dup")->Evaluate(0, 0) == 1.0);
+    }
+
+    //An empty file has no data at all, and loads as nothing
+    {
+        std::ofstream f(path, std::ios::binary | std::ios::trunc);
+    }
+    Clear();
+    TEST(LoadFromFile(path));
+    TEST(myCount == myCustomEqStart);
+
+    std::error_code err;
+    std::filesystem::remove(path, err);
+
+    #undef TEST
+    Clear();
+    return bSuccess;
+}
+
+bool Context::RunTest_Snapshots() {
+    bool bSuccess = true;
+    #define TEST(x) \
+        do { \
+            if (!(x)) { \
+                LogError("Context snapshot test failed: %s", #x); \
+                bSuccess = false; \
+            } \
+        } while (0)
+
+    const std::string path = (std::filesystem::temp_directory_path() / "graphit_snapshot_test.txt").string();
+    auto Write = [&path](const char* text) {
+        std::ofstream f(path, std::ios::binary);
+        f << text;
+    };
+
+    ContextPublisher publisher;
+    Write("f(a) = a * 2\ns = f(x) + y\nu = x - y\n");
+    {
+        std::shared_ptr<Context> first = std::make_shared<Context>();
+        TEST(first->LoadFromFileCached(path));
+        publisher.Publish(first);
+    }
+    ContextSnapshot pinned = publisher.Pin();
+    std::weak_ptr<const Context> watch = pinned;
+    const Equation* s = pinned->FindEquation("s");
+    const Equation* u = pinned->FindEquation("u");
+    TEST(s && u && s->Evaluate(1, 1) == 3.0);
+
+    //Changing f changes s as well, u keeps its revision
+    Write("f(a) = a * 3\ns = f(x) + y\nu = x - y\n");
+    {
+        std::shared_ptr<Context> next = std::make_shared<Context>();
+        ReloadStats stats;
+        TEST(next->LoadFromFileAfter(path, *pinned, &stats));
+        TEST(stats.Kept == 2 && stats.Parsed == 1 && stats.Removed == 1 && stats.Resolved == 2);
+        TEST(next->FindEquation("u")->Revision() == u->Revision() && next->FindEquation("s")->Revision() != s->Revision());
+        //Kept lines are copied with their text, not parsed again
+        TEST(next->FindEquation("u")->Name().data() == u->Name().data() && next->FindEquation("u") != u);
+        TEST(next->FindEquation("f")->Name().data() != pinned->FindEquation("f")->Name().data());
+        publisher.Publish(next);
+    }
+
+    //The old snapshot can still be used while it is pinned, and goes away with the last pin
+    TEST(!watch.expired() && s->Evaluate(1, 1) == 3.0 && publisher.Pin()->FindEquation("s")->Evaluate(1, 1) == 4.0);
+    pinned.reset();
+    TEST(watch.expired());
+    //The text of the kept lines outlives the snapshot it was loaded into
+    TEST(publisher.Pin()->FindEquation("u")->Evaluate(5, 2) == 3.0 && publisher.Pin()->FindEquation("u")->Name() == "u");
+
+    //Removing f breaks s
+    Write("s = f(x) + y\nu = x - y\n");
+    {
+        ContextSnapshot current = publisher.Pin();
+        std::shared_ptr<Context> next = std::make_shared<Context>();
+        ReloadStats stats;
+        TEST(next->LoadFromFileAfter(path, *current, &stats));
+        TEST(stats.Kept == 2 && stats.Removed == 1 && stats.Resolved == 1 && !next->FindEquation("s")->Valid());
+        TEST(next->FindEquation("u")->Revision() == current->FindEquation("u")->Revision());
+        publisher.Publish(next);
+    }
+
+    //Readers on another thread evaluate whatever is current while new snapshots are published
+    {
+        std::atomic<bool> bStop{ false };
+        std::atomic<int> bad{ 0 };
+        std::thread reader([&]() {
+            while (!bStop.load()) {
+                ContextSnapshot snapshot = publisher.Pin();
+                const Equation* eq = snapshot->FindEquation("u");
+                if (!eq || eq->Evaluate(5, 2) != 3.0)
+                    bad++;
+            }
+        });
+        for (int i = 0; i < 20; i++) {
+            ContextSnapshot current = publisher.Pin();
+            std::shared_ptr<Context> next = std::make_shared<Context>();
+            TEST(next->LoadFromFileAfter(path, *current));
+            publisher.Publish(next);
+        }
+        bStop = true;
+        reader.join();
+        TEST(bad == 0);
+    }
+
+    //A big file where one line changes only parses that line, and only resolves it and what calls it
+    {
+        std::string text;
+        for (int i = 0; i < 2000; i++)
+            text += "b" + std::to_string(i) + " = x * " + std::to_string(i) + "\n";
+        text += "top = b7 + b1999\n";
+        Write(text.c_str());
+        ContextSnapshot current = publisher.Pin();
+        std::shared_ptr<Context> big = std::make_shared<Context>();
+        ReloadStats stats;
+        TEST(big->LoadFromFileAfter(path, *current, &stats));
+        TEST(stats.Parsed == 2001 && stats.Removed == 2);
+
+        text.replace(text.find("b7 = x * 7"), 10, "b7 = x * 9");
+        Write(text.c_str());
+        std::shared_ptr<Context> next = std::make_shared<Context>();
+        TEST(next->LoadFromFileAfter(path, *big, &stats));
+        TEST(stats.Kept == 2000 && stats.Parsed == 1 && stats.Removed == 1 && stats.Resolved == 2);
+        TEST(next->FindEquation("top")->Evaluate(1, 0) == 9.0 + 1999.0);
+        TEST(next->FindEquation("b8")->Revision() == big->FindEquation("b8")->Revision());
+        big.reset();
+        TEST(next->FindEquation("b8")->Evaluate(2, 0) == 16.0);
+        publisher.Publish(next);
+    }
+
+    std::error_code err;
+    std::filesystem::remove(path, err);
+    std::filesystem::remove(CompiledPath(path), err);
+    #undef TEST
+    return bSuccess;
 }
 
 } //End of namespace MathParser
\ No newline at end of file
@@ -7,32 +7,19 @@
 #include <array>
 #include <variant>
 #include <stack>
+#include <memory>
+#include <atomic>
+#include <unordered_map>
 
-namespace MathParser {
-
-enum TokenType {
-    Token_Invalid,
-    Token_Number,
-    Token_EqualSign,
-    
-    Token_Expression,
-
-    Token_Operator, //Mainly used to refer to binary operators
-    Token_Comma,
+//Gives the benchmarks access to the individual parser stages
+struct ParserBenchAccess;
 
-    Token_Param_Start,
-    Token_Param_End,
-
-    Token_Brack_Start,
-    Token_Brack_End,
-};
-
-struct TokenData {
-    TokenType Type;
+namespace MathParser {
 
-    std::string_view Str;
-    double NumberValue;
-    char charValue;
+//Where and why a line could not be parsed
+struct ParseError {
+    std::string Message;
+    int Column = -1;    //Offset into the line
 };
 
 class Context;
@@ -44,45 +31,116 @@ public:
         myContext(ctx)
     {
     }
-    
-    void PushNode(const NodeGeneric& n) {
-        Assert(myNodeCount < myNodeSize && "Ran out of nodes");
-        myNodes[myNodeCount] = n;
-        myNodeCount++;
+    //The nodes, and the arguments of calls pushed from the same memory, are allocated from memory. Copies are not
+    Equation(Context* ctx, std::pmr::memory_resource* memory):
+        myContext(ctx), myNodes(memory)
+    {
     }
+    //A copy of other with its properties and revision, and its nodes in memory like above. Its calls go nowhere until it
+    //is resolved in ctx (see Context::LoadFromFileAfter)
+    Equation(const Equation& other, Context* ctx, std::pmr::memory_resource* memory);
+    
+    void PushNode(NodeGeneric&& n) { myNodes.push_back(std::move(n)); }
+    void ReserveNodes(int count) { myNodes.reserve(count); }
+    int NodeCount() const { return (int)myNodes.size(); }
+    NodeGeneric& Node(int index) { Assert(index >= 0 && index < NodeCount()); return myNodes[index]; }
+    const NodeGeneric& Node(int index) const { Assert(index >= 0 && index < NodeCount()); return myNodes[index]; }
 
     void SetName(std::string_view name) { myEquationName = name; }
-    const std::string_view& Name() { return myEquationName; }
+    const std::string_view& Name() const { return myEquationName; }
 
     void Print() const;
     void ResolveEquations(Context* ctx);    // Fetches equations from the ctx
     
-    // Calculates IParamCount, EParamCount and validity
+    // Calculates IParamCount, EParamCount and validity. Equations that this one calls have to be fetched first
     void FetchProperties();
+    void SetInvalid();
+    //Sets what FetchProperties would, for equations that were resolved before (see Context::LoadCompiled)
+    void SetProperties(int iParamCount, int eParamCount, bool bValid);
+    void SetTimeProperties(bool bUsesTime, bool bTimeAdditive);
     int EParamCount() const { return myEParamCount; }
     int IParamCount() const { return myIParamCount; }
     bool Valid() const { return myIsValid; }
+    //Uses the time t, directly or through an equation it calls
+    bool UsesTime() const { return myUsesTime; }
+    //Uses the time, but only as f(x, y, z) + g(t). A change in time then moves the whole surface along z by the same
+    //amount, so it does not have to be meshed again
+    bool TimeAdditive() const { return myTimeAdditive; }
+
+    //Changes whenever the equation, or an equation it uses, is resolved again. No two equations share one, even in
+    //different contexts. Graphers use it to skip re-meshing
+    uint32 Revision() const { return myRevision; }
+    void SetRevision(uint32 revision) { myRevision = revision; }
 
+    //Names of the equations this one calls, including the ones inside function arguments
+    void CollectReferences(std::vector<std::string_view>& outNames) const;
 
-    double Evaluate(double x, double y);
-    double Evaluate(double x, double y, double z);
+
+    //Only reads the equation, so any number of threads can evaluate it at once
+    double Evaluate(double x, double y) const;
+    double Evaluate(double x, double y, double z) const;
+    double Evaluate(double x, double y, double z, double t) const;
 
     //Todo: Make this private and accessible from MathExpression
-    NodeValueType EvaluatePrivate(NodeValue* iParams, int iSize, NodeValue* eParams, int eSize);
+    //Does not check anything, the equation has to be valid (see Validate). Domain errors, like sqrt(-1) or 1/0, give
+    //NaN, which carries through to the result
+    double EvaluatePrivate(NodeValue* iParams, int iSize, NodeValue* eParams, int eSize) const;
+
+    //Walks the nodes once and counts the stack depth, without evaluating anything. True if every operator has its
+    //operands, every param is passed, every called function is valid and exactly one value is left at the end. Also
+    //used on equations that were loaded instead of resolved (see Context::LoadCompiled)
+    bool Validate(int iSize, int eSize) const;
 private:
+    //Sets myUsesTime and myTimeAdditive. Only for valid equations
+    void FetchTimeProperties();
 
 private:
     Context* myContext = nullptr;
     std::string_view myEquationName;
 
-    static constexpr int myNodeSize = 100;
-    NodeGeneric myNodes[myNodeSize];
-    int myNodeCount = 0;
+    //Postfix order
+    std::pmr::vector<NodeGeneric> myNodes;
 
     //Properties
     int myEParamCount = 0; //Number of explicit parameters that this equation has
     int myIParamCount = 0; //Number of implicit parameters that this equation has
     bool myIsValid = false;
+    bool myUsesTime = false;
+    bool myTimeAdditive = false;
+    uint32 myRevision = 0;
+};
+
+//What Context::Reload or Context::LoadFromFileAfter did
+struct ReloadStats {
+    int Kept = 0;       //Lines that did not change. Their equations are reused (or copied) as they are
+    int Parsed = 0;     //New or changed lines
+    int Removed = 0;
+    int Resolved = 0;   //Parsed equations and every equation that depends on them
+};
+
+//Index of the first equation with each name. Open addressing in one array, so that adding a name does not allocate
+//and finding one mostly looks at a single slot. The names are not copied, they have to outlive the index
+class NameIndex {
+public:
+    void Clear();
+    void Reserve(size_t count);
+    //Keeps the index that was there first
+    void Emplace(std::string_view name, int index);
+    int Find(std::string_view name) const;      //-1 when there is none
+
+private:
+    struct Slot {
+        const char* Name = nullptr;
+        uint32 Length = 0;
+        uint32 Hash = 0;        //Also decides the slot, so growing does not hash the names again
+        int Index = -1;         //-1 for an empty slot
+    };
+    //The slot with the name, or the empty one where it would go
+    size_t Probe(std::string_view name, uint32 hash) const;
+    void Grow(size_t capacity);
+
+    std::vector<Slot> mySlots;      //A power of two long, at most half full
+    size_t myCount = 0;
 };
 
 class Context {
@@ -96,46 +154,149 @@ public:
     Context& operator= (Context&& other);
 
     void Clear();
-    void PrintProperties(bool bPrintBuiltIn = false);
+    void PrintProperties(bool bPrintBuiltIn = false) const;
 
     bool AddEquation(const std::string& str);
+    //Maps the file and parses it in chunks on the thread pool, then resolves it (see ResolveMarked)
     bool LoadFromFile(const std::string& str);
 
+    //Replaces the custom equations with the given lines. Lines that were already loaded keep their equation, so only
+    //new and changed lines are parsed, and only they and the equations that use them are resolved again
+    void Reload(const std::vector<std::string>& lines, ReloadStats* outStats = nullptr);
+    bool ReloadFromFile(const std::string& str, ReloadStats* outStats = nullptr);
+
+    //Replaces the equations with the ones in the file. Uses the precompiled file next to it (see CompiledPath) when
+    //that was made from the same text, otherwise the text is loaded and the precompiled file is written again
+    bool LoadFromFileCached(const std::string& path);
+    //Reload into a new context that replaces previous (see ContextPublisher), which is only read. The equations of the
+    //lines that were in previous are copied from it, so only new and changed lines are parsed, and only they and the
+    //equations that use them are resolved. The rest keep their revision, so graphers see them as unchanged
+    bool LoadFromFileAfter(const std::string& path, const Context& previous, ReloadStats* outStats = nullptr);
+
+    //Precompiled equations (.gic): the nodes, names and dependency graph of a resolved context, stored so that
+    //loading needs no parsing or resolving. sourceHash is the HashSource of the text they were made from, LoadCompiled
+    //fails (and leaves the context as it was) if it does not match
+    bool SaveCompiled(const std::string& path, uint64 sourceHash) const;
+    bool LoadCompiled(const std::string& path, uint64 sourceHash);
+    static uint64 HashSource(const char* data, size_t size);
+    static std::string CompiledPath(const std::string& path);
+
     bool Resolve();
     Equation* FindEquation(const std::string_view& str);
     Equation* FindEquationIndex(int index);
+    const Equation* FindEquation(const std::string_view& str) const;
+    const Equation* FindEquationIndex(int index) const;
+
+    //Indices of the equations that call the equation at index directly. Up to date after Resolve and Reload
+    const std::vector<int>& Dependents(int index) const;
+    //Adds every equation that depends on the given ones, directly or through other equations
+    void CollectDependents(std::vector<int>& inOutIndices) const;
 
     static bool RunAllTests();    //Returns true when all tests pass
 
     int GetCount() const { return myCount; }
 
 private:
-    bool ParseInfixToTokens(const std::string& strEquation, std::vector<TokenData>& outInfix, std::string* outError);
-    bool InfixToPostFix(std::vector<TokenData>& infix, std::string* outError, Equation* outEq);
+    friend struct ::ParserBenchAccess;
+
+    //Parses a whole line ("expr", "name = expr" or "name(a, b) = expr") into eq
+    bool ParseLine(std::string_view str, Equation* eq, ParseError* outError);
+    //Returns nullptr (and logs why) if str could not be parsed. The equation points into str, which has to be null
+    //terminated
+    Equation* ParseEquation(std::string_view str);
+    static bool ReadLines(const std::string& path, std::vector<std::string>& outLines);
 
-    bool AddEquationPrivate(const std::string& strEquation, std::string* outError, Equation* eq);
+    //Copies str into a new arena, null terminated
+    std::string_view StoreLine(std::string_view str);
+    //Frees the arenas that no equation points into anymore, and the equation arenas that no equation is in
+    void ReleaseUnusedArenas();
+    void PushEquation(Equation* eq, std::string_view str);
 
     //Debug related
-    void PrintTokens(const std::vector<TokenData>& tokens);
-    bool RunTest_InfixToToken();
+    bool RunTest_Parser();
+    bool RunTest_Reload();
+    bool RunTest_Graph();
+    bool RunTest_LoadFile();
+    bool RunTest_Compiled();
+    bool RunTest_Snapshots();
 
     void ClearPrivate();
     void AddInbuiltEqs();
 
+    int FindIndex(const std::string_view& name) const;
+    //Rebuilds myCallees and myCallers from the names that every equation calls
+    void BuildGraph();
+    //Resolves the marked equations, callees before callers, so that every equation is fetched once. Equations that
+    //are part of (or depend on) a cycle are made invalid. Equations on the same level of the graph do not depend on
+    //each other, so large levels are fetched in parallel
+    void ResolveMarked(const std::vector<bool>& marked);
+
 //Variables
 private:
-    // TokenData and Nodes store string_views. We need a storage for the string that the string_view points to.
-    // We cannot make it a std::vector because those might get resized and the string_view might become invalid 
-    static constexpr int myMaxEquations = 40;
     int myCount = 0;
     int myCustomEqStart = 0;    //Index of the first non inbuilt equation. This is only used for printing properties of equations
-    Equation* myEquations[myMaxEquations];
+    std::vector<Equation*> myEquations;
+    //Moved on every time equations get resolved. Shared by every context, so that two different equations never have
+    //the same revision, even in different contexts (see LoadFromFileAfter)
+    static std::atomic<uint32> ourRevision;
+
+    //Index of the first equation with each name. The keys point into the equations
+    NameIndex myNameIndex;
+
+    //Dependency graph, by equation index
+    std::vector<std::vector<int>> myCallees;
+    std::vector<std::vector<int>> myCallers;
+
+    //Nodes store string_views. This is the storage for the text they point to, which must not move. A file gets one
+    //arena per chunk and single lines get their own. The text never changes, so the contexts loaded after this one
+    //share the arenas of the lines they keep (see LoadFromFileAfter)
+    struct Arena {
+        std::shared_ptr<char[]> Data;
+        size_t Size = 0;
+    };
+    std::vector<Arena> myArenas;
+
+    //Equations loaded from a precompiled file in one block, with their nodes in a few more, which are only freed as a
+    //whole (see LoadCompiled). Loading then takes a few allocations instead of several per equation
+    struct EquationArena {
+        explicit EquationArena(size_t bytes):
+            Memory(bytes)
+        {
+        }
+        ~EquationArena();
+        bool Owns(const Equation* eq) const;
+
+        std::pmr::monotonic_buffer_resource Memory;
+        Equation* Equations = nullptr;
+        int Count = 0;
+        //Chunks of the equations are read on different threads, each into memory of its own
+        std::vector<std::unique_ptr<std::pmr::monotonic_buffer_resource>> Nodes;
+    };
+    std::vector<std::unique_ptr<EquationArena>> myEquationArenas;
+    //Equations in an arena are left to it, they are destroyed when it is released (see ReleaseUnusedArenas)
+    void DeleteEquation(Equation* eq);
 
 
 //Todo: Make this private
 public:
-    std::string myStrEquations[myMaxEquations];
+    //Line of every equation, null terminated. Points into myArenas (or a literal for the inbuilt ones)
+    std::vector<std::string_view> myStrEquations;
     
 };
 
+//A context that is not changed anymore, so any number of threads can read it
+using ContextSnapshot = std::shared_ptr<const Context>;
+
+//Hands the equations to the threads that read them, RCU style. A reload loads a new context (on any thread) and
+//publishes it, readers pin whatever is current and can use it for as long as they hold the pin. A snapshot is freed
+//when its last reader lets go. Neither side waits on the other's work, publishing and pinning only swap or copy a pointer
+class ContextPublisher {
+public:
+    ContextSnapshot Pin() const                 { return std::atomic_load(&myCurrent); }
+    void Publish(ContextSnapshot ctx)           { std::atomic_store(&myCurrent, std::move(ctx)); }
+
+private:
+    ContextSnapshot myCurrent;
+};
+
 }
\ No newline at end of file
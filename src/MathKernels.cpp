@@ -0,0 +1,471 @@
+#include "MathKernels.h"
+#include "Maths.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+namespace MathParser {
+namespace Kernels {
+
+//Levels of the approximations, one per Accuracy other than full
+enum Level {
+    Level_1e7,
+    Level_1e4,
+};
+
+//Layout and limits of each float type
+template <typename T> struct Bits;
+template <> struct Bits<float> {
+    using Int = int32;
+    static constexpr int Mantissa = 23;
+    static constexpr Int Bias = 127;
+    //Adding and subtracting this rounds to an integer
+    static constexpr float Round = 12582912.0f;     //1.5 * 2^23
+    //Beyond these exp is infinite or 0
+    static constexpr float ExpMax = 88.72f;
+    static constexpr float ExpMin = -87.33f;
+    //ln(2) in two parts, so that k * Ln2Hi is exact
+    static constexpr float Ln2Hi = 0.693359375f;
+    static constexpr float Ln2Lo = -2.12194440e-4f;
+    //Largest |x| that Reduce is accurate for, the same as Cephes
+    static constexpr float ReduceMax = 8192.0f;
+};
+template <> struct Bits<double> {
+    using Int = int64;
+    static constexpr int Mantissa = 52;
+    static constexpr Int Bias = 1023;
+    static constexpr double Round = 6755399441055744.0;     //1.5 * 2^52
+    static constexpr double ExpMax = 709.78;
+    static constexpr double ExpMin = -708.39;
+    static constexpr double Ln2Hi = 6.93147180369123816490e-01;
+    static constexpr double Ln2Lo = 1.90821492927058770002e-10;
+    static constexpr double ReduceMax = 1.073741824e9;
+};
+
+//pi/2 in three parts. The first two are exact in a float, so k * part is exact for the k that matter
+static constexpr double PiO2A = 1.5703125;
+static constexpr double PiO2B = 4.837512969970703125e-4;
+static constexpr double PiO2C = 7.54978995489188216916e-8;
+static constexpr double TwoOverPi = 0.636619772367581343076;
+static constexpr double Log2e = 1.44269504088896340736;
+static constexpr double Sqrt2 = 1.41421356237309504880;
+
+template <typename T>
+static inline T FromBits(typename Bits<T>::Int bits) {
+    T val;
+    memcpy(&val, &bits, sizeof(val));
+    return val;
+}
+
+template <typename T>
+static inline typename Bits<T>::Int ToBits(T val) {
+    typename Bits<T>::Int bits;
+    memcpy(&bits, &val, sizeof(val));
+    return bits;
+}
+
+//bCond ? a : b without a branch. The compiler does not turn a ?: between floats into a vector blend, as it can't
+//evaluate both sides when they might trap, so the selects are done on the bits
+template <typename T>
+static inline T Select(bool bCond, T a, T b) {
+    using Int = typename Bits<T>::Int;
+    const Int mask = -(Int)bCond;
+    return FromBits<T>((ToBits(a) & mask) | (ToBits(b) & ~mask));
+}
+
+//-v when bCond is set
+template <typename T>
+static inline T FlipSign(bool bCond, T v) {
+    using Int = typename Bits<T>::Int;
+    return FromBits<T>(ToBits(v) ^ ((Int)bCond << (sizeof(T) * 8 - 1)));
+}
+
+//2^k, for k inside the normal exponent range
+template <typename T>
+static inline T Pow2(typename Bits<T>::Int k) {
+    return FromBits<T>((k + Bits<T>::Bias) << Bits<T>::Mantissa);
+}
+
+//sin and cos on [-pi/4, pi/4]. 1e-7 uses the minimax coefficients of Cephes, 1e-4 the Taylor series
+template <typename T, Level L>
+static inline T SinPoly(T r) {
+    const T r2 = r * r;
+    if (L == Level_1e7)
+        return r + r * r2 * ((T)-1.6666654611e-1 + r2 * ((T)8.3321608736e-3 + r2 * (T)-1.9515295891e-4));
+    return r + r * r2 * ((T)(-1.0 / 6.0) + r2 * (T)(1.0 / 120.0));
+}
+
+template <typename T, Level L>
+static inline T CosPoly(T r) {
+    const T r2 = r * r;
+    if (L == Level_1e7)
+        return (T)1 - (T)0.5 * r2 + r2 * r2 * ((T)4.166664568298827e-2 + r2 * ((T)-1.388731625493765e-3 + r2 * (T)2.443315711809948e-5));
+    return (T)1 - (T)0.5 * r2 + r2 * r2 * ((T)(1.0 / 24.0) + r2 * (T)(-1.0 / 720.0));
+}
+
+//x = q * pi/2 + r, with r in [-pi/4, pi/4]. Only accurate for |x| <= ReduceMax, beyond that the kernels use the C
+//library (see UseApprox)
+template <typename T>
+static inline T Reduce(T x, typename Bits<T>::Int& q) {
+    const T k = (x * (T)TwoOverPi + Bits<T>::Round) - Bits<T>::Round;
+    q = (typename Bits<T>::Int)k;
+    return ((x - k * (T)PiO2A) - k * (T)PiO2B) - k * (T)PiO2C;
+}
+
+template <typename T, Level L>
+static inline T SinApprox(T x) {
+    typename Bits<T>::Int q;
+    const T r = Reduce(x, q);
+    const T s = SinPoly<T, L>(r);
+    const T c = CosPoly<T, L>(r);
+    return FlipSign((q & 2) != 0, Select((q & 1) != 0, c, s));
+}
+
+template <typename T, Level L>
+static inline T CosApprox(T x) {
+    typename Bits<T>::Int q;
+    const T r = Reduce(x, q);
+    const T s = SinPoly<T, L>(r);
+    const T c = CosPoly<T, L>(r);
+    return FlipSign(((q + 1) & 2) != 0, Select((q & 1) != 0, s, c));
+}
+
+template <typename T, Level L>
+static inline T TanApprox(T x) {
+    typename Bits<T>::Int q;
+    const T r = Reduce(x, q);
+    const T s = SinPoly<T, L>(r);
+    const T c = CosPoly<T, L>(r);
+    const bool bOdd = (q & 1) != 0;
+    return Select(bOdd, -c, s) / Select(bOdd, s, c);
+}
+
+//x = k * ln(2) + r with |r| <= ln(2)/2, so exp(x) = 2^k * exp(r)
+template <typename T, Level L>
+static inline T ExpApprox(T x) {
+    using B = Bits<T>;
+    T xc = Select(x < B::ExpMin, B::ExpMin, x);
+    xc = Select(xc > B::ExpMax, B::ExpMax, xc);
+    const T k = (xc * (T)Log2e + B::Round) - B::Round;
+    const T r = (xc - k * B::Ln2Hi) - k * B::Ln2Lo;
+
+    T p;
+    if (L == Level_1e7)
+        p = (T)1 + r * ((T)1 + r * ((T)(1.0/2) + r * ((T)(1.0/6) + r * ((T)(1.0/24) + r * ((T)(1.0/120) + r * ((T)(1.0/720) + r * (T)(1.0/5040)))))));
+    else
+        p = (T)1 + r * ((T)1 + r * ((T)(1.0/2) + r * ((T)(1.0/6) + r * (T)(1.0/24))));
+
+    //2^k in two halves, as 2^128 itself does not fit into a float
+    const typename B::Int ki = (typename B::Int)k;
+    T res = p * Pow2<T>(ki / 2) * Pow2<T>(ki - ki / 2);
+    res = Select(x > B::ExpMax, std::numeric_limits<T>::infinity(), res);
+    res = Select(x < B::ExpMin, (T)0, res);
+    return Select(x != x, x, res);
+}
+
+//For positive normal x. x = m * 2^e with m in [sqrt(1/2), sqrt(2)), and log(m) = 2 atanh(s) with s = (m - 1) / (m + 1)
+template <typename T, Level L>
+static inline T LnNormalApprox(T x) {
+    using B = Bits<T>;
+    using Int = typename B::Int;
+    const Int bits = ToBits(x);
+    Int e = (bits >> B::Mantissa) - B::Bias;
+    T m = FromBits<T>((bits & (((Int)1 << B::Mantissa) - 1)) | (B::Bias << B::Mantissa));
+    const bool bBig = m > (T)Sqrt2;
+    m = Select(bBig, m * (T)0.5, m);
+    e += (Int)bBig;
+
+    const T s = (m - (T)1) / (m + (T)1);
+    const T s2 = s * s;
+    T p;
+    if (L == Level_1e7)
+        p = s * ((T)2 + s2 * ((T)(2.0/3) + s2 * ((T)(2.0/5) + s2 * (T)(2.0/7))));
+    else
+        p = s * ((T)2 + s2 * ((T)(2.0/3) + s2 * (T)(2.0/5)));
+    const T ef = (T)e;
+    return ef * B::Ln2Hi + (p + ef * B::Ln2Lo);
+}
+
+//Every x. Denormals are scaled into the normal range first, 0, negatives, inf and NaN get what the C library returns
+template <typename T, Level L>
+static inline T LnApprox(T x) {
+    using B = Bits<T>;
+    const T inf = std::numeric_limits<T>::infinity();
+    const bool bDenormal = x < std::numeric_limits<T>::min();
+    T r = LnNormalApprox<T, L>(Select(bDenormal, x * Pow2<T>(B::Mantissa), x));
+    r = Select(bDenormal, r - (T)(B::Mantissa * 0.69314718055994530942), r);
+    r = Select(x == inf, inf, r);
+    r = Select(x == 0, -inf, r);
+    r = Select(x < 0, std::numeric_limits<T>::quiet_NaN(), r);
+    return Select(x != x, x, r);
+}
+
+template <typename T, Level L>
+static inline T PowApprox(T a, T b) {
+    using B = Bits<T>;
+    using Int = typename B::Int;
+    const T inf = std::numeric_limits<T>::infinity();
+    const T aAbs = std::abs(a);
+    //Every value this large is an even integer
+    const bool bHuge = std::abs(b) >= Pow2<T>(B::Mantissa + 1);
+    const Int bi = (Int)Select(bHuge, (T)0, b);
+    const bool bInt = bHuge | ((T)bi == b);
+    const bool bOdd = (bi & 1) != 0;
+
+    const bool bZero = aAbs == 0;
+    const bool bInf = aAbs == inf;
+    //LnApprox scales denormals into the normal range
+    T r = ExpApprox<T, L>(b * LnApprox<T, L>(Select(bZero | bInf, (T)1, aAbs)));
+    r = Select(bZero, Select(b > 0, (T)0, inf), r);
+    r = Select(bInf, Select(b > 0, inf, (T)0), r);
+    //A negative base only has a real result for integer exponents
+    r = Select(a < 0, Select(bInt, FlipSign(bOdd, r), std::numeric_limits<T>::quiet_NaN()), r);
+    r = Select((a != a) | (b != b), a + b, r);
+    return Select(b == 0, (T)1, r);
+}
+
+//The approximations only pay off where their loops become SIMD. With SSE2 the kernel benches (bench/BenchKernels.cpp)
+//have the float ones 1.5 to 10 times faster than the C library, apart from pow, which is slower. The double ones
+//barely win or lose by up to 5 times, as x86-64 has no packed conversion between double and int64 before AVX-512
+#if defined(__SSE2__) || defined(_M_X64) || defined(__ARM_NEON)
+    #define KERNELS_SIMD 1
+#else
+    #define KERNELS_SIMD 0
+#endif
+
+//Whether the kernel for f runs the approximation on a, or the C library whatever the accuracy
+template <typename T>
+static inline bool UseApprox(Function f, const T* a, int32 n) {
+    if (!KERNELS_SIMD || !std::is_same<T, float>::value || f == Func_Pow)
+        return false;
+    if (f == Func_Sin || f == Func_Cos || f == Func_Tan) {
+        //A batch with anything Reduce can't handle (large, inf or NaN) goes to the C library as a whole, as out may be a
+        bool bInside = true;
+        for (int32 i = 0; i < n; i++)
+            bInside &= std::abs(a[i]) <= Bits<T>::ReduceMax;
+        return bInside;
+    }
+    return true;
+}
+
+//Picks the loop for the accuracy, so that the loops themselves have no branches. Name##Batch always runs the
+//approximation of acc, Name only where it is faster (see UseApprox)
+#define KERNEL_UNARY(Name, Full, Func) \
+    template <typename T> KERNELS_CLONES \
+    static void Name##Batch(const T* a, T* out, int32 n, Accuracy acc) { \
+        switch (acc) { \
+            case Accuracy_Full: for (int32 i = 0; i < n; i++) out[i] = Full(a[i]);                     break; \
+            case Accuracy_1e7:  for (int32 i = 0; i < n; i++) out[i] = Name##Approx<T, Level_1e7>(a[i]);  break; \
+            case Accuracy_1e4:  for (int32 i = 0; i < n; i++) out[i] = Name##Approx<T, Level_1e4>(a[i]);  break; \
+        } \
+    } \
+    template <typename T> \
+    void Name(const T* a, T* out, int32 n, Accuracy acc) { \
+        Name##Batch(a, out, n, UseApprox(Func, a, n) ? acc : Accuracy_Full); \
+    } \
+    template void Name<float>(const float*, float*, int32, Accuracy); \
+    template void Name<double>(const double*, double*, int32, Accuracy);
+
+KERNEL_UNARY(Sin, std::sin, Func_Sin)
+KERNEL_UNARY(Cos, std::cos, Func_Cos)
+KERNEL_UNARY(Tan, std::tan, Func_Tan)
+KERNEL_UNARY(Exp, std::exp, Func_Exp)
+KERNEL_UNARY(Ln, std::log, Func_Ln)
+
+#undef KERNEL_UNARY
+
+template <typename T> KERNELS_CLONES
+static void PowBatch(const T* a, const T* b, T* out, int32 n, Accuracy acc) {
+    switch (acc) {
+        case Accuracy_Full: for (int32 i = 0; i < n; i++) out[i] = std::pow(a[i], b[i]);                  break;
+        case Accuracy_1e7:  for (int32 i = 0; i < n; i++) out[i] = PowApprox<T, Level_1e7>(a[i], b[i]);   break;
+        case Accuracy_1e4:  for (int32 i = 0; i < n; i++) out[i] = PowApprox<T, Level_1e4>(a[i], b[i]);   break;
+    }
+}
+
+template <typename T>
+void Pow(const T* a, const T* b, T* out, int32 n, Accuracy acc) {
+    PowBatch(a, b, out, n, UseApprox(Func_Pow, a, n) ? acc : Accuracy_Full);
+}
+template void Pow<float>(const float*, const float*, float*, int32, Accuracy);
+template void Pow<double>(const double*, const double*, double*, int32, Accuracy);
+
+const char* FunctionName(Function f) {
+    switch (f) {
+        case Func_Sin:  return "sin";
+        case Func_Cos:  return "cos";
+        case Func_Tan:  return "tan";
+        case Func_Exp:  return "exp";
+        case Func_Ln:  return "log";
+        case Func_Pow:  return "pow";
+        default:        return "?";
+    }
+}
+
+const char* AccuracyName(Accuracy acc) {
+    switch (acc) {
+        case Accuracy_Full: return "full";
+        case Accuracy_1e7:  return "1e-7";
+        case Accuracy_1e4:  return "1e-4";
+    }
+    return "?";
+}
+
+//Inputs that cover each function's range. The second input is only used by pow
+static void SweepInputs(Function f, std::vector<double>& a, std::vector<double>& b) {
+    constexpr int32 Count = 20000;
+    a.clear();
+    b.clear();
+    switch (f) {
+        case Func_Sin:
+        case Func_Cos:
+            for (int32 i = 0; i < Count; i++)
+                a.push_back(-100.0 + 200.0 * i / (Count - 1));
+            break;
+        case Func_Tan:
+            //Close to the poles the result is as much about the input as about the function
+            for (int32 i = 0; i < Count; i++) {
+                const double x = -100.0 + 200.0 * i / (Count - 1);
+                if (std::abs(std::cos(x)) > 1e-2)
+                    a.push_back(x);
+            }
+            break;
+        case Func_Exp:
+            for (int32 i = 0; i < Count; i++)
+                a.push_back(-80.0 + 160.0 * i / (Count - 1));
+            break;
+        case Func_Ln:
+            for (int32 i = 0; i < Count; i++)
+                a.push_back(std::pow(10.0, -30.0 + 60.0 * i / (Count - 1)));
+            break;
+        case Func_Pow:
+            //Positive bases with any exponent, and negative ones with integer exponents
+            for (int32 i = 0; i < 200; i++) {
+                for (int32 j = 0; j < 50; j++) {
+                    a.push_back(std::pow(10.0, -2.0 + 4.0 * i / 199));
+                    b.push_back(-8.0 + 16.0 * j / 49);
+                }
+            }
+            for (int32 i = 0; i < 200; i++) {
+                for (int32 j = -4; j <= 4; j++) {
+                    a.push_back(-10.0 + 9.99 * i / 199);
+                    b.push_back(j);
+                }
+            }
+            break;
+        default:
+            break;
+    }
+    b.resize(a.size(), 0.0);
+}
+
+template <typename T>
+Error Measure(Function f, Accuracy acc) {
+    std::vector<double> a, b;
+    SweepInputs(f, a, b);
+    const int32 n = (int32)a.size();
+    std::vector<T> ta(n), tb(n), out(n);
+    for (int32 i = 0; i < n; i++) {
+        ta[i] = (T)a[i];
+        tb[i] = (T)b[i];
+    }
+
+    switch (f) {
+        case Func_Sin:  SinBatch<T>(ta.data(), out.data(), n, acc);                 break;
+        case Func_Cos:  CosBatch<T>(ta.data(), out.data(), n, acc);                 break;
+        case Func_Tan:  TanBatch<T>(ta.data(), out.data(), n, acc);                 break;
+        case Func_Exp:  ExpBatch<T>(ta.data(), out.data(), n, acc);                 break;
+        case Func_Ln:   LnBatch<T>(ta.data(), out.data(), n, acc);                  break;
+        case Func_Pow:  PowBatch<T>(ta.data(), tb.data(), out.data(), n, acc);      break;
+        default:        break;
+    }
+
+    Error err = { 0.0, 0.0, 0.0 };
+    const bool bCrossesZero = (f == Func_Sin || f == Func_Cos || f == Func_Tan || f == Func_Ln);
+    for (int32 i = 0; i < n; i++) {
+        //The reference gets the same rounded input, so only the function is measured
+        const double x = (double)ta[i];
+        const double y = (double)tb[i];
+        double ref = 0.0;
+        switch (f) {
+            case Func_Sin:  ref = std::sin(x);      break;
+            case Func_Cos:  ref = std::cos(x);      break;
+            case Func_Tan:  ref = std::tan(x);      break;
+            case Func_Exp:  ref = std::exp(x);      break;
+            case Func_Ln:  ref = std::log(x);      break;
+            case Func_Pow:  ref = std::pow(x, y);   break;
+            default:        break;
+        }
+        const T refT = (T)ref;
+        if (!std::isfinite(refT) || refT == (T)0)
+            continue;
+
+        const double diff = std::abs((double)out[i] - ref);
+        const double ulp = (double)(std::nextafter(std::abs(refT), std::numeric_limits<T>::infinity()) - std::abs(refT));
+        const double rel = diff / (bCrossesZero ? Max(std::abs(ref), 1.0) : std::abs(ref));
+        err.MaxUlp = Max(err.MaxUlp, diff / ulp);
+        if (rel > err.MaxRel) {
+            err.MaxRel = rel;
+            err.WorstInput = x;
+        }
+    }
+    return err;
+}
+template Error Measure<float>(Function, Accuracy);
+template Error Measure<double>(Function, Accuracy);
+
+bool RunAllTests() {
+    bool bSuccess = true;
+
+    //What each level promises. Float results cannot be closer than a few of its own ulps, and pow loses more as
+    //|b * log(a)| grows (up to about 37 in the sweep)
+    for (int f = 0; f < FuncCount; f++) {
+        const Function func = (Function)f;
+        const double scale = (func == Func_Pow) ? 40.0 : 1.0;
+        struct Budget { Accuracy Acc; double Float; double Double; };
+        const Budget budgets[] = {
+            { Accuracy_1e7, 6e-7, 1.5e-7 },
+            { Accuracy_1e4, 1e-4, 1e-4 },
+        };
+        for (const Budget& budget : budgets) {
+            const Error ef = Measure<float>(func, budget.Acc);
+            const Error ed = Measure<double>(func, budget.Acc);
+            if (!(ef.MaxRel <= budget.Float * scale) || !(ed.MaxRel <= budget.Double * scale)) {
+                LogError("Kernel test failed: %s at %s. Float: %g (at %g), double: %g (at %g)", FunctionName(func),
+                    AccuracyName(budget.Acc), ef.MaxRel, ef.WorstInput, ed.MaxRel, ed.WorstInput);
+                bSuccess = false;
+            }
+        }
+    }
+
+    //Special values behave like the C library. Denormal bases are not 0, and odd integers beyond Round keep the sign
+    {
+        const float a[] = { 0.0f, 0.0f, -2.0f, -2.0f, -2.0f, 5.0f, 1e-40f, 1e-40f, -1.0f };
+        const float b[] = { 2.0f, -1.0f, 3.0f, 2.0f, 0.5f, 0.0f, 2.0f, 0.5f, 16777215.0f };
+        float out[9];
+        PowBatch<float>(a, b, out, 9, Accuracy_1e4);
+        bool bVal = out[0] == 0.0f && std::isinf(out[1]) && std::abs(out[2] + 8.0f) < 1e-3f && std::abs(out[3] - 4.0f) < 1e-3f;
+        bVal &= std::isnan(out[4]) && out[5] == 1.0f && out[6] == 0.0f;
+        bVal &= std::abs(out[7] - 1e-20f) < 1e-23f && out[8] == -1.0f;
+
+        const float e[] = { 100.0f, -100.0f, std::numeric_limits<float>::quiet_NaN() };
+        ExpBatch<float>(e, out, 3, Accuracy_1e7);
+        bVal &= std::isinf(out[0]) && out[1] == 0.0f && std::isnan(out[2]);
+
+        //Beyond what Reduce handles the kernels give what the C library does
+        const float big[] = { 0.5f, 1e6f, -3e7f, std::numeric_limits<float>::infinity() };
+        Sin<float>(big, out, 4, Accuracy_1e4);
+        bVal &= out[0] == std::sin(0.5f) && out[1] == std::sin(1e6f) && out[2] == std::sin(-3e7f) && std::isnan(out[3]);
+        if (!bVal) {
+            LogError("Kernel test failed: special values");
+            bSuccess = false;
+        }
+    }
+    return bSuccess;
+}
+
+} // End of namespace Kernels
+} // End of namespace
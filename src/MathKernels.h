@@ -0,0 +1,61 @@
+#pragma once
+#include "DebugFinal.h"
+
+//The batch loops of the evaluator are compiled again for AVX2 (8 floats wide) and AVX-512 (16 wide), and the loader
+//picks the widest the cpu has. Needs the ifuncs of gcc on linux. Other compilers get the wider loops by targeting the
+//cpu with the whole build instead (see --simd in premake5.lua)
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__) && !defined(__AVX512F__)
+    #define KERNELS_CLONES __attribute__((target_clones("arch=x86-64-v4", "arch=x86-64-v3", "default")))
+#else
+    #define KERNELS_CLONES
+#endif
+
+namespace MathParser {
+
+//How close the built in functions have to be to the C library. The approximations are polynomials after a range
+//reduction, without branches, so the loops over a batch vectorise (see Program). They are only used where that makes
+//them faster than the C library, which gets every other batch whatever the accuracy (see UseApprox in MathKernels.cpp)
+enum Accuracy {
+    Accuracy_Full,      //The C library
+    Accuracy_1e7,       //About 1e-7 relative, which is all a float has
+    Accuracy_1e4,       //About 1e-4 relative, plenty for a preview
+};
+
+//The built in functions over arrays. out can be the same as an input
+namespace Kernels {
+
+    enum Function {
+        Func_Sin,
+        Func_Cos,
+        Func_Tan,
+        Func_Exp,
+        Func_Ln,
+        Func_Pow,   //exp(b * log(a)), so its error grows with |b * log(a)|
+
+        FuncCount
+    };
+
+    template <typename T> void Sin(const T* a, T* out, int32 n, Accuracy acc);
+    template <typename T> void Cos(const T* a, T* out, int32 n, Accuracy acc);
+    template <typename T> void Tan(const T* a, T* out, int32 n, Accuracy acc);
+    template <typename T> void Exp(const T* a, T* out, int32 n, Accuracy acc);
+    template <typename T> void Ln(const T* a, T* out, int32 n, Accuracy acc);
+    template <typename T> void Pow(const T* a, const T* b, T* out, int32 n, Accuracy acc);
+
+    //Largest error of the approximation over a sweep of the function's range, against the double C library. Measured
+    //even where the kernels use the C library instead
+    struct Error {
+        double MaxUlp;          //In units of T
+        double MaxRel;          //Relative, but against at least 1 for sin/cos/tan/log, whose results cross 0
+        double WorstInput;      //Where MaxRel happened (the base, for pow)
+    };
+    template <typename T> Error Measure(Function f, Accuracy acc);
+
+    const char* FunctionName(Function f);
+    const char* AccuracyName(Accuracy acc);
+
+    bool RunAllTests();     //Returns true when all tests pass
+
+} // End of namespace Kernels
+
+} // End of namespace
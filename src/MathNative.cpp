@@ -0,0 +1,407 @@
+#include "MathNative.h"
+#include "MathContext.h"
+#include "MathProgram.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <map>
+#include <tuple>
+
+#include "Profiler.h"
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <dlfcn.h>
+#endif
+
+namespace MathParser {
+
+#ifdef _WIN32
+    std::string NativeLibrary::ourCompiler = "cl";
+    static const char* const ourLibExtension = ".dll";
+#elif defined(__APPLE__)
+    std::string NativeLibrary::ourCompiler = "cc";
+    static const char* const ourLibExtension = ".dylib";
+#else
+    std::string NativeLibrary::ourCompiler = "cc";
+    static const char* const ourLibExtension = ".so";
+#endif
+
+//Contraction into fma is off, so that the functions give the same results as Program does on targets without fma
+#ifdef _WIN32
+    static const char* const ourCompilerFlags = "/nologo /O2 /fp:precise /LD";
+#else
+    static const char* const ourCompilerFlags = "-O3 -march=native -ffp-contract=off -fPIC -shared";
+#endif
+
+//--------------------------------------------------------------------------------
+//                               Code generation
+//--------------------------------------------------------------------------------
+
+//A literal that is a double in C, whatever the value
+static std::string Literal(double value) {
+    if (std::isnan(value))
+        return "NAN";
+    if (std::isinf(value))
+        return value > 0 ? "HUGE_VAL" : "(-HUGE_VAL)";
+
+    char buf[40];
+    snprintf(buf, sizeof(buf), "%.17g", value);
+    std::string str = buf;
+    if (str.find_first_of(".e") == std::string::npos)
+        str += ".0";
+    return value < 0 ? "(" + str + ")" : str;
+}
+
+//Straight-line C for the program. Every value is calculated once: each instruction is numbered by its operation and
+//the numbers of its operands, and an instruction that was seen before reuses the temporary of the first one
+static void GenerateFunction(const Program& p, std::string& out) {
+    using Key = std::tuple<int32, int32, int32, uint64>;
+    std::map<Key, int32> seen;
+    std::vector<std::string> values;    //C expression of each numbered value
+    std::vector<int32> regs(p.RegisterCount(), -1);
+
+    auto Value = [&](const std::string& expr) {
+        values.push_back(expr);
+        return (int32)values.size() - 1;
+    };
+
+    static const char* const paramNames[] = { "x", "y", "z", "t" };
+    int32 temps = 0;
+    char line[256];
+    for (const Program::Instruction& in : p.Instructions()) {
+        int32 a = (in.Op == Program::Op_Const || in.Op == Program::Op_Param) ? -1 : regs[in.A];
+        int32 b = -1;
+        int32 c = -1;
+        switch (in.Op) {
+            case Program::Op_MulAdd:
+                c = regs[in.C];
+                b = regs[in.B];
+                break;
+            case Program::Op_Add: case Program::Op_Sub: case Program::Op_Mul: case Program::Op_Div: case Program::Op_Pow:
+                b = regs[in.B];
+                break;
+            default:
+                break;
+        }
+        if (in.Op == Program::Op_Copy) {
+            regs[in.Dst] = a;
+            continue;
+        }
+        //a + b and a * b are the same as b + a and b * a, bit for bit
+        if ((in.Op == Program::Op_Add || in.Op == Program::Op_Mul || in.Op == Program::Op_MulAdd) && b < a)
+            std::swap(a, b);
+
+        uint64 bits = 0;
+        if (in.Op == Program::Op_Const)
+            memcpy(&bits, &in.Value, sizeof(bits));
+        else if (in.Op == Program::Op_Param)
+            bits = in.A;
+        else if (in.Op == Program::Op_MulAdd)
+            bits = (uint64)c;
+
+        const Key key(in.Op, a, b, bits);
+        auto it = seen.find(key);
+        if (it != seen.end()) {
+            regs[in.Dst] = it->second;
+            continue;
+        }
+
+        int32 val;
+        if (in.Op == Program::Op_Const) {
+            val = Value(Literal(in.Value));
+        }
+        else if (in.Op == Program::Op_Param) {
+            Assert(in.A < 3 && "Equations that use t are not compiled");
+            val = Value(paramNames[in.A]);
+        }
+        else {
+            const char* va = values[a].c_str();
+            const char* vb = (b >= 0) ? values[b].c_str() : "";
+            const char* vc = (c >= 0) ? values[c].c_str() : "";
+            switch (in.Op) {
+                case Program::Op_Add:   snprintf(line, sizeof(line), "%s + %s", va, vb);        break;
+                case Program::Op_Sub:   snprintf(line, sizeof(line), "%s - %s", va, vb);        break;
+                case Program::Op_Mul:   snprintf(line, sizeof(line), "%s * %s", va, vb);        break;
+                case Program::Op_Div:   snprintf(line, sizeof(line), "%s == 0.0 ? NAN : %s / %s", vb, va, vb);   break;
+                case Program::Op_Pow:   snprintf(line, sizeof(line), "pow(%s, %s)", va, vb);    break;
+                case Program::Op_Sin:   snprintf(line, sizeof(line), "sin(%s)", va);            break;
+                case Program::Op_Cos:   snprintf(line, sizeof(line), "cos(%s)", va);            break;
+                case Program::Op_Tan:   snprintf(line, sizeof(line), "tan(%s)", va);            break;
+                case Program::Op_Sqrt:  snprintf(line, sizeof(line), "sqrt(%s)", va);           break;
+                case Program::Op_Exp:   snprintf(line, sizeof(line), "exp(%s)", va);            break;
+                case Program::Op_Neg:   snprintf(line, sizeof(line), "-%s", va);                break;
+                case Program::Op_MulAdd: snprintf(line, sizeof(line), "%s * %s + %s", va, vb, vc); break;
+                default:                Assert(false && "Unknown op");                          break;
+            }
+            char name[16];
+            snprintf(name, sizeof(name), "v%d", temps++);
+            out += "    const double ";
+            out += name;
+            out += " = ";
+            out += line;
+            out += ";\n";
+            val = Value(name);
+        }
+        seen.emplace(key, val);
+        regs[in.Dst] = val;
+    }
+    out += "    return " + values[regs[p.Output(0)]] + ";\n";
+}
+
+void NativeLibrary::GenerateSource(const Context& ctx, std::string& outSource, std::vector<int>& outIndices) {
+    outSource =
+        "/* Generated by GraphIt from an equation file, do not edit */\n"
+        "#include <math.h>\n"
+        "#ifdef _WIN32\n"
+        "    #define GRAPHIT_EXPORT __declspec(dllexport)\n"
+        "#else\n"
+        "    #define GRAPHIT_EXPORT\n"
+        "#endif\n";
+    outIndices.clear();
+
+    Program p;
+    char line[160];
+    for (int i = 0; i < ctx.GetCount(); i++) {
+        const Equation* eq = ctx.FindEquationIndex(i);
+        //Functions with explicit params are inlined into the ones that call them
+        if (!eq || !eq->Valid() || eq->EParamCount() != 0 || eq->UsesTime() || !p.Build(*eq))
+            continue;
+
+        snprintf(line, sizeof(line), "\n/* %.*s */\nGRAPHIT_EXPORT double graphit_eq%d_xyz(double x, double y, double z) {\n",
+            (int)eq->Name().size(), eq->Name().data(), i);
+        outSource += line;
+        GenerateFunction(p, outSource);
+        snprintf(line, sizeof(line), "}\nGRAPHIT_EXPORT double graphit_eq%d(double x, double y) {\n    return graphit_eq%d_xyz(x, y, 0.0);\n}\n", i, i);
+        outSource += line;
+        outIndices.push_back(i);
+    }
+}
+
+//--------------------------------------------------------------------------------
+//                               Compiling and loading
+//--------------------------------------------------------------------------------
+
+NativeLibrary::~NativeLibrary() {
+    Unload();
+}
+
+void NativeLibrary::SetCompiler(const std::string& compiler) {
+    ourCompiler = compiler;
+}
+
+std::string NativeLibrary::DefaultCacheDir() {
+    std::error_code err;
+    std::filesystem::path dir = std::filesystem::temp_directory_path(err);
+    if (err)
+        dir = ".";
+    return (dir / "GraphItNative").string();
+}
+
+bool NativeLibrary::Compile(const std::string& sourcePath, const std::string& libPath) {
+    PROFILE_ZONE("CompileNative");
+    //Compiled next to it and renamed over it, so that another instance never loads half a library
+    const std::filesystem::path lib(libPath);
+    const std::string partPath = (lib.parent_path() / lib.stem()).string() + ".part" + ourLibExtension;
+
+    std::string cmd = ourCompiler + " " + ourCompilerFlags;
+#ifdef _WIN32
+    cmd += " \"" + sourcePath + "\" /Fe\"" + partPath + "\" /Fo\"" + lib.parent_path().string() + "\\\\\" > nul";
+#else
+    cmd += " -o \"" + partPath + "\" \"" + sourcePath + "\" -lm";
+#endif
+    const int res = std::system(cmd.c_str());
+    std::error_code err;
+    if (res != 0) {
+        LogError("Could not compile the equations (%d): %s", res, cmd.c_str());
+        std::filesystem::remove(partPath, err);
+        return false;
+    }
+    std::filesystem::rename(partPath, libPath, err);
+    if (err) {
+        LogWarn("Could not write %s (%s)", libPath.c_str(), err.message().c_str());
+        std::filesystem::remove(partPath, err);
+        return false;
+    }
+    return true;
+}
+
+bool NativeLibrary::Build(const Context& ctx, const std::string& cacheDir) {
+    PROFILE_ZONE("BuildNative");
+    Unload();
+
+    std::string source;
+    std::vector<int> indices;
+    GenerateSource(ctx, source, indices);
+    if (indices.empty())
+        return true;
+
+    //Keyed by everything that goes into the library, so a different compiler or different flags compile it again
+    const std::string key = source + ourCompiler + ourCompilerFlags;
+    char name[32];
+    snprintf(name, sizeof(name), "graphit_%016llx", (unsigned long long)Context::HashSource(key.data(), key.size()));
+
+    std::error_code err;
+    std::filesystem::create_directories(cacheDir, err);
+    const std::filesystem::path base = std::filesystem::path(cacheDir) / name;
+    const std::string libPath = base.string() + ourLibExtension;
+
+    if (!std::filesystem::exists(libPath, err)) {
+        const std::string sourcePath = base.string() + ".c";
+        {
+            std::ofstream file(sourcePath, std::ios::binary | std::ios::trunc);
+            file.write(source.data(), (std::streamsize)source.size());
+            if (!file.good()) {
+                LogWarn("Could not write %s", sourcePath.c_str());
+                return false;
+            }
+        }
+        if (!Compile(sourcePath, libPath))
+            return false;
+        LogTrace("Compiled %d equations into %s", (int)indices.size(), libPath.c_str());
+    }
+
+#ifdef _WIN32
+    myHandle = (void*)LoadLibraryA(libPath.c_str());
+#else
+    myHandle = dlopen(libPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+#endif
+    if (!myHandle) {
+        LogError("Could not load %s", libPath.c_str());
+        return false;
+    }
+
+    myEntries.reserve(indices.size());
+    for (int i : indices) {
+        const Equation* eq = ctx.FindEquationIndex(i);
+        char symbol[48];
+        snprintf(symbol, sizeof(symbol), "graphit_eq%d", i);
+        FuncExplicitType funcExplicit = (FuncExplicitType)LoadSymbol(symbol);
+        snprintf(symbol, sizeof(symbol), "graphit_eq%d_xyz", i);
+        FuncImplicitType funcImplicit = (FuncImplicitType)LoadSymbol(symbol);
+        if (!funcExplicit || !funcImplicit) {
+            LogError("%s is missing %s", libPath.c_str(), symbol);
+            Unload();
+            return false;
+        }
+        myEntries.push_back({ eq, eq->Revision(), funcExplicit, funcImplicit });
+    }
+    return true;
+}
+
+void NativeLibrary::Unload() {
+    if (myHandle) {
+#ifdef _WIN32
+        FreeLibrary((HMODULE)myHandle);
+#else
+        dlclose(myHandle);
+#endif
+    }
+    myHandle = nullptr;
+    myEntries.clear();
+}
+
+void* NativeLibrary::LoadSymbol(const char* name) const {
+#ifdef _WIN32
+    return (void*)GetProcAddress((HMODULE)myHandle, name);
+#else
+    return dlsym(myHandle, name);
+#endif
+}
+
+const NativeLibrary::Entry* NativeLibrary::Find(const Equation* eq) const {
+    for (const Entry& e : myEntries) {
+        if (e.Eq == eq)
+            return (e.Revision == eq->Revision()) ? &e : nullptr;
+    }
+    return nullptr;
+}
+
+NativeLibrary::FuncExplicitType NativeLibrary::FindExplicit(const Equation* eq) const {
+    const Entry* e = Find(eq);
+    return e ? e->Explicit : nullptr;
+}
+
+NativeLibrary::FuncImplicitType NativeLibrary::FindImplicit(const Equation* eq) const {
+    const Entry* e = Find(eq);
+    return e ? e->Implicit : nullptr;
+}
+
+bool NativeLibrary::RunAllTests() {
+    bool bSuccess = true;
+    #define TEST(x) \
+        if (!(x)) { \
+            LogError("NativeLibrary test failed: %s", #x); \
+            bSuccess = false; \
+        }
+
+    Context ctx;
+    ctx.Reload({
+        "a = sin(x) * sin(x) + sin(x) / (1 + x*x)",
+        "b(p) = p^2 + 1",
+        "c = b(x) * b(y) - sqrt(x*x + y*y) + -2",
+        "d = z + x * y",
+        "w = x + t",
+    });
+    Equation* a = ctx.FindEquation("a");
+    Equation* c = ctx.FindEquation("c");
+    Equation* d = ctx.FindEquation("d");
+    Equation* w = ctx.FindEquation("w");
+
+    //Every value is calculated once, and neither functions with explicit params nor equations with t get a function
+    std::string source;
+    std::vector<int> indices;
+    GenerateSource(ctx, source, indices);
+    size_t sinCount = 0;
+    for (size_t pos = source.find("sin("); pos != std::string::npos; pos = source.find("sin(", pos + 1))
+        sinCount++;
+    TEST(sinCount == 1);
+    TEST(source.find("/* c */") != std::string::npos && source.find("/* d */") != std::string::npos);
+    TEST(source.find("/* b */") == std::string::npos && source.find("/* w */") == std::string::npos);
+    TEST(source.find("(-2.0)") != std::string::npos);
+
+    //Compiling needs a compiler on the path
+#ifdef _WIN32
+    const bool bCompiler = std::system(("where " + ourCompiler + " > nul 2> nul").c_str()) == 0;
+#else
+    const bool bCompiler = std::system(("command -v " + ourCompiler + " > /dev/null 2>&1").c_str()) == 0;
+#endif
+    if (!bCompiler) {
+        LogWarn("No %s on the path, skipping the NativeLibrary compile tests", ourCompiler.c_str());
+        return bSuccess;
+    }
+
+    NativeLibrary lib;
+    TEST(lib.Build(ctx, DefaultCacheDir()) && lib.Loaded());
+    FuncExplicitType fa = lib.FindExplicit(a);
+    FuncExplicitType fc = lib.FindExplicit(c);
+    FuncImplicitType fd = lib.FindImplicit(d);
+    TEST(fa && fc && fd && !lib.FindExplicit(w));
+    if (fa && fc && fd) {
+        bool bSame = true;
+        for (int32 i = 0; i < 50; i++) {
+            const double x = -10.0 + 0.4 * i;
+            const double y = 7.3 - 0.3 * i;
+            bSame &= fa(x, y) == a->Evaluate(x, y);
+            bSame &= fc(x, y) == c->Evaluate(x, y);
+            bSame &= fd(x, y, 0.5 * x) == d->Evaluate(x, y, 0.5 * x);
+        }
+        TEST(bSame);
+    }
+
+    //Changed equations have no function till the next build
+    ctx.Reload({ "a = cos(x)", "b(p) = p^2 + 1", "c = b(x) * b(y) - sqrt(x*x + y*y) + -2", "d = z + x * y", "w = x + t" });
+    a = ctx.FindEquation("a");
+    TEST(!lib.FindExplicit(a) && lib.FindExplicit(ctx.FindEquation("c")));
+    TEST(lib.Build(ctx, DefaultCacheDir()) && lib.FindExplicit(a) && lib.FindExplicit(a)(0.0, 0.0) == 1.0);
+
+    #undef TEST
+    return bSuccess;
+}
+
+} // End of namespace
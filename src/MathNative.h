@@ -0,0 +1,66 @@
+#pragma once
+#include "DebugFinal.h"
+#include <string>
+#include <vector>
+
+namespace MathParser {
+
+class Context;
+class Equation;
+
+//The equations of a context turned into C, compiled by the system compiler into a shared library and loaded. Meant for
+//equation files that rarely change: the library is cached by the hash of its source, so only the first run compiles.
+//Every equation that Program can build gets a function, apart from the ones that use t
+class NativeLibrary {
+public:
+    //Same as Grapher3D::FuncExplicitType and FuncImplicitType
+    using FuncExplicitType = double(*)(double x, double y);
+    using FuncImplicitType = double(*)(double x, double y, double z);
+
+public:
+    NativeLibrary() = default;
+    ~NativeLibrary();
+    NativeLibrary(const NativeLibrary&) = delete;
+    NativeLibrary& operator= (const NativeLibrary&) = delete;
+
+    //Returns false (and logs why) if the library could not be compiled or loaded. The functions from before are
+    //unloaded either way, so nothing may be calling them
+    bool Build(const Context& ctx, const std::string& cacheDir);
+    void Unload();
+
+    bool Loaded() const { return myHandle != nullptr; }
+    //nullptr when the equation has no function, or changed since Build (see Equation::Revision)
+    FuncExplicitType FindExplicit(const Equation* eq) const;
+    FuncImplicitType FindImplicit(const Equation* eq) const;
+    //Where the libraries go by default, a folder in the temp directory
+    static std::string DefaultCacheDir();
+
+    //C for every equation that can be compiled, and the indices in ctx of those equations. The functions of equation
+    //i are called graphit_eq<i> (x, y) and graphit_eq<i>_xyz (x, y, z)
+    static void GenerateSource(const Context& ctx, std::string& outSource, std::vector<int>& outIndices);
+
+    //The compiler that is run, cc (cl on windows) by default. It gets the flags for the platform appended
+    static void SetCompiler(const std::string& compiler);
+
+    static bool RunAllTests();    //Returns true when all tests pass
+
+private:
+    struct Entry {
+        const Equation* Eq;
+        uint32 Revision;
+        FuncExplicitType Explicit;
+        FuncImplicitType Implicit;
+    };
+    const Entry* Find(const Equation* eq) const;
+
+    static bool Compile(const std::string& sourcePath, const std::string& libPath);
+    void* LoadSymbol(const char* name) const;
+
+private:
+    void* myHandle = nullptr;
+    std::vector<Entry> myEntries;
+
+    static std::string ourCompiler;
+};
+
+} // End of namespace
@@ -23,112 +23,39 @@ NodeOperator::Operator NodeOperator::CharToOP(char c) {
     }
 }
 
-NodeValueType NodeOperator::Calculate(std::stack<NodeValue>& values) {
-    switch (myOp)
-    {
-        case OP_ADD: {
-            if (values.size() < 2)
-                return NodeValueType(false);
-
-            double op2 = values.top().GetValue();
-            values.pop();
-            double op1 = values.top().GetValue();
-            values.pop();
-
-            return NodeValueType( op1 + op2 );
+double NodeOperator::Calculate(ValueStack& values) const {
+    //Binary operators pop the second operand first
+    const double op2 = values.top().GetValue();
+    values.pop();
+    if (Arity() == 1) {
+        switch (myOp)
+        {
+            case OP_SIN:    return glm::sin(op2);
+            case OP_COS:    return glm::cos(op2);
+            case OP_TAN:    return glm::tan(op2);
+            case OP_SQRT:   return glm::sqrt(op2);
+            case OP_EXP:    return glm::exp(op2);
+            case OP_NEG:    return -op2;
+            default:        break;
         }
-        case OP_SUB: {
-            if (values.size() < 2)
-                return NodeValueType(false);
-            
-            double op2 = values.top().GetValue();
-            values.pop();
-            double op1 = values.top().GetValue();
-            values.pop();
-
-            return NodeValueType( op1 - op2 );
-        }
-        case OP_MUL: {
-            if (values.size() < 2)
-                return NodeValueType(false);
-            
-            double op2 = values.top().GetValue();
-            values.pop();
-            double op1 = values.top().GetValue();
-            values.pop();
-
-            return NodeValueType( op1 * op2 );
-        }
-        case OP_DIV: {
-            if (values.size() < 2)
-                return NodeValueType(false);
-            
-            double op2 = values.top().GetValue();
-            values.pop();
-            double op1 = values.top().GetValue();
-            values.pop();
-
-            return NodeValueType( op1 / op2 );
-        }
-        case OP_POW: {
-            if (values.size() < 2)
-                return NodeValueType(false);
-            
-            double op2 = values.top().GetValue();
-            values.pop();
-            double op1 = values.top().GetValue();
-            values.pop();
-
-            return NodeValueType( std::pow(op1, op2) );
-        }
-
-        case OP_SIN: {
-            if (values.size() < 1)
-                return NodeValueType(false);
-
-            double op = values.top().GetValue();
-            values.pop();
-            return NodeValueType( glm::sin(op) );
-        }
-        case OP_COS: {
-            if (values.size() < 1)
-                return NodeValueType(false);
-
-            double op = values.top().GetValue();
-            values.pop();
-            return NodeValueType( glm::cos(op) );
-        }
-        case OP_TAN: {
-            if (values.size() < 1)
-                return NodeValueType(false);
-
-            double op = values.top().GetValue();
-            values.pop();
-            return NodeValueType( glm::tan(op) );
-        }
-
-        case OP_SQRT: {
-            if (values.size() < 1)
-                return NodeValueType(false);
-
-            double op = values.top().GetValue();
-            values.pop();
-            return NodeValueType( glm::sqrt(op) );
-        }
-
-        case OP_EXP: {
-            if (values.size() < 1)
-                return NodeValueType(false);
-
-            double op = values.top().GetValue();
-            values.pop();
-            return NodeValueType( glm::exp(op) );
+    }
+    else {
+        const double op1 = values.top().GetValue();
+        values.pop();
+        switch (myOp)
+        {
+            case OP_ADD:    return op1 + op2;
+            case OP_SUB:    return op1 - op2;
+            case OP_MUL:    return op1 * op2;
+            case OP_DIV:    return Divide(op1, op2);
+            case OP_POW:    return std::pow(op1, op2);
+            default:        break;
         }
     }
 
     LogError("Unknown type: %c (%d)", myOp, myOp);
     Assert(false);
-    return NodeValueType(false);
+    return std::numeric_limits<double>::quiet_NaN();
 }
 
 void NodeExpression::ResolveEquations(Context* ctx) {
@@ -144,28 +71,21 @@ void NodeExpression::ResolveEquations(Context* ctx) {
 
 void NodeExpression::FetchProperties() {
     Assert(myEquation);
-    myEquation->FetchProperties();
     for (Equation& eq : myParams) {
         eq.FetchProperties();
     }
 }
 
-NodeValueType NodeExpression::Calculate(NodeValue* iParams, int iSize, NodeValue* eParams, int eSize)
+double NodeExpression::Calculate(NodeValue* iParams, int iSize, NodeValue* eParams, int eSize) const
 {
-    if (!myEquation)
-        return NodeValueType(false);
-    
-    //Todo: Store this on the stack
-    std::vector<NodeValue> funcParams;
-    funcParams.reserve(20);
-
-    for (Equation& eq : myParams) {
-        NodeValueType res = eq.EvaluatePrivate(iParams, iSize, eParams, eSize);
-        if (!res.Success)
-            return res;
-        funcParams.push_back(res.Value);
+    //Equation::Validate made sure that the function exists and gets all of its params
+    Assert(myEquation && myParams.size() <= MaxParams);
+    NodeValue funcParams[MaxParams];
+    int count = 0;
+    for (const Equation& eq : myParams) {
+        funcParams[count++] = eq.EvaluatePrivate(iParams, iSize, eParams, eSize);
     }
-    return myEquation->EvaluatePrivate(iParams, iSize, funcParams.data(), funcParams.size());
+    return myEquation->EvaluatePrivate(iParams, iSize, funcParams, count);
 }
 
 
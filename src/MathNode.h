@@ -2,9 +2,11 @@
 #include "DebugFinal.h"
 #include <string>
 #include <vector>
+#include <memory_resource>
 #include <array>
 #include <variant>
 #include <stack>
+#include <limits>
 
 namespace MathParser {
 
@@ -40,21 +42,30 @@ private:
     double value;
 };
 
-struct NodeValueType {
-    bool Success;
-    NodeValue Value;
-
-    NodeValueType(bool success, double val=0.0):
-        Success(success), Value(val)
-    {}
+//Fixed size stack that is used while evaluating, so that evaluating never allocates. It has the same interface as
+//std::stack. Equations that would need a deeper stack are invalid, see Equation::Validate
+class ValueStack {
+public:
+    static constexpr int Capacity = 100;
 
-    NodeValueType(double val):
-        Success(true), Value(val)
-    {}
+    int size() const                    { return myCount; }
+    bool empty() const                  { return myCount == 0; }
+    NodeValue& top()                    { Assert(myCount > 0); return myValues[myCount - 1]; }
+    void pop()                          { Assert(myCount > 0); myCount--; }
+    void push(const NodeValue& val)     { Assert(myCount < Capacity && "Ran out of stack"); myValues[myCount++] = val; }
 
+private:
+    NodeValue myValues[Capacity];
+    int myCount = 0;
 };
 
 class NodeParam {
+public:
+    //Implicit param index of the time, t. It is not counted in Equation::IParamCount, and is always passed in when
+    //evaluating (0 unless given)
+    static constexpr int TimeParam = 3;
+    static constexpr int ImplicitSlots = TimeParam + 1;
+
 public:
     NodeParam() = default;
     NodeParam(int index, bool implicit):
@@ -91,6 +102,8 @@ public:
 
         OP_SQRT,
         OP_EXP,
+
+        OP_NEG,     //Unary minus
     };
 
 public:
@@ -109,7 +122,19 @@ public:
         Log("%-15s : %c\n", "Operator", myOp);
     }
 
-    NodeValueType Calculate(std::stack<NodeValue>& values);
+    //Pops the operands and returns the result. Equation::Validate made sure that they are there, so nothing is checked.
+    //Domain errors give NaN
+    double Calculate(ValueStack& values) const;
+    Operator Op() const { return myOp; }
+
+    //a / b, but NaN when b is 0 instead of an infinity. Shared with Program, so that both give the same results
+    template <typename T>
+    static T Divide(T a, T b) {
+        const T r = a / b;
+        return (b == (T)0) ? std::numeric_limits<T>::quiet_NaN() : r;
+    }
+    //Number of values that Calculate pops
+    int Arity() const { return myOp >= OP_SIN ? 1 : 2; }
 
 private:
     Operator CharToOP(char c);
@@ -120,6 +145,10 @@ private:
 
 //This can either be a const variable or a float
 class NodeExpression {
+public:
+    //Maximum number of parameters a function can be called with
+    static constexpr int MaxParams = 20;
+
 public:
     NodeExpression() = default;
     NodeExpression(const std::string_view& str):
@@ -127,29 +156,30 @@ public:
     {
     }
 
-    NodeExpression(const std::string_view& str, std::vector<Equation>&& eqs):
+    NodeExpression(const std::string_view& str, std::pmr::vector<Equation>&& eqs):
         myEquation(nullptr), myName(str), myParams( std::move(eqs) )
     {   
     }
 
-    // void SetEquation(Equation* eq) { myEquation = eq; }
+    void SetEquation(Equation* eq) { myEquation = eq; }
     void Print() const;
     
     const std::string_view& Name() const { return myName; }
     Equation* GetEquation() { return myEquation; }
-    std::vector<Equation>& GetParams() { return myParams; }
+    std::pmr::vector<Equation>& GetParams() { return myParams; }
     const Equation* GetEquation() const { return myEquation; }
-    const std::vector<Equation>& GetParams() const { return myParams; }
+    const std::pmr::vector<Equation>& GetParams() const { return myParams; }
 
     void ResolveEquations(Context* ctx);
     void FetchProperties();
     
-    NodeValueType Calculate(NodeValue* iParams, int iSize, NodeValue* eParams, int eSize);
+    double Calculate(NodeValue* iParams, int iSize, NodeValue* eParams, int eSize) const;
 
 private:
     Equation* myEquation;
     std::string_view myName;
-    std::vector<Equation> myParams;
+    //In the memory of the equation, when it has its own (see Context::LoadCompiled). Copies are on the heap
+    std::pmr::vector<Equation> myParams;
 
 };
 
@@ -172,6 +202,9 @@ struct NodeGeneric {
     NodeGeneric(const NodeExpression& n):
         type(NodeType::NodeExpression), data(n)
     {}
+    NodeGeneric(NodeExpression&& n):
+        type(NodeType::NodeExpression), data(std::move(n))
+    {}
 
     
 
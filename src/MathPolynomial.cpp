@@ -0,0 +1,120 @@
+#include "MathPolynomial.h"
+#include "Maths.h"
+
+namespace MathParser {
+
+Polynomial Polynomial::Constant(double value) {
+    Polynomial p;
+    if (value != 0.0)
+        p.myTerms.push_back({ 0, value });
+    return p;
+}
+
+Polynomial Polynomial::Variable(int32 index) {
+    Assert(index >= 0 && index < Variables);
+    Polynomial p;
+    p.myTerms.push_back({ 1u << (8 * index), 1.0 });
+    return p;
+}
+
+bool Polynomial::Sum(const Polynomial& a, const Polynomial& b, double signB, Polynomial& out) {
+    std::vector<Term> terms;
+    terms.reserve(a.myTerms.size() + b.myTerms.size());
+    size_t i = 0, j = 0;
+    while (i < a.myTerms.size() || j < b.myTerms.size()) {
+        Term t;
+        if (j == b.myTerms.size() || (i < a.myTerms.size() && a.myTerms[i].Powers < b.myTerms[j].Powers))
+            t = a.myTerms[i++];
+        else if (i == a.myTerms.size() || b.myTerms[j].Powers < a.myTerms[i].Powers)
+            t = { b.myTerms[j].Powers, signB * b.myTerms[j++].Coeff };
+        else {
+            t = { a.myTerms[i].Powers, a.myTerms[i].Coeff + signB * b.myTerms[j].Coeff };
+            i++;
+            j++;
+        }
+        if (t.Coeff != 0.0)
+            terms.push_back(t);
+    }
+    if ((int32)terms.size() > MaxTerms)
+        return false;
+    out.myTerms = std::move(terms);
+    return true;
+}
+
+bool Polynomial::Product(const Polynomial& a, const Polynomial& b, Polynomial& out) {
+    if (a.myTerms.size() > 1 && b.myTerms.size() > 1)
+        return false;
+    if (a.myTerms.size() > 1)
+        return Product(b, a, out);
+    if (a.myTerms.empty()) {
+        out.myTerms.clear();
+        return true;
+    }
+
+    //Multiplying every term by the same one keeps them sorted
+    const Term m = a.myTerms[0];
+    std::vector<Term> terms;
+    terms.reserve(b.myTerms.size());
+    for (const Term& t : b.myTerms) {
+        uint32 powers = 0;
+        for (int32 var = 0; var < Variables; var++) {
+            const int32 e = Exponent(m.Powers, var) + Exponent(t.Powers, var);
+            if (e > MaxDegree)
+                return false;
+            powers |= (uint32)e << (8 * var);
+        }
+        const double coeff = m.Coeff * t.Coeff;
+        if (coeff != 0.0)
+            terms.push_back({ powers, coeff });
+    }
+    out.myTerms = std::move(terms);
+    return true;
+}
+
+bool Polynomial::Raise(const Polynomial& a, int32 n, Polynomial& out) {
+    Assert(n >= 0);
+    if (a.myTerms.size() > 1)
+        return false;
+    Polynomial result = Constant(1.0);
+    for (int32 i = 0; i < n; i++) {
+        if (!Product(result, a, result))
+            return false;
+    }
+    out = std::move(result);
+    return true;
+}
+
+void Polynomial::Scale(double s) {
+    int32 count = 0;
+    for (const Term& t : myTerms) {
+        const double coeff = t.Coeff * s;
+        if (coeff != 0.0)
+            myTerms[count++] = { t.Powers, coeff };
+    }
+    myTerms.resize(count);
+}
+
+bool Polynomial::IsConstant(double& outValue) const {
+    if (myTerms.empty()) {
+        outValue = 0.0;
+        return true;
+    }
+    if (myTerms.size() == 1 && myTerms[0].Powers == 0) {
+        outValue = myTerms[0].Coeff;
+        return true;
+    }
+    return false;
+}
+
+int32 Polynomial::TotalDegree() const {
+    int32 degree = 0;
+    for (const Term& t : myTerms) {
+        int32 d = 0;
+        for (int32 var = 0; var < Variables; var++)
+            d += Exponent(t.Powers, var);
+        degree = Max(degree, d);
+    }
+    return degree;
+}
+
+} // End of namespace
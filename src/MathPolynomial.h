@@ -0,0 +1,42 @@
+#pragma once
+#include "DebugFinal.h"
+#include <vector>
+
+namespace MathParser {
+
+//A polynomial in the implicit params x, y, z and t, as a sum of terms c * x^i * y^j * z^k * t^l. Program finds the parts
+//of an equation that are polynomials, and evaluates them in this form with Horner's rule instead of with pow
+class Polynomial {
+public:
+    static constexpr int32 Variables = 4;
+    static constexpr int32 MaxDegree = 16;      //In each variable
+    static constexpr int32 MaxTerms = 32;
+
+    struct Term {
+        uint32 Powers;      //8 bits for each variable, x in the lowest
+        double Coeff;
+    };
+
+public:
+    static Polynomial Constant(double value);
+    static Polynomial Variable(int32 index);
+    static int32 Exponent(uint32 powers, int32 var)     { return (powers >> (8 * var)) & 0xFF; }
+
+    //These return false when the result would have more than MaxTerms terms or more than MaxDegree in a variable.
+    //out can be one of the inputs
+    static bool Sum(const Polynomial& a, const Polynomial& b, double signB, Polynomial& out);
+    //Only when a or b is a single term. Multiplying out two sums can lose every digit, like (x - 1000)^4 does
+    static bool Product(const Polynomial& a, const Polynomial& b, Polynomial& out);
+    //Only when a is a single term, for the same reason
+    static bool Raise(const Polynomial& a, int32 n, Polynomial& out);
+    void Scale(double s);
+
+    const std::vector<Term>& Terms() const  { return myTerms; }
+    bool IsConstant(double& outValue) const;
+    int32 TotalDegree() const;
+
+private:
+    std::vector<Term> myTerms;      //Sorted by Powers, without zero coefficients
+};
+
+} // End of namespace
@@ -0,0 +1,877 @@
+#include "MathProgram.h"
+#include "MathContext.h"
+#include "MathNode.h"
+#include "MathPolynomial.h"
+#include "Maths.h"
+
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <map>
+#include <tuple>
+
+namespace MathParser {
+
+//Calls nested deeper than this are not inlined
+static constexpr int32 MaxDepth = 256;
+
+//Float keeps 24 bits. An add or subtract whose result is this much smaller than its operands lost 10 of them
+static constexpr float CancelLimit = 1024.0f;
+//Float sin/cos/tan reduce their argument in float, so past this the absolute error is about 1e-4
+static constexpr float TrigLimit = 4096.0f;
+//Results this close to the end of the float range (or past it) are redone
+static constexpr float LargeLimit = 1e30f;
+static constexpr float SmallLimit = 1e-30f;
+
+template <typename T> static std::vector<T>& Registers(Program::Scratch& s);
+template <> std::vector<float>& Registers<float>(Program::Scratch& s)     { return s.Float; }
+template <> std::vector<double>& Registers<double>(Program::Scratch& s)   { return s.Double; }
+
+static bool ToOpCode(NodeOperator::Operator op, Program::OpCode& outCode) {
+    switch (op) {
+        case NodeOperator::OP_ADD:  outCode = Program::Op_Add;  return true;
+        case NodeOperator::OP_SUB:  outCode = Program::Op_Sub;  return true;
+        case NodeOperator::OP_MUL:  outCode = Program::Op_Mul;  return true;
+        case NodeOperator::OP_DIV:  outCode = Program::Op_Div;  return true;
+        case NodeOperator::OP_POW:  outCode = Program::Op_Pow;  return true;
+        case NodeOperator::OP_SIN:  outCode = Program::Op_Sin;  return true;
+        case NodeOperator::OP_COS:  outCode = Program::Op_Cos;  return true;
+        case NodeOperator::OP_TAN:  outCode = Program::Op_Tan;  return true;
+        case NodeOperator::OP_SQRT: outCode = Program::Op_Sqrt; return true;
+        case NodeOperator::OP_EXP:  outCode = Program::Op_Exp;  return true;
+        case NodeOperator::OP_NEG:  outCode = Program::Op_Neg;  return true;
+        default:                    return false;
+    }
+}
+
+static bool Binary(Program::OpCode op) {
+    return op >= Program::Op_Add && op <= Program::Op_Pow;
+}
+
+void Program::Clear() {
+    myInstructions.clear();
+    myOutputs.clear();
+    myRegisters = 0;
+    myOverflow = false;
+}
+
+bool Program::Build(const Equation& eq) {
+    return Build(std::vector<const Equation*>{ &eq });
+}
+
+bool Program::Build(const std::vector<const Equation*>& eqs) {
+    Clear();
+    if (eqs.empty())
+        return false;
+
+    //Each equation leaves its result on the stack, above the ones before it
+    int32 sp = 0;
+    for (int32 i = 0; i < (int32)eqs.size(); i++) {
+        const Equation& eq = *eqs[i];
+        if (!eq.Valid() || eq.EParamCount() > 0 || !Compile(eq, nullptr, 0, sp, 0) || sp != i + 1) {
+            Clear();
+            return false;
+        }
+    }
+    if (!Optimize((int32)eqs.size())) {
+        Clear();
+        return false;
+    }
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+//                                  Optimizing
+//--------------------------------------------------------------------------------
+
+static int32 OperandCount(Program::OpCode op) {
+    switch (op) {
+        case Program::Op_Const:
+        case Program::Op_Param:     return 0;
+        case Program::Op_MulAdd:    return 3;
+        default:                    return Binary(op) ? 2 : 1;
+    }
+}
+
+//What the interpreter gives for constant operands
+static double Fold(Program::OpCode op, double a, double b, double c) {
+    switch (op) {
+        case Program::Op_Add:       return a + b;
+        case Program::Op_Sub:       return a - b;
+        case Program::Op_Mul:       return a * b;
+        case Program::Op_Div:       return NodeOperator::Divide(a, b);
+        case Program::Op_Pow:       return std::pow(a, b);
+        case Program::Op_Sin:       return std::sin(a);
+        case Program::Op_Cos:       return std::cos(a);
+        case Program::Op_Tan:       return std::tan(a);
+        case Program::Op_Sqrt:      return std::sqrt(a);
+        case Program::Op_Exp:       return std::exp(a);
+        case Program::Op_Neg:       return -a;
+        case Program::Op_MulAdd:    return a * b + c;
+        default:
+            Assert(false && "Not a calculation");
+            return 0.0;
+    }
+}
+
+//The values a program calculates, numbered by the calculation and the numbers of its operands. Asking for the same
+//calculation twice gives the same value, and calculations on constants are done right away
+struct ValueTable {
+    struct Value {
+        Program::OpCode Op;
+        int32 A;            //Param: the implicit index. Everything else: the values of the operands
+        int32 B;
+        int32 C;
+        double Const;
+    };
+    std::vector<Value> Values;
+    std::map<std::tuple<int32, int32, int32, int32, uint64>, int32> Known;
+
+    int32 Add(Program::OpCode op, int32 a = 0, int32 b = 0, int32 c = 0, double value = 0.0) {
+        const int32 operands = OperandCount(op);
+        if (operands > 0) {
+            bool bConst = true;
+            for (int32 i = 0; i < operands; i++)
+                bConst &= Values[i == 0 ? a : (i == 1 ? b : c)].Op == Program::Op_Const;
+            if (bConst)
+                return Const(Fold(op, Values[a].Const, operands > 1 ? Values[b].Const : 0.0, operands > 2 ? Values[c].Const : 0.0));
+        }
+        //a + b and a * b are the same as b + a and b * a, bit for bit
+        if ((op == Program::Op_Add || op == Program::Op_Mul || op == Program::Op_MulAdd) && b < a)
+            std::swap(a, b);
+
+        uint64 bits = 0;
+        if (op == Program::Op_Const)
+            memcpy(&bits, &value, sizeof(bits));
+        const auto key = std::make_tuple((int32)op, a, b, c, bits);
+        auto it = Known.find(key);
+        if (it == Known.end()) {
+            it = Known.emplace(key, (int32)Values.size()).first;
+            Values.push_back({ op, a, b, c, value });
+        }
+        return it->second;
+    }
+    int32 Const(double value)       { return Add(Program::Op_Const, 0, 0, 0, value); }
+    int32 Param(int32 index)        { return Add(Program::Op_Param, index); }
+    bool IsConst(int32 v, double value) const { return Values[v].Op == Program::Op_Const && Values[v].Const == value; }
+};
+
+//Multivariate Horner's rule. The terms are grouped by their power of var, highest first, and each group is a
+//polynomial in the variables after var: ((g_n * var + g_n-1) * var + ...) * var + g_0
+static int32 EmitHorner(ValueTable& table, const std::vector<Polynomial::Term>& terms, int32 var) {
+    if (terms.empty())
+        return table.Const(0.0);
+    if (var == Polynomial::Variables) {
+        Assert(terms.size() == 1);
+        return table.Const(terms[0].Coeff);
+    }
+    int32 degree = 0;
+    for (const Polynomial::Term& t : terms)
+        degree = Max(degree, Polynomial::Exponent(t.Powers, var));
+    if (degree == 0)
+        return EmitHorner(table, terms, var + 1);
+
+    const int32 x = table.Param(var);
+    int32 acc = -1;     //-1 while it is 1, which is left out of the multiplies
+    std::vector<Polynomial::Term> group;
+    for (int32 e = degree; e >= 0; e--) {
+        group.clear();
+        for (const Polynomial::Term& t : terms) {
+            if (Polynomial::Exponent(t.Powers, var) == e)
+                group.push_back(t);
+        }
+        if (e == degree) {
+            acc = EmitHorner(table, group, var + 1);
+            if (table.IsConst(acc, 1.0))
+                acc = -1;
+        }
+        else if (group.empty())
+            acc = (acc < 0) ? x : table.Add(Program::Op_Mul, acc, x);
+        else {
+            const int32 g = EmitHorner(table, group, var + 1);
+            acc = (acc < 0) ? table.Add(Program::Op_Add, x, g) : table.Add(Program::Op_MulAdd, acc, x, g);
+        }
+    }
+    return acc;
+}
+
+//b^n by squaring, so integer powers never call pow
+static int32 EmitIntPower(ValueTable& table, int32 b, int32 n) {
+    if (n == 0)
+        return table.Const(1.0);
+    int32 result = -1;
+    int32 square = b;
+    for (int32 m = n < 0 ? -n : n; m > 0; m >>= 1) {
+        if (m & 1)
+            result = (result < 0) ? square : table.Add(Program::Op_Mul, result, square);
+        if (m > 1)
+            square = table.Add(Program::Op_Mul, square, square);
+    }
+    return (n < 0) ? table.Add(Program::Op_Div, table.Const(1.0), result) : result;
+}
+
+//The exponent of x^n when it is a small integer
+static bool IntExponent(const ValueTable::Value& value, int32& outN) {
+    constexpr double MaxIntPower = 64.0;
+    if (value.Op != Program::Op_Const || value.Const != std::floor(value.Const) || std::abs(value.Const) > MaxIntPower)
+        return false;
+    outN = (int32)value.Const;
+    return true;
+}
+
+//Rewrites the numbered values of the stack code into in. The parts that are polynomials in x, y, z and t are found and
+//evaluated with Horner's rule (see Polynomial), the multiplies and adds of which become multiply-adds. Integer powers
+//that are left become multiplies. Only what the outputs need is kept
+static void Simplify(const ValueTable& in, std::vector<int32>& outputs, ValueTable& out) {
+    using Value = ValueTable::Value;
+    const int32 count = (int32)in.Values.size();
+
+    //The polynomial of every value that is one
+    std::vector<Polynomial> polys(count);
+    std::vector<uint8> isPoly(count, 0);
+    for (int32 v = 0; v < count; v++) {
+        const Value& value = in.Values[v];
+        Polynomial& p = polys[v];
+        bool bPoly = false;
+        double c;
+        int32 n;
+        switch (value.Op) {
+            case Program::Op_Const: p = Polynomial::Constant(value.Const);  bPoly = true;                    break;
+            case Program::Op_Param: p = Polynomial::Variable(value.A);      bPoly = true;                    break;
+            case Program::Op_Add:
+            case Program::Op_Sub:
+                bPoly = isPoly[value.A] && isPoly[value.B] &&
+                    Polynomial::Sum(polys[value.A], polys[value.B], value.Op == Program::Op_Add ? 1.0 : -1.0, p);
+                break;
+            case Program::Op_Mul:
+                bPoly = isPoly[value.A] && isPoly[value.B] && Polynomial::Product(polys[value.A], polys[value.B], p);
+                break;
+            case Program::Op_Div:
+                //Only by a constant, anything else is a rational function of two polynomials
+                if (isPoly[value.A] && isPoly[value.B] && polys[value.B].IsConstant(c) && c != 0.0 && std::isfinite(c)) {
+                    p = polys[value.A];
+                    p.Scale(1.0 / c);
+                    bPoly = true;
+                }
+                break;
+            case Program::Op_Neg:
+                if (isPoly[value.A]) {
+                    p = polys[value.A];
+                    p.Scale(-1.0);
+                    bPoly = true;
+                }
+                break;
+            case Program::Op_Pow:
+                bPoly = isPoly[value.A] && IntExponent(in.Values[value.B], n) && n >= 0 && Polynomial::Raise(polys[value.A], n, p);
+                break;
+            default:
+                break;
+        }
+        isPoly[v] = bPoly;
+    }
+
+    //Polynomials that something else uses are evaluated in their own form, from the variables. Linear ones are left as
+    //they are, Horner's rule does not save anything there
+    std::vector<uint8> wanted(count, 0);
+    std::vector<uint8> horner(count, 0);
+    for (int32 v : outputs)
+        wanted[v] = 1;
+    for (int32 v = count - 1; v >= 0; v--) {
+        if (!wanted[v])
+            continue;
+        double c;
+        if (isPoly[v] && (polys[v].TotalDegree() >= 2 || polys[v].IsConstant(c))) {
+            horner[v] = 1;
+            continue;
+        }
+        const Value& value = in.Values[v];
+        const int32 operands = OperandCount(value.Op);
+        if (operands > 0) wanted[value.A] = 1;
+        if (operands > 1) wanted[value.B] = 1;
+        if (operands > 2) wanted[value.C] = 1;
+    }
+
+    std::vector<int32> map(count, -1);
+    for (int32 v = 0; v < count; v++) {
+        if (!wanted[v])
+            continue;
+        const Value& value = in.Values[v];
+        int32 n;
+        if (horner[v])
+            map[v] = EmitHorner(out, polys[v].Terms(), 0);
+        else if (value.Op == Program::Op_Const)
+            map[v] = out.Const(value.Const);
+        else if (value.Op == Program::Op_Param)
+            map[v] = out.Param(value.A);
+        else if (value.Op == Program::Op_Pow && IntExponent(in.Values[value.B], n))
+            map[v] = EmitIntPower(out, map[value.A], n);
+        else {
+            const int32 operands = OperandCount(value.Op);
+            map[v] = out.Add(value.Op, map[value.A], operands > 1 ? map[value.B] : 0, operands > 2 ? map[value.C] : 0);
+        }
+    }
+    for (int32& v : outputs)
+        v = map[v];
+}
+
+//The compiled code uses the registers as a stack, so it copies a lot, and calculates a call again every time it is
+//inlined. Its values are numbered (see ValueTable), so that every calculation is only done once and the copies
+//disappear, and simplified. Then every value that an output needs gets a register, reusing the ones of values that are
+//not needed anymore. The outputs are in registers [0, outputCount) before
+bool Program::Optimize(int32 outputCount) {
+    ValueTable stack;
+    std::vector<int32> regValue(myRegisters, -1);
+    for (const Instruction& in : myInstructions) {
+        switch (in.Op) {
+            case Op_Copy:   regValue[in.Dst] = regValue[in.A];                  break;
+            case Op_Const:  regValue[in.Dst] = stack.Const(in.Value);           break;
+            case Op_Param:  regValue[in.Dst] = stack.Param(in.A);               break;
+            default:
+                Assert(regValue[in.A] >= 0 && (!Binary(in.Op) || regValue[in.B] >= 0));
+                regValue[in.Dst] = stack.Add(in.Op, regValue[in.A], Binary(in.Op) ? regValue[in.B] : 0);
+                break;
+        }
+    }
+    std::vector<int32> outputs(regValue.begin(), regValue.begin() + outputCount);
+
+    ValueTable table;
+    Simplify(stack, outputs, table);
+    std::vector<ValueTable::Value>& values = table.Values;
+
+    //Only what an output uses is kept. Outputs are never freed
+    const int32 count = (int32)values.size();
+    std::vector<int32> lastUse(count, -1);
+    for (int32 v : outputs)
+        lastUse[v] = count;
+    for (int32 v = count - 1; v >= 0; v--) {
+        if (lastUse[v] < 0)
+            continue;
+        const ValueTable::Value& value = values[v];
+        const int32 operands = OperandCount(value.Op);
+        if (operands > 0) lastUse[value.A] = Max(lastUse[value.A], v);
+        if (operands > 1) lastUse[value.B] = Max(lastUse[value.B], v);
+        if (operands > 2) lastUse[value.C] = Max(lastUse[value.C], v);
+    }
+
+    //An operand's register is freed before the result gets one, as the result can be written over an operand
+    std::vector<int32> reg(count, -1);
+    std::vector<uint16> freeRegs;
+    int32 regCount = 0;
+    myInstructions.clear();
+    for (int32 v = 0; v < count; v++) {
+        if (lastUse[v] < 0)
+            continue;
+        const ValueTable::Value& value = values[v];
+        const int32 operands = OperandCount(value.Op);
+        Instruction in = { value.Op, 0, (uint16)value.A, 0, 0, value.Const };
+        int32 used[3] = { operands > 0 ? value.A : -1, operands > 1 ? value.B : -1, operands > 2 ? value.C : -1 };
+        for (int32 i = 0; i < operands; i++) {
+            const int32 r = reg[used[i]];
+            (i == 0 ? in.A : (i == 1 ? in.B : in.C)) = (uint16)r;
+            //The same value can be more than one operand
+            bool bFirst = true;
+            for (int32 k = 0; k < i; k++)
+                bFirst &= used[k] != used[i];
+            if (bFirst && lastUse[used[i]] == v)
+                freeRegs.push_back((uint16)r);
+        }
+        if (freeRegs.empty()) {
+            if (regCount >= 0xFFFF)
+                return false;
+            reg[v] = regCount++;
+        }
+        else {
+            reg[v] = freeRegs.back();
+            freeRegs.pop_back();
+        }
+        in.Dst = (uint16)reg[v];
+        myInstructions.push_back(in);
+    }
+
+    myRegisters = regCount;
+    for (int32 v : outputs)
+        myOutputs.push_back((uint16)reg[v]);
+    return true;
+}
+
+void Program::Emit(OpCode op, int32 dst, int32 a, int32 b, double value) {
+    if ((int32)myInstructions.size() >= MaxInstructions || dst >= 0xFFFF) {
+        myOverflow = true;
+        return;
+    }
+    myInstructions.push_back( Instruction{ op, (uint16)dst, (uint16)a, (uint16)b, 0, value } );
+    myRegisters = Max(myRegisters, dst + 1);
+}
+
+//The registers are the evaluation stack, so sp is the first free one. Explicit params of eq are the registers in params
+bool Program::Compile(const Equation& eq, const uint16* params, int32 paramCount, int32& sp, int32 depth) {
+    if (depth > MaxDepth)
+        return false;
+
+    for (int i = 0; i < eq.NodeCount(); i++) {
+        const NodeGeneric& node = eq.Node(i);
+        switch (node.type) {
+            case NodeType::NodeValue:
+            {
+                Emit(Op_Const, sp++, 0, 0, node.GetValue()->GetValue());
+                break;
+            }
+            case NodeType::NodeParam:
+            {
+                const NodeParam* np = node.GetParam();
+                if (np->Implicit()) {
+                    if (np->Index() >= NodeParam::ImplicitSlots)
+                        return false;
+                    Emit(Op_Param, sp++, np->Index());
+                }
+                else {
+                    if (np->Index() >= paramCount)
+                        return false;
+                    Emit(Op_Copy, sp++, params[np->Index()]);
+                }
+                break;
+            }
+            case NodeType::NodeOperator:
+            {
+                const NodeOperator* op = node.GetOp();
+                OpCode code;
+                if (!ToOpCode(op->Op(), code))
+                    return false;
+                if (op->Arity() == 2) {
+                    if (sp < 2)
+                        return false;
+                    Emit(code, sp - 2, sp - 2, sp - 1);
+                    sp--;
+                }
+                else {
+                    if (sp < 1)
+                        return false;
+                    Emit(code, sp - 1, sp - 1);
+                }
+                break;
+            }
+            case NodeType::NodeExpression:
+            {
+                //The arguments stay in their registers while the callee runs above them, and its result is moved
+                //down to where the first argument was
+                const NodeExpression* ne = node.GetExpr();
+                const Equation* callee = ne->GetEquation();
+                if (!callee || ne->GetParams().size() > NodeExpression::MaxParams)
+                    return false;
+
+                const int32 first = sp;
+                uint16 args[NodeExpression::MaxParams];
+                int32 count = 0;
+                for (const Equation& arg : ne->GetParams()) {
+                    if (!Compile(arg, params, paramCount, sp, depth + 1) || sp != first + count + 1)
+                        return false;
+                    args[count] = (uint16)(first + count);
+                    count++;
+                }
+                if (!Compile(*callee, args, count, sp, depth + 1) || sp != first + count + 1)
+                    return false;
+                if (sp - 1 != first)
+                    Emit(Op_Copy, first, sp - 1);
+                sp = first + 1;
+                break;
+            }
+            default:
+                Assert(false && "Unknown type");
+                return false;
+        }
+        if (myOverflow)
+            return false;
+    }
+    return true;
+}
+
+void Program::Reserve(Scratch& s) const {
+    const size_t size = (size_t)myRegisters * BatchSize;
+    if (s.Float.size() < size)
+        s.Float.resize(size);
+    if (s.Double.size() < size)
+        s.Double.resize(size);
+    if (s.RedoOut.size() < myOutputs.size() * BatchSize)
+        s.RedoOut.resize(myOutputs.size() * BatchSize);
+}
+
+//Evaluates one batch. With bCheck, lossy[i] is set for the samples that lost too much precision
+template <typename T, bool bCheck> KERNELS_CLONES
+void Program::Run(const double* x, const double* y, double z, double t, double* out, int32 stride, int32 n, T* regs, uint8* lossy, Accuracy acc) const {
+    Assert(n > 0 && n <= BatchSize);
+    if (bCheck)
+        memset(lossy, 0, n);
+
+    auto Cancelled = [](T a, T b, T r) { return (std::abs(a) + std::abs(b)) > std::abs(r) * (T)CancelLimit; };
+    auto OutOfRange = [](T r) { return !(std::abs(r) <= (T)LargeLimit) || (r != (T)0 && std::abs(r) < (T)SmallLimit); };
+
+    for (const Instruction& in : myInstructions) {
+        T* d = regs + (size_t)in.Dst * BatchSize;
+        const T* a = regs + (size_t)in.A * BatchSize;
+        const T* b = regs + (size_t)in.B * BatchSize;
+        const T* c = regs + (size_t)in.C * BatchSize;
+
+        switch (in.Op) {
+            case Op_Const:
+            {
+                const T v = (T)in.Value;
+                for (int32 i = 0; i < n; i++)
+                    d[i] = v;
+                break;
+            }
+            case Op_Param:
+            {
+                if (in.A == 0 || in.A == 1) {
+                    const double* src = (in.A == 0) ? x : y;
+                    for (int32 i = 0; i < n; i++)
+                        d[i] = (T)src[i];
+                }
+                else {
+                    const T v = (T)(in.A == 2 ? z : t);
+                    for (int32 i = 0; i < n; i++)
+                        d[i] = v;
+                }
+                break;
+            }
+            case Op_Copy:
+            {
+                for (int32 i = 0; i < n; i++)
+                    d[i] = a[i];
+                break;
+            }
+
+            case Op_Add:
+            {
+                for (int32 i = 0; i < n; i++) {
+                    const T r = a[i] + b[i];
+                    if (bCheck)
+                        lossy[i] |= Cancelled(a[i], b[i], r);
+                    d[i] = r;
+                }
+                break;
+            }
+            case Op_Sub:
+            {
+                for (int32 i = 0; i < n; i++) {
+                    const T r = a[i] - b[i];
+                    if (bCheck)
+                        lossy[i] |= Cancelled(a[i], b[i], r);
+                    d[i] = r;
+                }
+                break;
+            }
+            case Op_Mul:
+            {
+                for (int32 i = 0; i < n; i++) {
+                    const T r = a[i] * b[i];
+                    if (bCheck)
+                        lossy[i] |= OutOfRange(r);
+                    d[i] = r;
+                }
+                break;
+            }
+            case Op_Div:
+            {
+                for (int32 i = 0; i < n; i++) {
+                    const T r = NodeOperator::Divide(a[i], b[i]);
+                    if (bCheck)
+                        lossy[i] |= OutOfRange(r);
+                    d[i] = r;
+                }
+                break;
+            }
+            case Op_Pow:
+            {
+                Kernels::Pow(a, b, d, n, acc);
+                if (bCheck) {
+                    for (int32 i = 0; i < n; i++)
+                        lossy[i] |= OutOfRange(d[i]);
+                }
+                break;
+            }
+
+            case Op_Sin:
+            {
+                if (bCheck) {
+                    for (int32 i = 0; i < n; i++)
+                        lossy[i] |= std::abs(a[i]) > (T)TrigLimit;
+                }
+                Kernels::Sin(a, d, n, acc);
+                break;
+            }
+            case Op_Cos:
+            {
+                if (bCheck) {
+                    for (int32 i = 0; i < n; i++)
+                        lossy[i] |= std::abs(a[i]) > (T)TrigLimit;
+                }
+                Kernels::Cos(a, d, n, acc);
+                break;
+            }
+            case Op_Tan:
+            {
+                //The argument is checked before, as d can be the same register as a
+                if (bCheck) {
+                    for (int32 i = 0; i < n; i++)
+                        lossy[i] |= std::abs(a[i]) > (T)TrigLimit;
+                }
+                Kernels::Tan(a, d, n, acc);
+                if (bCheck) {
+                    for (int32 i = 0; i < n; i++)
+                        lossy[i] |= OutOfRange(d[i]);
+                }
+                break;
+            }
+            case Op_Sqrt:
+            {
+                for (int32 i = 0; i < n; i++)
+                    d[i] = std::sqrt(a[i]);
+                break;
+            }
+            case Op_Exp:
+            {
+                Kernels::Exp(a, d, n, acc);
+                if (bCheck) {
+                    for (int32 i = 0; i < n; i++)
+                        lossy[i] |= OutOfRange(d[i]);
+                }
+                break;
+            }
+            case Op_Neg:
+            {
+                for (int32 i = 0; i < n; i++)
+                    d[i] = -a[i];
+                break;
+            }
+            case Op_MulAdd:
+            {
+                for (int32 i = 0; i < n; i++) {
+                    const T m = a[i] * b[i];
+                    const T r = m + c[i];
+                    if (bCheck)
+                        lossy[i] |= OutOfRange(m) | Cancelled(m, c[i], r);
+                    d[i] = r;
+                }
+                break;
+            }
+        }
+    }
+
+    for (int32 k = 0; k < (int32)myOutputs.size(); k++) {
+        const T* r = regs + (size_t)myOutputs[k] * BatchSize;
+        double* o = out + (size_t)k * stride;
+        for (int32 i = 0; i < n; i++)
+            o[i] = (double)r[i];
+    }
+}
+
+template <typename T>
+void Program::Evaluate(const double* x, const double* y, double z, double t, double* out, int32 count, Scratch& s) const {
+    Assert(Valid());
+    std::vector<T>& regs = Registers<T>(s);
+    Assert(regs.size() >= (size_t)myRegisters * BatchSize && "Call Reserve first");
+
+    for (int32 start = 0; start < count; start += BatchSize) {
+        Run<T, false>(x + start, y + start, z, t, out + start, count, Min(BatchSize, count - start), regs.data(), nullptr, myAccuracy);
+    }
+}
+
+template void Program::Evaluate<float>(const double*, const double*, double, double, double*, int32, Scratch&) const;
+template void Program::Evaluate<double>(const double*, const double*, double, double, double*, int32, Scratch&) const;
+
+int32 Program::EvaluateMixed(const double* x, const double* y, double z, double t, double* out, int32 count, Scratch& s) const {
+    Assert(Valid());
+    Assert(s.Float.size() >= (size_t)myRegisters * BatchSize && s.Double.size() >= (size_t)myRegisters * BatchSize &&
+           s.RedoOut.size() >= myOutputs.size() * BatchSize && "Call Reserve first");
+
+    int32 redone = 0;
+    for (int32 start = 0; start < count; start += BatchSize) {
+        const int32 n = Min(BatchSize, count - start);
+        Run<float, true>(x + start, y + start, z, t, out + start, count, n, s.Float.data(), s.Lossy, myAccuracy);
+
+        //The lossy samples are packed into one smaller batch
+        int32 m = 0;
+        for (int32 i = 0; i < n; i++) {
+            if (s.Lossy[i]) {
+                s.RedoIndex[m] = i;
+                s.RedoX[m] = x[start + i];
+                s.RedoY[m] = y[start + i];
+                m++;
+            }
+        }
+        if (m == 0)
+            continue;
+
+        Run<double, false>(s.RedoX, s.RedoY, z, t, s.RedoOut.data(), BatchSize, m, s.Double.data(), nullptr, Accuracy_Full);
+        for (int32 k = 0; k < (int32)myOutputs.size(); k++) {
+            for (int32 j = 0; j < m; j++)
+                out[(size_t)k * count + start + s.RedoIndex[j]] = s.RedoOut[(size_t)k * BatchSize + j];
+        }
+        redone += m;
+    }
+    return redone;
+}
+
+bool Program::RunAllTests() {
+    bool bSuccess = true;
+    #define TEST(x) \
+        if (!(x)) { \
+            LogError("Program test failed: %s", #x); \
+            bSuccess = false; \
+        }
+
+    Context ctx;
+    ctx.Reload({
+        "f(a, b) = a * sin(b) + g(a)",
+        "g(p) = p^2 - -3",
+        "h = f(x, y) / (1 + g(y)) - sqrt(x*x + 1) + exp(-y/4) * tan(x/7) + 2^t",
+        "c = (x + 10000) - 10000 + sin(y * 100000)",
+    });
+
+    //Enough samples for a partial batch at the end
+    constexpr int32 Count = Program::BatchSize * 3 + 7;
+    double xs[Count], ys[Count], out[Count];
+    for (int32 i = 0; i < Count; i++) {
+        xs[i] = -10.0 + 20.0 * i / (Count - 1);
+        ys[i] = 7.3 - 0.05 * i;
+    }
+    const double t = 0.75;
+
+    Program p;
+    Program::Scratch s;
+
+    //Double is the same as evaluating one sample at a time, but for the rounding of polynomials that are summed in
+    //another order (see Polynomial). Float is close
+    Equation* h = ctx.FindEquation("h");
+    TEST(h && p.Build(*h) && p.RegisterCount() > 1);
+    p.Reserve(s);
+    p.Evaluate<double>(xs, ys, 0.0, t, out, Count, s);
+    bool bExact = true;
+    for (int32 i = 0; i < Count; i++)
+        bExact &= std::abs(out[i] - h->Evaluate(xs[i], ys[i], 0.0, t)) <= 1e-14 * std::abs(out[i]);
+    TEST(bExact);
+    p.Evaluate<float>(xs, ys, 0.0, t, out, Count, s);
+    bool bClose = true;
+    for (int32 i = 0; i < Count; i++)
+        bClose &= std::abs(out[i] - h->Evaluate(xs[i], ys[i], 0.0, t)) <= 1e-4 * (1.0 + std::abs(out[i]));
+    TEST(bClose);
+
+    //Cancellation and a large argument to sin are wrong in float, mixed redoes them
+    Equation* c = ctx.FindEquation("c");
+    TEST(c && p.Build(*c));
+    p.Reserve(s);
+    p.Evaluate<float>(xs, ys, 0.0, t, out, Count, s);
+    double floatError = 0.0;
+    for (int32 i = 0; i < Count; i++)
+        floatError = Max(floatError, std::abs(out[i] - c->Evaluate(xs[i], ys[i])));
+    const int32 redone = p.EvaluateMixed(xs, ys, 0.0, t, out, Count, s);
+    double mixedError = 0.0;
+    for (int32 i = 0; i < Count; i++)
+        mixedError = Max(mixedError, std::abs(out[i] - c->Evaluate(xs[i], ys[i])));
+    TEST(floatError > 1e-4 && mixedError < 1e-9 && redone == Count);
+
+    //Well behaved samples stay in float
+    TEST(p.Build(*h));
+    TEST(p.EvaluateMixed(xs, ys, 0.0, t, out, Count, s) < Count / 4);
+
+    //The approximate functions stay within their budget, and the double pass of mixed is full
+    p.SetAccuracy(Accuracy_1e4);
+    p.Evaluate<double>(xs, ys, 0.0, t, out, Count, s);
+    bClose = true;
+    for (int32 i = 0; i < Count; i++)
+        bClose &= std::abs(out[i] - h->Evaluate(xs[i], ys[i], 0.0, t)) <= 1e-3 * (1.0 + std::abs(out[i]));
+    TEST(bClose);
+    TEST(c && p.Build(*c));
+    p.Reserve(s);
+    TEST(p.EvaluateMixed(xs, ys, 0.0, t, out, Count, s) == Count);
+    bExact = true;
+    for (int32 i = 0; i < Count; i++)
+        bExact &= out[i] == c->Evaluate(xs[i], ys[i]);
+    TEST(bExact);
+    p.SetAccuracy(Accuracy_Full);
+
+    //Domain errors are NaN in every precision, and only in the samples that have them
+    {
+        ctx.Reload({ "d = sqrt(y) / x" });
+        const double dx[] = { 0.0, 1.0, -1.0, 2.0 };
+        const double dy[] = { 1.0, -1.0, 4.0, 0.0 };
+        double dout[4];
+        TEST(p.Build(*ctx.FindEquation("d")));
+        p.Reserve(s);
+        for (int32 prec = 0; prec < 3; prec++) {
+            if (prec == 0)      p.Evaluate<double>(dx, dy, 0.0, 0.0, dout, 4, s);
+            else if (prec == 1) p.Evaluate<float>(dx, dy, 0.0, 0.0, dout, 4, s);
+            else                p.EvaluateMixed(dx, dy, 0.0, 0.0, dout, 4, s);
+            TEST(std::isnan(dout[0]) && std::isnan(dout[1]) && dout[2] == -2.0 && dout[3] == 0.0);
+        }
+    }
+
+    //Several equations in one program are the same as each on its own, and what they share is only calculated once
+    {
+        ctx.Reload({ "f(a, b) = a * sin(b) + exp(a / 9)", "s1 = f(x, y) + y", "s2 = f(x, y) * f(y, x)", "s3 = 2" });
+        Equation* eqs[] = { ctx.FindEquation("s1"), ctx.FindEquation("s2"), ctx.FindEquation("s3") };
+        int32 separate = 0;
+        for (const Equation* eq : eqs) {
+            TEST(p.Build(*eq));
+            separate += p.InstructionCount();
+        }
+        TEST(p.Build({ eqs[0], eqs[1], eqs[2] }) && p.OutputCount() == 3 && p.InstructionCount() <= separate - 8);
+        p.Reserve(s);
+        std::vector<double> planes(3 * Count);
+        p.Evaluate<double>(xs, ys, 0.0, t, planes.data(), Count, s);
+        bExact = true;
+        for (int32 k = 0; k < 3; k++) {
+            for (int32 i = 0; i < Count; i++)
+                bExact &= planes[k * Count + i] == eqs[k]->Evaluate(xs[i], ys[i], 0.0, t);
+        }
+        TEST(bExact);
+        p.EvaluateMixed(xs, ys, 0.0, t, planes.data(), Count, s);
+        bClose = true;
+        for (int32 k = 0; k < 3; k++) {
+            for (int32 i = 0; i < Count; i++) {
+                const double v = eqs[k]->Evaluate(xs[i], ys[i], 0.0, t);
+                bClose &= std::abs(planes[k * Count + i] - v) <= 1e-4 * (1.0 + std::abs(v));
+            }
+        }
+        TEST(bClose);
+    }
+
+    //Polynomials are evaluated with Horner's rule and integer powers with multiplies, so only x^2.5 calls pow
+    {
+        ctx.Reload({ "q = (0.5*x^2 + 0.5*y^2) / 10", "r = (x - 3)^3 / (1 + y^2) + sin(y)^-2", "u = x^2.5 + x*x*y - 2*x*y + 4" });
+        const char* names[] = { "q", "r", "u" };
+        const int32 pows[] = { 0, 0, 1 };
+        for (int32 k = 0; k < 3; k++) {
+            Equation* eq = ctx.FindEquation(names[k]);
+            TEST(p.Build(*eq));
+            int32 powCount = 0;
+            for (const Instruction& in : p.Instructions())
+                powCount += in.Op == Op_Pow;
+            TEST(powCount == pows[k]);
+
+            p.Reserve(s);
+            p.Evaluate<double>(xs, ys, 0.0, t, out, Count, s);
+            bClose = true;
+            for (int32 i = 0; i < Count; i++) {
+                const double v = eq->Evaluate(xs[i], ys[i], 0.0, t);
+                bClose &= (std::isnan(v) && std::isnan(out[i])) || std::abs(out[i] - v) <= 1e-12 * (1.0 + std::abs(v));
+            }
+            TEST(bClose);
+        }
+    }
+
+    //Each level doubles the inlined size, so this stops being inlined
+    {
+        std::vector<std::string> lines = { "e0 = x" };
+        for (int i = 1; i <= 20; i++)
+            lines.push_back("e" + std::to_string(i) + " = e" + std::to_string(i - 1) + " + e" + std::to_string(i - 1));
+        ctx.Reload(lines);
+        TEST(ctx.FindEquation("e10")->Valid() && p.Build(*ctx.FindEquation("e10")));
+        TEST(ctx.FindEquation("e20")->Valid() && !p.Build(*ctx.FindEquation("e20")) && !p.Valid());
+    }
+
+    #undef TEST
+    return bSuccess;
+}
+
+} // End of namespace
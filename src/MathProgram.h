@@ -0,0 +1,113 @@
+#pragma once
+#include "DebugFinal.h"
+#include "MathKernels.h"
+#include <vector>
+
+namespace MathParser {
+
+class Equation;
+
+//An equation flattened into a list of instructions, with every call inlined. Every instruction runs over a whole batch
+//of samples before the next one starts, so the loops over the batch vectorise, and float batches are twice as wide
+//as double ones. Built once per revision of the equation, and only read after that.
+//Several equations can be built into one program, which calculates what they have in common once per sample
+class Program {
+public:
+    enum OpCode : uint8 {
+        Op_Const,
+        Op_Param,       //Implicit param, x, y, z or t
+        Op_Copy,
+
+        Op_Add,
+        Op_Sub,
+        Op_Mul,
+        Op_Div,
+        Op_Pow,
+
+        Op_Sin,
+        Op_Cos,
+        Op_Tan,
+        Op_Sqrt,
+        Op_Exp,
+        Op_Neg,
+
+        Op_MulAdd,      //a * b + c, which the compiler fuses where the target has fma
+    };
+
+    //Registers are batches of samples. Dst can be the same as an operand
+    struct Instruction {
+        OpCode Op;
+        uint16 Dst;
+        uint16 A;       //Param: implicit index. Everything else: the first operand
+        uint16 B;
+        uint16 C;       //MulAdd only
+        double Value;   //Const
+    };
+
+    //Samples per instruction
+    static constexpr int32 BatchSize = 64;
+    //Inlining is stopped beyond this, as calls can blow up exponentially. Such equations are evaluated one sample at a time
+    static constexpr int32 MaxInstructions = 1 << 16;
+
+    //Registers and the precision check of one thread. Keep it around (see Reserve), so that evaluating does not allocate
+    struct Scratch {
+        std::vector<float> Float;
+        std::vector<double> Double;
+
+        uint8 Lossy[BatchSize];
+        int32 RedoIndex[BatchSize];
+        double RedoX[BatchSize];
+        double RedoY[BatchSize];
+        std::vector<double> RedoOut;    //A batch for each output
+    };
+
+public:
+    //False if the equation is invalid, has explicit params or is too big to inline. The program is then empty
+    bool Build(const Equation& eq);
+    //All the equations in one program, with an output for each. Calculations they share, like a helper that several
+    //of them call with the same arguments, are done once. False if any of them can not be built
+    bool Build(const std::vector<const Equation*>& eqs);
+    void Clear();
+
+    bool Valid() const                  { return !myInstructions.empty(); }
+    int32 InstructionCount() const      { return (int32)myInstructions.size(); }
+    int32 RegisterCount() const         { return myRegisters; }
+    int32 OutputCount() const           { return (int32)myOutputs.size(); }
+    //The register that output i (the equation at index i of Build) ends up in
+    int32 Output(int32 i) const         { return myOutputs[i]; }
+    const std::vector<Instruction>& Instructions() const { return myInstructions; }
+
+    void Reserve(Scratch& s) const;
+
+    //How close sin, cos, tan, exp and ^ are to the C library (see Kernels). The double pass of EvaluateMixed is always full
+    void SetAccuracy(Accuracy acc)      { myAccuracy = acc; }
+    Accuracy GetAccuracy() const        { return myAccuracy; }
+
+    //out[i] = eq(x[i], y[i], z, t) for count samples, calculated in T. With several outputs, out holds a plane of count
+    //samples for each, so out[k * count + i] is equation k
+    template <typename T>
+    void Evaluate(const double* x, const double* y, double z, double t, double* out, int32 count, Scratch& s) const;
+    //Evaluates in float, and again in double for the samples where float lost too many digits: large cancellation,
+    //large arguments to sin/cos/tan and results close to the end of the float range. Returns how many were redone
+    int32 EvaluateMixed(const double* x, const double* y, double z, double t, double* out, int32 count, Scratch& s) const;
+
+    static bool RunAllTests();    //Returns true when all tests pass
+
+private:
+    bool Compile(const Equation& eq, const uint16* params, int32 paramCount, int32& sp, int32 depth);
+    void Emit(OpCode op, int32 dst, int32 a = 0, int32 b = 0, double value = 0.0);
+    bool Optimize(int32 outputCount);
+
+    //Output k of sample i goes to out[k * stride + i]
+    template <typename T, bool bCheck>
+    void Run(const double* x, const double* y, double z, double t, double* out, int32 stride, int32 count, T* regs, uint8* lossy, Accuracy acc) const;
+
+private:
+    std::vector<Instruction> myInstructions;
+    std::vector<uint16> myOutputs;
+    int32 myRegisters = 0;
+    Accuracy myAccuracy = Accuracy_Full;
+    bool myOverflow = false;    //Set while compiling, when a limit was hit
+};
+
+} // End of namespace
@@ -6,6 +6,7 @@
 #include <gtc/matrix_transform.hpp>
 #include <gtc/type_ptr.hpp>
 #include <gtc/random.hpp>
+#include <gtc/type_precision.hpp>
 // #include <gtx/norm.hpp>
 // #include <gtx/compatibility.hpp>
 
@@ -42,4 +43,40 @@ inline double Mag(const T& v) {
 template <typename T>
 inline double SqMag(const T& v) {
     return glm::dot(v, v);
+}
+
+//Octahedral normal encoding. Maps a unit vector onto the [-1, 1] square. See Assets/Shaders/tri.prog for the decode
+inline glm::vec2 OctEncode(glm::vec3 n) {
+    float sum = glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+    if (sum <= 0.0f)
+        return glm::vec2(0.0f, 0.0f);
+    n /= sum;
+
+    glm::vec2 p = glm::vec2(n.x, n.y);
+    if (n.z < 0.0f) {
+        glm::vec2 signNotZero = glm::vec2( (p.x >= 0.0f) ? 1.0f : -1.0f, (p.y >= 0.0f) ? 1.0f : -1.0f );
+        p = (1.0f - glm::abs(glm::vec2(p.y, p.x))) * signNotZero;
+    }
+    return p;
+}
+
+inline glm::vec3 OctDecode(glm::vec2 p) {
+    glm::vec3 n = glm::vec3(p.x, p.y, 1.0f - glm::abs(p.x) - glm::abs(p.y));
+    if (n.z < 0.0f) {
+        glm::vec2 signNotZero = glm::vec2( (n.x >= 0.0f) ? 1.0f : -1.0f, (n.y >= 0.0f) ? 1.0f : -1.0f );
+        glm::vec2 xy = (1.0f - glm::abs(glm::vec2(n.y, n.x))) * signNotZero;
+        n.x = xy.x;
+        n.y = xy.y;
+    }
+    return glm::normalize(n);
+}
+
+//Packs a normal into 2 shorts which the gpu reads back as normalized floats in [-1, 1]
+inline glm::i16vec2 OctPackSnorm16(glm::vec3 n) {
+    glm::vec2 p = glm::clamp(OctEncode(n), -1.0f, 1.0f);
+    return glm::i16vec2( glm::round(p * 32767.0f) );
+}
+
+inline glm::vec3 OctUnpackSnorm16(glm::i16vec2 v) {
+    return OctDecode( glm::max(glm::vec2(v) / 32767.0f, -1.0f) );
 }
\ No newline at end of file
@@ -0,0 +1,391 @@
+#include "Profiler.h"
+#include "Maths.h"
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    #include <intrin.h>
+    #define PROFILER_RDTSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    #define PROFILER_RDTSC 1
+#else
+    #define PROFILER_RDTSC 0
+#endif
+
+static_assert((Profiler::RingCapacity & (Profiler::RingCapacity - 1)) == 0, "RingCapacity has to be a power of 2");
+
+//Once a ring buffer has wrapped, this many of its oldest events are skipped when reading, as the owning thread might be
+//overwriting them at that moment
+static constexpr uint64 WrapMargin = 256;
+
+struct ProfilerThreadBuffer {
+    uint32                  Id;
+    std::string             Name;
+    std::atomic<uint64>     Head{0};            //Total number of events ever written. Only the owning thread writes
+    uint64                  ReadCursor = 0;     //Render thread only, used for the breakdown
+    Profiler::Event         Events[Profiler::RingCapacity];
+};
+
+struct ProfilerZoneStat {
+    std::string_view    Name;
+    bool                bGpu;
+    double              AvgUs;
+    double              LastUs;
+    uint32              LastCalls;
+    double              FrameUs;
+    uint32              FrameCalls;
+};
+
+static std::mutex                                           ourMutex;       //Guards ourBuffers and the thread names
+static std::vector<std::unique_ptr<ProfilerThreadBuffer>>   ourBuffers;
+static ProfilerThreadBuffer*                                ourGpuBuffer = nullptr;
+static thread_local ProfilerThreadBuffer*                   tlBuffer = nullptr;
+static thread_local uint32                                  tlDepth = 0;
+
+//Render thread only
+static std::vector<ProfilerZoneStat>                        ourStats;
+static std::unordered_map<std::string_view, uint32>         ourStatIndex[2];    //Indexed by bGpu
+static uint64                                               ourFrameStart = 0;
+static uint64                                               ourFrameCount = 0;
+static double                                               ourAvgFrameUs = 0.0;
+static double                                               ourLastFrameUs = 0.0;
+
+static const uint64 ourEpochTicks = Profiler::Now();
+static const std::chrono::steady_clock::time_point ourEpochClock = std::chrono::steady_clock::now();
+
+uint64 Profiler::Now() {
+#if PROFILER_RDTSC
+    return __rdtsc();
+#else
+    return (uint64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static double TicksPerMicrosecond() {
+#if PROFILER_RDTSC
+    //Calibrated against steady_clock over everything since startup, so it gets more accurate the longer we run
+    double elapsedUs = 0.0;
+    uint64 ticks = 0;
+    do {
+        ticks = Profiler::Now();
+        elapsedUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - ourEpochClock).count();
+    } while (elapsedUs < 1000.0);
+    return (double)(ticks - ourEpochTicks) / elapsedUs;
+#else
+    return 1000.0;
+#endif
+}
+
+double Profiler::TicksToMicroseconds(uint64 ticks) {
+    return (double)ticks / TicksPerMicrosecond();
+}
+
+static ProfilerThreadBuffer* CreateBuffer(const char* name) {
+    std::lock_guard<std::mutex> lock(ourMutex);
+    ourBuffers.push_back(std::make_unique<ProfilerThreadBuffer>());
+    ProfilerThreadBuffer* b = ourBuffers.back().get();
+    b->Id = (uint32)ourBuffers.size();
+    if (name)
+        b->Name = name;
+    else
+        b->Name = "Thread " + std::to_string(b->Id);
+    return b;
+}
+
+static ProfilerThreadBuffer* LocalBuffer() {
+    if (!tlBuffer)
+        tlBuffer = CreateBuffer(nullptr);
+    return tlBuffer;
+}
+
+static void PushEvent(ProfilerThreadBuffer* b, const Profiler::Event& e) {
+    const uint64 head = b->Head.load(std::memory_order_relaxed);
+    b->Events[head & (Profiler::RingCapacity - 1)] = e;
+    b->Head.store(head + 1, std::memory_order_release);
+}
+
+void Profiler::SetThreadName(const char* name) {
+    ProfilerThreadBuffer* b = LocalBuffer();
+    std::lock_guard<std::mutex> lock(ourMutex);
+    b->Name = name;
+}
+
+uint32 Profiler::BeginZone() {
+    return tlDepth++;
+}
+
+void Profiler::EndZone(const char* name, uint64 start, uint32 depth) {
+    const uint64 end = Now();
+    tlDepth = depth;
+    PushEvent(LocalBuffer(), Event{ name, start, end, depth });
+}
+
+void Profiler::AddGpuEvent(const char* name, uint64 cpuStart, uint64 durationNs) {
+    if (!ourGpuBuffer)
+        ourGpuBuffer = CreateBuffer("GPU");
+
+    const uint64 durationTicks = (uint64)(durationNs * TicksPerMicrosecond() / 1000.0);
+    PushEvent(ourGpuBuffer, Event{ name, cpuStart, cpuStart + durationTicks, 0 });
+}
+
+//Index of the first event that is safe to read, given everything up to head was written
+static uint64 FirstReadable(uint64 head, uint64 cursor) {
+    if (head > Profiler::RingCapacity)
+        cursor = Max(cursor, head - Profiler::RingCapacity + WrapMargin);
+    return cursor;
+}
+
+static ProfilerZoneStat& FindStat(std::string_view name, bool bGpu) {
+    auto it = ourStatIndex[bGpu].find(name);
+    if (it != ourStatIndex[bGpu].end())
+        return ourStats[it->second];
+
+    ourStatIndex[bGpu][name] = (uint32)ourStats.size();
+    ourStats.push_back( ProfilerZoneStat{ name, bGpu, 0.0, 0.0, 0, 0.0, 0 } );
+    return ourStats.back();
+}
+
+void Profiler::NewFrame() {
+    const uint64 now = Now();
+    if (ourFrameStart == 0) {
+        ourFrameStart = now;
+        return;
+    }
+
+    //The frame itself shows up as a zone on the render thread
+    PushEvent(LocalBuffer(), Event{ "Frame", ourFrameStart, now, 0 });
+
+    std::vector<ProfilerThreadBuffer*> buffers;
+    {
+        std::lock_guard<std::mutex> lock(ourMutex);
+        for (auto& b : ourBuffers)
+            buffers.push_back(b.get());
+    }
+
+    const double ticksPerUs = TicksPerMicrosecond();
+    for (ProfilerThreadBuffer* b : buffers) {
+        const bool bGpu = (b == ourGpuBuffer);
+        const uint64 head = b->Head.load(std::memory_order_acquire);
+        for (uint64 i = FirstReadable(head, b->ReadCursor); i < head; i++) {
+            const Event& e = b->Events[i & (RingCapacity - 1)];
+            if (e.Name == nullptr || strcmp(e.Name, "Frame") == 0)
+                continue;
+            ProfilerZoneStat& stat = FindStat(e.Name, bGpu);
+            stat.FrameUs += (double)(e.End - e.Start) / ticksPerUs;
+            stat.FrameCalls++;
+        }
+        b->ReadCursor = head;
+    }
+
+    //Exponential moving average. The first few frames use a bigger weight so that the average warms up quickly
+    ourFrameCount++;
+    const double alpha = 1.0 / (double)Min<uint64>(ourFrameCount, RollingFrames);
+    ourLastFrameUs = (double)(now - ourFrameStart) / ticksPerUs;
+    ourAvgFrameUs += (ourLastFrameUs - ourAvgFrameUs) * alpha;
+    for (ProfilerZoneStat& stat : ourStats) {
+        stat.LastUs = stat.FrameUs;
+        stat.LastCalls = stat.FrameCalls;
+        stat.AvgUs += (stat.FrameUs - stat.AvgUs) * alpha;
+        stat.FrameUs = 0.0;
+        stat.FrameCalls = 0;
+    }
+
+    ourFrameStart = now;
+}
+
+void Profiler::PrintFrameBreakdown() {
+    std::vector<const ProfilerZoneStat*> sorted;
+    for (const ProfilerZoneStat& stat : ourStats)
+        sorted.push_back(&stat);
+    std::sort(sorted.begin(), sorted.end(), [](const ProfilerZoneStat* a, const ProfilerZoneStat* b) { return a->AvgUs > b->AvgUs; });
+
+    const double frameMs = ourAvgFrameUs / 1000.0;
+    LogL(LOG_LEVEL_INFO, LOG_ENDL);
+    LogL(LOG_LEVEL_INFO, "---------    Profiler (avg of ~%d frames)    -----" LOG_ENDL, RollingFrames);
+    LogL(LOG_LEVEL_INFO, "Frame            : %s%7.3f ms%s    (%.1f fps)" LOG_ENDL, LOG_COL_INFO, frameMs, LOG_COL_RESET, frameMs > 0.0 ? 1000.0 / frameMs : 0.0);
+    LogL(LOG_LEVEL_INFO, "Zones are summed over all threads, so they can add up to more than the frame" LOG_ENDL);
+    for (const ProfilerZoneStat* stat : sorted) {
+        double pct = ourAvgFrameUs > 0.0 ? 100.0 * stat->AvgUs / ourAvgFrameUs : 0.0;
+        LogL(LOG_LEVEL_INFO, "%-4s %-20.*s: %s%7.3f ms%s  %5.1f%%   last: %7.3f ms  x%u" LOG_ENDL,
+            stat->bGpu ? "GPU" : "CPU", (int)stat->Name.size(), stat->Name.data(),
+            LOG_COL_INFO, stat->AvgUs / 1000.0, LOG_COL_RESET, pct, stat->LastUs / 1000.0, stat->LastCalls);
+    }
+    LogL(LOG_LEVEL_INFO, LOG_ENDL);
+}
+
+//Zone names are string literals written by us, but escape them anyway so the file is always valid json
+static void WriteJsonString(FILE* pf, const char* str) {
+    fputc('"', pf);
+    for (const char* p = str; *p; p++) {
+        if (*p == '"' || *p == '\\')
+            fputc('\\', pf);
+        if ((unsigned char)*p >= 0x20)
+            fputc(*p, pf);
+    }
+    fputc('"', pf);
+}
+
+bool Profiler::ExportChromeTrace(const char* path) {
+    FILE* pf = fopen(path, "w");
+    if (!pf) {
+        LogWarn("Could not open trace file: %s", path);
+        return false;
+    }
+
+    const double ticksPerUs = TicksPerMicrosecond();
+    uint64 eventCount = 0;
+    bool bFirst = true;
+    fprintf(pf, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    std::lock_guard<std::mutex> lock(ourMutex);
+    for (auto& pBuffer : ourBuffers) {
+        const ProfilerThreadBuffer* b = pBuffer.get();
+
+        fprintf(pf, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", bFirst ? "" : ",\n", b->Id);
+        WriteJsonString(pf, b->Name.c_str());
+        fprintf(pf, "}}");
+        bFirst = false;
+
+        const uint64 head = b->Head.load(std::memory_order_acquire);
+        for (uint64 i = FirstReadable(head, 0); i < head; i++) {
+            const Event& e = b->Events[i & (RingCapacity - 1)];
+            if (!e.Name)
+                continue;
+            //Events that were recorded before the epoch was taken would have a negative timestamp
+            double ts = ((double)e.Start - (double)ourEpochTicks) / ticksPerUs;
+            double dur = (double)(e.End - e.Start) / ticksPerUs;
+
+            fprintf(pf, ",\n{\"ph\":\"X\",\"name\":");
+            WriteJsonString(pf, e.Name);
+            fprintf(pf, ",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", b->Id, ts, dur);
+            eventCount++;
+        }
+    }
+    fprintf(pf, "\n]}\n");
+    fclose(pf);
+
+    LogInfo("Wrote %llu profiler events to: %s", (unsigned long long)eventCount, path);
+    return true;
+}
+
+static const ProfilerThreadBuffer* FindBuffer(const char* name) {
+    std::lock_guard<std::mutex> lock(ourMutex);
+    for (auto& b : ourBuffers) {
+        if (b->Name == name)
+            return b.get();
+    }
+    return nullptr;
+}
+
+bool Profiler::RunAllTests() {
+    bool bSuccess = true;
+    const bool bWasEnabled = Enabled();
+    SetEnabled(true);
+
+    //Nesting. The inner zone ends first, so it is written first
+    {
+        ProfilerThreadBuffer* b = LocalBuffer();
+        const uint32 depth = tlDepth;
+        {
+            PROFILE_ZONE("Test Outer");
+            {
+                PROFILE_ZONE("Test Inner");
+            }
+        }
+        const uint64 head = b->Head.load();
+        const Event& inner = b->Events[(head - 2) & (RingCapacity - 1)];
+        const Event& outer = b->Events[(head - 1) & (RingCapacity - 1)];
+        bool bValid = strcmp(inner.Name, "Test Inner") == 0 && strcmp(outer.Name, "Test Outer") == 0;
+        bValid = bValid && inner.Depth == depth + 1 && outer.Depth == depth;
+        bValid = bValid && outer.Start <= inner.Start && inner.End <= outer.End;
+        bValid = bValid && tlDepth == depth;
+        if (!bValid) {
+            LogError("Profiler nesting test failed");
+            bSuccess = false;
+        }
+    }
+
+    //Every thread gets its own buffer, and a buffer keeps working after it wraps
+    {
+        constexpr int32 threadCount = 4;
+        const uint32 zoneCount = RingCapacity + 1000;
+        std::vector<std::thread> threads;
+        for (int32 t = 0; t < threadCount; t++) {
+            threads.emplace_back([t, zoneCount]() {
+                char name[32];
+                snprintf(name, sizeof(name), "Profiler Test %d", t);
+                SetThreadName(name);
+                for (uint32 i = 0; i < zoneCount; i++) {
+                    PROFILE_ZONE("Test Thread Zone");
+                }
+            });
+        }
+        for (std::thread& t : threads)
+            t.join();
+
+        for (int32 t = 0; t < threadCount; t++) {
+            char name[32];
+            snprintf(name, sizeof(name), "Profiler Test %d", t);
+            const ProfilerThreadBuffer* b = FindBuffer(name);
+            if (!b || b->Head.load() < zoneCount) {
+                LogError("Profiler thread test failed. Buffer '%s' is missing or has too few events", name);
+                bSuccess = false;
+            }
+        }
+    }
+
+    //Breakdown
+    {
+        NewFrame();
+        {
+            PROFILE_ZONE("Test Frame Zone");
+        }
+        NewFrame();
+
+        auto it = ourStatIndex[0].find("Test Frame Zone");
+        if (it == ourStatIndex[0].end() || ourStats[it->second].LastCalls != 1) {
+            LogError("Profiler breakdown test failed");
+            bSuccess = false;
+        }
+    }
+
+    //Chrome trace
+    {
+        const char* path = "profiler_test.json";
+        bool bValid = ExportChromeTrace(path);
+
+        std::string contents;
+        FILE* pf = fopen(path, "r");
+        if (pf) {
+            char buf[4096];
+            size_t n;
+            while ((n = fread(buf, 1, sizeof(buf), pf)) > 0)
+                contents.append(buf, n);
+            fclose(pf);
+        }
+        std::remove(path);
+
+        bValid = bValid && contents.rfind("{\"displayTimeUnit\"", 0) == 0;
+        bValid = bValid && contents.find("\"name\":\"Test Inner\"") != std::string::npos;
+        bValid = bValid && contents.find("\"args\":{\"name\":\"Profiler Test 3\"}") != std::string::npos;
+        bValid = bValid && contents.size() >= 4 && contents.compare(contents.size() - 4, 4, "\n]}\n") == 0;
+        if (!bValid) {
+            LogError("Profiler chrome trace test failed");
+            bSuccess = false;
+        }
+    }
+
+    SetEnabled(bWasEnabled);
+    return bSuccess;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "DebugFinal.h"
+#include <atomic>
+
+#ifndef USE_PROFILER
+    #define USE_PROFILER 1
+#endif
+
+//Low overhead cpu profiler. Every thread records its zones into its own ring buffer, so recording a zone is two
+//timestamps and a store without any locks. The render thread turns the zones into a rolling per frame breakdown
+//in NewFrame, and everything that is still in the ring buffers can be written out as a Chrome trace
+//(chrome://tracing or ui.perfetto.dev).
+//Usage: PROFILE_ZONE("Name") at the start of a scope. Names must be string literals as only the pointer is kept
+class Profiler {
+public:
+    struct Event {
+        const char* Name;
+        uint64      Start;      //Ticks, see Now()
+        uint64      End;
+        uint32      Depth;
+    };
+
+    //Events kept per thread. Older events are overwritten
+    static constexpr uint32 RingCapacity = 1 << 14;
+    //The breakdown is an exponential moving average over roughly this many frames
+    static constexpr int32 RollingFrames = 60;
+
+public:
+    //rdtsc where available, otherwise steady_clock nanoseconds
+    static uint64 Now();
+    static double TicksToMicroseconds(uint64 ticks);
+
+    static void SetEnabled(bool bEnabled)       { ourEnabled.store(bEnabled, std::memory_order_relaxed); }
+    static bool Enabled()                       { return ourEnabled.load(std::memory_order_relaxed); }
+    static void SetThreadName(const char* name);
+
+    //Render thread only. Closes the previous frame and adds it to the breakdown
+    static void NewFrame();
+    static void PrintFrameBreakdown();
+    static bool ExportChromeTrace(const char* path);
+
+    //Used by GpuTimer. cpuStart is in ticks and is only used to place the event in the trace
+    static void AddGpuEvent(const char* name, uint64 cpuStart, uint64 durationNs);
+
+    //Used by ProfileZone
+    static uint32 BeginZone();
+    static void EndZone(const char* name, uint64 start, uint32 depth);
+
+    static bool RunAllTests();    //Returns true when all tests pass
+
+private:
+    static inline std::atomic<bool> ourEnabled{ true };
+};
+
+class ProfileZone {
+public:
+    explicit ProfileZone(const char* name) :
+        myName(nullptr), myStart(0), myDepth(0)
+    {
+        if (Profiler::Enabled()) {
+            myName = name;
+            myDepth = Profiler::BeginZone();
+            myStart = Profiler::Now();
+        }
+    }
+    ~ProfileZone() {
+        if (myName)
+            Profiler::EndZone(myName, myStart, myDepth);
+    }
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator= (const ProfileZone&) = delete;
+
+private:
+    const char* myName;
+    uint64      myStart;
+    uint32      myDepth;
+};
+
+#if USE_PROFILER
+    #define PROFILE_CONCAT_(a, b) a##b
+    #define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+    #define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone_, __LINE__)(name)
+#else
+    #define PROFILE_ZONE(name)
+#endif
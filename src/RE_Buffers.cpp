@@ -12,6 +12,11 @@ static uint32 SizeFromSType (SType t) {
         case SType::Float4:  return 4*sizeof(float);
 
         case SType::Int:     return 1*sizeof(int);
+
+        case SType::Short2:         return 2*sizeof(int16);
+        case SType::Short4:         return 4*sizeof(int16);
+        case SType::UByte4:         return 4*sizeof(uint8);
+        case SType::Int_2_10_10_10: return 1*sizeof(int32);
     }
     Assert(!"Unknown Type");
     return 0;
@@ -24,6 +29,11 @@ static uint32 CountFromSType (SType t) {
         case SType::Float4:  return 4;
 
         case SType::Int:     return 1;
+
+        case SType::Short2:         return 2;
+        case SType::Short4:         return 4;
+        case SType::UByte4:         return 4;
+        case SType::Int_2_10_10_10: return 4;
     }
     Assert(!"Unknown Type");
     return 0;
@@ -36,6 +46,11 @@ static uint32 TypeFromSType (SType t) {
         case SType::Float4:  return GL_FLOAT;
 
         case SType::Int:     return GL_INT;
+
+        case SType::Short2:         return GL_SHORT;
+        case SType::Short4:         return GL_SHORT;
+        case SType::UByte4:         return GL_UNSIGNED_BYTE;
+        case SType::Int_2_10_10_10: return GL_INT_2_10_10_10_REV;
     }
     Assert(!"Unknown Type");
     return 0;
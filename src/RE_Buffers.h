@@ -12,7 +12,19 @@ enum class SType {
     Float3,
     Float4,
 
-    Int
+    Int,
+
+    //Integer types which are usually read as normalized floats in the shader. Pass Normalize::Yes to AttribType for that
+    Short2,
+    Short4,
+    UByte4,
+    Int_2_10_10_10,     //Packed signed 10-10-10-2 in a single int32
+};
+
+//Its own type, so that it never converts to or from the integer offset of AttribType
+enum class Normalize {
+    No = 0,
+    Yes,
 };
 
 struct AttribType {
@@ -22,13 +34,18 @@ struct AttribType {
     {
     }
 
+    AttribType(const char* name, SType type, Normalize norm) :
+        Name(name), Type(type), Normalized(norm == Normalize::Yes), Offset(0)
+    {
+    }
+
     AttribType(const char* name, SType type, uint64 off) :
         Name(name), Type(type), Normalized(false), Offset(off)
     {
     }
 
-    AttribType(const char* name, SType type, bool norm, uint64 off) :
-        Name(name), Type(type), Normalized(norm), Offset(off)
+    AttribType(const char* name, SType type, Normalize norm, uint64 off) :
+        Name(name), Type(type), Normalized(norm == Normalize::Yes), Offset(off)
     {
     }
 
@@ -0,0 +1,448 @@
+#include "RE_CommandList.h"
+#include "ThreadPool.h"
+#include "Profiler.h"
+
+#include <atomic>
+
+void CommandList::Clear() {
+    mySegments.clear();
+    myPoints.clear();
+    myLines.clear();
+    myTris.clear();
+    myIndices.clear();
+    myTriOffset = glm::vec3(0.0f);
+}
+
+void CommandList::PushDepthState(DepthState s) {
+    myDepthStack.Push( (s == RE_DEPTH_INVALID) ? CurDepth() : s );
+}
+void CommandList::PopDepthState() {
+    myDepthStack.Pop();
+}
+void CommandList::PushPolygonState(PolygonState s) {
+    myPolygonStack.Push( (s == RE_POLYGON_INVALID) ? CurPolygon() : s );
+}
+void CommandList::PopPolygonState() {
+    myPolygonStack.Pop();
+}
+
+uint32 CommandList::VertexCount(Primitive p) const {
+    switch (p) {
+        case CMD_PRIM_POINT:    return (uint32)myPoints.size();
+        case CMD_PRIM_LINE:     return (uint32)myLines.size();
+        case CMD_PRIM_TRI:      return (uint32)myTris.size();
+    }
+    Assert(!"Unknown primitive");
+    return 0;
+}
+
+CommandList::Segment& CommandList::Reserve(Primitive p, glm::vec4 col, uint32 vertexCount, uint32 indexCount) {
+    Assert(vertexCount <= MaxSegmentVertices && indexCount <= MaxSegmentIndices && "Draw should have been split up");
+
+    bool bNew = mySegments.empty();
+    if (!bNew) {
+        const Segment& s = mySegments.back();
+        bNew =  s.Prim != p ||
+                s.Depth != CurDepth() ||
+                s.Polygon != CurPolygon() ||
+                (p == CMD_PRIM_TRI && (s.Col != col || s.Offset != myTriOffset)) ||
+                s.VertexCount + vertexCount > MaxSegmentVertices ||
+                s.IndexCount + indexCount > MaxSegmentIndices;
+    }
+
+    if (bNew) {
+        Segment s;
+        s.Prim = p;
+        s.Depth = CurDepth();
+        s.Polygon = CurPolygon();
+        s.Col = col;
+        s.Offset = (p == CMD_PRIM_TRI) ? myTriOffset : glm::vec3(0.0f);
+        s.VertexStart = VertexCount(p);
+        s.VertexCount = 0;
+        s.IndexStart = (uint32)myIndices.size();
+        s.IndexCount = 0;
+        s.PrimitiveCount = 0;
+        mySegments.push_back(s);
+    }
+    return mySegments.back();
+}
+
+void CommandList::DrawPoint(glm::vec3 pos, glm::vec4 col, float width) {
+    Segment& seg = Reserve(CMD_PRIM_POINT, col, 1, 0);
+    myPoints.push_back( VertexPoint{ pos, col, width } );
+    seg.VertexCount++;
+    seg.PrimitiveCount++;
+}
+
+void CommandList::DrawLine(glm::vec3 p1, glm::vec3 p2, glm::vec4 col, float width) {
+    Segment& seg = Reserve(CMD_PRIM_LINE, col, 2, 2);
+    uint32 base = seg.VertexCount;
+    myLines.push_back( VertexLine{ p1, col, width } );
+    myLines.push_back( VertexLine{ p2, col, width } );
+    myIndices.push_back(base);
+    myIndices.push_back(base+1);
+
+    seg.VertexCount += 2;
+    seg.IndexCount += 2;
+    seg.PrimitiveCount++;
+}
+
+void CommandList::DrawLineStrip(const glm::vec3* pos, int32 count, glm::vec4 col, float width) {
+    if (count <= 1) {
+        LogWarn("Cannot draw LineStrip with count: %d", count);
+        return;
+    }
+    if ((uint32)count > MaxSegmentVertices || 2*(uint32)(count-1) > MaxSegmentIndices) {
+        //Same as RendererBatch, split it into two smaller strips which share a vertex
+        int32 newCount = (count+1)/2;
+        DrawLineStrip(&pos[0], newCount, col, width);
+        DrawLineStrip(&pos[newCount-1], count-newCount+1, col, width);
+        return;
+    }
+
+    Segment& seg = Reserve(CMD_PRIM_LINE, col, count, 2*(count-1));
+    uint32 base = seg.VertexCount;
+    myLines.push_back( VertexLine{ pos[0], col, width } );
+    for (int32 i = 1; i < count; i++) {
+        myLines.push_back( VertexLine{ pos[i], col, width } );
+        myIndices.push_back(base + i-1);
+        myIndices.push_back(base + i);
+    }
+
+    seg.VertexCount += count;
+    seg.IndexCount += 2*(count-1);
+    seg.PrimitiveCount += count-1;
+}
+
+void CommandList::DrawLineLoop(const glm::vec3* pos, int32 count, glm::vec4 col, float width) {
+    if (count <= 1) {
+        LogWarn("Cannot draw LineLoop with count: %d", count);
+        return;
+    }
+    if ((uint32)count > MaxSegmentVertices || 2*(uint32)count > MaxSegmentIndices) {
+        DrawLineStrip(pos, count, col, width);
+        DrawLine(pos[0], pos[count-1], col, width);
+        return;
+    }
+
+    Segment& seg = Reserve(CMD_PRIM_LINE, col, count, 2*count);
+    uint32 base = seg.VertexCount;
+    myLines.push_back( VertexLine{ pos[0], col, width } );
+    for (int32 i = 1; i < count; i++) {
+        myLines.push_back( VertexLine{ pos[i], col, width } );
+        myIndices.push_back(base + i-1);
+        myIndices.push_back(base + i);
+    }
+    myIndices.push_back(base + count-1);
+    myIndices.push_back(base);
+
+    seg.VertexCount += count;
+    seg.IndexCount += 2*count;
+    seg.PrimitiveCount += count;
+}
+
+void CommandList::DrawTriangle(glm::vec3 pos1, glm::vec3 pos2, glm::vec3 pos3, glm::vec4 col) {
+    Segment& seg = Reserve(CMD_PRIM_TRI, col, 3, 3);
+    uint32 base = seg.VertexCount;
+    glm::i16vec2 normal = OctPackSnorm16( CalculateNormal(pos1, pos2, pos3) );
+    myTris.push_back( VertexTri{ pos1, normal } );
+    myTris.push_back( VertexTri{ pos2, normal } );
+    myTris.push_back( VertexTri{ pos3, normal } );
+    myIndices.push_back(base);
+    myIndices.push_back(base+1);
+    myIndices.push_back(base+2);
+
+    seg.VertexCount += 3;
+    seg.IndexCount += 3;
+    seg.PrimitiveCount++;
+}
+
+void CommandList::DrawTriangleStrip(const glm::vec3* pos, int32 count, glm::vec4 col, bool bFlipNormal) {
+    if (count <= 2) {
+        LogWarn("Cannot draw Triangle Strip with count: %d", count);
+        return;
+    }
+    const uint32 newIndicesCount = (count-2) * 3;
+    if ((uint32)count > MaxSegmentVertices || newIndicesCount > MaxSegmentIndices) {
+        const int32 newTriCount = (count-2) / 2;
+        const int32 newCount = newTriCount + 2;
+        const int32 newCount2 = count - newCount + 2;
+        DrawTriangleStrip(&pos[0], newCount, col, bFlipNormal);
+        //An odd number of triangles in the first half flips the winding order of the second half
+        DrawTriangleStrip(&pos[newCount-2], newCount2, col, bFlipNormal != (newTriCount % 2 == 1));
+        return;
+    }
+
+    if (myNormalScratch.size() < (uint64)count)
+        myNormalScratch.resize(count);
+    CalculateStripNormals(pos, count, bFlipNormal, myNormalScratch.data());
+
+    Segment& seg = Reserve(CMD_PRIM_TRI, col, count, newIndicesCount);
+    uint32 base = seg.VertexCount;
+    for (int32 i = 0; i < count; i++) {
+        myTris.push_back( VertexTri{ pos[i], OctPackSnorm16(myNormalScratch[i]) } );
+        if (i >= 2) {
+            myIndices.push_back(base + i-2);
+            myIndices.push_back(base + i-1);
+            myIndices.push_back(base + i);
+        }
+    }
+
+    seg.VertexCount += count;
+    seg.IndexCount += newIndicesCount;
+    seg.PrimitiveCount += count-2;
+}
+
+void CommandList::DrawTriangleFan(const glm::vec3* pos, int32 count, glm::vec4 col) {
+    if (count <= 2) {
+        LogWarn("Cannot draw Triangle Fan with count: %d", count);
+        return;
+    }
+    const uint32 newIndicesCount = (count-2) * 3;
+    if ((uint32)count > MaxSegmentVertices || newIndicesCount > MaxSegmentIndices) {
+        //Both halves keep the centre vertex
+        const int32 half = (count-1) / 2;
+        std::vector<glm::vec3> second;
+        second.reserve(count - half + 1);
+        second.push_back(pos[0]);
+        second.insert(second.end(), &pos[half], &pos[count]);
+        DrawTriangleFan(pos, half+1, col);
+        DrawTriangleFan(second.data(), (int32)second.size(), col);
+        return;
+    }
+
+    Segment& seg = Reserve(CMD_PRIM_TRI, col, count, newIndicesCount);
+    uint32 base = seg.VertexCount;
+    glm::i16vec2 normal = OctPackSnorm16( CalculateNormal(pos[0], pos[1], pos[2]) );
+    for (int32 i = 0; i < count; i++) {
+        myTris.push_back( VertexTri{ pos[i], normal } );
+        if (i >= 2) {
+            myIndices.push_back(base);
+            myIndices.push_back(base + i-1);
+            myIndices.push_back(base + i);
+        }
+    }
+
+    seg.VertexCount += count;
+    seg.IndexCount += newIndicesCount;
+    seg.PrimitiveCount += count-2;
+}
+
+void CommandList::Append(const CommandList& other) {
+    for (const Segment& s : other.mySegments) {
+        Segment seg = s;
+        seg.VertexStart = VertexCount(s.Prim);
+        seg.IndexStart = (uint32)myIndices.size();
+
+        switch (s.Prim) {
+            case CMD_PRIM_POINT:
+                myPoints.insert(myPoints.end(), &other.myPoints[s.VertexStart], &other.myPoints[s.VertexStart] + s.VertexCount);
+                break;
+            case CMD_PRIM_LINE:
+                myLines.insert(myLines.end(), &other.myLines[s.VertexStart], &other.myLines[s.VertexStart] + s.VertexCount);
+                break;
+            case CMD_PRIM_TRI:
+                myTris.insert(myTris.end(), &other.myTris[s.VertexStart], &other.myTris[s.VertexStart] + s.VertexCount);
+                break;
+        }
+        if (s.IndexCount) {
+            myIndices.insert(myIndices.end(), &other.myIndices[s.IndexStart], &other.myIndices[s.IndexStart] + s.IndexCount);
+        }
+        mySegments.push_back(seg);
+    }
+}
+
+//--------------------------------------------------------------------------------
+//                               CommandQueue
+//--------------------------------------------------------------------------------
+
+CommandList& CommandQueue::Local() {
+    std::lock_guard<std::mutex> lock(myMutex);
+    std::thread::id id = std::this_thread::get_id();
+    auto it = myMap.find(id);
+    if (it != myMap.end())
+        return *it->second;
+
+    myLists.push_back( std::make_unique<CommandList>() );
+    CommandList* pList = myLists.back().get();
+    myMap[id] = pList;
+    return *pList;
+}
+
+void CommandQueue::Submit(Renderer* r) {
+    Assert(r);
+    PROFILE_ZONE("Submit");
+    std::lock_guard<std::mutex> lock(myMutex);
+    for (std::unique_ptr<CommandList>& list : myLists) {
+        if (list->Empty())
+            continue;
+        r->Submit(*list);
+        list->Clear();
+    }
+}
+
+void CommandQueue::Merge(CommandList& out) {
+    std::lock_guard<std::mutex> lock(myMutex);
+    for (std::unique_ptr<CommandList>& list : myLists) {
+        out.Append(*list);
+        list->Clear();
+    }
+}
+
+void CommandQueue::Clear() {
+    std::lock_guard<std::mutex> lock(myMutex);
+    for (std::unique_ptr<CommandList>& list : myLists) {
+        list->Clear();
+    }
+}
+
+//--------------------------------------------------------------------------------
+//                               Tests
+//--------------------------------------------------------------------------------
+
+//Every index has to point inside its own segment and no segment can be bigger than the batch
+static bool ValidateList(const CommandList& list) {
+    for (const CommandList::Segment& s : list.Segments()) {
+        if (s.VertexCount > CommandList::MaxSegmentVertices || s.IndexCount > CommandList::MaxSegmentIndices)
+            return false;
+        for (uint32 i = 0; i < s.IndexCount; i++) {
+            if (list.Indices()[s.IndexStart + i] >= s.VertexCount)
+                return false;
+        }
+    }
+    return true;
+}
+
+bool CommandList::RunAllTests() {
+    bool bVal = RunTest_Recording();
+    bVal = bVal && RunTest_Stress();
+    return bVal;
+}
+
+bool CommandList::RunTest_Recording() {
+    bool bVal = true;
+    CommandList list;
+    const glm::vec4 col = glm::vec4(1.0f);
+    const glm::vec4 col2 = glm::vec4(0.5f);
+
+    glm::vec3 pos[4] = { {0, 0, 0}, {1, 0, 0}, {0, 1, 0}, {1, 1, 0} };
+    list.DrawLine(pos[0], pos[1], col, 1.0f);
+    list.DrawLineStrip(pos, 4, col, 1.0f);      //Merges with the previous segment
+    list.DrawTriangleStrip(pos, 4, col);
+    list.DrawTriangleStrip(pos, 4, col2);       //A different colour needs a new segment
+
+    list.PushDepthState(RE_DEPTH_LESS);
+    list.DrawTriangleStrip(pos, 4, col2);       //So does a different state
+    list.PopDepthState();
+
+    bVal &= list.Segments().size() == 4;
+    bVal &= list.Lines().size() == 6;
+    bVal &= list.Tris().size() == 12;
+    bVal &= list.Segments()[3].Depth == RE_DEPTH_LESS;
+    bVal &= list.Segments()[2].Depth == RE_DEPTH_INVALID;
+    bVal &= ValidateList(list);
+
+    //Offsets go to the triangles recorded after them as segment state. The vertices themselves are left alone
+    list.DrawTriangleStrip(pos, 4, col2);
+    list.SetTriOffset(glm::vec3(0.0f, 0.0f, 2.0f));
+    list.DrawTriangleStrip(pos, 4, col2);       //Only the offset differs from the previous segment
+    list.DrawLine(pos[0], pos[1], col, 1.0f);
+    list.SetTriOffset(glm::vec3(0.0f));
+    bVal &= list.Segments().size() == 7;
+    bVal &= list.Segments()[4].Offset == glm::vec3(0.0f) && list.Segments()[5].Offset == glm::vec3(0.0f, 0.0f, 2.0f);
+    bVal &= list.Segments()[6].Offset == glm::vec3(0.0f);
+    bVal &= list.Tris()[16].Pos.z == 0.0f && list.Tris()[19].Pos.x == 1.0f;
+
+    //A strip which is bigger than the batch is split up
+    std::vector<glm::vec3> big(MaxSegmentVertices * 2 + 5);
+    for (uint64 i = 0; i < big.size(); i++) {
+        big[i] = glm::vec3( (float)(i/2), (float)(i%2), 0.0f );
+    }
+    CommandList listBig;
+    listBig.DrawTriangleStrip(big.data(), (int32)big.size(), col);
+    uint32 triCount = 0;
+    for (const Segment& s : listBig.Segments()) {
+        triCount += s.PrimitiveCount;
+    }
+    bVal &= triCount == big.size() - 2;
+    bVal &= listBig.Segments().size() > 1;
+    bVal &= ValidateList(listBig);
+
+    //All normals of a flat strip should point the same way, even across a split
+    for (const VertexTri& v : listBig.Tris()) {
+        bVal &= OctUnpackSnorm16(v.Normal).z > 0.99f;
+    }
+
+    if (!bVal)
+        LogError("CommandList recording test failed");
+    return bVal;
+}
+
+bool CommandList::RunTest_Stress() {
+    //Lots of producers record at the same time into their own lists, then everything gets concatenated
+    constexpr int32 Producers = 32;
+    constexpr int32 DrawsPerProducer = 200;
+    constexpr int32 StripLength = 50;
+
+    CommandQueue queue;
+    std::atomic<int32> expectedTris{0};
+    std::atomic<int32> expectedLines{0};
+
+    std::vector<std::thread> threads;
+    for (int32 p = 0; p < Producers; p++) {
+        threads.emplace_back([&, p]() {
+            CommandList& list = queue.Local();
+            glm::vec3 strip[StripLength];
+            for (int32 d = 0; d < DrawsPerProducer; d++) {
+                for (int32 i = 0; i < StripLength; i++) {
+                    strip[i] = glm::vec3( (float)(i/2), (float)(i%2) + d, (float)p );
+                }
+                if (d % 3 == 0) {
+                    list.DrawLineStrip(strip, StripLength, glm::vec4(1.0f), 1.0f);
+                    expectedLines += StripLength-1;
+                }
+                else {
+                    list.DrawTriangleStrip(strip, StripLength, glm::vec4(0.75f, 0.75f, 0.75f, 1.0f));
+                    expectedTris += StripLength-2;
+                }
+            }
+        });
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+
+    //The same thing through the thread pool, where several jobs end up sharing a thread's list
+    ThreadPool::Global().ParallelFor(Producers, [&](int32 p) {
+        CommandList& list = queue.Local();
+        glm::vec3 tri[3] = { {0, 0, (float)p}, {1, 0, (float)p}, {0, 1, (float)p} };
+        for (int32 d = 0; d < DrawsPerProducer; d++) {
+            list.DrawTriangle(tri[0], tri[1], tri[2], glm::vec4(0.75f, 0.75f, 0.75f, 1.0f));
+        }
+        expectedTris += DrawsPerProducer;
+    });
+
+    CommandList merged;
+    queue.Merge(merged);
+
+    int32 lines = 0, tris = 0;
+    for (const Segment& s : merged.Segments()) {
+        if (s.Prim == CMD_PRIM_LINE) lines += s.PrimitiveCount;
+        if (s.Prim == CMD_PRIM_TRI) tris += s.PrimitiveCount;
+    }
+
+    bool bVal = true;
+    bVal &= lines == expectedLines.load();
+    bVal &= tris == expectedTris.load();
+    bVal &= merged.Indices().size() == (uint64)(2*lines + 3*tris);
+    bVal &= ValidateList(merged);
+
+    //Merging leaves the per thread lists empty and ready for the next frame
+    CommandList empty;
+    queue.Merge(empty);
+    bVal &= empty.Empty();
+
+    if (!bVal)
+        LogError("CommandList stress test failed");
+    return bVal;
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include "DebugFinal.h"
+#include "RE_RendererBatch.h"
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+enum CommandPrimitive {
+    CMD_PRIM_POINT,
+    CMD_PRIM_LINE,
+    CMD_PRIM_TRI,
+};
+
+//A run of draws which share the same primitive and state. Indices are relative to VertexStart
+struct CommandSegment {
+    CommandPrimitive    Prim;
+    DepthState          Depth;
+    PolygonState        Polygon;
+    glm::vec4           Col;            //Only used by triangles, as their colour is a per draw uniform
+    glm::vec3           Offset;         //Only used by triangles, added to their positions by a uniform as well
+    uint32              VertexStart;
+    uint32              VertexCount;
+    uint32              IndexStart;
+    uint32              IndexCount;
+    uint32              PrimitiveCount; //For metrics
+};
+
+//Records draw calls without touching OpenGL, so it can be filled on any thread. Vertices (including normals) are
+//generated while recording, and the render thread only copies them into its batch. See Renderer::Submit
+class CommandList {
+public:
+    using Primitive = CommandPrimitive;
+    using Segment = CommandSegment;
+
+    //A segment always fits into an empty RendererBatch
+    static constexpr uint32 MaxSegmentVertices = RendererBatch::VertexCapacity;
+    static constexpr uint32 MaxSegmentIndices = RendererBatch::IndexCapacity;
+
+public:
+    CommandList() = default;
+    CommandList(const CommandList&) = delete;
+    CommandList(CommandList&&) = default;
+    CommandList& operator= (CommandList&&) = default;
+
+    void Clear();
+    bool Empty() const { return mySegments.empty(); }
+
+    //RE_DEPTH_INVALID and RE_POLYGON_INVALID mean that whatever state the renderer has during Submit is used
+    void PushDepthState(DepthState s = RE_DEPTH_INVALID);
+    void PopDepthState();
+    void PushPolygonState(PolygonState s = RE_POLYGON_INVALID);
+    void PopPolygonState();
+
+    //Added to the position of every triangle recorded after this call. Like the colour it is a per segment uniform,
+    //so a surface can be moved every frame without being meshed again or its vertices being touched
+    void SetTriOffset(glm::vec3 offset) { myTriOffset = offset; }
+
+    void DrawPoint(glm::vec3 pos, glm::vec4 col, float width);
+
+    void DrawLine(glm::vec3 p1, glm::vec3 p2, glm::vec4 col, float width);
+    void DrawLineLoop(const glm::vec3* pos, int32 count, glm::vec4 col, float width);
+    void DrawLineStrip(const glm::vec3* pos, int32 count, glm::vec4 col, float width);
+
+    void DrawTriangle(glm::vec3 pos1, glm::vec3 pos2, glm::vec3 pos3, glm::vec4 col);
+    void DrawTriangleStrip(const glm::vec3* pos, int32 count, glm::vec4 col, bool bFlipNormal = false);
+    void DrawTriangleFan(const glm::vec3* pos, int32 count, glm::vec4 col);
+
+    //Concatenates the commands of other after the commands of this list
+    void Append(const CommandList& other);
+
+    const std::vector<Segment>&         Segments() const    { return mySegments; }
+    const std::vector<VertexPoint>&     Points() const      { return myPoints; }
+    const std::vector<VertexLine>&      Lines() const       { return myLines; }
+    const std::vector<VertexTri>&       Tris() const        { return myTris; }
+    const std::vector<uint32>&          Indices() const     { return myIndices; }
+
+    static bool RunAllTests();    //Returns true when all tests pass
+
+private:
+    Segment& Reserve(Primitive p, glm::vec4 col, uint32 vertexCount, uint32 indexCount);
+    uint32 VertexCount(Primitive p) const;
+
+    DepthState CurDepth() const         { return myDepthStack.Empty() ? RE_DEPTH_INVALID : myDepthStack.Top(); }
+    PolygonState CurPolygon() const     { return myPolygonStack.Empty() ? RE_POLYGON_INVALID : myPolygonStack.Top(); }
+
+    static bool RunTest_Recording();
+    static bool RunTest_Stress();
+
+private:
+    std::vector<Segment>        mySegments;
+    std::vector<VertexPoint>    myPoints;
+    std::vector<VertexLine>     myLines;
+    std::vector<VertexTri>      myTris;
+    std::vector<uint32>         myIndices;
+    std::vector<glm::vec3>      myNormalScratch;
+    glm::vec3                   myTriOffset = glm::vec3(0.0f);
+
+    StateStack<DepthState, DepthStateSize>          myDepthStack;
+    StateStack<PolygonState, PolygonStateSize>      myPolygonStack;
+};
+
+//Hands out one CommandList per thread. Workers record into Local() in parallel and the render thread
+//submits everything in one pass
+class CommandQueue {
+public:
+    CommandQueue() = default;
+    CommandQueue(const CommandQueue&) = delete;
+
+    //The list owned by the calling thread. Look it up once per job rather than once per draw
+    CommandList& Local();
+
+    //Render thread only. Must not be called while other threads are still recording
+    void Submit(Renderer* r);
+    void Merge(CommandList& out);
+    void Clear();
+
+private:
+    std::mutex                                          myMutex;
+    std::vector<std::unique_ptr<CommandList>>           myLists;
+    std::unordered_map<std::thread::id, CommandList*>   myMap;
+};
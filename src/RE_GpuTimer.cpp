@@ -0,0 +1,87 @@
+#include "RE_GpuTimer.h"
+#include "Profiler.h"
+#include "RE_RendererState.h"
+
+GpuTimer::GpuTimer() :
+    myFrames{},
+    myFrame(0),
+    myAvailable(false),
+    myInZone(false)
+{
+}
+
+GpuTimer::~GpuTimer() {
+    Cleanup();
+}
+
+void GpuTimer::Init() {
+    Cleanup();
+    myAvailable = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+    if (!myAvailable) {
+        LogWarn("Timer queries are not supported, gpu zones are disabled");
+        return;
+    }
+
+    for (Frame& f : myFrames) {
+        glGenQueries(MaxZonesPerFrame, f.Queries);
+        f.Count = 0;
+    }
+    glCheckError();
+    myFrame = 0;
+}
+
+void GpuTimer::Cleanup() {
+    if (!myAvailable)
+        return;
+
+    for (Frame& f : myFrames) {
+        glDeleteQueries(MaxZonesPerFrame, f.Queries);
+        f.Count = 0;
+    }
+    myAvailable = false;
+}
+
+void GpuTimer::BeginZone(const char* name) {
+    Assert(!myInZone && "Gpu zones cannot be nested");
+    Frame& f = myFrames[myFrame];
+    if (!myAvailable || !Profiler::Enabled() || f.Count >= MaxZonesPerFrame)
+        return;
+
+    f.Names[f.Count] = name;
+    f.CpuStart[f.Count] = Profiler::Now();
+    glBeginQuery(GL_TIME_ELAPSED, f.Queries[f.Count]);
+    myInZone = true;
+}
+
+void GpuTimer::EndZone() {
+    if (!myInZone)
+        return;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    myFrames[myFrame].Count++;
+    myInZone = false;
+}
+
+void GpuTimer::EndFrame() {
+    if (!myAvailable)
+        return;
+
+    myFrame = (myFrame + 1) % FrameLatency;
+    Frame& f = myFrames[myFrame];
+    if (f.Count == 0)
+        return;
+
+    //Queries finish in order, so if the last one is done all of them are. If the gpu is more than FrameLatency
+    //frames behind, the frame is dropped instead of waiting for it
+    GLint bAvailable = 0;
+    glGetQueryObjectiv(f.Queries[f.Count - 1], GL_QUERY_RESULT_AVAILABLE, &bAvailable);
+    if (bAvailable) {
+        for (uint32 i = 0; i < f.Count; i++) {
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(f.Queries[i], GL_QUERY_RESULT, &ns);
+            Profiler::AddGpuEvent(f.Names[i], f.CpuStart[i], ns);
+        }
+    }
+    glCheckError();
+    f.Count = 0;
+}
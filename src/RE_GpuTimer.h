@@ -0,0 +1,54 @@
+#pragma once
+#include <GL/glew.h>
+#include "DebugFinal.h"
+
+//GL_TIME_ELAPSED queries which are fed into the Profiler as gpu zones. Results are read FrameLatency frames later
+//so reading them never stalls the pipeline. Time elapsed queries cannot be nested, so neither can the zones.
+//Does nothing when the context has no timer queries (GL 3.3 or ARB_timer_query)
+class GpuTimer {
+public:
+    static constexpr uint32 FrameLatency = 4;
+    static constexpr uint32 MaxZonesPerFrame = 64;
+
+public:
+    GpuTimer();
+    ~GpuTimer();
+    GpuTimer(const GpuTimer&) = delete;
+    const GpuTimer& operator= (const GpuTimer&) = delete;
+
+    void Init();
+    void Cleanup();
+
+    //Name must be a string literal, same as PROFILE_ZONE
+    void BeginZone(const char* name);
+    void EndZone();
+
+    //Reads back the oldest frame, and starts a new one
+    void EndFrame();
+
+    bool Available() const { return myAvailable; }
+
+private:
+    struct Frame {
+        GLuint      Queries[MaxZonesPerFrame];
+        const char* Names[MaxZonesPerFrame];
+        uint64      CpuStart[MaxZonesPerFrame];
+        uint32      Count;
+    };
+
+    Frame       myFrames[FrameLatency];
+    uint32      myFrame;
+    bool        myAvailable;
+    bool        myInZone;       //True when the current zone was started, false if it was skipped
+};
+
+class GpuZone {
+public:
+    GpuZone(GpuTimer& timer, const char* name) : myTimer(timer) { myTimer.BeginZone(name); }
+    ~GpuZone() { myTimer.EndZone(); }
+    GpuZone(const GpuZone&) = delete;
+    GpuZone& operator= (const GpuZone&) = delete;
+
+private:
+    GpuTimer& myTimer;
+};
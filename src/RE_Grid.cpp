@@ -0,0 +1,84 @@
+#include "RE_Grid.h"
+
+namespace Grid {
+
+//glsl fract() behaves differently from std::modf for negative numbers
+static glm::vec2 Fract(glm::vec2 v) {
+    return v - glm::floor(v);
+}
+
+float LineCoverage(glm::vec2 pos, glm::vec2 fw, float spacing, float width) {
+    glm::vec2 coord = pos / spacing;
+    glm::vec2 deriv = glm::max(fw / spacing, glm::vec2(1e-6f));
+
+    //Distance (in pixels) to the closest line along each axis
+    glm::vec2 dist = glm::abs(Fract(coord - 0.5f) - 0.5f) / deriv;
+    float d = glm::min(dist.x, dist.y);
+    return glm::clamp(0.5f*width + 0.5f - d, 0.0f, 1.0f);
+}
+
+float AxisCoverage(float dist, float fw, float width) {
+    float d = glm::abs(dist) / glm::max(fw, 1e-6f);
+    return glm::clamp(0.5f*width + 0.5f - d, 0.0f, 1.0f);
+}
+
+glm::vec4 Shade(const GridSettings& s, glm::vec2 pos, glm::vec2 fw) {
+    glm::vec4 col = glm::vec4(0.0f);
+
+    if (s.Subdivisions > 1) {
+        float minorSpacing = s.Spacing / s.Subdivisions;
+        //Fade out the minor lines once they are less than a few pixels apart to avoid moire patterns
+        float density = glm::max(fw.x, fw.y) / minorSpacing;
+        float fade = 1.0f - glm::smoothstep(0.1f, 0.3f, density);
+        float cov = LineCoverage(pos, fw, minorSpacing, s.LineWidth) * fade;
+        col = glm::mix(col, s.MinorCol, cov);
+    }
+
+    col = glm::mix(col, s.MajorCol, LineCoverage(pos, fw, s.Spacing, s.LineWidth));
+
+    //x axis lies on y = 0 and the y axis on x = 0
+    col = glm::mix(col, s.AxisXCol, AxisCoverage(pos.y, fw.y, s.LineWidth));
+    col = glm::mix(col, s.AxisYCol, AxisCoverage(pos.x, fw.x, s.LineWidth));
+    return col;
+}
+
+static bool Near(float a, float b, float eps = 1e-4f) {
+    return glm::abs(a - b) <= eps;
+}
+
+bool RunAllTests() {
+    bool bVal = true;
+    const glm::vec2 fw = glm::vec2(0.01f);   //100 pixels per world unit
+
+    //On a line the pixel is fully covered and halfway between two lines it is empty
+    bVal &= Near(LineCoverage(glm::vec2(3.0f, 0.37f), fw, 1.0f, 1.0f), 1.0f);
+    bVal &= Near(LineCoverage(glm::vec2(-2.0f, -0.37f), fw, 1.0f, 1.0f), 1.0f);
+    bVal &= Near(LineCoverage(glm::vec2(0.5f, 0.5f), fw, 1.0f, 1.0f), 0.0f);
+
+    //Anti aliasing: half a pixel away from a 1 pixel wide line is the edge, so 1.5 pixels away is empty
+    bVal &= Near(LineCoverage(glm::vec2(1.005f, 0.5f), fw, 1.0f, 1.0f), 0.5f);
+    bVal &= Near(LineCoverage(glm::vec2(1.015f, 0.5f), fw, 1.0f, 1.0f), 0.0f);
+
+    //Spacing
+    bVal &= Near(LineCoverage(glm::vec2(2.5f, 0.25f), fw, 2.5f, 1.0f), 1.0f);
+    bVal &= Near(LineCoverage(glm::vec2(1.25f, 1.25f), fw, 2.5f, 1.0f), 0.0f);
+
+    GridSettings s;
+    s.Subdivisions = 4;
+
+    //Axes take priority over the grid lines
+    bVal &= (Shade(s, glm::vec2(0.5f, 0.0f), fw) == s.AxisXCol);
+    bVal &= (Shade(s, glm::vec2(0.0f, 0.5f), fw) == s.AxisYCol);
+    bVal &= (Shade(s, glm::vec2(3.0f, 0.5f), fw) == s.MajorCol);
+    bVal &= (Shade(s, glm::vec2(3.25f, 0.5f), fw) == s.MinorCol);
+    bVal &= (Shade(s, glm::vec2(3.125f, 0.625f), fw).a == 0.0f);
+
+    //Minor lines disappear when they would be too dense to see
+    bVal &= (Shade(s, glm::vec2(3.25f, 0.5f), glm::vec2(0.2f)).a == 0.0f);
+
+    if (!bVal)
+        LogError("Grid tests failed");
+    return bVal;
+}
+
+} //End of namespace Grid
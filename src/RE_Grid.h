@@ -0,0 +1,29 @@
+#pragma once
+#include "DebugFinal.h"
+#include "Maths.h"
+
+//Settings for the analytic grid pass. The grid is drawn as a single quad on the z=0 plane and the lines are
+//computed per fragment, so the cost does not depend on the extent or the number of lines
+struct GridSettings {
+    float       Spacing = 1.0f;         //World distance between two major lines
+    int32       Subdivisions = 1;       //Number of minor cells per major cell. 1 means no minor lines
+    float       Extent = 20.0f;         //Half size of the grid quad
+    float       LineWidth = 1.0f;       //In pixels
+
+    glm::vec4   MajorCol = glm::vec4(0.2, 0.2, 0.2, 1.0);
+    glm::vec4   MinorCol = glm::vec4(0.15, 0.15, 0.15, 1.0);
+    glm::vec4   AxisXCol = glm::vec4(0.8, 0.2, 0.2, 1.0);
+    glm::vec4   AxisYCol = glm::vec4(0.2, 0.8, 0.2, 1.0);
+};
+
+//CPU version of the math in Assets/Shaders/grid.prog. Keep both in sync
+namespace Grid {
+    //Returns how much of the pixel is covered by the closest line of a grid with the given spacing.
+    //fw is the screen space derivative of the world position (fwidth() in glsl)
+    float LineCoverage(glm::vec2 pos, glm::vec2 fw, float spacing, float width);
+    float AxisCoverage(float dist, float fw, float width);
+
+    glm::vec4 Shade(const GridSettings& s, glm::vec2 pos, glm::vec2 fw);
+
+    bool RunAllTests();    //Returns true when all tests pass
+}
@@ -17,3 +17,8 @@ void Renderer::Cleanup() {
 
 }
 
+void Renderer::PrintAllocMetrics() const {
+    LogL(LOG_LEVEL_INFO, "Frame  Allocs    : %s%05d%s    Bytes : %s%07d%s" LOG_ENDL, LOG_COL_INFO, myMetFrameAllocs, LOG_COL_RESET, LOG_COL_INFO, myMetFrameAllocBytes, LOG_COL_RESET);
+    LogL(LOG_LEVEL_INFO, "Remesh Allocs    : %s%05d%s    Bytes : %s%07d%s" LOG_ENDL, LOG_COL_INFO, myMetRemeshAllocs, LOG_COL_RESET, LOG_COL_INFO, myMetRemeshAllocBytes, LOG_COL_RESET);
+}
+
@@ -6,8 +6,10 @@
 #include "RE_Shader.h"
 #include "RE_Texture.h"
 #include "Camera.h"
+#include "RE_Grid.h"
 
 
+class CommandList;
 
 class Renderer : public RendererState {
 public:
@@ -36,7 +38,22 @@ public:
     void DrawTriangleFan(const glm::vec3* pos, int32 count, glm::vec4 col) 
                     { DrawTriangleFanPrivate(pos[0], &pos[1], count-1, col); }
 
+    //Draws the ground plane grid and the x/y axes in a single pass
+    virtual void DrawGrid(const GridSettings& settings) = 0;
+
+    //Draws everything that was recorded in the list, in order. Render thread only
+    virtual void Submit(const CommandList& list) = 0;
+
+    //Surface tiles are culled before they are recorded (see TileBVH), so the renderer only gets told the result for its metrics
+    virtual void AddCullMetrics(uint64 tilesVisible, uint64 tilesCulled) = 0;
+
+    //Heap allocations (see AllocTracker). Most of them happen outside the renderer, so the caller measures them
+    void SetFrameAllocMetrics(uint64 allocs, uint64 bytes)     { myMetFrameAllocs = allocs; myMetFrameAllocBytes = bytes; }
+    void SetRemeshAllocMetrics(uint64 allocs, uint64 bytes)    { myMetRemeshAllocs = allocs; myMetRemeshAllocBytes = bytes; }
+
 protected:
+    void PrintAllocMetrics() const;
+
     virtual void DrawTriangleFanPrivate(glm::vec3 posBase, const glm::vec3* pos, int32 count, glm::vec4 col) = 0;
 
 private:
@@ -46,6 +63,11 @@ private:
 protected:
     Camera*             myCam = 0;
 
+    uint64              myMetFrameAllocs = 0;       //Last frame
+    uint64              myMetFrameAllocBytes = 0;
+    uint64              myMetRemeshAllocs = 0;      //Last re-mesh
+    uint64              myMetRemeshAllocBytes = 0;
+
 };
 
 #include "RE_RendererBatch.h"
\ No newline at end of file
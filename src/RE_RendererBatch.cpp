@@ -1,5 +1,8 @@
 #include "RE_RendererBatch.h"
+#include "RE_CommandList.h"
+#include "Profiler.h"
 #include <type_traits>
+#include <cstring>
 
 RendererBatch::RendererBatch() :
     myBuffer(nullptr),
@@ -12,13 +15,19 @@ RendererBatch::RendererBatch() :
     myVertexCount(0),
     myIndexCount(0),
     myPrim(RE_PRIM_NONE),
+    myTriCol(1.0f, 1.0f, 1.0f, 1.0f),
+    myTriOffset(0.0f),
 
     myMetLineDrawCalls(0),
     myMetLinePrimitives(0),
     myMetPointDrawCalls(0),
     myMetPointPrimitives(0),
     myMetTriDrawCalls(0),
-    myMetTriPrimitives(0)
+    myMetTriPrimitives(0),
+    myMetGridDrawCalls(0),
+    myMetTilesVisible(0),
+    myMetTilesCulled(0),
+    myMetOverlaysCulled(0)
 
 {
 
@@ -28,10 +37,13 @@ RendererBatch::~RendererBatch() {
 }
 
 void RendererBatch::Init(Camera* cam) {
+    glEnable(GL_DEPTH_TEST);
     Renderer::Init(cam);
 
-    constexpr uint64 BufferSize = 10'000 * sizeof(VertexTri);
-    constexpr uint64 IndexBufferCount = 10'000;
+    //The buffer is shared by all the primitives, so it is sized for the biggest vertex
+    constexpr uint64 MaxVertexSize = (sizeof(VertexLine) > sizeof(VertexTri)) ? sizeof(VertexLine) : sizeof(VertexTri);
+    constexpr uint64 BufferSize = VertexCapacity * MaxVertexSize;
+    constexpr uint64 IndexBufferCount = IndexCapacity;
 
     myBuffer = (uint8*)malloc(sizeof(uint8) * BufferSize);
     myBufferSize = BufferSize;
@@ -65,13 +77,58 @@ void RendererBatch::Init(Camera* cam) {
     myVaoTri.Init();
     myVbo.SetLayout({
         { "Position", SType::Float3 },
-        { "Col", SType::Float4 },
-        { "Normal", SType::Float3 },
+        { "Normal", SType::Short2, Normalize::Yes },
     });
     bStatus = myShaderTri.Load("Assets/Shaders/tri.prog");
     Assert(bStatus);
 
+    //Unit quad drawn as a triangle strip. It gets scaled to the grid extent in the vertex shader
+    const glm::vec2 gridQuad[4] = {
+        glm::vec2(-1.0f, -1.0f),
+        glm::vec2(+1.0f, -1.0f),
+        glm::vec2(-1.0f, +1.0f),
+        glm::vec2(+1.0f, +1.0f),
+    };
+    myVaoGrid.Init();
+    myVboGrid.Init(sizeof(gridQuad), gridQuad, GL_STATIC_DRAW);
+    myVboGrid.SetLayout({
+        { "Position", SType::Float2 },
+    });
+    bStatus = myShaderGrid.Load("Assets/Shaders/grid.prog");
+    Assert(bStatus);
+
+    myGpuTimer.Init();
+
+}
+void RendererBatch::ApplyDepthState(DepthState s) {
+    GLenum val;
+    switch (s) {
+    default: Assert(false && "Unknown type"); return;
+    case RE_DEPTH_NEVER: val = GL_NEVER;     break;
+    case RE_DEPTH_LESS: val = GL_LESS;      break;
+    case RE_DEPTH_EQUAL: val = GL_EQUAL;     break;
+    case RE_DEPTH_LEQUAL: val = GL_LEQUAL;    break;
+    case RE_DEPTH_GREATER: val = GL_GREATER;   break;
+    case RE_DEPTH_NOTEQUAL: val = GL_NOTEQUAL;  break;
+    case RE_DEPTH_GEQUAL: val = GL_GEQUAL;    break;
+    case RE_DEPTH_ALWAYS: val = GL_ALWAYS;    break;
+    }
+    glDepthFunc(val);
+    glCheckError();
+}
+
+void RendererBatch::ApplyPolygonState(PolygonState s) {
+    GLenum val;
+    switch (s) {
+        default                  : Assert(false && "Unknown type"); return;
+        case RE_POLYGON_POINT    : val = GL_POINT;     break;
+        case RE_POLYGON_LINE     : val = GL_LINE;      break;
+        case RE_POLYGON_FILL     : val = GL_FILL;      break;
+    };
+    glPolygonMode( GL_FRONT_AND_BACK, val );
+    glCheckError();
 }
+
 void RendererBatch::Cleanup() {
     if (myBuffer) {
         free(myBuffer);
@@ -81,6 +138,7 @@ void RendererBatch::Cleanup() {
         free(myIndexBuffer);
         myIndexBuffer = 0;
     }
+    myGpuTimer.Cleanup();
 }
 
 template<typename T>
@@ -160,10 +218,15 @@ void RendererBatch::StartFrame() {
     myMetPointPrimitives = 0;
     myMetTriDrawCalls = 0;
     myMetTriPrimitives = 0;
+    myMetGridDrawCalls = 0;
+    myMetTilesVisible = 0;
+    myMetTilesCulled = 0;
+    myMetOverlaysCulled = 0;
 }
 
 void RendererBatch::EndFrame() {
     Flush();
+    myGpuTimer.EndFrame();
 }
 
 void RendererBatch::SwitchPrim(Primitive p)
@@ -175,7 +238,7 @@ void RendererBatch::SwitchPrim(Primitive p)
 }
 
 void RendererBatch::PrintMetrics() {
-    uint64 total = myMetLineDrawCalls + myMetPointDrawCalls + myMetTriDrawCalls;
+    uint64 total = myMetLineDrawCalls + myMetPointDrawCalls + myMetTriDrawCalls + myMetGridDrawCalls;
 
     LogL(LOG_LEVEL_INFO, LOG_ENDL);
     // LogL(LOG_LEVEL_INFO, "%s" LOG_ENDL, LOG_COL_INFO);
@@ -183,6 +246,10 @@ void RendererBatch::PrintMetrics() {
     LogL(LOG_LEVEL_INFO, "Line Draw Calls  : %s%03d%s    Lines : %s%07d%s" LOG_ENDL, LOG_COL_INFO, myMetLineDrawCalls, LOG_COL_RESET, LOG_COL_INFO, myMetLinePrimitives, LOG_COL_RESET);
     LogL(LOG_LEVEL_INFO, "Point Draw Calls : %s%03d%s    Points: %s%07d%s" LOG_ENDL, LOG_COL_INFO, myMetPointDrawCalls, LOG_COL_RESET, LOG_COL_INFO, myMetPointPrimitives, LOG_COL_RESET);
     LogL(LOG_LEVEL_INFO, "Tri   Draw Calls : %s%03d%s    Tri   : %s%07d%s" LOG_ENDL, LOG_COL_INFO, myMetTriDrawCalls, LOG_COL_RESET, LOG_COL_INFO, myMetTriPrimitives, LOG_COL_RESET);
+    LogL(LOG_LEVEL_INFO, "Grid  Draw Calls : %s%03d%s" LOG_ENDL, LOG_COL_INFO, myMetGridDrawCalls, LOG_COL_RESET);
+    LogL(LOG_LEVEL_INFO, "Tiles Visible    : %s%05d%s    Culled: %s%07d%s" LOG_ENDL, LOG_COL_INFO, myMetTilesVisible, LOG_COL_RESET, LOG_COL_INFO, myMetTilesCulled, LOG_COL_RESET);
+    LogL(LOG_LEVEL_INFO, "Overlays Culled  : %s%05d%s" LOG_ENDL, LOG_COL_INFO, myMetOverlaysCulled, LOG_COL_RESET);
+    PrintAllocMetrics();
 
     LogL(LOG_LEVEL_INFO, LOG_ENDL);
     LogL(LOG_LEVEL_INFO, "Total Draw Calls : %s%05d%s" LOG_ENDL, LOG_COL_INFO, total, LOG_COL_RESET);
@@ -194,6 +261,9 @@ void RendererBatch::PrintMetrics() {
 void RendererBatch::DoFlush() {
     if (myPrim == RE_PRIM_NONE)
         return;
+
+    PROFILE_ZONE("DoFlush");
+    GpuZone gpuZone(myGpuTimer, "DoFlush");
     
     if (myPrim == RE_PRIM_POINT)
     {
@@ -257,6 +327,8 @@ void RendererBatch::DoFlush() {
         myShaderTri.SetFloat("ambient_strength", ambientStrength);
         myShaderTri.SetFloat3("light_color", glm::value_ptr(lightCol));
         myShaderTri.SetFloat3("light_dir", glm::value_ptr(lightDir));
+        myShaderTri.SetFloat4("u_col", glm::value_ptr(myTriCol));
+        myShaderTri.SetFloat3("u_offset", glm::value_ptr(myTriOffset));
 
         myVbo.Bind();
         myVbo.Update(0, myBuffer, myVertexCount*sizeof(VertexTri));
@@ -330,6 +402,8 @@ void RendererBatch::DrawLineStrip(const glm::vec3* pos, int32 count, glm::vec4 c
         LogWarn("Cannot draw LineStrip with count: %d", count);
         return;
     }
+    if (IsCulled(pos, count))
+        return;
     
     SwitchPrim(RE_PRIM_LINE);
     if (!VBHasSpace<VertexLine>(count) || !IBHasSpace( 2*(count-1) )) {
@@ -377,6 +451,8 @@ void RendererBatch::DrawLineLoop(const glm::vec3* pos, int32 count, glm::vec4 co
         LogWarn("Cannot draw LineLoop with count: %d", count);
         return;
     }
+    if (IsCulled(pos, count))
+        return;
     
     SwitchPrim(RE_PRIM_LINE);
     if (!VBHasSpace<VertexLine>(count) || !IBHasSpace(2*count)) {
@@ -419,36 +495,85 @@ glm::vec3 CalculateNormal(glm::vec3 a, glm::vec3 b, glm::vec3 c) {
     const glm::vec3 y = c-a;
     return glm::normalize( glm::cross(x, y) );
 }
+
+void CalculateStripNormals(const glm::vec3* pos, int32 count, bool bFlipNormal, glm::vec3* outNormals) {
+    Assert(count >= 3);
+    glm::vec3* pNormals = outNormals;
+    pNormals[0] = glm::vec3(0.0f, 0.0f, 0.0f);
+    pNormals[1] = glm::vec3(0.0f, 0.0f, 0.0f);
+
+    for (int32 i = 2; i < count; i++) {
+        glm::vec3 n = CalculateNormal(pos[i-2], pos[i-1], pos[i]);
+        if ( (i + (int)bFlipNormal) % 2 == 0 ) {
+            //I believe opengl flips the winding order every alternate triangle so that all triangles have the same winding order
+            // As a result, even though the positions are in the 'wrong' order, we need to flip the normal to get the correct normal
+            
+            n *= -1.0f;
+        }
+        pNormals[i] = n;
+        pNormals[i-1] += n;
+        pNormals[i-2] += n;
+    }
+
+    glm::vec3 eps = glm::vec3(0.01);
+    glm::vec3* pn = &pNormals[1];
+
+    //If the vector is 0.0f, then don't attempt to normalize it
+    if (!glm::all( glm::lessThan( glm::abs(*pn), eps )))
+        *pn = glm::normalize( *pn / 2.0f );
+    pn = &pNormals[count-2];
+    if (!glm::all( glm::lessThan( glm::abs(*pn), eps )))
+        *pn = glm::normalize( *pn / 2.0f );
+
+    for (int32 i = 2; i < count-2; i++) {
+        pn = &pNormals[i];
+        if (!glm::all( glm::lessThan( glm::abs(*pn), eps )))
+            *pn = glm::normalize( *pn / 3.0f );
+    }
+}
+
+//Colour is a per draw uniform for triangles, so a change in colour ends the current batch
+void RendererBatch::SwitchTriCol(glm::vec4 col)
+{
+    if (myTriCol != col) {
+        Flush();
+        myTriCol = col;
+    }
+}
+
+//Same for the offset of a CommandList segment, which the vertex shader adds to every position
+void RendererBatch::SwitchTriOffset(glm::vec3 offset)
+{
+    if (myTriOffset != offset) {
+        Flush();
+        myTriOffset = offset;
+    }
+}
+
 void RendererBatch::DrawTriangle(glm::vec3 pos1, glm::vec3 pos2, glm::vec3 pos3, glm::vec4 col)
 {
     SwitchPrim(RE_PRIM_TRI);
+    SwitchTriCol(col);
+    SwitchTriOffset(glm::vec3(0.0f));
     if (!VBHasSpace<VertexTri>(3) || !IBHasSpace(3)) {
         Flush();
         Assert(VBHasSpace<VertexTri>(3) && IBHasSpace(3) && "Buffer is not big enough");
     }
     uint32 vertexCount = myVertexCount;
     glm::vec3 normal = CalculateNormal(pos1, pos2, pos3);
+    glm::i16vec2 packedNormal = OctPackSnorm16(normal);
 
     VertexTri* pv = VBPush<VertexTri>();
     pv->Pos = pos1;
-    pv->Col = col;
-    //pv->Tex = {0.0f, 0.0f};
-    //pv->TexId = -1;
-    pv->Normal = normal;
+    pv->Normal = packedNormal;
 
     pv = VBPush<VertexTri>();
     pv->Pos = pos2;
-    pv->Col = col;
-    //pv->Tex = {0.0f, 0.0f};
-    //pv->TexId = -1;
-    pv->Normal = normal;
+    pv->Normal = packedNormal;
 
     pv = VBPush<VertexTri>();
     pv->Pos = pos3;
-    pv->Col = col;
-    //pv->Tex = {0.0f, 0.0f};
-    //pv->TexId = -1;
-    pv->Normal = normal;
+    pv->Normal = packedNormal;
 
     IBPush(vertexCount);
     IBPush(vertexCount+1);
@@ -469,11 +594,15 @@ void RendererBatch::DrawTriangle(glm::vec3 pos1, glm::vec3 pos2, glm::vec3 pos3,
 
 void RendererBatch::DrawTriangleStrip(const glm::vec3* pos, const int32 count, glm::vec4 col, bool bFlipNormal)
 {
-    SwitchPrim(RE_PRIM_TRI);
     if (count <= 2) {
         LogWarn("Cannot draw Triangle Strip with count: %d", count);
         return;
     }
+    if (IsCulled(pos, count))
+        return;
+    SwitchPrim(RE_PRIM_TRI);
+    SwitchTriCol(col);
+    SwitchTriOffset(glm::vec3(0.0f));
     const int32 newIndicesCount = (count-2) * 3;
     if (!VBHasSpace<VertexTri>(count) || !IBHasSpace(newIndicesCount)) {
         Flush();
@@ -486,68 +615,30 @@ void RendererBatch::DrawTriangleStrip(const glm::vec3* pos, const int32 count, g
             //While splitting into smaller regions, we should never split too small that we cant render anymore. If this happens then increase the buffer size
             Assert( newCount >= 3 );
             Assert( newCount2 >= 3 );
-            DrawTriangleStrip(&pos[0], newCount, col);
-            DrawTriangleStrip(&pos[newCount-2], newCount2, col);
+            DrawTriangleStrip(&pos[0], newCount, col, bFlipNormal);
+            //An odd number of triangles in the first half flips the winding order of the second half
+            DrawTriangleStrip(&pos[newCount-2], newCount2, col, bFlipNormal != (newTriCount % 2 == 1));
             return;
         }
     }
 
-    uint32 vertexCount = myVertexCount;
-    //We can treat this as an array
-    VertexTri* pStartVertex = VBPush<VertexTri>();  
-
-    VertexTri* pv = pStartVertex;
-    pv->Pos = pos[0];
-    pv->Col = col;
-    //pv->Tex = {0.0f, 0.0f};
-    //pv->TexId = -1;
-    pv->Normal = glm::vec3(0.0f, 0.0f, 0.0f);
+    //Normals are accumulated in full precision and only packed once they are final
+    if (myNormalScratch.size() < (uint64)count)
+        myNormalScratch.resize(count);
+    glm::vec3* pNormals = myNormalScratch.data();
+    CalculateStripNormals(pos, count, bFlipNormal, pNormals);
 
-    pv = VBPush<VertexTri>();
-    pv->Pos = pos[1];
-    pv->Col = col;
-    //pv->Tex = {0.0f, 0.0f};
-    //pv->TexId = -1;
-    pv->Normal = glm::vec3(0.0f, 0.0f, 0.0f);
-
-    for (int32 i = 2; i < count; i++) {
-        pv = VBPush<VertexTri>();
+    uint32 vertexCount = myVertexCount;
+    for (int32 i = 0; i < count; i++) {
+        VertexTri* pv = VBPush<VertexTri>();
         pv->Pos = pos[i];
-        // pv->Col = col + glm::vec4(0.0, 1.0 * (float)i/count, 0.0, 0.0);
-        pv->Col = col;
-        //pv->Tex = {0.0f, 0.0f};
-        //pv->TexId = -1;
+        pv->Normal = OctPackSnorm16(pNormals[i]);
 
-        glm::vec3 n = CalculateNormal(pStartVertex[i-2].Pos, pStartVertex[i-1].Pos, pv->Pos);
-        if ( (i + (int)bFlipNormal) % 2 == 0 ) {
-            //I believe opengl flips the winding order every alternate triangle so that all triangles have the same winding order
-            // As a result, even though the positions are in the 'wrong' order, we need to flip the normal to get the correct normal
-            
-            n *= -1.0f;
+        if (i >= 2) {
+            IBPush(vertexCount + i-2);
+            IBPush(vertexCount + i-1);
+            IBPush(vertexCount + i);
         }
-        pv->Normal = n;
-        pStartVertex[i-1].Normal += n;
-        pStartVertex[i-2].Normal += n;
-
-        IBPush(vertexCount + i-2);
-        IBPush(vertexCount + i-1);
-        IBPush(vertexCount + i);
-    }
-
-    glm::vec3 eps = glm::vec3(0.01);
-    glm::vec3* pn = &pStartVertex[1].Normal;
-
-    //If the vector is 0.0f, then don't attempt to normalize it
-    if (!glm::all( glm::lessThan( glm::abs(*pn), eps )))
-        *pn = glm::normalize( *pn / 2.0f );
-    pn = &pStartVertex[count-2].Normal;
-    if (!glm::all( glm::lessThan( glm::abs(*pn), eps )))
-        *pn = glm::normalize( *pn / 2.0f );
-
-    for (int32 i = 2; i < count-2; i++) {
-        pn = &pStartVertex[i].Normal;
-        if (!glm::all( glm::lessThan( glm::abs(*pn), eps )))
-            *pn = glm::normalize( *pn / 3.0f );
     }
 
     myFlush = true;
@@ -557,24 +648,14 @@ void RendererBatch::DrawTriangleStrip(const glm::vec3* pos, const int32 count, g
 
 
 #if 0
-    glm::vec3* posss    = new glm::vec3[count];
-    glm::vec3* normalss = new glm::vec3[count];
-
-    for (int i = 0; i < count; i++) {
-        posss[i] = pStartVertex[i].Pos;
-        normalss[i] = pStartVertex[i].Normal;
-    }
-
     //glPolygonMode( GL_FRONT_AND_BACK, GL_LINE );
     DoFlush();
     //glPolygonMode( GL_FRONT_AND_BACK, GL_FILL );
     PushDepthState(RE_DEPTH_LESS);
     for (int32 i = 0 ; i < count; i++) {
-        DrawLine( posss[i], posss[i] + normalss[i] * 0.3f, glm::vec4(0.8f, 0.2f, 0.2f, 1.0f), 2);
+        DrawLine( pos[i], pos[i] + pNormals[i] * 0.3f, glm::vec4(0.8f, 0.2f, 0.2f, 1.0f), 2);
     }
     PopDepthState();
-    delete[] posss;
-    delete[] normalss;
     glCheckError();
     DoFlush();
 #endif
@@ -584,11 +665,15 @@ void RendererBatch::DrawTriangleStrip(const glm::vec3* pos, const int32 count, g
 
 void RendererBatch::DrawTriangleFanPrivate(glm::vec3 posBase, const glm::vec3* pos, int32 count, glm::vec4 col) {
 
-    SwitchPrim(RE_PRIM_TRI);
     if (count <= 1) {
         LogWarn("Cannot draw Triangle Fan with count: %d", count);
         return;
     }
+    if (IsCulled(pos, count, &posBase))
+        return;
+    SwitchPrim(RE_PRIM_TRI);
+    SwitchTriCol(col);
+    SwitchTriOffset(glm::vec3(0.0f));
 
     const int32 newIndicesCount = (count-1) * 3;
     if (!VBHasSpace<VertexTri>(count+1) || !IBHasSpace(newIndicesCount)) {
@@ -608,25 +693,22 @@ void RendererBatch::DrawTriangleFanPrivate(glm::vec3 posBase, const glm::vec3* p
         }
     }
 
+    //A fan is mostly used for flat shapes, so every vertex gets the normal of the first triangle
+    glm::i16vec2 packedNormal = OctPackSnorm16( CalculateNormal(posBase, pos[0], pos[1]) );
+
     uint32 vertexCount = myVertexCount;
     VertexTri* pv = VBPush<VertexTri>();
     pv->Pos = posBase;
-    pv->Col = col;
-    //pv->Tex = {0.0f, 0.0f};
-    //pv->TexId = -1;
+    pv->Normal = packedNormal;
 
     pv = VBPush<VertexTri>();
     pv->Pos = pos[0];
-    pv->Col = col;
-    //pv->Tex = {0.0f, 0.0f};
-    //pv->TexId = -1;
+    pv->Normal = packedNormal;
 
     for (int32 i = 1; i < count; i++) {
         pv = VBPush<VertexTri>();
         pv->Pos = pos[i];
-        pv->Col = col;
-        //pv->Tex = {0.0f, 0.0f};
-        //pv->TexId = -1;
+        pv->Normal = packedNormal;
 
         IBPush(vertexCount);
         IBPush(vertexCount + i);
@@ -638,4 +720,109 @@ void RendererBatch::DrawTriangleFanPrivate(glm::vec3 posBase, const glm::vec3* p
     myMetTriPrimitives += (count-1);
 }
 
+bool RendererBatch::IsCulled(const glm::vec3* pos, int32 count, const glm::vec3* extra) {
+    if (!myCam)
+        return false;
+
+    AABB bounds;
+    bounds.Expand(pos, count);
+    if (extra)
+        bounds.Expand(*extra);
+
+    if (myCam->GetFrustum().Intersects(bounds))
+        return false;
+
+    myMetOverlaysCulled++;
+    return true;
+}
+
+void RendererBatch::AddCullMetrics(uint64 tilesVisible, uint64 tilesCulled) {
+    myMetTilesVisible += tilesVisible;
+    myMetTilesCulled += tilesCulled;
+}
+
+void RendererBatch::DrawGrid(const GridSettings& settings) {
+    //The grid does not use the batch buffer, but whatever is batched so far was submitted before the grid
+    Flush();
+
+    myVaoGrid.Bind();
+    myShaderGrid.Bind();
+    myShaderGrid.SetMat4("mat_proj", glm::value_ptr(myCam->VP()));
+    myShaderGrid.SetFloat("u_extent", settings.Extent);
+    myShaderGrid.SetFloat("u_spacing", settings.Spacing);
+    myShaderGrid.SetFloat("u_subdiv", (float)settings.Subdivisions);
+    myShaderGrid.SetFloat("u_width", settings.LineWidth);
+    myShaderGrid.SetFloat4("u_col_major", glm::value_ptr(settings.MajorCol));
+    myShaderGrid.SetFloat4("u_col_minor", glm::value_ptr(settings.MinorCol));
+    myShaderGrid.SetFloat4("u_col_axis_x", glm::value_ptr(settings.AxisXCol));
+    myShaderGrid.SetFloat4("u_col_axis_y", glm::value_ptr(settings.AxisYCol));
+
+    //The grid is depth tested but never writes depth, so that it cannot hide a graph which is drawn after it
+    glDepthMask(GL_FALSE);
+    glCheckError();
+    {
+        GpuZone gpuZone(myGpuTimer, "Grid");
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    }
+    glCheckError();
+    glDepthMask(GL_TRUE);
+
+    myMetGridDrawCalls++;
+}
 
+template<typename T>
+void RendererBatch::SubmitSegment(const CommandSegment& seg, const T* vertices, const uint32* indices) {
+    if (!VBHasSpace<T>(seg.VertexCount) || !IBHasSpace(seg.IndexCount)) {
+        Flush();
+    }
+    Assert(VBHasSpace<T>(seg.VertexCount) && IBHasSpace(seg.IndexCount) && "CommandList segment is bigger than the batch");
+
+    //Vertices are already final, only the indices need to be moved to where the segment lands in the buffer
+    uint32 vertexCount = myVertexCount;
+    memcpy(myBuffer + vertexCount * sizeof(T), vertices + seg.VertexStart, seg.VertexCount * sizeof(T));
+    myVertexCount += seg.VertexCount;
+
+    const uint32* pIndex = indices + seg.IndexStart;
+    for (uint32 i = 0; i < seg.IndexCount; i++) {
+        myIndexBuffer[myIndexCount] = vertexCount + pIndex[i];
+        ++myIndexCount;
+    }
+    myFlush = true;
+}
+
+void RendererBatch::Submit(const CommandList& list) {
+    const uint32* pIndices = list.Indices().data();
+    for (const CommandSegment& seg : list.Segments()) {
+        PushDepthState(seg.Depth);
+        PushPolygonState(seg.Polygon);
+
+        switch (seg.Prim) {
+            case CMD_PRIM_POINT:
+            {
+                SwitchPrim(RE_PRIM_POINT);
+                SubmitSegment<VertexPoint>(seg, list.Points().data(), pIndices);
+                myMetPointPrimitives += seg.PrimitiveCount;
+                break;
+            }
+            case CMD_PRIM_LINE:
+            {
+                SwitchPrim(RE_PRIM_LINE);
+                SubmitSegment<VertexLine>(seg, list.Lines().data(), pIndices);
+                myMetLinePrimitives += seg.PrimitiveCount;
+                break;
+            }
+            case CMD_PRIM_TRI:
+            {
+                SwitchPrim(RE_PRIM_TRI);
+                SwitchTriCol(seg.Col);
+                SwitchTriOffset(seg.Offset);
+                SubmitSegment<VertexTri>(seg, list.Tris().data(), pIndices);
+                myMetTriPrimitives += seg.PrimitiveCount;
+                break;
+            }
+        }
+
+        PopPolygonState();
+        PopDepthState();
+    }
+}
@@ -5,6 +5,7 @@
 #include "RE_Buffers.h"
 #include "RE_Shader.h"
 #include "RE_Texture.h"
+#include "RE_GpuTimer.h"
 #include "Maths.h"
 #include "Camera.h"
 
@@ -20,13 +21,27 @@ struct VertexLine {
     glm::vec4 Col;
     float Width;
 };
+//Colour is the same for a whole surface so it is sent as a uniform instead of per vertex.
+//The normal is octahedral encoded into 2 normalized shorts (see OctPackSnorm16)
 struct VertexTri {
     glm::vec3 Pos;
-    glm::vec4 Col;
-    glm::vec3 Normal;
+    glm::i16vec2 Normal;
 };
+static_assert(sizeof(VertexTri) == 16, "VertexTri is expected to be tightly packed");
+
+glm::vec3 CalculateNormal(glm::vec3 a, glm::vec3 b, glm::vec3 c);
+//Smooth per vertex normals of a triangle strip. outNormals needs space for count normals
+void CalculateStripNormals(const glm::vec3* pos, int32 count, bool bFlipNormal, glm::vec3* outNormals);
+
+class CommandList;
+struct CommandSegment;
 
 class RendererBatch : public Renderer {
+public:
+    //Maximum number of vertices and indices that go into a single draw call
+    static constexpr uint32 VertexCapacity = 10'000;
+    static constexpr uint32 IndexCapacity = 10'000;
+
 public:
     RendererBatch();
     ~RendererBatch();
@@ -49,6 +64,15 @@ public:
     void DrawTriangle(glm::vec3 pos1, glm::vec3 pos2, glm::vec3 pos3, glm::vec4 col) override;
     void DrawTriangleStrip(const glm::vec3* pos, int32 count, glm::vec4 col, bool bFlipNormal = false) override;
 
+    void DrawGrid(const GridSettings& settings) override;
+
+    void Submit(const CommandList& list) override;
+    void AddCullMetrics(uint64 tilesVisible, uint64 tilesCulled) override;
+
+protected:
+    void ApplyDepthState(DepthState s) override;
+    void ApplyPolygonState(PolygonState s) override;
+
 private:
     enum Primitive {
         RE_PRIM_NONE,
@@ -57,6 +81,8 @@ private:
         RE_PRIM_TRI,
     };
     void SwitchPrim(Primitive p);
+    void SwitchTriCol(glm::vec4 col);
+    void SwitchTriOffset(glm::vec3 offset);
 
     //Vertex Buffer. Template parameter should only be a vertex struct ideally
     template<typename T>
@@ -70,6 +96,9 @@ private:
 
     inline void VBClear() { myVertexCount = 0; }
 
+    template<typename T>
+    void SubmitSegment(const CommandSegment& seg, const T* vertices, const uint32* indices);
+
     void IBPush(int32 val);
     void IBPush(int32* ar, uint32 count);
     bool IBHasSpace(uint32 count);
@@ -78,6 +107,9 @@ private:
     void Cleanup();
 
 private:
+    //True when the draw is completely outside the camera frustum. Used for the overlay draws which dont go through the BVH
+    bool IsCulled(const glm::vec3* pos, int32 count, const glm::vec3* extra = nullptr);
+
     void DrawTriangleFanPrivate(glm::vec3 posBase, const glm::vec3* pos, int32 count, glm::vec4 col);
 
 private:
@@ -90,6 +122,9 @@ private:
     uint32              myIndexCount;
 
     Primitive           myPrim;
+    glm::vec4           myTriCol;
+    glm::vec3           myTriOffset;
+    std::vector<glm::vec3> myNormalScratch;
     VertexBuffer        myVbo;
     IndexBuffer         myIbo;
 
@@ -104,6 +139,13 @@ private:
     //Tri stuff
     VertexArray         myVaoTri;
     Shader              myShaderTri;
+
+    //Grid stuff. The grid has its own static quad so it never goes through myBuffer
+    VertexArray         myVaoGrid;
+    VertexBuffer        myVboGrid;
+    Shader              myShaderGrid;
+
+    GpuTimer            myGpuTimer;
     
     //Metrics
     uint64               myMetLineDrawCalls;
@@ -112,4 +154,8 @@ private:
     uint64               myMetPointPrimitives;
     uint64               myMetTriDrawCalls;
     uint64               myMetTriPrimitives;
+    uint64               myMetGridDrawCalls;
+    uint64               myMetTilesVisible;
+    uint64               myMetTilesCulled;
+    uint64               myMetOverlaysCulled;
 };
@@ -0,0 +1,1068 @@
+#include "RE_RendererSoft.h"
+#include "RE_CommandList.h"
+#include "RE_Texture.h"
+#include "ThreadPool.h"
+#include "Profiler.h"
+#include <stb_image.h>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define RE_SOFT_SSE 1
+    #include <emmintrin.h>
+#else
+    #define RE_SOFT_SSE 0
+#endif
+
+//Input primitives are flushed once this many are batched, to bound the memory of a single flush
+static constexpr uint64 BatchCapacity = 1 << 16;
+//Number of input primitives that one setup job transforms
+static constexpr int32 SetupChunkSize = 256;
+
+//Keep in sync with the light uniforms in RendererBatch::DoFlush
+static constexpr float LightAmbient = 0.4f;
+static const glm::vec3 LightCol = glm::vec3(1.0f, 1.0f, 220.0f / 255.0f);
+static const glm::vec3 LightDir = glm::vec3(-1.0f, -1.0f, -1.0f);
+
+RendererSoft::RendererSoft(int32 width, int32 height) :
+    myWidth(0),
+    myHeight(0),
+    myTilesX(0),
+    myTilesY(0),
+    myClearCol(0.1f, 0.1f, 0.1f, 1.0f),
+
+    myPrim(RE_PRIM_NONE),
+    myTriCol(1.0f, 1.0f, 1.0f, 1.0f),
+    myTriOffset(0.0f),
+
+    myDepthFunc(RE_DEPTH_LESS),
+    myPolygonMode(RE_POLYGON_FILL),
+    myDepthWrite(true),
+    myVP(1.0f),
+    myVPInv(1.0f),
+
+    mySimd(RE_SOFT_SSE),
+    myThreaded(true),
+
+    myMetFlushes(0),
+    myMetTrisIn(0),
+    myMetTrisSetup(0),
+    myMetTilesRastered(0),
+    myMetTilesVisible(0),
+    myMetTilesCulled(0)
+{
+    Resize(width, height);
+}
+
+RendererSoft::~RendererSoft() {
+}
+
+void RendererSoft::Init(Camera* cam) {
+    Renderer::Init(cam);
+}
+
+void RendererSoft::Resize(int32 width, int32 height) {
+    Assert(width > 0 && height > 0);
+    myWidth = width;
+    myHeight = height;
+    myTilesX = (width + TileSize - 1) / TileSize;
+    myTilesY = (height + TileSize - 1) / TileSize;
+
+    myColor.assign(width * height, myClearCol);
+    myDepth.assign(width * height + 4, 1.0f);
+    myPixels.assign(width * height * 4, 0);
+    myBins.resize(myTilesX * myTilesY);
+}
+
+void RendererSoft::ApplyDepthState(DepthState s) {
+    Assert(s != RE_DEPTH_INVALID);
+    myDepthFunc = s;
+}
+
+void RendererSoft::ApplyPolygonState(PolygonState s) {
+    Assert(s != RE_POLYGON_INVALID);
+    myPolygonMode = s;
+}
+
+void RendererSoft::StartFrame() {
+    std::fill(myColor.begin(), myColor.end(), myClearCol);
+    std::fill(myDepth.begin(), myDepth.end(), 1.0f);
+
+    //Metrics
+    myMetFlushes = 0;
+    myMetTrisIn = 0;
+    myMetTrisSetup = 0;
+    myMetTilesRastered = 0;
+    myMetTilesVisible = 0;
+    myMetTilesCulled = 0;
+}
+
+void RendererSoft::EndFrame() {
+    Flush();
+
+    for (int32 i = 0; i < myWidth * myHeight; i++) {
+        glm::vec4 c = glm::clamp(myColor[i], 0.0f, 1.0f);
+        myPixels[4*i + 0] = (uint8)(c.r * 255.0f + 0.5f);
+        myPixels[4*i + 1] = (uint8)(c.g * 255.0f + 0.5f);
+        myPixels[4*i + 2] = (uint8)(c.b * 255.0f + 0.5f);
+        myPixels[4*i + 3] = (uint8)(c.a * 255.0f + 0.5f);
+    }
+}
+
+void RendererSoft::SaveFrame(const char* path) const {
+    CreateBMP(path, myWidth, myHeight, 4, myPixels.data());
+}
+
+void RendererSoft::PrintMetrics() {
+    LogL(LOG_LEVEL_INFO, LOG_ENDL);
+    LogL(LOG_LEVEL_INFO, "---------    RendererSoft Metrics    -------------" LOG_ENDL);
+    LogL(LOG_LEVEL_INFO, "Resolution       : %s%d x %d%s    Tiles: %s%d%s" LOG_ENDL, LOG_COL_INFO, myWidth, myHeight, LOG_COL_RESET, LOG_COL_INFO, myTilesX*myTilesY, LOG_COL_RESET);
+    LogL(LOG_LEVEL_INFO, "Flushes          : %s%03d%s" LOG_ENDL, LOG_COL_INFO, myMetFlushes, LOG_COL_RESET);
+    LogL(LOG_LEVEL_INFO, "Tri   In         : %s%07d%s    Setup : %s%07d%s" LOG_ENDL, LOG_COL_INFO, myMetTrisIn, LOG_COL_RESET, LOG_COL_INFO, myMetTrisSetup, LOG_COL_RESET);
+    LogL(LOG_LEVEL_INFO, "Tiles Rastered   : %s%05d%s" LOG_ENDL, LOG_COL_INFO, myMetTilesRastered, LOG_COL_RESET);
+    LogL(LOG_LEVEL_INFO, "Tiles Visible    : %s%05d%s    Culled: %s%07d%s" LOG_ENDL, LOG_COL_INFO, myMetTilesVisible, LOG_COL_RESET, LOG_COL_INFO, myMetTilesCulled, LOG_COL_RESET);
+    LogL(LOG_LEVEL_INFO, "Simd             : %s%s%s    Threads: %s%s%s" LOG_ENDL, LOG_COL_INFO, mySimd ? "on" : "off", LOG_COL_RESET, LOG_COL_INFO, myThreaded ? "on" : "off", LOG_COL_RESET);
+    PrintAllocMetrics();
+    LogL(LOG_LEVEL_INFO, LOG_ENDL);
+}
+
+void RendererSoft::AddCullMetrics(uint64 tilesVisible, uint64 tilesCulled) {
+    myMetTilesVisible += tilesVisible;
+    myMetTilesCulled += tilesCulled;
+}
+
+void RendererSoft::SwitchPrim(Primitive p) {
+    if (myPrim != p) {
+        Flush();
+        myPrim = p;
+    }
+}
+
+void RendererSoft::SwitchTriCol(glm::vec4 col) {
+    if (myTriCol != col) {
+        Flush();
+        myTriCol = col;
+    }
+}
+
+void RendererSoft::SwitchTriOffset(glm::vec3 offset) {
+    if (myTriOffset != offset) {
+        Flush();
+        myTriOffset = offset;
+    }
+}
+
+//-----------------------------------------------------
+//               Draw calls
+//-----------------------------------------------------
+
+void RendererSoft::PushTri(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 n0, glm::vec3 n1, glm::vec3 n2) {
+    if (myTris.size() >= BatchCapacity)
+        Flush();
+    myTris.push_back( InputTri{ {p0, p1, p2}, {n0, n1, n2} } );
+    myFlush = true;
+}
+
+void RendererSoft::DrawPoint(glm::vec3 pos, glm::vec4 col, float width) {
+    SwitchPrim(RE_PRIM_POINT);
+    if (myPoints.size() >= BatchCapacity)
+        Flush();
+    myPoints.push_back( InputPoint{ pos, col, width } );
+    myFlush = true;
+}
+
+void RendererSoft::DrawLine(glm::vec3 p1, glm::vec3 p2, glm::vec4 col, float width) {
+    SwitchPrim(RE_PRIM_LINE);
+    if (myLines.size() >= BatchCapacity)
+        Flush();
+    myLines.push_back( InputLine{ {p1, p2}, col, width } );
+    myFlush = true;
+}
+
+void RendererSoft::DrawLineStrip(const glm::vec3* pos, int32 count, glm::vec4 col, float width) {
+    if (count <= 1) {
+        LogWarn("Cannot draw LineStrip with count: %d", count);
+        return;
+    }
+    for (int32 i = 1; i < count; i++)
+        DrawLine(pos[i-1], pos[i], col, width);
+}
+
+void RendererSoft::DrawLineLoop(const glm::vec3* pos, int32 count, glm::vec4 col, float width) {
+    if (count <= 1) {
+        LogWarn("Cannot draw LineLoop with count: %d", count);
+        return;
+    }
+    DrawLineStrip(pos, count, col, width);
+    DrawLine(pos[count-1], pos[0], col, width);
+}
+
+void RendererSoft::DrawTriangle(glm::vec3 pos1, glm::vec3 pos2, glm::vec3 pos3, glm::vec4 col) {
+    SwitchPrim(RE_PRIM_TRI);
+    SwitchTriCol(col);
+    SwitchTriOffset(glm::vec3(0.0f));
+    glm::vec3 normal = CalculateNormal(pos1, pos2, pos3);
+    PushTri(pos1, pos2, pos3, normal, normal, normal);
+}
+
+void RendererSoft::DrawTriangleStrip(const glm::vec3* pos, int32 count, glm::vec4 col, bool bFlipNormal) {
+    if (count <= 2) {
+        LogWarn("Cannot draw Triangle Strip with count: %d", count);
+        return;
+    }
+    SwitchPrim(RE_PRIM_TRI);
+    SwitchTriCol(col);
+    SwitchTriOffset(glm::vec3(0.0f));
+
+    if (myNormalScratch.size() < (uint64)count)
+        myNormalScratch.resize(count);
+    glm::vec3* pNormals = myNormalScratch.data();
+    CalculateStripNormals(pos, count, bFlipNormal, pNormals);
+
+    for (int32 i = 2; i < count; i++) {
+        PushTri(pos[i-2], pos[i-1], pos[i], pNormals[i-2], pNormals[i-1], pNormals[i]);
+    }
+}
+
+void RendererSoft::DrawTriangleFanPrivate(glm::vec3 posBase, const glm::vec3* pos, int32 count, glm::vec4 col) {
+    if (count <= 1) {
+        LogWarn("Cannot draw Triangle Fan with count: %d", count);
+        return;
+    }
+    SwitchPrim(RE_PRIM_TRI);
+    SwitchTriCol(col);
+    SwitchTriOffset(glm::vec3(0.0f));
+
+    //Same as RendererBatch, every vertex gets the normal of the first triangle
+    glm::vec3 normal = CalculateNormal(posBase, pos[0], pos[1]);
+    for (int32 i = 1; i < count; i++) {
+        PushTri(posBase, pos[i-1], pos[i], normal, normal, normal);
+    }
+}
+
+void RendererSoft::DrawGrid(const GridSettings& settings) {
+    SwitchPrim(RE_PRIM_GRID);
+    myGrid = settings;
+
+    const float e = settings.Extent;
+    const glm::vec3 n = glm::vec3(0.0f, 0.0f, 1.0f);
+    myTris.push_back( InputTri{ { glm::vec3(-e, -e, 0.0f), glm::vec3(+e, -e, 0.0f), glm::vec3(-e, +e, 0.0f) }, {n, n, n} } );
+    myTris.push_back( InputTri{ { glm::vec3(-e, +e, 0.0f), glm::vec3(+e, -e, 0.0f), glm::vec3(+e, +e, 0.0f) }, {n, n, n} } );
+    myFlush = true;
+
+    //The grid settings are not batched, so draw it right away
+    Flush();
+}
+
+void RendererSoft::Submit(const CommandList& list) {
+    const uint32* pIndices = list.Indices().data();
+    for (const CommandSegment& seg : list.Segments()) {
+        PushDepthState(seg.Depth);
+        PushPolygonState(seg.Polygon);
+
+        const uint32* pIndex = pIndices + seg.IndexStart;
+        switch (seg.Prim) {
+            case CMD_PRIM_POINT:
+            {
+                const VertexPoint* pv = list.Points().data() + seg.VertexStart;
+                for (uint32 i = 0; i < seg.VertexCount; i++)
+                    DrawPoint(pv[i].Pos, pv[i].Col, pv[i].Width);
+                break;
+            }
+            case CMD_PRIM_LINE:
+            {
+                const VertexLine* pv = list.Lines().data() + seg.VertexStart;
+                for (uint32 i = 0; i + 1 < seg.IndexCount; i += 2) {
+                    const VertexLine& a = pv[pIndex[i]];
+                    const VertexLine& b = pv[pIndex[i+1]];
+                    DrawLine(a.Pos, b.Pos, a.Col, a.Width);
+                }
+                break;
+            }
+            case CMD_PRIM_TRI:
+            {
+                SwitchPrim(RE_PRIM_TRI);
+                SwitchTriCol(seg.Col);
+                SwitchTriOffset(seg.Offset);
+                const VertexTri* pv = list.Tris().data() + seg.VertexStart;
+                for (uint32 i = 0; i + 2 < seg.IndexCount; i += 3) {
+                    const VertexTri& a = pv[pIndex[i]];
+                    const VertexTri& b = pv[pIndex[i+1]];
+                    const VertexTri& c = pv[pIndex[i+2]];
+                    PushTri(a.Pos, b.Pos, c.Pos, OctUnpackSnorm16(a.Normal), OctUnpackSnorm16(b.Normal), OctUnpackSnorm16(c.Normal));
+                }
+                break;
+            }
+        }
+
+        PopPolygonState();
+        PopDepthState();
+    }
+}
+
+//-----------------------------------------------------
+//               Setup
+//-----------------------------------------------------
+
+//Signed distance to the 6 clip planes. Inside when >= 0
+static inline float ClipDistance(const glm::vec4& p, int32 plane) {
+    switch (plane) {
+        case 0: return p.w + p.x;
+        case 1: return p.w - p.x;
+        case 2: return p.w + p.y;
+        case 3: return p.w - p.y;
+        case 4: return p.w + p.z;
+        default: return p.w - p.z;
+    }
+}
+
+glm::vec4 RendererSoft::ToScreen(glm::vec4 clip) const {
+    const float invW = 1.0f / clip.w;
+    glm::vec3 ndc = glm::vec3(clip) * invW;
+
+    //Snap to 1/16th of a pixel. Together with the edge function setup this makes shared edges watertight
+    float x = (ndc.x * 0.5f + 0.5f) * myWidth;
+    float y = (ndc.y * 0.5f + 0.5f) * myHeight;
+    x = glm::round(x * 16.0f) / 16.0f;
+    y = glm::round(y * 16.0f) / 16.0f;
+    return glm::vec4(x, y, ndc.z * 0.5f + 0.5f, invW);
+}
+
+glm::vec4 RendererSoft::Light(glm::vec3 normal, glm::vec4 col) const {
+    //Same as DirectionLight in Assets/Shaders/tri.prog
+    glm::vec3 n = glm::normalize(normal);
+    float diff = glm::max(glm::dot(n, glm::normalize(-LightDir)), 0.0f);
+    glm::vec3 c = (LightAmbient + diff) * LightCol;
+    return glm::vec4(c, 1.0f) * col;
+}
+
+void RendererSoft::SetupScreenTri(const glm::vec4* s, const glm::vec3* normals, glm::vec4 col, Shading shade, std::vector<SetupTri>& out) const {
+    SetupTri t;
+
+    //Edge i is opposite of vertex i, so it is 0 on the other two vertices and equals the (doubled) area on vertex i
+    for (int32 i = 0; i < 3; i++) {
+        const glm::vec4& a = s[(i+1) % 3];
+        const glm::vec4& b = s[(i+2) % 3];
+        t.Edge[i] = glm::vec3( a.y - b.y, b.x - a.x, a.x*b.y - a.y*b.x );
+    }
+
+    float area = t.Edge[0].x * s[0].x + t.Edge[0].y * s[0].y + t.Edge[0].z;
+    if (area == 0.0f || !std::isfinite(area))
+        return;
+
+    //There is no face culling (same as the gl renderer), so both windings are rasterized
+    if (area < 0.0f) {
+        for (int32 i = 0; i < 3; i++)
+            t.Edge[i] = -t.Edge[i];
+        area = -area;
+    }
+
+    //Top left rule. A shared edge has negated coefficients in the two triangles, so exactly one of them owns it
+    for (int32 i = 0; i < 3; i++)
+        t.TopLeft[i] = t.Edge[i].x > 0.0f || (t.Edge[i].x == 0.0f && t.Edge[i].y < 0.0f);
+
+    const float invArea = 1.0f / area;
+    auto plane = [&t, invArea](float v0, float v1, float v2) {
+        return (t.Edge[0]*v0 + t.Edge[1]*v1 + t.Edge[2]*v2) * invArea;
+    };
+
+    t.Depth = plane(s[0].z, s[1].z, s[2].z);
+    t.InvW = plane(s[0].w, s[1].w, s[2].w);
+    if (normals) {
+        for (int32 k = 0; k < 3; k++)
+            t.Normal[k] = plane(normals[0][k] * s[0].w, normals[1][k] * s[1].w, normals[2][k] * s[2].w);
+    }
+    t.Col = col;
+    t.Shade = shade;
+
+    //Pixel centers are at +0.5
+    float minX = glm::min(s[0].x, glm::min(s[1].x, s[2].x));
+    float maxX = glm::max(s[0].x, glm::max(s[1].x, s[2].x));
+    float minY = glm::min(s[0].y, glm::min(s[1].y, s[2].y));
+    float maxY = glm::max(s[0].y, glm::max(s[1].y, s[2].y));
+    t.MinX = Max( (int32)glm::ceil(minX - 0.5f), 0 );
+    t.MaxX = Min( (int32)glm::floor(maxX - 0.5f), myWidth - 1 );
+    t.MinY = Max( (int32)glm::ceil(minY - 0.5f), 0 );
+    t.MaxY = Min( (int32)glm::floor(maxY - 0.5f), myHeight - 1 );
+    if (t.MinX > t.MaxX || t.MinY > t.MaxY)
+        return;
+
+    out.push_back(t);
+}
+
+void RendererSoft::SetupTriangle(const InputTri& tri, std::vector<SetupTri>& out) const {
+    const bool bGrid = (myPrim == RE_PRIM_GRID);
+
+    ClipVertex v[3];
+    //The offset is a uniform in RendererBatch, so it is applied here and not when the triangle is pushed
+    const glm::vec3 offset = bGrid ? glm::vec3(0.0f) : myTriOffset;
+    for (int32 i = 0; i < 3; i++) {
+        v[i].Pos = myVP * glm::vec4(tri.Pos[i] + offset, 1.0f);
+        v[i].Normal = tri.Normal[i];
+    }
+
+    //Polygon mode only changes how the triangle is rasterized, the lighting stays per face like it does in gl
+    if (!bGrid && myPolygonMode != RE_POLYGON_FILL) {
+        glm::vec4 col = Light(tri.Normal[0] + tri.Normal[1] + tri.Normal[2], myTriCol);
+        for (int32 i = 0; i < 3; i++) {
+            if (myPolygonMode == RE_POLYGON_LINE)
+                SetupLine(v[i].Pos, v[(i+1) % 3].Pos, col, 1.0f, out);
+            else
+                SetupPoint(v[i].Pos, col, 1.0f, out);
+        }
+        return;
+    }
+
+    //Sutherland-Hodgman against all 6 planes. Triangles that are completely inside skip all of it
+    constexpr int32 maxVertices = 9;
+    ClipVertex polyA[maxVertices], polyB[maxVertices];
+    ClipVertex* poly = polyA;
+    ClipVertex* next = polyB;
+    int32 count = 3;
+    for (int32 i = 0; i < 3; i++)
+        poly[i] = v[i];
+
+    for (int32 plane = 0; plane < 6 && count > 0; plane++) {
+        bool bAllInside = true;
+        for (int32 i = 0; i < count; i++)
+            bAllInside &= ClipDistance(poly[i].Pos, plane) >= 0.0f;
+        if (bAllInside)
+            continue;
+
+        int32 nextCount = 0;
+        for (int32 i = 0; i < count; i++) {
+            const ClipVertex& a = poly[i];
+            const ClipVertex& b = poly[(i+1) % count];
+            float da = ClipDistance(a.Pos, plane);
+            float db = ClipDistance(b.Pos, plane);
+
+            if (da >= 0.0f)
+                next[nextCount++] = a;
+            if ((da >= 0.0f) != (db >= 0.0f)) {
+                float t = da / (da - db);
+                next[nextCount].Pos = glm::mix(a.Pos, b.Pos, t);
+                next[nextCount].Normal = glm::mix(a.Normal, b.Normal, t);
+                nextCount++;
+            }
+            Assert(nextCount <= maxVertices);
+        }
+        std::swap(poly, next);
+        count = nextCount;
+    }
+    if (count < 3)
+        return;
+
+    glm::vec4 screen[maxVertices];
+    glm::vec3 normals[maxVertices];
+    for (int32 i = 0; i < count; i++) {
+        screen[i] = ToScreen(poly[i].Pos);
+        normals[i] = poly[i].Normal;
+    }
+
+    const Shading shade = bGrid ? SHADE_GRID : SHADE_LIT;
+    for (int32 i = 2; i < count; i++) {
+        glm::vec4 s[3] = { screen[0], screen[i-1], screen[i] };
+        glm::vec3 n[3] = { normals[0], normals[i-1], normals[i] };
+        SetupScreenTri(s, n, myTriCol, shade, out);
+    }
+}
+
+void RendererSoft::SetupLine(glm::vec4 c0, glm::vec4 c1, glm::vec4 col, float width, std::vector<SetupTri>& out) const {
+    //Parametric clip against the 6 planes
+    float t0 = 0.0f, t1 = 1.0f;
+    for (int32 plane = 0; plane < 6; plane++) {
+        float d0 = ClipDistance(c0, plane);
+        float d1 = ClipDistance(c1, plane);
+        if (d0 < 0.0f && d1 < 0.0f)
+            return;
+        if (d0 < 0.0f)
+            t0 = glm::max(t0, d0 / (d0 - d1));
+        else if (d1 < 0.0f)
+            t1 = glm::min(t1, d0 / (d0 - d1));
+    }
+    if (t0 > t1)
+        return;
+
+    glm::vec4 s0 = ToScreen(glm::mix(c0, c1, t0));
+    glm::vec4 s1 = ToScreen(glm::mix(c0, c1, t1));
+
+    //Expand into a quad which is width pixels wide, like the geometry shader in line.prog would
+    glm::vec2 dir = glm::vec2(s1) - glm::vec2(s0);
+    float len = glm::length(dir);
+    if (len < 1e-6f)
+        return;
+    glm::vec2 n = glm::vec2(-dir.y, dir.x) / len * (0.5f * glm::max(width, 1.0f));
+    glm::vec4 off = glm::vec4(n, 0.0f, 0.0f);
+
+    glm::vec4 q0 = s0 + off, q1 = s0 - off, q2 = s1 + off, q3 = s1 - off;
+    glm::vec4 triA[3] = { q0, q1, q2 };
+    glm::vec4 triB[3] = { q2, q1, q3 };
+    SetupScreenTri(triA, nullptr, col, SHADE_FLAT, out);
+    SetupScreenTri(triB, nullptr, col, SHADE_FLAT, out);
+}
+
+void RendererSoft::SetupPoint(glm::vec4 c, glm::vec4 col, float width, std::vector<SetupTri>& out) const {
+    //Points are culled when the center is outside, same as gl
+    for (int32 plane = 0; plane < 6; plane++) {
+        if (ClipDistance(c, plane) < 0.0f)
+            return;
+    }
+
+    glm::vec4 s = ToScreen(c);
+    float h = 0.5f * glm::max(width, 1.0f);
+    glm::vec4 q0 = s + glm::vec4(-h, -h, 0, 0);
+    glm::vec4 q1 = s + glm::vec4(+h, -h, 0, 0);
+    glm::vec4 q2 = s + glm::vec4(-h, +h, 0, 0);
+    glm::vec4 q3 = s + glm::vec4(+h, +h, 0, 0);
+    glm::vec4 triA[3] = { q0, q1, q2 };
+    glm::vec4 triB[3] = { q2, q1, q3 };
+    SetupScreenTri(triA, nullptr, col, SHADE_FLAT, out);
+    SetupScreenTri(triB, nullptr, col, SHADE_FLAT, out);
+}
+
+//-----------------------------------------------------
+//               Flush
+//-----------------------------------------------------
+
+void RendererSoft::DoFlush() {
+    if (myPrim == RE_PRIM_NONE)
+        return;
+
+    PROFILE_ZONE("DoFlush");
+    Assert(myCam && "Init was not called");
+
+    myVP = myCam->VP();
+    myVPInv = myCam->VPInv();
+    //The grid is depth tested but never writes depth, same as RendererBatch::DrawGrid
+    myDepthWrite = (myPrim != RE_PRIM_GRID);
+
+    int32 inputCount = 0;
+    switch (myPrim) {
+        case RE_PRIM_TRI:
+        case RE_PRIM_GRID:  inputCount = (int32)myTris.size();     break;
+        case RE_PRIM_LINE:  inputCount = (int32)myLines.size();    break;
+        case RE_PRIM_POINT: inputCount = (int32)myPoints.size();   break;
+        default: break;
+    }
+    if (inputCount == 0)
+        return;
+
+    //Transform, clip and set up every primitive. Each chunk writes its own list so the order stays deterministic
+    const int32 chunkCount = (inputCount + SetupChunkSize - 1) / SetupChunkSize;
+    std::vector<std::vector<SetupTri>> chunks(chunkCount);
+    auto setupChunk = [&](int32 c) {
+        std::vector<SetupTri>& out = chunks[c];
+        const int32 start = c * SetupChunkSize;
+        const int32 end = Min(start + SetupChunkSize, inputCount);
+        for (int32 i = start; i < end; i++) {
+            switch (myPrim) {
+                case RE_PRIM_TRI:
+                case RE_PRIM_GRID:
+                    SetupTriangle(myTris[i], out);
+                    break;
+                case RE_PRIM_LINE:
+                {
+                    const InputLine& l = myLines[i];
+                    SetupLine(myVP * glm::vec4(l.Pos[0], 1.0f), myVP * glm::vec4(l.Pos[1], 1.0f), l.Col, l.Width, out);
+                    break;
+                }
+                case RE_PRIM_POINT:
+                {
+                    const InputPoint& p = myPoints[i];
+                    SetupPoint(myVP * glm::vec4(p.Pos, 1.0f), p.Col, p.Width, out);
+                    break;
+                }
+                default: break;
+            }
+        }
+    };
+    if (myThreaded)
+        ThreadPool::Global().ParallelFor(chunkCount, setupChunk);
+    else {
+        for (int32 c = 0; c < chunkCount; c++)
+            setupChunk(c);
+    }
+
+    //Bin into tiles
+    mySetup.clear();
+    for (std::vector<uint32>& bin : myBins)
+        bin.clear();
+
+    for (std::vector<SetupTri>& chunk : chunks) {
+        for (const SetupTri& t : chunk) {
+            const uint32 index = (uint32)mySetup.size();
+            mySetup.push_back(t);
+            for (int32 ty = t.MinY / TileSize; ty <= t.MaxY / TileSize; ty++) {
+                for (int32 tx = t.MinX / TileSize; tx <= t.MaxX / TileSize; tx++) {
+                    myBins[ty * myTilesX + tx].push_back(index);
+                }
+            }
+        }
+    }
+
+    //Rasterize. Tiles never share pixels, so they need no synchronisation
+    std::vector<int32> activeTiles;
+    for (int32 i = 0; i < (int32)myBins.size(); i++) {
+        if (!myBins[i].empty())
+            activeTiles.push_back(i);
+    }
+    if (myThreaded)
+        ThreadPool::Global().ParallelFor((int32)activeTiles.size(), [&](int32 i) { RasterTile(activeTiles[i]); });
+    else {
+        for (int32 tile : activeTiles)
+            RasterTile(tile);
+    }
+
+    //Metrics
+    myMetFlushes++;
+    myMetTrisIn += inputCount;
+    myMetTrisSetup += mySetup.size();
+    myMetTilesRastered += activeTiles.size();
+
+    myTris.clear();
+    myLines.clear();
+    myPoints.clear();
+}
+
+//-----------------------------------------------------
+//               Raster
+//-----------------------------------------------------
+
+static inline bool DepthPass(DepthState func, float z, float d) {
+    switch (func) {
+        case RE_DEPTH_NEVER:    return false;
+        case RE_DEPTH_LESS:     return z < d;
+        case RE_DEPTH_EQUAL:    return z == d;
+        case RE_DEPTH_LEQUAL:   return z <= d;
+        case RE_DEPTH_GREATER:  return z > d;
+        case RE_DEPTH_NOTEQUAL: return z != d;
+        case RE_DEPTH_GEQUAL:   return z >= d;
+        default:                return true;
+    }
+}
+
+static inline bool EdgeInside(float e, bool bTopLeft) {
+    return e > 0.0f || (e == 0.0f && bTopLeft);
+}
+
+void RendererSoft::RasterTile(int32 tile) {
+    PROFILE_ZONE("Raster");
+    const int32 tx = tile % myTilesX;
+    const int32 ty = tile / myTilesX;
+    const int32 rx0 = tx * TileSize;
+    const int32 ry0 = ty * TileSize;
+    const int32 rx1 = Min(rx0 + TileSize, myWidth) - 1;
+    const int32 ry1 = Min(ry0 + TileSize, myHeight) - 1;
+
+    for (uint32 index : myBins[tile]) {
+        const SetupTri& t = mySetup[index];
+        const int32 x0 = Max(t.MinX, rx0);
+        const int32 y0 = Max(t.MinY, ry0);
+        const int32 x1 = Min(t.MaxX, rx1);
+        const int32 y1 = Min(t.MaxY, ry1);
+        if (x0 > x1 || y0 > y1)
+            continue;
+
+        if (mySimd)
+            RasterTriSimd(t, x0, y0, x1, y1);
+        else
+            RasterTriScalar(t, x0, y0, x1, y1);
+    }
+}
+
+void RendererSoft::RasterTriScalar(const SetupTri& t, int32 x0, int32 y0, int32 x1, int32 y1) {
+    //Keep the operations in the same order as RasterTriSimd so that both produce the same result
+    for (int32 y = y0; y <= y1; y++) {
+        const float py = (float)y + 0.5f;
+        float row[3];
+        for (int32 i = 0; i < 3; i++)
+            row[i] = t.Edge[i].y * py + t.Edge[i].z;
+        const float rowZ = t.Depth.y * py + t.Depth.z;
+
+        for (int32 x = x0; x <= x1; x++) {
+            const float px = (float)x + 0.5f;
+            if (!EdgeInside(t.Edge[0].x * px + row[0], t.TopLeft[0]) ||
+                !EdgeInside(t.Edge[1].x * px + row[1], t.TopLeft[1]) ||
+                !EdgeInside(t.Edge[2].x * px + row[2], t.TopLeft[2]))
+                continue;
+
+            const float z = t.Depth.x * px + rowZ;
+            if (!DepthPass(myDepthFunc, z, myDepth[y*myWidth + x]))
+                continue;
+
+            WritePixel(t, x, y, px, py, z);
+        }
+    }
+}
+
+#if RE_SOFT_SSE
+static inline __m128 DepthPass4(DepthState func, __m128 z, __m128 d) {
+    switch (func) {
+        case RE_DEPTH_NEVER:    return _mm_setzero_ps();
+        case RE_DEPTH_LESS:     return _mm_cmplt_ps(z, d);
+        case RE_DEPTH_EQUAL:    return _mm_cmpeq_ps(z, d);
+        case RE_DEPTH_LEQUAL:   return _mm_cmple_ps(z, d);
+        case RE_DEPTH_GREATER:  return _mm_cmpgt_ps(z, d);
+        case RE_DEPTH_NOTEQUAL: return _mm_cmpneq_ps(z, d);
+        case RE_DEPTH_GEQUAL:   return _mm_cmpge_ps(z, d);
+        default:                return _mm_castsi128_ps(_mm_set1_epi32(-1));
+    }
+}
+
+void RendererSoft::RasterTriSimd(const SetupTri& t, int32 x0, int32 y0, int32 x1, int32 y1) {
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 laneOffset = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    const __m128 laneIndex = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+
+    __m128 edgeX[3], topLeft[3];
+    for (int32 i = 0; i < 3; i++) {
+        edgeX[i] = _mm_set1_ps(t.Edge[i].x);
+        topLeft[i] = t.TopLeft[i] ? _mm_castsi128_ps(_mm_set1_epi32(-1)) : zero;
+    }
+    const __m128 depthX = _mm_set1_ps(t.Depth.x);
+
+    for (int32 y = y0; y <= y1; y++) {
+        const float py = (float)y + 0.5f;
+        __m128 row[3];
+        for (int32 i = 0; i < 3; i++)
+            row[i] = _mm_set1_ps(t.Edge[i].y * py + t.Edge[i].z);
+        const __m128 rowZ = _mm_set1_ps(t.Depth.y * py + t.Depth.z);
+        const float* pDepth = &myDepth[y*myWidth];
+
+        //4 pixels at a time. The depth buffer is padded so the last load of the last row stays in bounds
+        for (int32 x = x0; x <= x1; x += 4) {
+            const __m128 px = _mm_add_ps(_mm_set1_ps((float)x), laneOffset);
+            __m128 mask = _mm_cmplt_ps(laneIndex, _mm_set1_ps((float)(x1 - x + 1)));
+
+            for (int32 i = 0; i < 3; i++) {
+                __m128 e = _mm_add_ps(_mm_mul_ps(edgeX[i], px), row[i]);
+                __m128 inside = _mm_or_ps(_mm_cmpgt_ps(e, zero), _mm_and_ps(_mm_cmpeq_ps(e, zero), topLeft[i]));
+                mask = _mm_and_ps(mask, inside);
+            }
+            int32 bits = _mm_movemask_ps(mask);
+            if (!bits)
+                continue;
+
+            const __m128 z = _mm_add_ps(_mm_mul_ps(depthX, px), rowZ);
+            bits &= _mm_movemask_ps(DepthPass4(myDepthFunc, z, _mm_loadu_ps(pDepth + x)));
+            if (!bits)
+                continue;
+
+            alignas(16) float zs[4];
+            _mm_store_ps(zs, z);
+            for (int32 lane = 0; lane < 4; lane++) {
+                if (bits & (1 << lane))
+                    WritePixel(t, x + lane, y, (float)(x + lane) + 0.5f, py, zs[lane]);
+            }
+        }
+    }
+}
+#else
+void RendererSoft::RasterTriSimd(const SetupTri& t, int32 x0, int32 y0, int32 x1, int32 y1) {
+    RasterTriScalar(t, x0, y0, x1, y1);
+}
+#endif
+
+bool RendererSoft::ShadeGrid(float px, float py, glm::vec4& outCol) const {
+    //Intersect the pixel ray with the z = 0 plane, which is what frag_pos is in grid.prog
+    auto groundPoint = [this](float x, float y, glm::vec2& out) {
+        glm::vec2 ndc = glm::vec2(x / myWidth * 2.0f - 1.0f, y / myHeight * 2.0f - 1.0f);
+        glm::vec4 n = myVPInv * glm::vec4(ndc, -1.0f, 1.0f);
+        glm::vec4 f = myVPInv * glm::vec4(ndc, +1.0f, 1.0f);
+        glm::vec3 a = glm::vec3(n) / n.w;
+        glm::vec3 b = glm::vec3(f) / f.w;
+        float dz = b.z - a.z;
+        if (glm::abs(dz) < 1e-12f)
+            return false;
+        float t = -a.z / dz;
+        out = glm::vec2(a + (b - a) * t);
+        return true;
+    };
+
+    glm::vec2 pos, posX, posY;
+    if (!groundPoint(px, py, pos) || !groundPoint(px + 1.0f, py, posX) || !groundPoint(px, py + 1.0f, posY))
+        return false;
+
+    //fwidth(p) = abs(dFdx(p)) + abs(dFdy(p))
+    glm::vec2 fw = glm::abs(posX - pos) + glm::abs(posY - pos);
+    outCol = Grid::Shade(myGrid, pos, fw);
+    return outCol.a > 0.0f;
+}
+
+inline void RendererSoft::WritePixel(const SetupTri& t, int32 x, int32 y, float px, float py, float z) {
+    glm::vec4 src;
+    switch (t.Shade) {
+        case SHADE_FLAT:
+            src = t.Col;
+            break;
+        case SHADE_LIT:
+        {
+            const float invW = t.InvW.x * px + t.InvW.y * py + t.InvW.z;
+            glm::vec3 n;
+            for (int32 k = 0; k < 3; k++)
+                n[k] = t.Normal[k].x * px + t.Normal[k].y * py + t.Normal[k].z;
+            src = Light(n / invW, t.Col);
+            break;
+        }
+        case SHADE_GRID:
+            if (!ShadeGrid(px, py, src))
+                return;
+            break;
+    }
+
+    //Same as glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA) into a unorm target
+    src = glm::clamp(src, 0.0f, 1.0f);
+    glm::vec4& dst = myColor[y*myWidth + x];
+    dst = src * src.a + dst * (1.0f - src.a);
+
+    if (myDepthWrite)
+        myDepth[y*myWidth + x] = z;
+}
+
+//-----------------------------------------------------
+//               Tests
+//-----------------------------------------------------
+
+//Number of pixels where any colour channel differs by more than tolerance. Both images are RGBA8
+static int32 CountDiffPixels(const uint8* a, const uint8* b, int32 pixelCount, int32 tolerance) {
+    int32 count = 0;
+    for (int32 i = 0; i < pixelCount; i++) {
+        for (int32 c = 0; c < 3; c++) {
+            if (glm::abs((int32)a[4*i + c] - (int32)b[4*i + c]) > tolerance) {
+                count++;
+                break;
+            }
+        }
+    }
+    return count;
+}
+
+static glm::vec4 PixelAt(const RendererSoft& r, int32 x, int32 y) {
+    const uint8* p = r.Pixels() + 4 * (y * r.Width() + x);
+    return glm::vec4(p[0], p[1], p[2], p[3]) / 255.0f;
+}
+
+bool RendererSoft::RunTest_Depth() {
+    bool bSuccess = true;
+    const int32 size = 64;
+    Camera cam(glm::vec3(0, 0, 5), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0), 45.0f, 1.0f, 0.1f, 100.0f);
+
+    const glm::vec4 red = glm::vec4(1, 0, 0, 1);
+    const glm::vec4 green = glm::vec4(0, 1, 0, 1);
+    auto drawQuad = [](Renderer& r, float z, glm::vec4 col) {
+        glm::vec3 pos[4] = { {-1, -1, z}, {+1, -1, z}, {-1, +1, z}, {+1, +1, z} };
+        r.DrawTriangleStrip(pos, 4, col);
+    };
+
+    struct TestCase { DepthState Depth; bool bNearFirst; bool bExpectGreen; const char* Name; };
+    TestCase tests[] = {
+        { RE_DEPTH_LESS,   true,  true,  "less, near first" },
+        { RE_DEPTH_LESS,   false, true,  "less, far first" },
+        { RE_DEPTH_ALWAYS, true,  false, "always, near first" },
+        { RE_DEPTH_ALWAYS, false, true,  "always, far first" },
+    };
+
+    for (const TestCase& test : tests) {
+        RendererSoft r(size, size);
+        r.SetClearColor(glm::vec4(0, 0, 0, 1));
+        r.Init(&cam);
+        r.StartFrame();
+        r.PushDepthState(test.Depth);
+        //Green is nearer to the camera
+        if (test.bNearFirst) {
+            drawQuad(r, 0.5f, green);
+            drawQuad(r, 0.0f, red);
+        }
+        else {
+            drawQuad(r, 0.0f, red);
+            drawQuad(r, 0.5f, green);
+        }
+        r.PopDepthState();
+        r.EndFrame();
+
+        glm::vec4 c = PixelAt(r, size/2, size/2);
+        bool bGreen = c.g > c.r;
+        if (bGreen != test.bExpectGreen) {
+            LogError("RendererSoft depth test failed (%s). Centre pixel: %.2f, %.2f, %.2f", test.Name, c.r, c.g, c.b);
+            bSuccess = false;
+        }
+    }
+
+    //Wireframe leaves the inside of the quad empty, and the state is restored on pop
+    {
+        RendererSoft r(size, size);
+        r.SetClearColor(glm::vec4(0, 0, 0, 1));
+        r.Init(&cam);
+        r.StartFrame();
+        r.PushDepthState(RE_DEPTH_LESS);
+        r.PushPolygonState(RE_POLYGON_LINE);
+        drawQuad(r, 0.0f, red);
+        r.PopPolygonState();
+        drawQuad(r, -1.0f, green);  //Behind, only visible where the wireframe did not write depth
+        r.PopDepthState();
+        r.EndFrame();
+
+        glm::vec4 c = PixelAt(r, size/2 - 5, size/2 + 3);
+        if (!(c.g > 0.0f && c.r == 0.0f)) {
+            LogError("RendererSoft polygon state test failed. Pixel: %.2f, %.2f, %.2f", c.r, c.g, c.b);
+            bSuccess = false;
+        }
+    }
+
+    //Two triangles sharing an edge must not blend twice along it
+    {
+        RendererSoft r(size, size);
+        r.SetClearColor(glm::vec4(0, 0, 0, 1));
+        r.Init(&cam);
+        r.StartFrame();
+        r.PushDepthState(RE_DEPTH_ALWAYS);
+        r.DrawTriangle(glm::vec3(-2, -2, 0), glm::vec3(2, -2, 0), glm::vec3(-2, 2, 0), glm::vec4(1, 1, 1, 0.5f));
+        r.DrawTriangle(glm::vec3(-2, 2, 0), glm::vec3(2, -2, 0), glm::vec3(2, 2, 0), glm::vec4(1, 1, 1, 0.5f));
+        r.PopDepthState();
+        r.EndFrame();
+
+        //The quad covers everything but the outer couple of pixels
+        const uint8* ref = r.Pixels() + 4 * (4 * size + 4);
+        int32 bad = (ref[0] == 0) ? 1 : 0;
+        for (int32 y = 4; y < size - 4; y++) {
+            for (int32 x = 4; x < size - 4; x++)
+                bad += (memcmp(r.Pixels() + 4 * (y * size + x), ref, 3) != 0) ? 1 : 0;
+        }
+        if (bad) {
+            LogError("RendererSoft shared edge test failed. %d pixels differ", bad);
+            bSuccess = false;
+        }
+    }
+
+    return bSuccess;
+}
+
+//The scene used by the golden image test
+static void DrawTestScene(Renderer& r, bool bUseCommandList) {
+    GridSettings grid;
+    grid.Extent = 10.0f;
+    r.PushDepthState(RE_DEPTH_LESS);
+    r.DrawGrid(grid);
+
+    CommandList list;
+    auto draw = [&](auto fn) {
+        if (bUseCommandList)
+            fn(list);
+        else
+            fn(r);
+    };
+
+    //A small surface made from strips, the same way Grapher3D meshes it
+    draw([](auto& target) {
+        std::vector<glm::vec3> strip;
+        for (float y = -3.0f; y < 3.0f; y += 0.5f) {
+            strip.clear();
+            for (float x = -3.0f; x <= 3.0f + 0.001f; x += 0.5f) {
+                strip.emplace_back(x, y, glm::sin(x) * glm::cos(y));
+                strip.emplace_back(x, y + 0.5f, glm::sin(x) * glm::cos(y + 0.5f));
+            }
+            target.DrawTriangleStrip(strip.data(), (int32)strip.size(), glm::vec4(0.75, 0.75, 0.75, 1.0));
+        }
+    });
+
+    draw([](auto& target) {
+        glm::vec3 loop[4] = { {-4, -4, 1}, {4, -4, 1}, {4, 4, 1}, {-4, 4, 1} };
+        target.DrawLineLoop(loop, 4, glm::vec4(1.0, 0.6, 0.1, 1.0), 2.0f);
+        for (int32 i = 0; i < 8; i++)
+            target.DrawPoint(glm::vec3(-3.5f + i, 3.5f, 2.0f), glm::vec4(0.2, 0.4, 1.0, 1.0), 4.0f);
+
+        target.PushPolygonState(RE_POLYGON_LINE);
+        target.DrawTriangle(glm::vec3(4, -2, 0.5f), glm::vec3(6, -2, 0.5f), glm::vec3(5, 0, 2.5f), glm::vec4(0.9, 0.2, 0.9, 1.0));
+        target.PopPolygonState();
+
+        //Translucent triangle on top of everything
+        target.PushDepthState(RE_DEPTH_ALWAYS);
+        target.DrawTriangle(glm::vec3(-6, -6, 0.2f), glm::vec3(-2, -6, 0.2f), glm::vec3(-4, -2, 0.2f), glm::vec4(0.1, 0.9, 0.3, 0.5));
+        target.DrawLine(glm::vec3(0, 0, 0), glm::vec3(0, 0, 5), glm::vec4(0.2, 0.2, 0.8, 1.0), 1.0f);
+        target.PopDepthState();
+    });
+
+    if (bUseCommandList)
+        r.Submit(list);
+    r.PopDepthState();
+}
+
+bool RendererSoft::RunTest_Scene() {
+    bool bSuccess = true;
+    const int32 width = 160, height = 120;
+    const int32 pixelCount = width * height;
+    Camera cam(glm::vec3(-7.0f, -12.0f, 9.0f), glm::vec3(0.42f, 0.72f, -0.55f), glm::vec3(0, 0, 1), 45.0f, (float)width / height, 0.1f, 100.0f);
+
+    auto render = [&](RendererSoft& r, bool bUseCommandList) {
+        r.Init(&cam);
+        r.StartFrame();
+        DrawTestScene(r, bUseCommandList);
+        r.EndFrame();
+    };
+
+    RendererSoft fast(width, height);
+    render(fast, false);
+
+    //The simd path and the threaded path have to match the plain scalar path
+    {
+        RendererSoft slow(width, height);
+        slow.SetSimd(false);
+        slow.SetThreaded(false);
+        render(slow, false);
+
+        int32 diff = CountDiffPixels(fast.Pixels(), slow.Pixels(), pixelCount, 1);
+        if (diff > pixelCount / 1000) {
+            LogError("RendererSoft scene test failed. Scalar and simd paths differ in %d pixels", diff);
+            bSuccess = false;
+        }
+    }
+
+    //Command lists pack the normals, so allow for small lighting differences
+    {
+        RendererSoft listed(width, height);
+        render(listed, true);
+
+        int32 diff = CountDiffPixels(fast.Pixels(), listed.Pixels(), pixelCount, 3);
+        if (diff > pixelCount / 100) {
+            LogError("RendererSoft scene test failed. Command list render differs in %d pixels", diff);
+            bSuccess = false;
+        }
+    }
+
+    //Golden image. A missing golden image is written out instead, so new scenes can be bootstrapped
+    const char* goldenPath = "Assets/Golden/soft_scene.bmp";
+    int32 w = 0, h = 0, ch = 0;
+    uint8* golden = stbi_load(goldenPath, &w, &h, &ch, 4);
+    if (!golden) {
+        LogWarn("Golden image not found, writing: %s", goldenPath);
+        fast.SaveFrame(goldenPath);
+        return bSuccess;
+    }
+
+    if (w != width || h != height) {
+        LogError("RendererSoft golden test failed. Expected %d x %d, golden image is %d x %d", width, height, w, h);
+        bSuccess = false;
+    }
+    else {
+        //stb_image returns the top row first
+        std::vector<uint8> flipped(pixelCount * 4);
+        for (int32 y = 0; y < height; y++)
+            memcpy(&flipped[y * width * 4], golden + (height - 1 - y) * width * 4, width * 4);
+
+        int32 diff = CountDiffPixels(fast.Pixels(), flipped.data(), pixelCount, 4);
+        if (diff > pixelCount / 200) {
+            LogError("RendererSoft golden test failed. %d pixels differ from %s. Writing the result next to it", diff, goldenPath);
+            fast.SaveFrame("Assets/Golden/soft_scene.fail.bmp");
+            bSuccess = false;
+        }
+    }
+    stbi_image_free(golden);
+
+    return bSuccess;
+}
+
+bool RendererSoft::RunAllTests() {
+    bool bSuccess = true;
+    bSuccess &= RunTest_Depth();
+    bSuccess &= RunTest_Scene();
+    return bSuccess;
+}
@@ -0,0 +1,183 @@
+#pragma once
+#include "DebugFinal.h"
+#include "RE_Renderer.h"
+#include "Maths.h"
+
+#include <vector>
+
+//Renderer which rasterizes on the cpu, for machines without a gpu (ci, batch nodes) and for golden image tests.
+//Draws are batched the same way as RendererBatch. Every flush transforms and clips the batch, bins the resulting
+//screen space triangles into tiles, and then rasterizes the tiles in parallel with SSE edge functions.
+//Lines and points are expanded into screen space quads, so they go through the same triangle rasterizer
+class RendererSoft : public Renderer {
+public:
+    static constexpr int32 TileSize = 64;
+
+public:
+    RendererSoft(int32 width, int32 height);
+    ~RendererSoft();
+    RendererSoft(const RendererSoft&) = delete;
+
+    void Init(Camera* cam) override;
+
+    void PrintMetrics() override;
+    void DoFlush() override;
+    void StartFrame() override;
+    void EndFrame() override;
+
+    //Render related
+    void DrawPoint(glm::vec3 pos, glm::vec4 col, float width) override;
+
+    void DrawLine(glm::vec3 p1, glm::vec3 p2, glm::vec4 col, float width) override;
+    void DrawLineLoop(const glm::vec3* pos, int32 count, glm::vec4 col, float width) override;
+    void DrawLineStrip(const glm::vec3* pos, int32 count, glm::vec4 col, float width) override;
+
+    void DrawTriangle(glm::vec3 pos1, glm::vec3 pos2, glm::vec3 pos3, glm::vec4 col) override;
+    void DrawTriangleStrip(const glm::vec3* pos, int32 count, glm::vec4 col, bool bFlipNormal = false) override;
+
+    void DrawGrid(const GridSettings& settings) override;
+
+    void Submit(const CommandList& list) override;
+    void AddCullMetrics(uint64 tilesVisible, uint64 tilesCulled) override;
+
+    void Resize(int32 width, int32 height);
+    void SetClearColor(glm::vec4 col)               { myClearCol = col; }
+
+    //Both paths produce the same image. These only exist so that the tests can compare them
+    void SetSimd(bool bSimd)                        { mySimd = bSimd; }
+    void SetThreaded(bool bThreaded)                { myThreaded = bThreaded; }
+
+    int32 Width() const                             { return myWidth; }
+    int32 Height() const                            { return myHeight; }
+
+    //RGBA8, bottom row first (same layout as glReadPixels). Valid after EndFrame
+    const uint8* Pixels() const                     { return myPixels.data(); }
+    //Window space depth in [0, 1], bottom row first
+    float DepthAt(int32 x, int32 y) const           { Assert(x >= 0 && x < myWidth && y >= 0 && y < myHeight); return myDepth[y*myWidth + x]; }
+
+    //Writes the last frame through CreateBMP
+    void SaveFrame(const char* path) const;
+
+    static bool RunAllTests();    //Returns true when all tests pass
+
+protected:
+    void ApplyDepthState(DepthState s) override;
+    void ApplyPolygonState(PolygonState s) override;
+
+    void DrawTriangleFanPrivate(glm::vec3 posBase, const glm::vec3* pos, int32 count, glm::vec4 col) override;
+
+private:
+    enum Primitive {
+        RE_PRIM_NONE,
+        RE_PRIM_POINT,
+        RE_PRIM_LINE,
+        RE_PRIM_TRI,
+        RE_PRIM_GRID,
+    };
+    enum Shading : uint8 {
+        SHADE_FLAT,
+        SHADE_LIT,
+        SHADE_GRID,
+    };
+
+    //World space input, collected till the next flush
+    struct InputTri {
+        glm::vec3 Pos[3];
+        glm::vec3 Normal[3];
+    };
+    struct InputLine {
+        glm::vec3 Pos[2];
+        glm::vec4 Col;
+        float Width;
+    };
+    struct InputPoint {
+        glm::vec3 Pos;
+        glm::vec4 Col;
+        float Width;
+    };
+
+    //Vertex after the projection, before the perspective divide
+    struct ClipVertex {
+        glm::vec4 Pos;
+        glm::vec3 Normal;
+    };
+
+    //Screen space triangle. Every value is stored as a plane v(x, y) = X*x + Y*y + Z, and the edge functions are
+    //positive inside the triangle
+    struct SetupTri {
+        glm::vec3   Edge[3];
+        bool        TopLeft[3];
+        glm::vec3   Depth;
+        glm::vec3   InvW;
+        glm::vec3   Normal[3];      //Normal * 1/w, for perspective correct interpolation. Only used by SHADE_LIT
+        glm::vec4   Col;
+        int32       MinX, MinY, MaxX, MaxY;
+        Shading     Shade;
+    };
+
+    void SwitchPrim(Primitive p);
+    void SwitchTriCol(glm::vec4 col);
+    void SwitchTriOffset(glm::vec3 offset);
+    void PushTri(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 n0, glm::vec3 n1, glm::vec3 n2);
+
+    //Setup. Each appends the screen space triangles of one input primitive to out
+    void SetupTriangle(const InputTri& tri, std::vector<SetupTri>& out) const;
+    void SetupLine(glm::vec4 c0, glm::vec4 c1, glm::vec4 col, float width, std::vector<SetupTri>& out) const;
+    void SetupPoint(glm::vec4 c, glm::vec4 col, float width, std::vector<SetupTri>& out) const;
+    void SetupScreenTri(const glm::vec4* screen, const glm::vec3* normals, glm::vec4 col, Shading shade, std::vector<SetupTri>& out) const;
+    glm::vec4 ToScreen(glm::vec4 clip) const;
+
+    void RasterTile(int32 tile);
+    void RasterTriScalar(const SetupTri& t, int32 x0, int32 y0, int32 x1, int32 y1);
+    void RasterTriSimd(const SetupTri& t, int32 x0, int32 y0, int32 x1, int32 y1);
+    //Shades and blends a pixel which passed the coverage and depth tests
+    inline void WritePixel(const SetupTri& t, int32 x, int32 y, float px, float py, float z);
+    bool ShadeGrid(float px, float py, glm::vec4& outCol) const;
+
+    glm::vec4 Light(glm::vec3 normal, glm::vec4 col) const;
+
+    static bool RunTest_Depth();
+    static bool RunTest_Scene();
+
+private:
+    int32                       myWidth;
+    int32                       myHeight;
+    int32                       myTilesX;
+    int32                       myTilesY;
+
+    std::vector<glm::vec4>      myColor;
+    std::vector<float>          myDepth;    //Padded so that a 4 wide load at the end of a row never reads past the end
+    std::vector<uint8>          myPixels;
+    glm::vec4                   myClearCol;
+
+    //Current batch
+    Primitive                   myPrim;
+    glm::vec4                   myTriCol;
+    glm::vec3                   myTriOffset;
+    std::vector<InputTri>       myTris;
+    std::vector<InputLine>      myLines;
+    std::vector<InputPoint>     myPoints;
+    std::vector<glm::vec3>      myNormalScratch;
+    GridSettings                myGrid;
+
+    //State of the batch that is being rasterized
+    DepthState                  myDepthFunc;
+    PolygonState                myPolygonMode;
+    bool                        myDepthWrite;
+    glm::mat4                   myVP;
+    glm::mat4                   myVPInv;
+
+    std::vector<SetupTri>               mySetup;
+    std::vector<std::vector<uint32>>    myBins;
+
+    bool                        mySimd;
+    bool                        myThreaded;
+
+    //Metrics
+    uint64                      myMetFlushes;
+    uint64                      myMetTrisIn;
+    uint64                      myMetTrisSetup;
+    uint64                      myMetTilesRastered;
+    uint64                      myMetTilesVisible;
+    uint64                      myMetTilesCulled;
+};
@@ -33,7 +33,6 @@ bool glCheckError_(int line, const char* file) {
 
 void RendererState::Init() {
     myFlush = false;
-    glEnable(GL_DEPTH_TEST);
     PushDepthState(RE_DEPTH_ALWAYS);
 
     PushPolygonState(RE_POLYGON_FILL);
@@ -44,21 +43,8 @@ void RendererState::Init() {
 //-----------------------------------------------------
 
 void RendererState::SetDepthStatePrivate(DepthState s) {
-    GLenum val;
-    switch (s) {
-    default: Assert(false && "Unknown type"); return;
-    case RE_DEPTH_NEVER: val = GL_NEVER;     break;
-    case RE_DEPTH_LESS: val = GL_LESS;      break;
-    case RE_DEPTH_EQUAL: val = GL_EQUAL;     break;
-    case RE_DEPTH_LEQUAL: val = GL_LEQUAL;    break;
-    case RE_DEPTH_GREATER: val = GL_GREATER;   break;
-    case RE_DEPTH_NOTEQUAL: val = GL_NOTEQUAL;  break;
-    case RE_DEPTH_GEQUAL: val = GL_GEQUAL;    break;
-    case RE_DEPTH_ALWAYS: val = GL_ALWAYS;    break;
-    }
-    glDepthFunc(val);
+    ApplyDepthState(s);
     myDepthStateStack.SetTop(s);
-    glCheckError();
 }
 
 void RendererState::SetDepthState(DepthState s) {
@@ -85,16 +71,8 @@ void RendererState::PopDepthState() {
 //-----------------------------------------------------
 
 void RendererState::SetPolygonStatePrivate(PolygonState s) {
-    GLenum val;
-    switch (s) {
-        default                  : Assert(false && "Unknown type"); return;
-        case RE_POLYGON_POINT    : val = GL_POINT;     break;
-        case RE_POLYGON_LINE     : val = GL_LINE;      break;
-        case RE_POLYGON_FILL     : val = GL_FILL;      break;
-    };
-    glPolygonMode( GL_FRONT_AND_BACK, val );
+    ApplyPolygonState(s);
     myPolygonStateStack.SetTop(s);
-    glCheckError();
 }
 
 void RendererState::SetPolygonState(PolygonState s) {
@@ -106,9 +84,9 @@ void RendererState::SetPolygonState(PolygonState s) {
 
 void RendererState::PopPolygonState() {
     PolygonState prev = myPolygonStateStack.Pop();
-    if (!myDepthStateStack.Empty()) {
+    if (!myPolygonStateStack.Empty()) {
         PolygonState cur = myPolygonStateStack.Top();
-        if (prev != cur && cur != RE_DEPTH_INVALID) {
+        if (prev != cur && cur != RE_POLYGON_INVALID) {
             Flush();
             SetPolygonStatePrivate(cur);
         }
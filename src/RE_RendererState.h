@@ -102,11 +102,19 @@ public:
     void SetPolygonState(PolygonState s);
     void PopPolygonState();
 
+    DepthState GetDepthState() const        { return myDepthStateStack.Empty() ? RE_DEPTH_INVALID : myDepthStateStack.Top(); }
+    PolygonState GetPolygonState() const    { return myPolygonStateStack.Empty() ? RE_POLYGON_INVALID : myPolygonStateStack.Top(); }
+
 private:
     void SetDepthStatePrivate(DepthState s);
     void SetPolygonStatePrivate(PolygonState s);
 
 protected:
+    //Called whenever the effective state changes, after everything drawn with the old state was flushed.
+    //This is where a backend applies the state to its api
+    virtual void ApplyDepthState(DepthState s) = 0;
+    virtual void ApplyPolygonState(PolygonState s) = 0;
+
     virtual void DoFlush() = 0;
     inline void Flush() {
         if (myFlush) {
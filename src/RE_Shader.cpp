@@ -67,7 +67,8 @@ void Shader::Unbind() const {
 
 int Shader::GetUniformLocation(const char* name) const {
     int loc;
-    std::unordered_map<std::string, int>::const_iterator it = mapUniforms.find(name);
+    lookupKey.assign(name);
+    std::unordered_map<std::string, int>::const_iterator it = mapUniforms.find(lookupKey);
     if(it == mapUniforms.end()) {
         loc = glGetUniformLocation(m_id, name); 
         if (loc == -1) {
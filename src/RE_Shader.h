@@ -45,5 +45,6 @@ private:
 private:
     unsigned int m_id;
     mutable std::unordered_map<std::string, int> mapUniforms;
+    mutable std::string lookupKey;  //Reused for every lookup, so that names longer than the small string buffer do not allocate
 };
 
@@ -0,0 +1,113 @@
+#include "ThreadPool.h"
+#include "Maths.h"
+#include "Profiler.h"
+#include <atomic>
+#include <memory>
+
+ThreadPool::ThreadPool(int32 threadCount) {
+    if (threadCount <= 0) {
+        threadCount = (int32)std::thread::hardware_concurrency() - 1;
+        if (threadCount < 1)
+            threadCount = 1;
+    }
+
+    myThreads.reserve(threadCount);
+    for (int32 i = 0; i < threadCount; i++) {
+        myThreads.emplace_back(&ThreadPool::WorkerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(myMutex);
+        myStop = true;
+    }
+    myCvJob.notify_all();
+    for (std::thread& t : myThreads) {
+        t.join();
+    }
+}
+
+ThreadPool& ThreadPool::Global() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::Enqueue(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(myMutex);
+        myJobs.push_back(std::move(job));
+    }
+    myCvJob.notify_one();
+}
+
+void ThreadPool::Wait() {
+    std::unique_lock<std::mutex> lock(myMutex);
+    myCvDone.wait(lock, [this]() { return myJobs.empty() && myActive == 0; });
+}
+
+void ThreadPool::WorkerLoop() {
+    Profiler::SetThreadName("Worker");
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(myMutex);
+            myCvJob.wait(lock, [this]() { return myStop || !myJobs.empty(); });
+            if (myStop && myJobs.empty())
+                return;
+
+            job = std::move(myJobs.front());
+            myJobs.pop_front();
+            myActive++;
+        }
+
+        job();
+
+        {
+            std::lock_guard<std::mutex> lock(myMutex);
+            myActive--;
+            if (myJobs.empty() && myActive == 0)
+                myCvDone.notify_all();
+        }
+    }
+}
+
+void ThreadPool::ParallelFor(int32 count, const std::function<void(int32)>& fn) {
+    if (count <= 0)
+        return;
+    if (count == 1) {
+        fn(0);
+        return;
+    }
+
+    //Helpers which start after all the work is taken never touch fn, so we only have to wait for the work to be done
+    //and not for the helpers themselves. This is what makes nesting safe when every worker is busy
+    struct State {
+        std::atomic<int32> Next{0};
+        std::atomic<int32> Done{0};
+        std::mutex Mutex;
+        std::condition_variable Cv;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    const std::function<void(int32)>* pFn = &fn;
+
+    auto work = [state, pFn, count]() {
+        int32 i;
+        while ( (i = state->Next.fetch_add(1)) < count ) {
+            (*pFn)(i);
+            if (state->Done.fetch_add(1) + 1 == count) {
+                std::lock_guard<std::mutex> lock(state->Mutex);
+                state->Cv.notify_all();
+            }
+        }
+    };
+
+    int32 helpers = Min(count - 1, ThreadCount());
+    for (int32 i = 0; i < helpers; i++) {
+        Enqueue(work);
+    }
+    work();
+
+    std::unique_lock<std::mutex> lock(state->Mutex);
+    state->Cv.wait(lock, [&]() { return state->Done.load() == count; });
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "DebugFinal.h"
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+class ThreadPool {
+public:
+    //A thread count of 0 uses one thread less than the number of hardware threads (the calling thread also does work)
+    explicit ThreadPool(int32 threadCount = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator= (const ThreadPool&) = delete;
+
+    void Enqueue(std::function<void()> job);
+    //Blocks till every job that was enqueued so far has finished
+    void Wait();
+
+    //Calls fn(i) for every i in [0, count). The calling thread takes part, so this is safe to call from inside a job
+    void ParallelFor(int32 count, const std::function<void(int32)>& fn);
+
+    int32 ThreadCount() const { return (int32)myThreads.size(); }
+
+    static ThreadPool& Global();
+
+private:
+    void WorkerLoop();
+
+private:
+    std::vector<std::thread>            myThreads;
+    std::deque<std::function<void()>>   myJobs;
+
+    std::mutex                          myMutex;
+    std::condition_variable             myCvJob;
+    std::condition_variable             myCvDone;
+    int32                               myActive = 0;
+    bool                                myStop = false;
+};
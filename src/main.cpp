@@ -9,6 +9,7 @@
 #include <GLFW/glfw3.h>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <new>
 
 #include "EventCallback.h"
@@ -20,13 +21,26 @@
 #include "RE_Shader.h"
 #include "RE_Renderer.h"
 #include "RE_Font.h"
+#include "RE_CommandList.h"
+#include "RE_RendererSoft.h"
+#include "ThreadPool.h"
+#include "BVH.h"
+#include "Profiler.h"
+#include "AllocTracker.h"
+#include "FileWatcher.h"
 
 #include "Camera.h"
 #include "Grapher3D.h"
 
 #include "Maths.h"
 #include "MathContext.h"
+#include "MathProgram.h"
+#include "MathKernels.h"
+#include "MathNative.h"
 #include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 #ifdef _WIN32
 #include "Windows.h"
@@ -36,8 +50,13 @@
 Camera* g_cam;
 Renderer* g_renderer;
 const char* g_strEqFile = nullptr;
-MathParser::Context* g_ctx = nullptr;
+MathParser::ContextPublisher* g_equations = nullptr;     //The equations that are shown. Reloads publish a new snapshot
 bool g_updateGrapher = true;
+bool g_reloadEquations = false;     //Set by EventCallback, the file is read again by the main loop
+MathParser::NativeLibrary* g_native = nullptr;     //Set with --native, the equations are compiled to machine code
+double g_contourSpacing = 0.0;      //Height between the contour lines over the surfaces, 0 for none. Toggled by EventCallback
+glm::vec2 g_cursor = glm::vec2(-1.0f);  //Window coordinates of the cursor, set by EventCallback
+bool g_logPick = false;             //Set by EventCallback on a click, the point under the cursor is logged by the main loop
 
 double func(double x, double y) {
     return sin(x) * exp(y/7);
@@ -81,44 +100,21 @@ double deltaTime;
 
 
 void DrawGrid(Renderer* r) {
-    double majInc = 1;
-    glm::vec4 majCol = glm::vec4(0.2, 0.2, 0.2, 1.0);
-    double majWidth = 1.0;
+    GridSettings settings;
+    settings.Spacing = 1.0f;
+    settings.Subdivisions = 1;
+    settings.Extent = 20.0f;
+    settings.LineWidth = 1.0f;
 
-    glm::vec4 axisXCol = glm::vec4(0.8, 0.2, 0.2, 1.0);
-    glm::vec4 axisYCol = glm::vec4(0.2, 0.8, 0.2, 1.0);
     glm::vec4 axisZCol = glm::vec4(0.2, 0.2, 0.8, 1.0);
 
-
-    //Todo: This is a temporary fix to prevent grid from showing above the graph. Have a more permanent fix than this
-    glDepthMask(false);
-
-    double lastLine = 20;
-    double eps = 0.001;
     r->PushDepthState(RE_DEPTH_LESS);
-    for(double x = 0; x < lastLine + eps; x += majInc) {
-        r->DrawLine(glm::vec3(x, -lastLine, 0), glm::vec3(x, +lastLine, 0), majCol, majWidth);
-    }
-    for(double x = 0; x > -lastLine - eps; x -= majInc) {
-        r->DrawLine(glm::vec3(x, -lastLine, 0), glm::vec3(x, +lastLine, 0), majCol, majWidth);
-    }
-
-    for(double y = 0; y < lastLine + eps; y += majInc) {
-        r->DrawLine(glm::vec3(-lastLine, y, 0), glm::vec3(+lastLine, y, 0), majCol, majWidth);
-    }
-    for(double y = 0; y > -lastLine - eps; y -= majInc) {
-        r->DrawLine(glm::vec3(-lastLine, y, 0), glm::vec3(+lastLine, y, 0), majCol, majWidth);
-    }
+    r->DrawGrid(settings);
 
+    //The z axis is not on the ground plane so it cannot be drawn by the grid pass
     r->SetDepthState(RE_DEPTH_ALWAYS);
-    //Draw xyz axes in a different colour
-    r->DrawLine(glm::vec3(0, 0, 0), glm::vec3(lastLine, 0, 0), axisXCol, majWidth);
-    r->DrawLine(glm::vec3(0, 0, 0), glm::vec3(0, lastLine, 0), axisYCol, majWidth);
-    r->DrawLine(glm::vec3(0, 0, 0), glm::vec3(0, 0, lastLine), axisZCol, majWidth);
+    r->DrawLine(glm::vec3(0, 0, 0), glm::vec3(0, 0, settings.Extent), axisZCol, settings.LineWidth);
     r->PopDepthState();
-
-    //Todo: This is a temporary fix to prevent grid from showing above the graph. Have a more permanent fix than this
-    glDepthMask(true);
 }
 
 void Print(const glm::vec4& v) {
@@ -137,6 +133,21 @@ void Print(const glm::mat4& m) {
 
 void Debug() {
     Assert(MathParser::Context::RunAllTests() && "A test failed");
+    Assert(MathParser::Program::RunAllTests() && "A test failed");
+    Assert(MathParser::Kernels::RunAllTests() && "A test failed");
+    Assert(MathParser::NativeLibrary::RunAllTests() && "A test failed");
+    Assert(Grapher3D::RunAllTests() && "A test failed");
+    Assert(Contours::RunAllTests() && "A test failed");
+    Assert(HeightMipmap::RunAllTests() && "A test failed");
+    Assert(Grid::RunAllTests() && "A test failed");
+    Assert(CommandList::RunAllTests() && "A test failed");
+    Assert(Frustum::RunAllTests() && "A test failed");
+    Assert(TileBVH::RunAllTests() && "A test failed");
+    Assert(RendererSoft::RunAllTests() && "A test failed");
+    Assert(Profiler::RunAllTests() && "A test failed");
+    Assert(AllocTracker::RunAllTests() && "A test failed");
+    Assert(AsyncLog::RunAllTests() && "A test failed");
+    Assert(FileWatcher::RunAllTests() && "A test failed");
 
     MathParser::Context c;
 
@@ -145,10 +156,26 @@ void Debug() {
     
 }
 
-void UpdateGraphers(std::vector<Grapher3D>& graphers, MathParser::Context& ctx) {
-    graphers.clear();
+void RebuildTiles(const std::vector<Grapher3D>& graphers, TileBVH& bvh) {
+    std::vector<TileBVH::Item> tiles;
+    for (int32 i = 0; i < (int32)graphers.size(); i++) {
+        for (int32 tile = 0; tile < graphers[i].TileCount(); tile++) {
+            tiles.push_back({ graphers[i].TileBounds(tile), (uint32)i, (uint32)tile });
+        }
+    }
+    bvh.Build(std::move(tiles));
+}
+
+void UpdateGraphers(Renderer* r, std::vector<Grapher3D>& graphers, TileBVH& bvh, Grapher3D::FuseCache& fuse, const MathParser::ContextSnapshot& snapshot, double time) {
+    PROFILE_ZONE("UpdateGraphers");
+    const AllocTracker::Counters allocStart = AllocTracker::Total();
+    const MathParser::Context& ctx = *snapshot;
+
+    //Graphers are reused so that they keep their mesh buffers, and their mesh when the equation did not change. A
+    //grapher still pins the snapshot its equation came from, so the old equation can be compared with
+    int32 count = 0;
     for (int i = 0; i < ctx.GetCount(); i++) {
-        MathParser::Equation* eq = ctx.FindEquationIndex(i);
+        const MathParser::Equation* eq = ctx.FindEquationIndex(i);
         if (eq && eq->Valid() && eq->EParamCount() == 0)
         {
             //Dont draw constant functions for the time being
@@ -159,36 +186,218 @@ void UpdateGraphers(std::vector<Grapher3D>& graphers, MathParser::Context& ctx)
             }
             else if (eq->IParamCount() > 0) // 1 or 2
             {
-                //Draw explicit function
-                int index = graphers.size();
-                graphers.emplace_back();
-                graphers[index].SetEquation(eq);
+                //Draw explicit function, as a curve when it only uses x
+                auto it = std::find_if(graphers.begin() + count, graphers.end(), [eq](const Grapher3D& g) {
+                    return g.GetEquation() && g.GetEquation()->Revision() == eq->Revision();
+                });
+                if (it != graphers.end())
+                    std::swap(*it, graphers[count]);
+                else if (count == (int32)graphers.size())
+                    graphers.emplace_back();
+                graphers[count].SetEquation(eq, snapshot);
+                graphers[count].SetContourSpacing(g_contourSpacing);
+                graphers[count++].SetNative(g_native ? g_native->FindExplicit(eq) : nullptr);
             }
             
         }
     }
+    graphers.resize(count);
+
+    // Precalculate the mesh. Surfaces that can share one program are meshed together, what is left over only reads
+    // from the context so they can be meshed in parallel
+    for (Grapher3D& g : graphers) {
+        if (g.Outdated())
+            g.SetTime(time);
+    }
+    Grapher3D::CalculateFused(graphers, fuse);
+    ThreadPool::Global().ParallelFor((int32)graphers.size(), [&](int32 i) {
+        if (graphers[i].Outdated())
+            graphers[i].Calculate(nullptr); //Dont do this every frame
+    });
+    RebuildTiles(graphers, bvh);
+
+    const AllocTracker::Counters allocEnd = AllocTracker::Total();
+    r->SetRemeshAllocMetrics(allocEnd.Allocs - allocStart.Allocs, allocEnd.Bytes - allocStart.Bytes);
+}
+
+//Compiles the equations again when --native is on. The graphers must not be meshing, as the old functions get unloaded
+void BuildNative(const MathParser::Context& ctx) {
+    if (g_native && !g_native->Build(ctx, MathParser::NativeLibrary::DefaultCacheDir()))
+        LogWarn("Using the interpreter for the equations");
+}
 
-    // Precalculate the mesh
+//Moves or re-meshes the surfaces that use t. Render thread only, does not wait for the workers
+void AnimateGraphers(std::vector<Grapher3D>& graphers, TileBVH& bvh, double time) {
+    bool bMoved = false;
     for (Grapher3D& g : graphers) {
-        g.Calculate(nullptr); //Dont do this every frame
+        if (g.Animated())
+            bMoved |= g.Animate(time);
+    }
+    if (bMoved)
+        RebuildTiles(graphers, bvh);
+}
+
+//Has to be called before the native functions change, as background re-meshes call them
+void WaitGraphers(std::vector<Grapher3D>& graphers) {
+    for (Grapher3D& g : graphers)
+        g.WaitRemesh();
+}
+
+//Reads the equation file into a new context on a worker, and publishes it. Only the lines that changed since previous
+//are parsed, everything is when there is no previous. bRunning is cleared once the job is done
+void StartReload(MathParser::ContextSnapshot previous, std::atomic<bool>& bRunning) {
+    bRunning.store(true, std::memory_order_relaxed);
+    ThreadPool::Global().Enqueue([previous, &bRunning]() {
+        std::shared_ptr<MathParser::Context> ctx = std::make_shared<MathParser::Context>();
+        if (previous) {
+            MathParser::ReloadStats stats;
+            if (ctx->LoadFromFileAfter(g_strEqFile, *previous, &stats)) {
+                LogInfo("Reloaded %s. Parsed: %d, Kept: %d, Removed: %d, Resolved: %d", g_strEqFile, stats.Parsed, stats.Kept, stats.Removed, stats.Resolved);
+                if (stats.Resolved || stats.Removed)
+                    g_equations->Publish(std::move(ctx));
+            }
+        }
+        else if (ctx->LoadFromFile(g_strEqFile)) {
+            ctx->PrintProperties();
+            g_equations->Publish(std::move(ctx));
+        }
+        bRunning.store(false, std::memory_order_release);
+    });
+}
+
+//Marks the point of the surfaces under the cursor, with a line up the steepest slope. Render thread only
+void PickGraphers(Renderer* r, const Camera& cam, const std::vector<Grapher3D>& graphers) {
+    PROFILE_ZONE("PickGraphers");
+    const Ray ray = cam.ScreenPointToRay(g_cursor);
+    Grapher3D::PickHit nearest;
+    bool bHit = false;
+    for (const Grapher3D& g : graphers) {
+        Grapher3D::PickHit hit;
+        if (g.Pick(ray, hit) && (!bHit || hit.T < nearest.T)) {
+            nearest = hit;
+            bHit = true;
+        }
+    }
+    if (!bHit) {
+        g_logPick = false;
+        return;
+    }
+
+    const glm::vec3 pos = glm::vec3(nearest.Position);
+    const glm::dvec2 grad = nearest.Gradient;
+    const glm::vec3 uphill = glm::vec3(glm::dvec3(grad.x, grad.y, glm::dot(grad, grad)));
+    r->PushDepthState(RE_DEPTH_ALWAYS);
+    r->DrawPoint(pos, glm::vec4(1.0f, 0.8f, 0.2f, 1.0f), 8.0f);
+    if (glm::dot(uphill, uphill) > 0.0f && std::isfinite(uphill.z))
+        r->DrawLine(pos, pos + glm::normalize(uphill), glm::vec4(1.0f, 0.4f, 0.1f, 1.0f), 2.0f);
+    r->PopDepthState();
+
+    if (g_logPick) {
+        g_logPick = false;
+        LogInfo("Picked (%.6f, %.6f, %.6f), gradient (%.6f, %.6f)", nearest.Position.x, nearest.Position.y, nearest.Position.z, grad.x, grad.y);
     }
 }
 
+//Render thread only
+void DrawGraphers(Renderer* r, const Camera& cam, std::vector<Grapher3D>& graphers, const TileBVH& bvh, CommandQueue& queue) {
+    PROFILE_ZONE("DrawGraphers");
+    static std::vector<const TileBVH::Item*> visibleTiles;
+    static std::vector<std::vector<uint32>> visibleTilesPerGrapher;
+
+    //Only tiles which are inside the frustum get recorded
+    TileBVH::QueryStats stats;
+    visibleTiles.clear();
+    bvh.Query(cam.GetFrustum(), visibleTiles, &stats);
+    r->AddCullMetrics(stats.Visible, stats.Culled);
+
+    visibleTilesPerGrapher.resize(graphers.size());
+    for (std::vector<uint32>& v : visibleTilesPerGrapher)
+        v.clear();
+    for (const TileBVH::Item* item : visibleTiles)
+        visibleTilesPerGrapher[item->Grapher].push_back(item->Tile);
+
+    //Vertices for the graphers are generated on the worker threads, and then submitted together
+    ThreadPool::Global().ParallelFor((int32)graphers.size(), [&](int32 i) {
+        std::vector<uint32>& tiles = visibleTilesPerGrapher[i];
+        //Keep the mesh order, the BVH returns tiles in spatial order
+        std::sort(tiles.begin(), tiles.end());
+        graphers[i].Draw(queue.Local(), tiles);
+    });
+    queue.Submit(r);
+}
+
+//Renders a single frame on the cpu and writes it to outFile. Needs neither a window nor a gpu
+int RunHeadless(const char* outFile) {
+    glm::vec3 posCam = glm::vec3(-9.81f, -21.986, 16.197);
+    glm::vec3 posTarget = posCam + glm::vec3(0.3228f, 0.738f, -0.5917f);
+    glm::vec3 up = glm::vec3(0.0f, 0.0f, 1.0f);
+    Camera cam(posCam, posTarget-posCam, up, 45.0f, (float)(windowSize.x) / windowSize.y, 0.1f, 100.0f);
+    cam.LoadPrefs("Assets/Prefs/cam.pref");
+
+    RendererSoft* r = new RendererSoft(windowSize.x, windowSize.y);
+    g_renderer = r;
+    r->Init(&cam);
+
+    MathParser::ContextPublisher equations;
+    g_equations = &equations;
+    {
+        std::shared_ptr<MathParser::Context> ctx = std::make_shared<MathParser::Context>();
+        ctx->LoadFromFileCached(g_strEqFile);
+        equations.Publish(std::move(ctx));
+    }
+    const MathParser::ContextSnapshot snapshot = equations.Pin();
+    BuildNative(*snapshot);
+
+    std::vector<Grapher3D> graphers;
+    TileBVH grapherTiles;
+    Grapher3D::FuseCache grapherFuse;
+    CommandQueue drawQueue;
+    UpdateGraphers(r, graphers, grapherTiles, grapherFuse, snapshot, 0.0);
+
+    r->StartFrame();
+    r->PushDepthState(RE_DEPTH_LESS);
+    DrawGrid(r);
+    DrawGraphers(r, cam, graphers, grapherTiles, drawQueue);
+    r->PopDepthState();
+    r->EndFrame();
+
+    r->SaveFrame(outFile);
+    LogInfo("Wrote frame to: %s", outFile);
+    r->PrintMetrics();
+
+    delete r;
+    g_renderer = nullptr;
+    g_equations = nullptr;
+    return 0;
+}
+
 int main(int argc, const char* argv[]) {
     LOG_INIT();
+    Profiler::SetThreadName("Main");
 
     #if CATCH_SIGINT
         signal(SIGINT,  signal_handler);
     #endif
     
     // return 0;
-    if (argc == 2) {
-        g_strEqFile = argv[1];
-    }
-    else {
-        g_strEqFile = "equations.txt";
+    //Usage: GraphIt [equations.txt] [--headless out.bmp] [--native] [--contours spacing]
+    const char* strHeadlessFile = nullptr;
+    MathParser::NativeLibrary native;
+    g_strEqFile = "equations.txt";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0 && i+1 < argc)
+            strHeadlessFile = argv[++i];
+        else if (strcmp(argv[i], "--native") == 0)
+            g_native = &native;
+        else if (strcmp(argv[i], "--contours") == 0 && i+1 < argc)
+            g_contourSpacing = atof(argv[++i]);
+        else
+            g_strEqFile = argv[i];
     }
 
+    if (strHeadlessFile)
+        return RunHeadless(strHeadlessFile);
+
     glfwSetErrorCallback(glfw_error_callback);
     if (!glfwInit())
         return 1;
@@ -253,22 +462,57 @@ int main(int argc, const char* argv[]) {
     r->Init(&cam);
     r->PushDepthState(RE_DEPTH_LESS);
 
-    MathParser::Context ctx;
-    g_ctx = &ctx;
+    //Graphers and background re-meshes pin the snapshot they use, reloads build the next one on a worker
+    MathParser::ContextPublisher equations;
+    g_equations = &equations;
+    {
+        //Uses the precompiled equations from the last run when the file did not change since
+        std::shared_ptr<MathParser::Context> ctx = std::make_shared<MathParser::Context>();
+        ctx->LoadFromFileCached(g_strEqFile);
+        ctx->PrintProperties();
+        equations.Publish(std::move(ctx));
+    }
+    MathParser::ContextSnapshot snapshot = equations.Pin();
+    BuildNative(*snapshot);
+    std::atomic<bool> bReloading{ false };
+    bool bReloadPending = false;
 
-    ctx.LoadFromFile(g_strEqFile);
-    ctx.PrintProperties();
+    //Saving the equation file reloads it
+    FileWatcher eqWatcher;
+    eqWatcher.Watch(g_strEqFile);
 
     std::vector<Grapher3D> graphers;
+    TileBVH grapherTiles;
+    Grapher3D::FuseCache grapherFuse;
+    CommandQueue drawQueue;
 
     while (bRunning && !glfwWindowShouldClose(window))
     {
+        Profiler::NewFrame();
+        const AllocTracker::Counters frameAllocStart = AllocTracker::Total();
         double curTime = glfwGetTime();
         deltaTime = curTime - lastTime;
         lastTime = curTime;
      
         glfwPollEvents();
 
+        //One reload runs at a time. A save while one is running is picked up after it, against the newest snapshot
+        bReloadPending |= eqWatcher.Poll(curTime);
+        if ((g_reloadEquations || bReloadPending) && !bReloading.load(std::memory_order_acquire)) {
+            StartReload(g_reloadEquations ? nullptr : equations.Pin(), bReloading);
+            g_reloadEquations = false;
+            bReloadPending = false;
+        }
+
+        //Everything keeps drawing the old snapshot till the new one is published
+        MathParser::ContextSnapshot latest = equations.Pin();
+        if (latest != snapshot) {
+            snapshot = std::move(latest);
+            WaitGraphers(graphers);
+            BuildNative(*snapshot);
+            g_updateGrapher = true;
+        }
+
         float col = 0.1;
         glClearColor(col, col, col, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -488,21 +732,35 @@ int main(int argc, const char* argv[]) {
         if (g_updateGrapher)
         {
             g_updateGrapher = false;
-            UpdateGraphers(graphers, ctx);
+            UpdateGraphers(r, graphers, grapherTiles, grapherFuse, snapshot, curTime);
         }
-
-        for (Grapher3D& g : graphers) {
-            // g.Calculate(r); //Dont do this every frame
-            g.Draw(r);
+        else {
+            AnimateGraphers(graphers, grapherTiles, curTime);
+            //Only the lines are extracted again, from the heights the graphers already have
+            for (Grapher3D& g : graphers)
+                g.SetContourSpacing(g_contourSpacing);
         }
 
+        DrawGraphers(r, cam, graphers, grapherTiles, drawQueue);
+        PickGraphers(r, cam, graphers);
+
         r->EndFrame();
 
-        glfwSwapBuffers(window);
+        {
+            PROFILE_ZONE("Swap");
+            glfwSwapBuffers(window);
+        }
+
+        const AllocTracker::Counters frameAllocEnd = AllocTracker::Total();
+        r->SetFrameAllocMetrics(frameAllocEnd.Allocs - frameAllocStart.Allocs, frameAllocEnd.Bytes - frameAllocStart.Bytes);
     }
 
     r->PopDepthState();
     // Cleanup
+    while (bReloading.load(std::memory_order_acquire))
+        std::this_thread::yield();
+    WaitGraphers(graphers);
+    g_equations = nullptr;
     delete r;
     r = nullptr;
     g_renderer = nullptr;